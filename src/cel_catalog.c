@@ -0,0 +1,700 @@
+/******************************************************************
+ **
+ ** file: cel_catalog.c
+ **
+ ** Aim: keep a persistent catalog of CEL file headers so that
+ **      unchanged files need not be reparsed and revalidated
+ **
+ ** Created on Oct 16, 2026
+ **
+ ** History
+ ** Oct 16, 2026 - Initial version
+ ** Oct 16, 2026 - count files opened for the read timing
+ ** Oct 16, 2026 - write the catalog through a unique temporary file
+ **
+ **
+ ** The catalog is a binary file named by the R_AFFYIO_CATALOG
+ ** environment variable (if it is not set there is no catalog).
+ ** For each CEL file it records the detected format, the detailed
+ ** header, the offset of the intensity data (where known) and the
+ ** size, modification time and a fingerprint of the file (a hash
+ ** of its first and last few kilobytes). An entry is only used if
+ ** all three still match the file on disk.
+ **
+ ** The catalog is read on the main thread by cel_catalog_open().
+ ** cel_catalog_lookup() and cel_catalog_store() may then be called
+ ** from threads, entries being stored in a pending list until
+ ** cel_catalog_sync() (main thread only) merges them in and writes
+ ** the catalog back out. Entries returned by cel_catalog_lookup()
+ ** are only valid until the next cel_catalog_sync() or
+ ** cel_catalog_open().
+ **
+ ******************************************************************/
+
+#include <R.h>
+#include <Rdefines.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "cel_catalog.h"
+#include "read_timing.h"
+
+#if USE_PTHREADS
+#include <pthread.h>
+#endif
+
+
+#define CATALOG_ENV_VAR "R_AFFYIO_CATALOG"
+#define CATALOG_MAGIC "AFFYCELC"
+#define CATALOG_VERSION 1
+#define CATALOG_BYTE_ORDER 0x01020304
+#define CATALOG_FINGERPRINT_BYTES 4096
+
+
+typedef struct{
+  char *path;                   /* the catalog file, NULL when there is no catalog */
+  double size;                  /* of the catalog file when last read or written */
+  double mtime;
+  cel_catalog_entry *entries;
+  int n_entries;
+  int max_entries;
+  int *index;                   /* open addressing hash table of entries (-1 is empty) */
+  int index_size;
+  cel_catalog_entry *pending;   /* stored since the last sync */
+  int n_pending;
+  int max_pending;
+} cel_catalog;
+
+
+static cel_catalog catalog;
+
+#if USE_PTHREADS
+static pthread_mutex_t catalog_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+
+static uint64_t fnv1a_hash(const unsigned char *buffer, size_t length, uint64_t hash){
+
+  size_t i;
+
+  for (i = 0; i < length; i++){
+    hash ^= buffer[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+/****************************************************************
+ **
+ ** static int file_fingerprint(const char *filename, double *size, double *mtime, uint64_t *fingerprint)
+ **
+ ** get the size and modification time of a file and a hash of
+ ** its first and last CATALOG_FINGERPRINT_BYTES bytes. Returns 0
+ ** if the file could not be read.
+ **
+ ****************************************************************/
+
+static int file_fingerprint(const char *filename, double *size, double *mtime, uint64_t *fingerprint){
+
+  struct stat file_info;
+  unsigned char buffer[CATALOG_FINGERPRINT_BYTES];
+  size_t n;
+  FILE *infile;
+  uint64_t hash = 14695981039346656037ULL;
+
+  if (stat(filename, &file_info) != 0){
+    return 0;
+  }
+  read_timing_opened();
+  if ((infile = fopen(filename, "rb")) == NULL){
+    return 0;
+  }
+  n = fread(buffer, 1, CATALOG_FINGERPRINT_BYTES, infile);
+  hash = fnv1a_hash(buffer, n, hash);
+  if (file_info.st_size > 2*CATALOG_FINGERPRINT_BYTES){
+    if (fseek(infile, -CATALOG_FINGERPRINT_BYTES, SEEK_END) != 0){
+      fclose(infile);
+      return 0;
+    }
+    n = fread(buffer, 1, CATALOG_FINGERPRINT_BYTES, infile);
+    hash = fnv1a_hash(buffer, n, hash);
+  }
+  fclose(infile);
+
+  *size = (double)file_info.st_size;
+  *mtime = (double)file_info.st_mtime;
+  *fingerprint = hash;
+  return 1;
+}
+
+
+/****************************************************************
+ **
+ ** static char *catalog_key(const char *filename)
+ **
+ ** the name a file is catalogued under, its canonical path where
+ ** this can be found so that the same file is found whatever the
+ ** working directory.
+ **
+ ****************************************************************/
+
+static char *catalog_key(const char *filename){
+
+  char *key;
+#ifndef _WIN32
+  char *resolved = realpath(filename, NULL);
+
+  if (resolved != NULL){
+    key = R_Calloc(strlen(resolved)+1, char);
+    strcpy(key, resolved);
+    free(resolved);
+    return key;
+  }
+#endif
+  key = R_Calloc(strlen(filename)+1, char);
+  strcpy(key, filename);
+  return key;
+}
+
+
+static char *copy_string(const char *x){
+
+  char *copy;
+
+  if (x == NULL){
+    return NULL;
+  }
+  copy = R_Calloc(strlen(x)+1, char);
+  strcpy(copy, x);
+  return copy;
+}
+
+
+static void free_entry(cel_catalog_entry *entry){
+  R_Free(entry->filename);
+  R_Free(entry->header.cdfName);
+  R_Free(entry->header.DatHeader);
+  R_Free(entry->header.Algorithm);
+  R_Free(entry->header.AlgorithmParameters);
+  R_Free(entry->header.ScanDate);
+}
+
+
+static unsigned int key_hash(const char *key){
+  return (unsigned int)fnv1a_hash((const unsigned char *)key, strlen(key), 14695981039346656037ULL);
+}
+
+
+static void index_entry(int i){
+
+  unsigned int slot = key_hash(catalog.entries[i].filename) & (catalog.index_size - 1);
+
+  while (catalog.index[slot] >= 0){
+    slot = (slot + 1) & (catalog.index_size - 1);
+  }
+  catalog.index[slot] = i;
+}
+
+
+static void build_index(void){
+
+  int i;
+
+  R_Free(catalog.index);
+  catalog.index_size = 64;
+  while (catalog.index_size < 2*catalog.max_entries){
+    catalog.index_size*=2;
+  }
+  catalog.index = R_Calloc(catalog.index_size, int);
+  for (i = 0; i < catalog.index_size; i++){
+    catalog.index[i] = -1;
+  }
+  for (i = 0; i < catalog.n_entries; i++){
+    index_entry(i);
+  }
+}
+
+
+static int find_entry(const char *key){
+
+  unsigned int slot;
+
+  if (catalog.index == NULL){
+    return -1;
+  }
+  slot = key_hash(key) & (catalog.index_size - 1);
+  while (catalog.index[slot] >= 0){
+    if (strcmp(catalog.entries[catalog.index[slot]].filename, key) == 0){
+      return catalog.index[slot];
+    }
+    slot = (slot + 1) & (catalog.index_size - 1);
+  }
+  return -1;
+}
+
+
+static void add_entry(cel_catalog_entry *entry){
+
+  int i = find_entry(entry->filename);
+
+  if (i >= 0){
+    free_entry(&catalog.entries[i]);
+    catalog.entries[i] = *entry;
+    return;
+  }
+  if (catalog.n_entries == catalog.max_entries){
+    catalog.max_entries = (catalog.max_entries == 0) ? 256 : 2*catalog.max_entries;
+    catalog.entries = R_Realloc(catalog.entries, catalog.max_entries, cel_catalog_entry);
+    build_index();
+  }
+  catalog.entries[catalog.n_entries] = *entry;
+  index_entry(catalog.n_entries);
+  catalog.n_entries++;
+}
+
+
+static void clear_catalog(void){
+
+  int i;
+
+  for (i = 0; i < catalog.n_entries; i++){
+    free_entry(&catalog.entries[i]);
+  }
+  R_Free(catalog.entries);
+  R_Free(catalog.index);
+  catalog.n_entries = 0;
+  catalog.max_entries = 0;
+  catalog.index_size = 0;
+}
+
+
+static void clear_pending(void){
+
+  int i;
+
+  for (i = 0; i < catalog.n_pending; i++){
+    free_entry(&catalog.pending[i]);
+  }
+  R_Free(catalog.pending);
+  catalog.n_pending = 0;
+  catalog.max_pending = 0;
+}
+
+
+/****************************************************************
+ ****************************************************************
+ **
+ ** The catalog file is
+ **
+ ** char[8] magic ("AFFYCELC"), int version, int byte_order, int n_entries
+ **
+ ** followed by n_entries entries each of which is
+ **
+ ** string filename, double size, double mtime, uint64 fingerprint,
+ ** int format, double data_offset, int cols, int rows,
+ ** int[8] grid corners (ULx, ULy, URx, URy, LRx, LRy, LLx, LLy),
+ ** string cdfName, DatHeader, Algorithm, AlgorithmParameters, ScanDate
+ **
+ ** in native byte order where a string is an int length (-1 for
+ ** a missing string) followed by that many chars.
+ **
+ ****************************************************************
+ ****************************************************************/
+
+typedef struct{
+  const char *buffer;
+  size_t length;
+  size_t position;
+} catalog_cursor;
+
+
+static int get_bytes(catalog_cursor *cursor, void *dest, size_t n){
+  if (n > cursor->length - cursor->position){
+    return 0;
+  }
+  memcpy(dest, cursor->buffer + cursor->position, n);
+  cursor->position+=n;
+  return 1;
+}
+
+
+static int get_string(catalog_cursor *cursor, char **dest){
+
+  int length;
+
+  *dest = NULL;
+  if (!get_bytes(cursor, &length, sizeof(int))){
+    return 0;
+  }
+  if (length < 0){
+    return 1;
+  }
+  if ((size_t)length > cursor->length - cursor->position){
+    return 0;
+  }
+  *dest = R_Calloc(length+1, char);
+  return get_bytes(cursor, *dest, length);
+}
+
+
+static int get_entry(catalog_cursor *cursor, cel_catalog_entry *entry){
+
+  int grid[8];
+
+  memset(entry, 0, sizeof(cel_catalog_entry));
+  if (!get_string(cursor, &entry->filename) || entry->filename == NULL ||
+      !get_bytes(cursor, &entry->size, sizeof(double)) ||
+      !get_bytes(cursor, &entry->mtime, sizeof(double)) ||
+      !get_bytes(cursor, &entry->fingerprint, sizeof(uint64_t)) ||
+      !get_bytes(cursor, &entry->format, sizeof(int)) ||
+      !get_bytes(cursor, &entry->data_offset, sizeof(double)) ||
+      !get_bytes(cursor, &entry->header.cols, sizeof(int)) ||
+      !get_bytes(cursor, &entry->header.rows, sizeof(int)) ||
+      !get_bytes(cursor, grid, 8*sizeof(int)) ||
+      !get_string(cursor, &entry->header.cdfName) ||
+      !get_string(cursor, &entry->header.DatHeader) ||
+      !get_string(cursor, &entry->header.Algorithm) ||
+      !get_string(cursor, &entry->header.AlgorithmParameters) ||
+      !get_string(cursor, &entry->header.ScanDate)){
+    free_entry(entry);
+    return 0;
+  }
+  entry->header.GridCornerULx = grid[0];
+  entry->header.GridCornerULy = grid[1];
+  entry->header.GridCornerURx = grid[2];
+  entry->header.GridCornerURy = grid[3];
+  entry->header.GridCornerLRx = grid[4];
+  entry->header.GridCornerLRy = grid[5];
+  entry->header.GridCornerLLx = grid[6];
+  entry->header.GridCornerLLy = grid[7];
+  return 1;
+}
+
+
+static int put_string(FILE *outfile, const char *x){
+
+  int length = (x == NULL) ? -1 : (int)strlen(x);
+
+  if (fwrite(&length, sizeof(int), 1, outfile) != 1){
+    return 0;
+  }
+  return (length <= 0) || (fwrite(x, 1, length, outfile) == (size_t)length);
+}
+
+
+static int put_entry(FILE *outfile, const cel_catalog_entry *entry){
+
+  int grid[8];
+
+  grid[0] = entry->header.GridCornerULx;
+  grid[1] = entry->header.GridCornerULy;
+  grid[2] = entry->header.GridCornerURx;
+  grid[3] = entry->header.GridCornerURy;
+  grid[4] = entry->header.GridCornerLRx;
+  grid[5] = entry->header.GridCornerLRy;
+  grid[6] = entry->header.GridCornerLLx;
+  grid[7] = entry->header.GridCornerLLy;
+
+  return put_string(outfile, entry->filename) &&
+    fwrite(&entry->size, sizeof(double), 1, outfile) == 1 &&
+    fwrite(&entry->mtime, sizeof(double), 1, outfile) == 1 &&
+    fwrite(&entry->fingerprint, sizeof(uint64_t), 1, outfile) == 1 &&
+    fwrite(&entry->format, sizeof(int), 1, outfile) == 1 &&
+    fwrite(&entry->data_offset, sizeof(double), 1, outfile) == 1 &&
+    fwrite(&entry->header.cols, sizeof(int), 1, outfile) == 1 &&
+    fwrite(&entry->header.rows, sizeof(int), 1, outfile) == 1 &&
+    fwrite(grid, sizeof(int), 8, outfile) == 8 &&
+    put_string(outfile, entry->header.cdfName) &&
+    put_string(outfile, entry->header.DatHeader) &&
+    put_string(outfile, entry->header.Algorithm) &&
+    put_string(outfile, entry->header.AlgorithmParameters) &&
+    put_string(outfile, entry->header.ScanDate);
+}
+
+
+static void note_catalog_file(void){
+
+  struct stat file_info;
+
+  if (stat(catalog.path, &file_info) == 0){
+    catalog.size = (double)file_info.st_size;
+    catalog.mtime = (double)file_info.st_mtime;
+  } else {
+    catalog.size = -1.0;
+    catalog.mtime = -1.0;
+  }
+}
+
+
+/****************************************************************
+ **
+ ** static void load_catalog(void)
+ **
+ ** read the catalog file. A missing file gives an empty catalog,
+ ** as does one that is not a catalog or is truncated (it will be
+ ** rewritten at the next sync).
+ **
+ ****************************************************************/
+
+static void load_catalog(void){
+
+  FILE *infile;
+  char *buffer;
+  char magic[8];
+  int version, byte_order, n_entries;
+  int i;
+  catalog_cursor cursor;
+  cel_catalog_entry entry;
+  struct stat file_info;
+
+  clear_catalog();
+  note_catalog_file();
+
+  if (stat(catalog.path, &file_info) != 0 || (infile = fopen(catalog.path, "rb")) == NULL){
+    return;
+  }
+  buffer = R_Calloc((size_t)file_info.st_size + 1, char);
+  cursor.buffer = buffer;
+  cursor.length = fread(buffer, 1, (size_t)file_info.st_size, infile);
+  cursor.position = 0;
+  fclose(infile);
+
+  if (!get_bytes(&cursor, magic, 8) || memcmp(magic, CATALOG_MAGIC, 8) != 0 ||
+      !get_bytes(&cursor, &version, sizeof(int)) || version != CATALOG_VERSION ||
+      !get_bytes(&cursor, &byte_order, sizeof(int)) || byte_order != CATALOG_BYTE_ORDER ||
+      !get_bytes(&cursor, &n_entries, sizeof(int)) || n_entries < 0){
+    warning("%s is not a CEL catalog (of this version) and will be rewritten", catalog.path);
+    R_Free(buffer);
+    return;
+  }
+  for (i = 0; i < n_entries; i++){
+    if (!get_entry(&cursor, &entry)){
+      warning("The CEL catalog %s is truncated. Only %d of %d entries were read", catalog.path, i, n_entries);
+      break;
+    }
+    add_entry(&entry);
+  }
+  R_Free(buffer);
+}
+
+
+/****************************************************************
+ **
+ ** static void write_catalog(void)
+ **
+ ** write the catalog to a uniquely named temporary file in the
+ ** same directory which is then renamed, so that other processes
+ ** never see a partly written catalog and two processes writing
+ ** at once do not write into the same temporary file.
+ ** A catalog that cannot be written only gives a warning.
+ **
+ ****************************************************************/
+
+static void write_catalog(void){
+
+  FILE *outfile = NULL;
+  char *tmp_name;
+  int i, ok, header[3];
+#ifndef _WIN32
+  int fd;
+#endif
+
+  tmp_name = R_Calloc(strlen(catalog.path)+8, char);
+  strcpy(tmp_name, catalog.path);
+  strcat(tmp_name, ".XXXXXX");
+
+#ifndef _WIN32
+  if ((fd = mkstemp(tmp_name)) != -1){
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if ((outfile = fdopen(fd, "wb")) == NULL){
+      close(fd);
+      remove(tmp_name);
+    }
+  }
+#else
+  if (_mktemp(tmp_name) != NULL){
+    outfile = fopen(tmp_name, "wb");
+  }
+#endif
+  if (outfile == NULL){
+    warning("Unable to write CEL catalog %s", catalog.path);
+    R_Free(tmp_name);
+    return;
+  }
+  header[0] = CATALOG_VERSION;
+  header[1] = CATALOG_BYTE_ORDER;
+  header[2] = catalog.n_entries;
+  ok = (fwrite(CATALOG_MAGIC, 1, 8, outfile) == 8) && (fwrite(header, sizeof(int), 3, outfile) == 3);
+  for (i = 0; ok && i < catalog.n_entries; i++){
+    ok = put_entry(outfile, &catalog.entries[i]);
+  }
+  ok = (fclose(outfile) == 0) && ok;
+#ifdef _WIN32
+  if (ok){
+    remove(catalog.path);
+  }
+#endif
+  if (!ok || rename(tmp_name, catalog.path) != 0){
+    remove(tmp_name);
+    warning("Unable to write CEL catalog %s", catalog.path);
+  }
+  R_Free(tmp_name);
+  note_catalog_file();
+}
+
+
+/****************************************************************
+ **
+ ** int cel_catalog_open(void)
+ **
+ ** (re)read the catalog named by the R_AFFYIO_CATALOG environment
+ ** variable if it has changed since it was last read. Returns 1 if
+ ** there is a catalog, 0 otherwise. Main thread only.
+ **
+ ****************************************************************/
+
+int cel_catalog_open(void){
+
+  const char *path = getenv(CATALOG_ENV_VAR);
+  struct stat file_info;
+
+  if (path == NULL || path[0] == '\0'){
+    if (catalog.path != NULL){
+      clear_catalog();
+      clear_pending();
+      R_Free(catalog.path);
+    }
+    return 0;
+  }
+
+  if (catalog.path == NULL || strcmp(catalog.path, path) != 0){
+    R_Free(catalog.path);
+    clear_pending();
+    catalog.path = copy_string(path);
+    load_catalog();
+  } else if (stat(path, &file_info) == 0 ?
+	     ((double)file_info.st_size != catalog.size || (double)file_info.st_mtime != catalog.mtime) :
+	     (catalog.size >= 0.0)){
+    load_catalog();
+  }
+  return 1;
+}
+
+
+int cel_catalog_active(void){
+  return catalog.path != NULL;
+}
+
+
+/****************************************************************
+ **
+ ** const cel_catalog_entry *cel_catalog_lookup(const char *filename)
+ **
+ ** the catalog entry for filename, or NULL if there is no catalog,
+ ** no entry or the file has changed since it was catalogued.
+ **
+ ****************************************************************/
+
+const cel_catalog_entry *cel_catalog_lookup(const char *filename){
+
+  char *key;
+  int i;
+  double size, mtime;
+  uint64_t fingerprint;
+  const cel_catalog_entry *entry;
+
+  if (catalog.path == NULL){
+    return NULL;
+  }
+  key = catalog_key(filename);
+  i = find_entry(key);
+  R_Free(key);
+  if (i < 0){
+    return NULL;
+  }
+  entry = &catalog.entries[i];
+  if (!file_fingerprint(filename, &size, &mtime, &fingerprint) ||
+      size != entry->size || mtime != entry->mtime || fingerprint != entry->fingerprint){
+    return NULL;
+  }
+  return entry;
+}
+
+
+/****************************************************************
+ **
+ ** void cel_catalog_store(const char *filename, int format, double data_offset, const detailed_header_info *header_info)
+ **
+ ** record the header of a CEL file (copying it). It is added to
+ ** the catalog at the next cel_catalog_sync().
+ **
+ ****************************************************************/
+
+void cel_catalog_store(const char *filename, int format, double data_offset, const detailed_header_info *header_info){
+
+  cel_catalog_entry entry;
+
+  if (catalog.path == NULL){
+    return;
+  }
+  if (!file_fingerprint(filename, &entry.size, &entry.mtime, &entry.fingerprint)){
+    return;
+  }
+  entry.filename = catalog_key(filename);
+  entry.format = format;
+  entry.data_offset = data_offset;
+  entry.header = *header_info;
+  entry.header.cdfName = copy_string(header_info->cdfName);
+  entry.header.DatHeader = copy_string(header_info->DatHeader);
+  entry.header.Algorithm = copy_string(header_info->Algorithm);
+  entry.header.AlgorithmParameters = copy_string(header_info->AlgorithmParameters);
+  entry.header.ScanDate = copy_string(header_info->ScanDate);
+
+#if USE_PTHREADS
+  pthread_mutex_lock(&catalog_mutex);
+#endif
+  if (catalog.n_pending == catalog.max_pending){
+    catalog.max_pending = (catalog.max_pending == 0) ? 64 : 2*catalog.max_pending;
+    catalog.pending = R_Realloc(catalog.pending, catalog.max_pending, cel_catalog_entry);
+  }
+  catalog.pending[catalog.n_pending++] = entry;
+#if USE_PTHREADS
+  pthread_mutex_unlock(&catalog_mutex);
+#endif
+}
+
+
+/****************************************************************
+ **
+ ** void cel_catalog_sync(void)
+ **
+ ** add any stored entries to the catalog and write it out. Main
+ ** thread only, and not while other threads may use the catalog.
+ **
+ ****************************************************************/
+
+void cel_catalog_sync(void){
+
+  int i;
+
+  if (catalog.path == NULL || catalog.n_pending == 0){
+    return;
+  }
+  for (i = 0; i < catalog.n_pending; i++){
+    add_entry(&catalog.pending[i]);
+  }
+  R_Free(catalog.pending);
+  catalog.n_pending = 0;
+  catalog.max_pending = 0;
+  write_catalog();
+}
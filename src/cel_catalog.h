@@ -0,0 +1,51 @@
+#ifndef CEL_CATALOG_H
+#define CEL_CATALOG_H
+
+#include <stdint.h>
+
+#include "read_abatch.h"
+
+
+/****************************************************************
+ **
+ ** The formats of CEL file that are recognised
+ **
+ ***************************************************************/
+
+#define CEL_FORMAT_UNKNOWN 0
+#define CEL_FORMAT_TEXT 1
+#define CEL_FORMAT_GZTEXT 2
+#define CEL_FORMAT_BINARY 3
+#define CEL_FORMAT_GZBINARY 4
+#define CEL_FORMAT_GENERIC 5
+#define CEL_FORMAT_GZGENERIC 6
+
+
+/****************************************************************
+ **
+ ** An entry in the catalog of CEL file headers (see cel_catalog.c)
+ **
+ ***************************************************************/
+
+typedef struct{
+  char *filename;          /* canonical path of the CEL file */
+  double size;             /* size, modification time and a hash of the */
+  double mtime;            /* start and end of the file when it was catalogued */
+  uint64_t fingerprint;
+  int format;              /* one of the CEL_FORMAT_ values */
+  double data_offset;      /* where the intensities start, -1 if not known: */
+                           /*   text - the [INTENSITY] line */
+                           /*   binary - the first cell record, after the header */
+                           /*   command console - the first float32 of the intensity data set */
+                           /*   gzipped - always -1, a compressed stream can not be seeked */
+  detailed_header_info header;
+} cel_catalog_entry;
+
+
+int cel_catalog_open(void);
+int cel_catalog_active(void);
+const cel_catalog_entry *cel_catalog_lookup(const char *filename);
+void cel_catalog_store(const char *filename, int format, double data_offset, const detailed_header_info *header_info);
+void cel_catalog_sync(void);
+
+#endif
@@ -153,6 +153,54 @@
  ** Sept 18, 2013 -  improve 64bit support for read_abatch
  ** Jun 22, 2016 - Define PTHREAD_STACK_MIN if missing (e.g. Intel compiler) (DCT)
  ** Sept 4, 2017 - change gzFile* to gzFile
+ ** Oct 16, 2026 - read_probeintensities accepts INTSXP location matrices in cdfInfo and keeps
+ **                integer indices internally. NA/NaN locations give NA rather than an invalid read
+ ** Oct 16, 2026 - CountCDFProbes uses the n.probes attribute of cdfInfo when present
+ ** Oct 16, 2026 - Add ReadHeaderBatch which reads the headers of many CEL files (using threads)
+ **                into columns. ReadHeaderDetailed no longer leaks the ScanDate
+ ** Oct 16, 2026 - Consult the CEL catalog (see cel_catalog.c) when checking, reading the headers of 
+ **                and working out the format of CEL files
+ ** Oct 16, 2026 - Text CEL file headers are read in a single pass into a key/value table which
+ **                records where the [INTENSITY] section starts. The intensity, stddev and npixels
+ **                readers seek there when the offset is known
+ ** Oct 16, 2026 - read_cel_file reads text and binary CEL files in a single pass. Add
+ **                R_read_cel_files which reads many CEL files (using threads) into a list
+ ** Oct 16, 2026 - Add R_read_cel_files_matrices which reads many CEL files into shared matrices
+ **                (npixels as integers) and compressed mask/outlier index vectors
+ ** Oct 16, 2026 - Time the format, check, read, mask and store phases of read_abatch and
+ **                read_probeintensities and count files opened (see read_timing.c)
+ ** Oct 16, 2026 - Add R_cel_block_iterator which reads a batch of CEL files a block of files
+ **                at a time into two reused matrices, reading the next block in the background
+ ** Oct 16, 2026 - Add R_read_cel_cells which reads a subset of the cells of many CEL files, seeking
+ **                to the wanted cells of binary and command console files. The data offset of command
+ **                console files is now catalogued
+ ** Oct 16, 2026 - The batch readers hint the next files to be read to the operating system
+ **                (see read_prefetch.c)
+ ** Oct 16, 2026 - The readers raise errors with read_error() (see read_error.c). ReadHeaderBatch
+ **                catches them on its threads and calls error() once they are joined
+ ** Oct 16, 2026 - R_read_cel_files raises errors from its threads on the main thread. The number
+ **                of threads is only kept when built with pthreads
+ ** Oct 16, 2026 - R_read_cel_files_matrices raises every error from its threads on the main thread
+ ** Oct 16, 2026 - read_cel_file reports a command console file whose values can not all be read
+ ** Oct 16, 2026 - The CEL block iterator keeps the errors of its background threads for
+ **                R_cel_block_iterator_next to raise
+ ** Oct 16, 2026 - Checking a batch keeps the format and data offset of each file for the reading,
+ **                so a file is looked up in the catalog once. The masks are applied by format
+ ** Oct 16, 2026 - check_cel_file hands back the offset of the [INTENSITY] section, so text files are
+ **                read with a seek also when there is no catalog
+ ** Oct 16, 2026 - R_read_cel_cells raises errors from its threads on the main thread
+ ** Oct 16, 2026 - A probe count mismatch reports the expected and actual counts
+ ** Oct 16, 2026 - The threads of read_probeintensities trap read_error() for each file, the
+ **                errors being raised once they are joined
+ ** Oct 16, 2026 - R_read_cel_files_matrices also traps errors when reading on the main thread,
+ **                freeing what it has allocated before raising them
+ ** Oct 16, 2026 - Finding the format of a file while checking a batch is timed as the format phase again
+ ** Oct 16, 2026 - The CEL block iterator keeps the truncation warnings of its threads for
+ **                R_cel_block_iterator_next to print
+ ** Oct 16, 2026 - R_cel_block_iterator_next returns a new matrix for each block rather than
+ **                one of the buffers being read into
+ ** Oct 16, 2026 - read_cel_file and R_read_cel_files hand the format they find (or, for R_read_cel_files,
+ **                take from the catalog) to the reader, rather than sniffing the file again for each part
  ** 
  *************************************************************/
  
@@ -163,10 +211,17 @@
 
 #include "stdlib.h"
 #include "stdio.h"
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "fread_functions.h"
 #include "read_multichannel_celfile_generic.h"
 #include "read_celfile_generic.h"
 #include "read_abatch.h"
+#include "cel_catalog.h"
+#include "read_timing.h"
+#include "read_prefetch.h"
+#include "read_error.h"
 
 #define HAVE_ZLIB 1
 
@@ -189,9 +244,10 @@
 pthread_mutex_t mutex_R;
 int n_probesets;
 int *n_probes = NULL;
-double **cur_indexes = NULL;
+int **cur_indexes = NULL;
 struct thread_data{
   SEXP filenames;
+  const char **file_names;
   double *CurintensityMatrix;
   double *pmMatrix;
   double *mmMatrix;
@@ -206,6 +262,9 @@ struct thread_data{
   const char *refCdfName;
   int which_flag;
   SEXP verbose;
+  int *formats;            /* of each file, found when checking it */
+  long *data_offsets;
+  char **messages;         /* the read_error() of each file (see read_error.c) */
 };
 #define THREADS_ENV_VAR "R_THREADS"
 #endif 
@@ -461,7 +520,7 @@ static int token_ends_with(char *token, char *ends_in){
 
 static void ReadFileLine(char *buffer, int buffersize, FILE *currentFile){
   if (fgets(buffer, buffersize, currentFile) == NULL){
-    error("End of file reached unexpectedly. Perhaps this file is truncated.\n");
+    read_error("End of file reached unexpectedly. Perhaps this file is truncated.\n");
   }  
 }	  
 
@@ -486,16 +545,17 @@ static FILE *open_cel_file(const char *filename){
   FILE *currentFile = NULL; 
   char buffer[BUF_SIZE];
 
+  read_timing_opened();
   currentFile = fopen(filename,mode);
   if (currentFile == NULL){
-     error("Could not open file %s", filename);
+     read_error("Could not open file %s", filename);
   } else {
     /** check to see if first line is [CEL] so looks like a CEL file**/
     ReadFileLine(buffer, BUF_SIZE, currentFile);
     if (strncmp("[CEL]", buffer, 4) == 0) {
       rewind(currentFile);
     } else {
-      error("The file %s does not look like a CEL file",filename);
+      read_error("The file %s does not look like a CEL file",filename);
     }
   }
   
@@ -546,78 +606,293 @@ static void AdvanceToSection(FILE *my_file,char *sectiontitle, char *buffer){
 }
 
 
+/****************************************************************
+ ****************************************************************
+ **
+ ** A single pass parser for the header of a text CEL file
+ **
+ ** The [CEL] and [HEADER] sections are read once, each key=value
+ ** line being stored in a table. Reading stops at the [INTENSITY] 
+ ** line and its byte offset is recorded, so that the intensities 
+ ** can be found again by seeking rather than by rereading the
+ ** header (see position_at_intensities()).
+ **
+ ***************************************************************
+ ***************************************************************/
+
+typedef struct{
+  char *key;          /* key and value share a single allocation */
+  char *value;
+} text_header_entry;
+
+typedef struct{
+  text_header_entry *entries;
+  int n_entries;
+  int max_entries;
+  long intensity_offset;
+} text_cel_header;
+
+
+static void delete_text_cel_header(text_cel_header *header){
+
+  int i;
+
+  for (i = 0; i < header->n_entries; i++){
+    R_Free(header->entries[i].key);
+  }
+  R_Free(header->entries);
+  header->n_entries = 0;
+  header->max_entries = 0;
+}
+
+
+/****************************************************************
+ **
+ ** static void read_text_cel_header(FILE *currentFile, const char *filename, text_cel_header *header)
+ **
+ ** FILE *currentFile - a text CEL file opened with open_cel_file()
+ ** const char *filename - its name (for error messages)
+ ** text_cel_header *header - the table to fill
+ **
+ ** reads up to and including the [INTENSITY] line. Lines may be 
+ ** of any length.
+ **
+ ***************************************************************/
+
+static void read_text_cel_header(FILE *currentFile, const char *filename, text_cel_header *header){
+
+  size_t size = BUF_SIZE, length, key_length;
+  char *line = R_Calloc(size, char);
+  char *equals;
+  long offset;
+  text_header_entry *entry;
+
+  header->entries = NULL;
+  header->n_entries = 0;
+  header->max_entries = 0;
+  header->intensity_offset = -1;
+
+  while (1){
+    offset = ftell(currentFile);
+    length = 0;
+    while (fgets(line + length, (int)(size - length), currentFile) != NULL){
+      length+= strlen(line + length);
+      if (line[length - 1] == '\n'){
+	break;
+      }
+      if (length + 1 == size){
+	size*=2;
+	line = R_Realloc(line, size, char);
+      }
+    }
+    if (length == 0){
+      R_Free(line);
+      delete_text_cel_header(header);
+      read_error("End of file reached before the [INTENSITY] section of %s. Perhaps this file is truncated.\n", filename);
+    }
+    if (strncmp(line, "[INTENSITY]", 11) == 0){
+      header->intensity_offset = offset;
+      break;
+    }
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')){
+      line[--length] = '\0';
+    }
+    if (line[0] == '[' || (equals = strchr(line, '=')) == NULL){
+      continue;
+    }
+
+    if (header->n_entries == header->max_entries){
+      header->max_entries = (header->max_entries == 0) ? 32 : 2*header->max_entries;
+      header->entries = R_Realloc(header->entries, header->max_entries, text_header_entry);
+    }
+    entry = &header->entries[header->n_entries++];
+    key_length = equals - line;
+    entry->key = R_Calloc(length + 1, char);
+    memcpy(entry->key, line, length + 1);
+    entry->key[key_length] = '\0';
+    entry->value = entry->key + key_length + 1;
+  }
+  R_Free(line);
+}
+
+
+/****************************************************************
+ **
+ ** static const char *text_header_value(const text_cel_header *header, const char *key, const char *filename)
+ **
+ ** the value stored for key (the first if it appears more than 
+ ** once). It is an error for the key to be missing.
+ **
+ ***************************************************************/
+
+static const char *text_header_value(const text_cel_header *header, const char *key, const char *filename){
+
+  int i;
+
+  for (i = 0; i < header->n_entries; i++){
+    if (strcmp(header->entries[i].key, key) == 0){
+      return header->entries[i].value;
+    }
+  }
+  read_error("The header of %s does not contain %s\n", filename, key);
+  return NULL;
+}
+
+
+static void text_header_pair(const text_cel_header *header, const char *key, const char *filename, int *x, int *y){
+
+  char *end;
+  const char *value = text_header_value(header, key, filename);
+
+  *x = (int)strtol(value, &end, 10);
+  *y = (int)strtol(end, NULL, 10);
+}
+
+
+/****************************************************************
+ **
+ ** static char *text_header_cdf_name(const char *DatHeader, const char *filename)
+ **
+ ** the CDF name is the token of the DatHeader ending in ".1sq" 
+ ** with that ending removed.
+ **
+ ***************************************************************/
+
+static char *text_header_cdf_name(const char *DatHeader, const char *filename){
+
+  const char *token = DatHeader + strspn(DatHeader, " ");
+  size_t token_length;
+  char *cdfName;
+
+  while (*token != '\0'){
+    token_length = strcspn(token, " ");
+    if (token_length > 4 && strncmp(token + token_length - 4, ".1sq", 4) == 0){
+      cdfName = R_Calloc(token_length - 3, char);
+      memcpy(cdfName, token, token_length - 4);
+      cdfName[token_length - 4] = '\0';
+      return cdfName;
+    }
+    token+=token_length;
+    token+=strspn(token, " ");
+  }
+  read_error("Cel file %s does not seem to be have cdf information",filename);
+  return NULL;
+}
+
+
+/****************************************************************
+ **
+ ** static int text_header_names_cdf(const char *DatHeader, const char *ref_cdfName)
+ **
+ ** does any token of the DatHeader start with the reference CDF
+ ** name (ignoring case)? This is the test check_cel_file() applies.
+ **
+ ***************************************************************/
+
+static int text_header_names_cdf(const char *DatHeader, const char *ref_cdfName){
+
+  size_t ref_length = strlen(ref_cdfName);
+  size_t token_length;
+  const char *token = DatHeader + strspn(DatHeader, " ");
+
+  while (*token != '\0'){
+    token_length = strcspn(token, " ");
+    if (token_length >= ref_length && strncasecmp(token, ref_cdfName, ref_length) == 0){
+      return 1;
+    }
+    token+=token_length;
+    token+=strspn(token, " ");
+  }
+  return 0;
+}
+
+
+/****************************************************************
+ **
+ ** static void position_at_intensities(FILE *currentFile, long intensity_offset, char *buffer)
+ **
+ ** move an opened text CEL file to just past the [INTENSITY] line. 
+ ** If intensity_offset (from read_text_cel_header(), -1 if not known)
+ ** is at that line the file is seeked there, otherwise the file is
+ ** read up to it.
+ **
+ ***************************************************************/
+
+static void position_at_intensities(FILE *currentFile, long intensity_offset, char *buffer){
+
+  if (intensity_offset >= 0 && fseek(currentFile, intensity_offset, SEEK_SET) == 0){
+    if (fgets(buffer, BUF_SIZE, currentFile) != NULL && strncmp(buffer, "[INTENSITY]", 11) == 0){
+      return;
+    }
+    rewind(currentFile);
+  }
+  AdvanceToSection(currentFile,"[INTENSITY]",buffer);
+}
+
+
 /******************************************************************
  ** 
- ** int check_cel_file(const char *filename, const char *ref_cdfName, int ref_dim_1, int ref_dim_2)
+ ** int check_cel_file(const char *filename, const char *ref_cdfName, int ref_dim_1, int ref_dim_2,
+ **                    long *intensity_offset)
  **
  ** const char *filename - the file to read
  ** const char *ref_cdfName - the reference CDF filename
  ** int ref_dim_1 - 1st dimension of reference cel file
  ** int ref_dim_2 - 2nd dimension of reference cel file
+ ** long *intensity_offset - if not NULL, set to the offset of the [INTENSITY] section
+ **                          found on the way, to be handed to the readers
  **
  ** returns 0 if no problem, 1 otherwise
  **
  ** The aim of this function is to read the header of the CEL file
  ** in particular we will look for the rows beginning "Cols="  and "Rows="
  ** and then for the line DatHeader=  to scope out the appropriate cdf
- ** file. An error() will be flagged if the appropriate conditions
+ ** file. An read_error() will be flagged if the appropriate conditions
  ** are not met.
  **
  **
  ******************************************************************/
 
-static int check_cel_file(const char *filename, const char *ref_cdfName, int ref_dim_1, int ref_dim_2){
+static int check_cel_file(const char *filename, const char *ref_cdfName, int ref_dim_1, int ref_dim_2, long *intensity_offset){
 
-  int i;
   int dim1,dim2;
 
   FILE *currentFile; 
-  char buffer[BUF_SIZE];
-  tokenset *cur_tokenset;
+  text_cel_header header;
 
   currentFile = open_cel_file(filename);
-  
-
-  AdvanceToSection(currentFile,"[HEADER]",buffer);
-  findStartsWith(currentFile,"Cols",buffer);  
-  cur_tokenset = tokenize(buffer,"=");
-  dim1 = atoi(get_token(cur_tokenset,1));
-  delete_tokens(cur_tokenset);
+  read_text_cel_header(currentFile, filename, &header);
+  fclose(currentFile);
 
-  findStartsWith(currentFile,"Rows",buffer);
-  cur_tokenset = tokenize(buffer,"=");
-  dim2 = atoi(get_token(cur_tokenset,1));
-  delete_tokens(cur_tokenset);
+  dim1 = atoi(text_header_value(&header, "Cols", filename));
+  dim2 = atoi(text_header_value(&header, "Rows", filename));
   if ((dim1 != ref_dim_1) || (dim2 != ref_dim_2)){
-    error("Cel file %s does not seem to have the correct dimensions",filename);
+    delete_text_cel_header(&header);
+    read_error("Cel file %s does not seem to have the correct dimensions",filename);
   }
   
-  
-  findStartsWith(currentFile,"DatHeader",buffer);
-  cur_tokenset = tokenize(buffer," ");
-  for (i =0; i < tokenset_size(cur_tokenset);i++){
-    if (strncasecmp(get_token(cur_tokenset,i),ref_cdfName,strlen(ref_cdfName)) == 0){
-      break;
-    }
-    if (i == (tokenset_size(cur_tokenset) - 1)){
-      error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
-    }
+  if (!text_header_names_cdf(text_header_value(&header, "DatHeader", filename), ref_cdfName)){
+    delete_text_cel_header(&header);
+    read_error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
   }
-  delete_tokens(cur_tokenset);
-  fclose(currentFile);
+  if (intensity_offset != NULL){
+    *intensity_offset = header.intensity_offset;
+  }
+  delete_text_cel_header(&header);
 
   return 0;
 }
 
 /************************************************************************
  **
- ** int read_cel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols)
+ ** int read_cel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols, long intensity_offset)
  **
  ** const char *filename - the name of the cel file to read
  ** double *intensity  - the intensity matrix to fill
  ** int chip_num - the column of the intensity matrix that we will be filling
  ** int rows - dimension of intensity matrix
  ** int cols - dimension of intensity matrix
+ ** long intensity_offset - offset of the [INTENSITY] section, -1 if not known
  **
  ** returns 0 if successful, non zero if unsuccessful
  **
@@ -626,7 +901,7 @@ static int check_cel_file(const char *filename, const char *ref_cdfName, int ref
  **
  ************************************************************************/
 
-static int read_cel_file_intensities(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows){
+static int read_cel_file_intensities(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows, long intensity_offset){
 #if USE_PTHREADS  
   char *tmp_pointer;
 #endif  
@@ -642,7 +917,7 @@ static int read_cel_file_intensities(const char *filename, double *intensity, si
 
   currentFile = open_cel_file(filename);
   
-  AdvanceToSection(currentFile,"[INTENSITY]",buffer);
+  position_at_intensities(currentFile,intensity_offset,buffer);
   findStartsWith(currentFile,"CellHeader=",buffer);  
   
   for (i=0; i < rows; i++){
@@ -653,7 +928,7 @@ static int read_cel_file_intensities(const char *filename, double *intensity, si
     cur_mean = atof(get_token(cur_tokenset,2)); */
     
     if (strlen(buffer) <=2){
-      Rprintf("Warning: found an empty line where not expected in %s.\nThis means that there is a cel intensity missing from the cel file.\nSucessfully read to cel intensity %d of %d expected\n", filename, i-1, i);
+      read_warning("Warning: found an empty line where not expected in %s.\nThis means that there is a cel intensity missing from the cel file.\nSucessfully read to cel intensity %d of %d expected\n", filename, (int)i-1, (int)i);
       break;
     }
 #if USE_PTHREADS
@@ -662,7 +937,7 @@ static int read_cel_file_intensities(const char *filename, double *intensity, si
     current_token = strtok(buffer," \t");
 #endif
     if (current_token == NULL){
-       Rprintf("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, i-1, rows);
+       read_warning("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, (int)i-1, (int)rows);
       break;
     }
 
@@ -674,7 +949,7 @@ static int read_cel_file_intensities(const char *filename, double *intensity, si
 #endif
 
     if (current_token == NULL){
-      Rprintf("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, i-1, rows);
+      read_warning("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, (int)i-1, (int)rows);
       break;
     }
 
@@ -686,16 +961,16 @@ static int read_cel_file_intensities(const char *filename, double *intensity, si
 #endif
  
     if (current_token == NULL){
-      Rprintf("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, i-1, rows);
+      read_warning("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, (int)i-1, (int)rows);
       break;
     }
 
     if (cur_x < 0 || cur_x >= chip_dim_rows){    
-      error("It appears that the file %s is corrupted.",filename);
+      read_error("It appears that the file %s is corrupted.",filename);
       return 1;
     }
     if (cur_y < 0 || cur_y >= chip_dim_rows){
-      error("It appears that the file %s is corrupted.",filename);
+      read_error("It appears that the file %s is corrupted.",filename);
       return 1;
     }
 
@@ -721,13 +996,14 @@ static int read_cel_file_intensities(const char *filename, double *intensity, si
 
 /************************************************************************
  **
- ** int read_cel_file_stddev(const char *filename, double *intensity, int chip_num, int rows, int cols)
+ ** int read_cel_file_stddev(const char *filename, double *intensity, int chip_num, int rows, int cols, long intensity_offset)
  **
  ** const char *filename - the name of the cel file to read
  ** double *intensity  - the intensity matrix to fill
  ** int chip_num - the column of the intensity matrix that we will be filling
  ** int rows - dimension of intensity matrix
  ** int cols - dimension of intensity matrix
+ ** long intensity_offset - offset of the [INTENSITY] section, -1 if not known
  **
  ** returns 0 if successful, non zero if unsuccessful
  **
@@ -736,7 +1012,7 @@ static int read_cel_file_intensities(const char *filename, double *intensity, si
  **
  ************************************************************************/
 
-static int read_cel_file_stddev(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows){
+static int read_cel_file_stddev(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows, long intensity_offset){
 #if USE_PTHREADS  
   char *tmp_pointer;
 #endif  
@@ -750,7 +1026,7 @@ static int read_cel_file_stddev(const char *filename, double *intensity, size_t
 
   currentFile = open_cel_file(filename);
   
-  AdvanceToSection(currentFile,"[INTENSITY]",buffer);
+  position_at_intensities(currentFile,intensity_offset,buffer);
   findStartsWith(currentFile,"CellHeader=",buffer);  
   
   for (i=0; i < rows; i++){
@@ -827,13 +1103,14 @@ static int read_cel_file_stddev(const char *filename, double *intensity, size_t
 
 /************************************************************************
  **
- ** int read_cel_file_npixels(const char *filename, double *intensity, int chip_num, int rows, int cols)
+ ** int read_cel_file_npixels(const char *filename, double *intensity, int chip_num, int rows, int cols, long intensity_offset)
  **
  ** const char *filename - the name of the cel file to read
  ** double *intensity  - the intensity matrix to fill
  ** int chip_num - the column of the intensity matrix that we will be filling
  ** int rows - dimension of intensity matrix
  ** int cols - dimension of intensity matrix
+ ** long intensity_offset - offset of the [INTENSITY] section, -1 if not known
  **
  ** returns 0 if successful, non zero if unsuccessful
  **
@@ -842,7 +1119,7 @@ static int read_cel_file_stddev(const char *filename, double *intensity, size_t
  **
  ************************************************************************/
 
-static int read_cel_file_npixels(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows){
+static int read_cel_file_npixels(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows, long intensity_offset){
 #if USE_PTHREADS  
   char *tmp_pointer;
 #endif  
@@ -856,7 +1133,7 @@ static int read_cel_file_npixels(const char *filename, double *intensity, size_t
 
   currentFile = open_cel_file(filename);
   
-  AdvanceToSection(currentFile,"[INTENSITY]",buffer);
+  position_at_intensities(currentFile,intensity_offset,buffer);
   findStartsWith(currentFile,"CellHeader=",buffer);  
   
   for (i=0; i < rows; i++){
@@ -1042,87 +1319,41 @@ static void apply_masks(const char *filename, double *intensity, size_t chip_num
 
 /****************************************************************
  **
- ** static void get_masks_outliers(const char *filename, 
- **                         int *nmasks, short **masks_x, short **masks_y, 
- **                         int *noutliers, short **outliers_x, short **outliers_y
+ ** static void read_text_cel_locations(FILE *currentFile, char *section, 
+ **                         char *buffer, int *n, short **x, short **y)
  ** 
- ** This gets the x and y coordinates stored in the masks and outliers sections
- ** of the cel files.
+ ** This gets the x and y coordinates stored in the [MASKS] or [OUTLIERS] 
+ ** section (given by section) of an opened text cel file, reading forward
+ ** from the current position.
  **
  ****************************************************************/
 
-static void get_masks_outliers(const char *filename, int *nmasks, short **masks_x, short **masks_y, int *noutliers, short **outliers_x, short **outliers_y){
+static void read_text_cel_locations(FILE *currentFile, char *section, char *buffer, int *n, short **x, short **y){
   
-  FILE *currentFile;
-  char buffer[BUF_SIZE];
   int numcells, cur_x, cur_y; 
   tokenset *cur_tokenset;
   int i;
 
-
-  currentFile = open_cel_file(filename);
-  /* read masks section */
-  
-
-  AdvanceToSection(currentFile,"[MASKS]",buffer);
+  AdvanceToSection(currentFile,section,buffer);
   findStartsWith(currentFile,"NumberCells=",buffer); 
   cur_tokenset = tokenize(buffer,"=");
   numcells = atoi(get_token(cur_tokenset,1));
   delete_tokens(cur_tokenset);
   findStartsWith(currentFile,"CellHeader=",buffer); 
   
-  *nmasks = numcells;
-
-  *masks_x = R_Calloc(numcells,short);
-  *masks_y = R_Calloc(numcells,short);
-
+  *n = numcells;
+  *x = R_Calloc(numcells,short);
+  *y = R_Calloc(numcells,short);
 
   for (i =0; i < numcells; i++){
     ReadFileLine(buffer, BUF_SIZE, currentFile);
-    
-    
-    cur_tokenset = tokenize(buffer," \t");
-    cur_x = atoi(get_token(cur_tokenset,0));
-    cur_y = atoi(get_token(cur_tokenset,1));
-    (*masks_x)[i] = (short)cur_x;
-    (*masks_y)[i] = (short)cur_y;
-    
-    delete_tokens(cur_tokenset); 
-  }
-  
-  
-  /* read outliers section */
-    
-  AdvanceToSection(currentFile,"[OUTLIERS]",buffer);
-  findStartsWith(currentFile,"NumberCells=",buffer);
-  cur_tokenset = tokenize(buffer,"=");
-  numcells = atoi(get_token(cur_tokenset,1));
-  delete_tokens(cur_tokenset);
-  findStartsWith(currentFile,"CellHeader=",buffer); 
-
-  *noutliers = numcells;
-  *outliers_x = R_Calloc(numcells,short);
-  *outliers_y = R_Calloc(numcells,short);
-
-
-  for (i = 0; i < numcells; i++){
-    ReadFileLine(buffer, BUF_SIZE, currentFile);      
     cur_tokenset = tokenize(buffer," \t");
     cur_x = atoi(get_token(cur_tokenset,0));
     cur_y = atoi(get_token(cur_tokenset,1));
-    /* Rprintf("%d: %d %d   %d\n",i, cur_x,cur_y, numcells); */
-    (*outliers_x)[i] = (short)cur_x;
-    (*outliers_y)[i] = (short)cur_y;
-    
+    (*x)[i] = (short)cur_x;
+    (*y)[i] = (short)cur_y;
     delete_tokens(cur_tokenset); 
   }
-  
-  
-  fclose(currentFile);
-
-
-
-
 }
 
 
@@ -1142,157 +1373,100 @@ static void get_masks_outliers(const char *filename, int *nmasks, short **masks_
 
 static char *get_header_info(const char *filename, int *dim1, int *dim2){
   
-  int i,endpos;
   char *cdfName = NULL;
   FILE *currentFile; 
-  char buffer[BUF_SIZE];
-  tokenset *cur_tokenset;
+  text_cel_header header;
 
   currentFile = open_cel_file(filename);
+  read_text_cel_header(currentFile, filename, &header);
+  fclose(currentFile);
 
-  AdvanceToSection(currentFile,"[HEADER]",buffer);
-  findStartsWith(currentFile,"Cols",buffer);  
-  cur_tokenset = tokenize(buffer,"=");
-  *dim1 = atoi(get_token(cur_tokenset,1));
-  delete_tokens(cur_tokenset);
+  *dim1 = atoi(text_header_value(&header, "Cols", filename));
+  *dim2 = atoi(text_header_value(&header, "Rows", filename));
+  cdfName = text_header_cdf_name(text_header_value(&header, "DatHeader", filename), filename);
 
-  findStartsWith(currentFile,"Rows",buffer);
-  cur_tokenset = tokenize(buffer,"=");
-  *dim2 = atoi(get_token(cur_tokenset,1));
-  delete_tokens(cur_tokenset);
-  
-  findStartsWith(currentFile,"DatHeader",buffer);
-  cur_tokenset = tokenize(buffer," ");
-  for (i =0; i < tokenset_size(cur_tokenset);i++){
-    /* look for a token ending in ".1sq" */
-    endpos=token_ends_with(get_token(cur_tokenset,i),".1sq");
-    if(endpos > 0){
-      /* Found the likely CDF name, now chop of .1sq and store it */
-      
-      cdfName= R_Calloc(endpos+1,char);
-      strncpy(cdfName,get_token(cur_tokenset,i),endpos);
-      cdfName[endpos] = '\0';
-      
-      break;
-    }
-    if (i == (tokenset_size(cur_tokenset) - 1)){
-      error("Cel file %s does not seem to be have cdf information",filename);
-    }
-  }
-  delete_tokens(cur_tokenset);
-  fclose(currentFile);
+  delete_text_cel_header(&header);
   return(cdfName);
 }
 
 
 /*************************************************************************
  **
- ** void get_detailed_header_info(const char *filename, detailed_header_info *header_info)
+ ** void text_detailed_header_info(const text_cel_header *header, const char *filename, detailed_header_info *header_info)
+ **
+ ** const text_cel_header *header - the header table of a text CEL file
+ ** const char *filename - name of the file (for error messages)
+ ** detailed_header_info *header_info - place to store header information
+ **
+ ** fills header_info from the table made by read_text_cel_header() (ignoring
+ ** some fields that are unused).
+ **
+ ************************************************************************/
+
+static void text_detailed_header_info(const text_cel_header *header, const char *filename, detailed_header_info *header_info){
+
+  const char *value;
+  size_t length;
+
+  header_info->cols = atoi(text_header_value(header, "Cols", filename));
+  header_info->rows = atoi(text_header_value(header, "Rows", filename));
+
+  text_header_pair(header, "GridCornerUL", filename, &header_info->GridCornerULx, &header_info->GridCornerULy);
+  text_header_pair(header, "GridCornerUR", filename, &header_info->GridCornerURx, &header_info->GridCornerURy);
+  text_header_pair(header, "GridCornerLR", filename, &header_info->GridCornerLRx, &header_info->GridCornerLRy);
+  text_header_pair(header, "GridCornerLL", filename, &header_info->GridCornerLLx, &header_info->GridCornerLLy);
+
+  value = text_header_value(header, "DatHeader", filename);
+  header_info->DatHeader = R_Calloc(strlen(value)+1,char);
+  strcpy(header_info->DatHeader,value);
+
+  /* now pull out the actual cdfname */ 
+  header_info->cdfName = text_header_cdf_name(value, filename);
+  
+  /* as before, the Algorithm and its parameters stop at any further '=' */
+  value = text_header_value(header, "Algorithm", filename);
+  length = strcspn(value, "=");
+  header_info->Algorithm = R_Calloc(length+1,char);
+  memcpy(header_info->Algorithm,value,length);
+
+  value = text_header_value(header, "AlgorithmParameters", filename);
+  length = strcspn(value, "=");
+  header_info->AlgorithmParameters = R_Calloc(length+1,char);
+  memcpy(header_info->AlgorithmParameters,value,length);
+
+  header_info->ScanDate = R_Calloc(2, char);
+}
+
+
+/*************************************************************************
+ **
+ ** void get_detailed_header_info(const char *filename, detailed_header_info *header_info, long *intensity_offset)
  **
  ** const char *filename - file to open
  ** detailed_header_info *header_info - place to store header information
+ ** long *intensity_offset - if not NULL, set to the offset of the [INTENSITY] section
  **
  ** reads the header information from a text cdf file (ignoring some fields
  ** that are unused).
  **
  ************************************************************************/
 
-static void get_detailed_header_info(const char *filename, detailed_header_info *header_info){
+static void get_detailed_header_info(const char *filename, detailed_header_info *header_info, long *intensity_offset){
 
-  int i,endpos;
   FILE *currentFile; 
-  char buffer[BUF_SIZE];
-  char *buffercopy;
-
-  tokenset *cur_tokenset;
+  text_cel_header header;
 
   currentFile = open_cel_file(filename);
+  read_text_cel_header(currentFile, filename, &header);
+  fclose(currentFile);
 
-  AdvanceToSection(currentFile,"[HEADER]",buffer);
+  text_detailed_header_info(&header, filename, header_info);
 
-  findStartsWith(currentFile,"Cols",buffer);  
-  cur_tokenset = tokenize(buffer,"=");
-  header_info->cols = atoi(get_token(cur_tokenset,1));
-  delete_tokens(cur_tokenset);
-
-  findStartsWith(currentFile,"Rows",buffer);
-  cur_tokenset = tokenize(buffer,"=");
-  header_info->rows = atoi(get_token(cur_tokenset,1));
-  delete_tokens(cur_tokenset);
-
-  findStartsWith(currentFile,"GridCornerUL",buffer);
-  cur_tokenset = tokenize(buffer,"= ");
-  header_info->GridCornerULx  = atoi(get_token(cur_tokenset,1));
-  header_info->GridCornerULy  = atoi(get_token(cur_tokenset,2));
-  delete_tokens(cur_tokenset);
-
-  findStartsWith(currentFile,"GridCornerUR",buffer);
-  cur_tokenset = tokenize(buffer,"= ");
-  header_info->GridCornerURx  = atoi(get_token(cur_tokenset,1));
-  header_info->GridCornerURy  = atoi(get_token(cur_tokenset,2));
-  delete_tokens(cur_tokenset);
-  
-  findStartsWith(currentFile,"GridCornerLR",buffer);
-  cur_tokenset = tokenize(buffer,"= ");
-  header_info->GridCornerLRx  = atoi(get_token(cur_tokenset,1));
-  header_info->GridCornerLRy  = atoi(get_token(cur_tokenset,2));
-  delete_tokens(cur_tokenset);
-
-  findStartsWith(currentFile,"GridCornerLL",buffer);
-  cur_tokenset = tokenize(buffer,"= ");
-  header_info->GridCornerLLx  = atoi(get_token(cur_tokenset,1));
-  header_info->GridCornerLLy  = atoi(get_token(cur_tokenset,2));
-  delete_tokens(cur_tokenset);
-
-  findStartsWith(currentFile,"DatHeader",buffer);
-  /* first lets copy the entire string over */
-
-  buffercopy =  R_Calloc(strlen(buffer)+1,char);
-  strcpy(buffercopy,buffer);
-  cur_tokenset = tokenize(buffercopy,"\r\n");
-  header_info->DatHeader = R_Calloc(strlen(get_token(cur_tokenset,0))-8,char);
-  strcpy(header_info->DatHeader,(get_token(cur_tokenset,0)+10));  /* the +10 is to avoid the starting "DatHeader=" */
-  R_Free(buffercopy);
-  delete_tokens(cur_tokenset);
-
-  
-  /* now pull out the actual cdfname */ 
-  cur_tokenset = tokenize(buffer," ");
-  for (i =0; i < tokenset_size(cur_tokenset);i++){
-    /* look for a token ending in ".1sq" */
-    endpos=token_ends_with(get_token(cur_tokenset,i),".1sq");
-    if(endpos > 0){
-      /* Found the likely CDF name, now chop of .1sq and store it */
-      
-      header_info->cdfName= R_Calloc(endpos+1,char);
-      strncpy( header_info->cdfName,get_token(cur_tokenset,i),endpos);
-       header_info->cdfName[endpos] = '\0';
-      
-      break;
-    }
-    if (i == (tokenset_size(cur_tokenset) - 1)){
-      error("Cel file %s does not seem to be have cdf information",filename);
-    }
-  }
-  delete_tokens(cur_tokenset);
-  
-  findStartsWith(currentFile,"Algorithm",buffer);
-  cur_tokenset = tokenize(buffer,"=\r\n");
-  header_info->Algorithm = R_Calloc(strlen(get_token(cur_tokenset,1))+1,char);
-  strcpy(header_info->Algorithm,get_token(cur_tokenset,1));
-  
-
-  delete_tokens(cur_tokenset);
-
-  findStartsWith(currentFile,"AlgorithmParameters",buffer);
-  cur_tokenset = tokenize(buffer,"=\r\n");
-  header_info->AlgorithmParameters = R_Calloc(strlen(get_token(cur_tokenset,1))+1,char);
-  strcpy(header_info->AlgorithmParameters,get_token(cur_tokenset,1));
-  
-  fclose(currentFile);
-
-  header_info->ScanDate = R_Calloc(2, char);
-}
+  if (intensity_offset != NULL){
+    *intensity_offset = header.intensity_offset;
+  }
+  delete_text_cel_header(&header);
+}
 
 
 
@@ -1320,9 +1494,10 @@ static int isTextCelFile(const char *filename){
   FILE *currentFile= NULL; 
   char buffer[BUF_SIZE];
 
+  read_timing_opened();
   currentFile = fopen(filename,mode);
   if (currentFile == NULL){
-    error("Could not open file %s", filename);
+    read_error("Could not open file %s", filename);
   } else {
     /** check to see if first line is [CEL] so looks like a CEL file**/
     ReadFileLine(buffer, BUF_SIZE, currentFile);
@@ -1363,7 +1538,7 @@ static int isTextCelFile(const char *filename){
 
 static void ReadgzFileLine(char *buffer, int buffersize, gzFile currentFile){
   if (gzgets( currentFile,buffer, buffersize) == NULL){
-    error("End of gz file reached unexpectedly. Perhaps this file is truncated.\n");
+    read_error("End of gz file reached unexpectedly. Perhaps this file is truncated.\n");
   }  
 }
 
@@ -1389,16 +1564,17 @@ static gzFile open_gz_cel_file(const char *filename){
   gzFile currentFile= NULL; 
   char buffer[BUF_SIZE];
 
+  read_timing_opened();
   currentFile = gzopen(filename,mode);
   if (currentFile == NULL){
-     error("Could not open file %s", filename);
+     read_error("Could not open file %s", filename);
   } else {
     /** check to see if first line is [CEL] so looks like a CEL file**/
     ReadgzFileLine(buffer, BUF_SIZE, currentFile);
     if (strncmp("[CEL]", buffer, 4) == 0) {
       gzrewind(currentFile);
     } else {
-      error("The file %s does not look like a CEL file",filename);
+      read_error("The file %s does not look like a CEL file",filename);
     }
   }
   
@@ -1466,7 +1642,7 @@ static void gzAdvanceToSection(gzFile my_file,char *sectiontitle, char *buffer){
  ** The aim of this function is to read the header of the CEL file
  ** in particular we will look for the rows beginning "Cols="  and "Rows="
  ** and then for the line DatHeader=  to scope out the appropriate cdf
- ** file. An error() will be flagged if the appropriate conditions
+ ** file. An read_error() will be flagged if the appropriate conditions
  ** are not met.
  **
  **
@@ -1495,7 +1671,7 @@ static int check_gzcel_file(const char *filename, const char *ref_cdfName, int r
   dim2 = atoi(get_token(cur_tokenset,1));
   delete_tokens(cur_tokenset);
   if ((dim1 != ref_dim_1) || (dim2 != ref_dim_2)){
-    error("Cel file %s does not seem to have the correct dimensions",filename);
+    read_error("Cel file %s does not seem to have the correct dimensions",filename);
   }
   
   
@@ -1506,7 +1682,7 @@ static int check_gzcel_file(const char *filename, const char *ref_cdfName, int r
       break;
     }
     if (i == (tokenset_size(cur_tokenset) - 1)){
-      error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
+      read_error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
     }
   }
   delete_tokens(cur_tokenset);
@@ -1564,7 +1740,7 @@ static int read_gzcel_file_intensities(const char *filename, double *intensity,
     current_token = strtok(buffer," \t");
 #endif
     if (current_token == NULL){
-      Rprintf("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, i-1, rows);
+      read_warning("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, (int)i-1, (int)rows);
       break;
     }
 
@@ -1575,7 +1751,7 @@ static int read_gzcel_file_intensities(const char *filename, double *intensity,
     current_token = strtok(NULL," \t");
 #endif
     if (current_token == NULL){
-      Rprintf("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, i-1, rows);
+      read_warning("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, (int)i-1, (int)rows);
       break;
     }
 
@@ -1586,16 +1762,16 @@ static int read_gzcel_file_intensities(const char *filename, double *intensity,
     current_token = strtok(NULL," \t");
 #endif
     if (current_token == NULL){
-      Rprintf("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, i-1, rows);
+      read_warning("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, (int)i-1, (int)rows);
       break;
     }
  
     if (cur_x < 0 || cur_x >= chip_dim_rows){
-      error("It appears that the file %s is corrupted.",filename);
+      read_error("It appears that the file %s is corrupted.",filename);
       return 1;
     }
     if (cur_y < 0 || cur_y >= chip_dim_rows){
-      error("It appears that the file %s is corrupted.",filename);
+      read_error("It appears that the file %s is corrupted.",filename);
       return 1;
     }
 
@@ -1965,7 +2141,7 @@ static char *gz_get_header_info(const char *filename, int *dim1, int *dim2){
       break;
     }
     if (i == (tokenset_size(cur_tokenset) - 1)){
-      error("Cel file %s does not seem to be have cdf information",filename);
+      read_error("Cel file %s does not seem to be have cdf information",filename);
     }
   }
   delete_tokens(cur_tokenset);
@@ -2062,7 +2238,7 @@ static void gz_get_detailed_header_info(const char *filename, detailed_header_in
       break;
     }
     if (i == (tokenset_size(cur_tokenset) - 1)){
-      error("Cel file %s does not seem to be have cdf information",filename);
+      read_error("Cel file %s does not seem to be have cdf information",filename);
     }
   }
   delete_tokens(cur_tokenset);
@@ -2199,9 +2375,10 @@ static int isgzTextCelFile(const char *filename){
   const char *mode = "rb"; 
  gzFile currentFile = NULL; 
  char buffer[BUF_SIZE];
+ read_timing_opened();
  currentFile = gzopen(filename,mode);
  if (currentFile == NULL){
-   error("Could not open file %s", filename);
+   read_error("Could not open file %s", filename);
  } else {
    /** check to see if first line is [CEL] so looks like a CEL file**/
    ReadgzFileLine(buffer, BUF_SIZE, currentFile);
@@ -2232,8 +2409,11 @@ static int isgzTextCelFile(const char *filename){
  **
  ** returns the number of probes (PM)
  **
- **
- **
+ ** If cdfInfo carries an "n.probes" attribute (number of probesets, 
+ ** number of probes) as set by ReadCDFFileLocations, and the number 
+ ** of probesets still agrees, the count is taken from it rather than
+ ** from each of the matrices. storeIntensities checks that the
+ ** matrices do in fact add up to this.
  **
  *************************************************************************/
 
@@ -2243,6 +2423,11 @@ static int CountCDFProbes(SEXP cdfInfo){
   int i;
   int n_probes = 0;
   int n_probesets =  GET_LENGTH(cdfInfo);
+  SEXP counts = getAttrib(cdfInfo,install("n.probes"));
+
+  if (TYPEOF(counts) == INTSXP && GET_LENGTH(counts) == 2 && INTEGER(counts)[0] == n_probesets && INTEGER(counts)[1] >= 0){
+    return INTEGER(counts)[1];
+  }
 
   for (i =0; i < n_probesets; i++){
     n_probes +=INTEGER(getAttrib(VECTOR_ELT(cdfInfo,i),R_DimSymbol))[0]; 
@@ -2253,6 +2438,38 @@ static int CountCDFProbes(SEXP cdfInfo){
 }
 
 
+/*************************************************************************
+ **
+ ** static int cdf_location_index(double location)
+ **
+ ** converts a (1-based) location from a REALSXP cdfInfo matrix to an
+ ** integer. Locations not present (NaN/NA) become NA_INTEGER.
+ **
+ *************************************************************************/
+
+static int cdf_location_index(double location){
+  if (ISNAN(location)){
+    return NA_INTEGER;
+  }
+  return (int)location;
+}
+
+/*************************************************************************
+ **
+ ** static double index_intensity(double *CurintensityMatrix, int index)
+ **
+ ** the intensity at a 1-based location, NA if the location is NA
+ **
+ *************************************************************************/
+
+static double index_intensity(double *CurintensityMatrix, int index){
+  if (index == NA_INTEGER){
+    return R_NaReal;
+  }
+  return CurintensityMatrix[index - 1];
+}
+
+
 /*************************************************************************
  **
  ** static void  storeIntensities(double *CurintensityMatrix,double *pmMatrix,
@@ -2261,6 +2478,8 @@ static int CountCDFProbes(SEXP cdfInfo){
  **
  ** double *CurintensityMatrix 
  **
+ ** The matrices in cdfInfo may be either INTSXP or REALSXP. INTSXP
+ ** indices are used directly.
  **
  *************************************************************************/
 
@@ -2271,6 +2490,7 @@ static void storeIntensities(double *CurintensityMatrix, double *pmMatrix, doubl
   int n_probes=0;
   int n_probesets = GET_LENGTH(cdfInfo);
   double *cur_index;
+  int *cur_index_int;
 
   SEXP curIndices;
 #endif
@@ -2279,29 +2499,53 @@ static void storeIntensities(double *CurintensityMatrix, double *pmMatrix, doubl
 #ifdef USE_PTHREADS
     for (j=0; j < n_probes[i]; j++){
       if (which >= 0){
-	pmMatrix[curcol*tot_n_probes + currow] =  CurintensityMatrix[(int)cur_indexes[i][j] - 1]; 
+	pmMatrix[curcol*tot_n_probes + currow] =  index_intensity(CurintensityMatrix,cur_indexes[i][j]); 
       }
       if (which <= 0){
-	mmMatrix[curcol*tot_n_probes + currow] =  CurintensityMatrix[(int)cur_indexes[i][j+n_probes[i]] - 1];
+	mmMatrix[curcol*tot_n_probes + currow] =  index_intensity(CurintensityMatrix,cur_indexes[i][j+n_probes[i]]);
       }
       currow++;
     }
 #else
     curIndices = VECTOR_ELT(cdfInfo,i);
     n_probes = INTEGER(getAttrib(curIndices,R_DimSymbol))[0];
-    cur_index = NUMERIC_POINTER(AS_NUMERIC(curIndices));
+    if (currow + n_probes > tot_n_probes){
+      for (j=i+1; j < n_probesets; j++){
+	n_probes += INTEGER(getAttrib(VECTOR_ELT(cdfInfo,j),R_DimSymbol))[0];
+      }
+      read_error("cdfInfo has %d probes, not the %d expected.", (int)currow + n_probes, (int)tot_n_probes);
+    }
 
-    for (j=0; j < n_probes; j++){
-      if (which >= 0){
-	pmMatrix[curcol*tot_n_probes + currow] =  CurintensityMatrix[(int)cur_index[j] - 1]; 
+    if (TYPEOF(curIndices) == INTSXP){
+      cur_index_int = INTEGER_POINTER(curIndices);
+      for (j=0; j < n_probes; j++){
+	if (which >= 0){
+	  pmMatrix[curcol*tot_n_probes + currow] =  index_intensity(CurintensityMatrix,cur_index_int[j]); 
+	}
+	if (which <= 0){
+	  mmMatrix[curcol*tot_n_probes + currow] =  index_intensity(CurintensityMatrix,cur_index_int[j+n_probes]);	
+	}
+	currow++;
       }
-      if (which <= 0){
-	mmMatrix[curcol*tot_n_probes + currow] =  CurintensityMatrix[(int)cur_index[j+n_probes] - 1];	
+    } else {
+      cur_index = NUMERIC_POINTER(AS_NUMERIC(curIndices));
+      for (j=0; j < n_probes; j++){
+	if (which >= 0){
+	  pmMatrix[curcol*tot_n_probes + currow] =  index_intensity(CurintensityMatrix,cdf_location_index(cur_index[j])); 
+	}
+	if (which <= 0){
+	  mmMatrix[curcol*tot_n_probes + currow] =  index_intensity(CurintensityMatrix,cdf_location_index(cur_index[j+n_probes]));	
+	}
+	currow++;
       }
-      currow++;
     }
 #endif
   }
+#ifndef USE_PTHREADS
+  if (currow != tot_n_probes){
+    read_error("cdfInfo has %d probes, not the %d expected.", (int)currow, (int)tot_n_probes);
+  }
+#endif
 }
 
 
@@ -2375,9 +2619,10 @@ static int isBinaryCelFile(const char *filename){
   int magicnumber;
   int version_number;
   
+  read_timing_opened();
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
       return 0;
     }
   
@@ -2445,20 +2690,21 @@ static binary_header *read_binary_header(const char *filename, int return_stream
   
   /* Pass through all the header information */
   
+  read_timing_opened();
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
   if (!fread_int32(&(this_header->magic_number),1,infile)){
-    error("The binary file %s does not have the appropriate magic number\n",filename);
+    read_error("The binary file %s does not have the appropriate magic number\n",filename);
     fclose(infile);
     return 0;
   }
   
   if (this_header->magic_number != 64){
-    error("The binary file %s does not have the appropriate magic number\n",filename);
+    read_error("The binary file %s does not have the appropriate magic number\n",filename);
     fclose(infile);
     return 0;
   }
@@ -2469,7 +2715,7 @@ static binary_header *read_binary_header(const char *filename, int return_stream
   }
 
   if (this_header->version_number != 4){
-    error("The binary file %s is not version 4. Cannot read\n",filename);
+    read_error("The binary file %s is not version 4. Cannot read\n",filename);
     fclose(infile);
     return 0;
   }
@@ -2481,69 +2727,69 @@ static binary_header *read_binary_header(const char *filename, int return_stream
   /** We follow FUSION here (in the past we followed the DOCS **/
 
   if (!fread_int32(&(this_header->rows),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   
   if (!fread_int32(&(this_header->cols),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
     return 0;
   }
   
 
   if (!fread_int32(&(this_header->n_cells),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   if (this_header->n_cells != (this_header->cols)*(this_header->rows)){
-    error("The number of cells does not seem to be equal to cols*rows in %s.\n",filename);
+    read_error("The number of cells does not seem to be equal to cols*rows in %s.\n",filename);
   }
 
   
   if (!fread_int32(&(this_header->header_len),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
 
   this_header->header = R_Calloc(this_header->header_len+1,char);
   
   if (!fread(this_header->header,sizeof(char),this_header->header_len,infile)){
-    error("binary file corrupted? Could not read any further.\n");
+    read_error("binary file corrupted? Could not read any further.\n");
   }
   
   if (!fread_int32(&(this_header->alg_len),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   this_header->algorithm = R_Calloc(this_header->alg_len+1,char);
   
   if (!fread_char(this_header->algorithm,this_header->alg_len,infile)){
-    error("binary file corrupted? Could not read any further.\n");
+    read_error("binary file corrupted? Could not read any further.\n");
   }
   
   if (!fread_int32(&(this_header->alg_param_len),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   this_header->alg_param = R_Calloc(this_header->alg_param_len+1,char);
   
   if (!fread_char(this_header->alg_param,this_header->alg_param_len,infile)){
-    error("binary file corrupted? Could not read any further.\n");
+    read_error("binary file corrupted? Could not read any further.\n");
   }
     
   if (!fread_int32(&(this_header->celmargin),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   if (!fread_uint32(&(this_header->n_outliers),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   if (!fread_uint32(&(this_header->n_masks),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
 
   if (!fread_int32(&(this_header->n_subgrids),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   } 
 
 
@@ -2600,7 +2846,7 @@ static char *binary_get_header_info(const char *filename, int *dim1, int *dim2){
       break;
     }
     if (i == (tokenset_size(my_tokenset) - 1)){
-      error("Cel file %s does not seem to be have cdf information",filename);
+      read_error("Cel file %s does not seem to be have cdf information",filename);
     }
   }
   
@@ -2622,7 +2868,8 @@ static char *binary_get_header_info(const char *filename, int *dim1, int *dim2){
  ** detailed_header_info *header_info - place to store header information
  **
  ** reads the header information from a binary cdf file (ignoring some fields
- ** that are unused).
+ ** that are unused). binary_detailed_header_info() does the work given a
+ ** header already read by read_binary_header().
  **
  ************************************************************************/
 
@@ -2630,7 +2877,7 @@ static char *binary_get_header_info(const char *filename, int *dim1, int *dim2){
 
 
 
-static void binary_get_detailed_header_info(const char *filename, detailed_header_info *header_info){
+static void binary_detailed_header_info(binary_header *my_header, const char *filename, detailed_header_info *header_info){
 
   /* char *cdfName =0; */
   tokenset *my_tokenset;
@@ -2642,11 +2889,6 @@ static void binary_get_detailed_header_info(const char *filename, detailed_heade
 
   
   int i = 0,endpos;
-  
-  binary_header *my_header;
-  
-
-  my_header = read_binary_header(filename,0);
 
 
   header_info->cols = my_header->cols;
@@ -2741,20 +2983,30 @@ static void binary_get_detailed_header_info(const char *filename, detailed_heade
       break;
     }
     if (i == (tokenset_size(my_tokenset) - 1)){
-      error("Cel file %s does not seem to be have cdf information",filename);
+      read_error("Cel file %s does not seem to be have cdf information",filename);
     }
   }
    
   header_info->ScanDate = R_Calloc(2, char);
 
   delete_tokens(my_tokenset);
-  delete_binary_header(my_header);
   R_Free(header_copy);
 
 
 }
 
 
+static void binary_get_detailed_header_info(const char *filename, detailed_header_info *header_info){
+
+  binary_header *my_header;
+
+  my_header = read_binary_header(filename,0);
+  binary_detailed_header_info(my_header, filename, header_info);
+  delete_binary_header(my_header);
+
+}
+
+
 
 
 
@@ -2791,7 +3043,7 @@ static int check_binary_cel_file(const char *filename, const char *ref_cdfName,
   my_header = read_binary_header(filename,0);  
 
   if ((my_header->cols != ref_dim_1) || (my_header->rows != ref_dim_2)){
-    error("Cel file %s does not seem to have the correct dimensions",filename);
+    read_error("Cel file %s does not seem to have the correct dimensions",filename);
   }
   
   my_tokenset = tokenize(my_header->header," ");
@@ -2811,12 +3063,12 @@ static int check_binary_cel_file(const char *filename, const char *ref_cdfName,
       break;
     }
     if (i == (tokenset_size(my_tokenset) - 1)){
-      error("Cel file %s does not seem to be have cdf information",filename);
+      read_error("Cel file %s does not seem to be have cdf information",filename);
     }
   }
 
   if (strncasecmp(cdfName,ref_cdfName,strlen(ref_cdfName)) != 0){
-    error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
+    read_error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
   }
 
   
@@ -3053,65 +3305,27 @@ static void binary_apply_masks(const char *filename, double *intensity, size_t c
 
 /****************************************************************
  **
- ** static void binary_get_masks_outliers(const char *filename, 
- **                         int *nmasks, short **masks_x, short **masks_y, 
- **                         int *noutliers, short **outliers_x, short **outliers_y
+ ** static void binary_read_locations(FILE *infile, unsigned int n, short **x, short **y)
  ** 
- ** This gets the x and y coordinates stored in the masks and outliers sections
- ** of the cel files. (for binary CEL files)
+ ** This gets n x and y coordinates from the masks or outliers section
+ ** of an opened binary CEL file, reading from the current position.
  **
  ****************************************************************/
 
-static void binary_get_masks_outliers(const char *filename, int *nmasks, short **masks_x, short **masks_y, int *noutliers, short **outliers_x, short **outliers_y){
-
-  
-  int i=0;
-
-  int sizeofrecords;
-
-  outliermask_loc *cur_loc= R_Calloc(1,outliermask_loc);
-  binary_header *my_header;
-
-  my_header = read_binary_header(filename,1);
-
-  sizeofrecords = 2*sizeof(float) + sizeof(short);
-
-  fseek(my_header->infile,my_header->n_cells*sizeofrecords,SEEK_CUR);
- 
-
-  *nmasks = my_header->n_masks;
-  *masks_x = R_Calloc(my_header->n_masks,short);
-  *masks_y = R_Calloc(my_header->n_masks,short);
-
-  for (i =0; i < my_header->n_masks; i++){
-    fread_int16(&(cur_loc->x),1,my_header->infile);
-    fread_int16(&(cur_loc->y),1,my_header->infile);
-    (*masks_x)[i] = (cur_loc->x);
-    (*masks_y)[i] = (cur_loc->y);
-  }
-
-
-  *noutliers = my_header->n_outliers;
-  *outliers_x = R_Calloc(my_header->n_outliers,short);
-  *outliers_y = R_Calloc(my_header->n_outliers,short);
-  
-
+static void binary_read_locations(FILE *infile, unsigned int n, short **x, short **y){
 
-  for (i =0; i < my_header->n_outliers; i++){
-    fread_int16(&(cur_loc->x),1,my_header->infile);
-    fread_int16(&(cur_loc->y),1,my_header->infile);
-    (*outliers_x)[i] = (cur_loc->x);
-    (*outliers_y)[i] = (cur_loc->y);
+  unsigned int i;
+  outliermask_loc cur_loc;
 
+  *x = R_Calloc(n,short);
+  *y = R_Calloc(n,short);
 
+  for (i =0; i < n; i++){
+    fread_int16(&(cur_loc.x),1,infile);
+    fread_int16(&(cur_loc.y),1,infile);
+    (*x)[i] = cur_loc.x;
+    (*y)[i] = cur_loc.y;
   }
-      
-  fclose(my_header->infile);
-  delete_binary_header(my_header);
- 
-  R_Free(cur_loc);
-  
-
 }
 
 
@@ -3149,9 +3363,10 @@ static int isgzBinaryCelFile(const char *filename){
   int magicnumber;
   int version_number;
   
+  read_timing_opened();
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
       return 0;
     }
   
@@ -3200,19 +3415,20 @@ static binary_header *gzread_binary_header(const char *filename, int return_stre
   
   /* Pass through all the header information */
   
+  read_timing_opened();
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
   if (!gzread_int32(&(this_header->magic_number),1,infile)){
-    error("The binary file %s does not have the appropriate magic number\n",filename);
+    read_error("The binary file %s does not have the appropriate magic number\n",filename);
     return 0;
   }
   
   if (this_header->magic_number != 64){
-    error("The binary file %s does not have the appropriate magic number\n",filename);
+    read_error("The binary file %s does not have the appropriate magic number\n",filename);
     return 0;
   }
   
@@ -3221,7 +3437,7 @@ static binary_header *gzread_binary_header(const char *filename, int return_stre
   }
 
   if (this_header->version_number != 4){
-    error("The binary file %s is not version 4. Cannot read\n",filename);
+    read_error("The binary file %s is not version 4. Cannot read\n",filename);
     return 0;
   }
     
@@ -3232,67 +3448,67 @@ static binary_header *gzread_binary_header(const char *filename, int return_stre
   /** We follow FUSION here (in the past we followed the DOCS **/
   
   if (!gzread_int32(&(this_header->rows),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   if (!gzread_int32(&(this_header->cols),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
     return 0;
   }
 
   if (!gzread_int32(&(this_header->n_cells),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   if (this_header->n_cells != (this_header->cols)*(this_header->rows)){
-    error("The number of cells does not seem to be equal to cols*rows in %s.\n",filename);
+    read_error("The number of cells does not seem to be equal to cols*rows in %s.\n",filename);
   }
 
   
   if (!gzread_int32(&(this_header->header_len),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
 
   this_header->header = R_Calloc(this_header->header_len+1,char);
   
   if (!gzread(infile,this_header->header,sizeof(char)*this_header->header_len)){
-    error("binary file corrupted? Could not read any further.\n");
+    read_error("binary file corrupted? Could not read any further.\n");
   }
   
   if (!gzread_int32(&(this_header->alg_len),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   this_header->algorithm = R_Calloc(this_header->alg_len+1,char);
   
   if (!gzread_char(this_header->algorithm,this_header->alg_len,infile)){
-    error("binary file corrupted? Could not read any further.\n");
+    read_error("binary file corrupted? Could not read any further.\n");
   }
   
   if (!gzread_int32(&(this_header->alg_param_len),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   this_header->alg_param = R_Calloc(this_header->alg_param_len+1,char);
   
   if (!gzread_char(this_header->alg_param,this_header->alg_param_len,infile)){
-    error("binary file corrupted? Could not read any further.\n");
+    read_error("binary file corrupted? Could not read any further.\n");
   }
     
   if (!gzread_int32(&(this_header->celmargin),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   if (!gzread_uint32(&(this_header->n_outliers),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
   
   if (!gzread_uint32(&(this_header->n_masks),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   }
 
   if (!gzread_int32(&(this_header->n_subgrids),1,infile)){
-    error("Binary file corrupted? Could not read any further\n");
+    read_error("Binary file corrupted? Could not read any further\n");
   } 
 
 
@@ -3351,7 +3567,7 @@ static char *gzbinary_get_header_info(const char *filename, int *dim1, int *dim2
       break;
     }
     if (i == (tokenset_size(my_tokenset) - 1)){
-      error("Cel file %s does not seem to be have cdf information",filename);
+      read_error("Cel file %s does not seem to be have cdf information",filename);
     }
   }
   
@@ -3490,7 +3706,7 @@ static void gzbinary_get_detailed_header_info(const char *filename, detailed_hea
       break;
     }
     if (i == (tokenset_size(my_tokenset) - 1)){
-      error("Cel file %s does not seem to be have cdf information",filename);
+      read_error("Cel file %s does not seem to be have cdf information",filename);
     }
   }
   
@@ -3530,7 +3746,7 @@ static int check_gzbinary_cel_file(const char *filename, const char *ref_cdfName
   my_header = gzread_binary_header(filename,0);  
 
   if ((my_header->cols != ref_dim_1) || (my_header->rows != ref_dim_2)){
-    error("Cel file %s does not seem to have the correct dimensions",filename);
+    read_error("Cel file %s does not seem to have the correct dimensions",filename);
   }
   
   my_tokenset = tokenize(my_header->header," ");
@@ -3550,12 +3766,12 @@ static int check_gzbinary_cel_file(const char *filename, const char *ref_cdfName
       break;
     }
     if (i == (tokenset_size(my_tokenset) - 1)){
-      error("Cel file %s does not seem to be have cdf information",filename);
+      read_error("Cel file %s does not seem to be have cdf information",filename);
     }
   }
 
   if (strncasecmp(cdfName,ref_cdfName,strlen(ref_cdfName)) != 0){
-    error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
+    read_error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
   }
 
   
@@ -3847,151 +4063,471 @@ static void gzbinary_get_masks_outliers(const char *filename, int *nmasks, short
 /****************************************************************
  ****************************************************************
  **
- ** This is the code that interfaces with R
+ ** Format detection and the CEL catalog
+ **
+ ** When the R_AFFYIO_CATALOG environment variable names a catalog
+ ** file (see cel_catalog.c) the format and header of a CEL file
+ ** are recorded the first time it is checked or has its header
+ ** read. While the file is unchanged later calls take the format
+ ** from the catalog and check the CDF name and dimensions against
+ ** the catalogued header rather than reopening the file.
  **
  ***************************************************************
  ***************************************************************/
 
-/************************************************************************
+static void not_a_cel_file_error(const char *cur_file_name){
+#if defined HAVE_ZLIB
+  read_error("Is %s really a CEL file? tried reading as text, gzipped text, binary, gzipped binary, command console and gzipped command console formats.\n",cur_file_name);
+#else
+  read_error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",cur_file_name);
+#endif
+}
+
+
+static void free_detailed_header(detailed_header_info *header_info){
+  R_Free(header_info->Algorithm);
+  R_Free(header_info->AlgorithmParameters);
+  R_Free(header_info->DatHeader);
+  R_Free(header_info->cdfName);
+  R_Free(header_info->ScanDate);
+}
+
+
+static int detect_cel_file_format(const char *filename){
+
+  if (isTextCelFile(filename)){
+    return CEL_FORMAT_TEXT;
+  } else if (isgzTextCelFile(filename)){
+    return CEL_FORMAT_GZTEXT;
+  } else if (isBinaryCelFile(filename)){
+    return CEL_FORMAT_BINARY;
+  } else if (isgzBinaryCelFile(filename)){
+    return CEL_FORMAT_GZBINARY;
+  } else if (isGenericCelFile(filename)){
+    return CEL_FORMAT_GENERIC;
+  } else if (isgzGenericCelFile(filename)){
+    return CEL_FORMAT_GZGENERIC;
+  }
+  return CEL_FORMAT_UNKNOWN;
+}
+
+
+/*************************************************************************
  **
- **  SEXP read_abatch(SEXP filenames, SEXP compress,  
- **                   SEXP rm_mask, SEXP rm_outliers, SEXP rm_extra, 
- **                   SEXP ref_cdfName)
+ ** static long format_detailed_header(const char *filename, int format, detailed_header_info *header_info)
  **
- ** SEXP filenames - an R character vector of filenames to read
- ** SEXP compress  - logical flag TRUE means files are *.gz
- ** SEXP rm_mask   - if true set MASKS  to NA
- ** SEXP rm_outliers - if true set OUTLIERS to NA
- ** SEXP rm_extra    - if true  overrides rm_mask and rm_outliers settings
- ** SEXP ref_cdfName - the reference CDF name to check each CEL file against 
- ** SEXP ref_dim     - cols/rows of reference chip
- ** SEXP verbose     - if verbose print out more information to the screen
+ ** read the detailed header of a file in the given format. Returns the
+ ** offset of the intensities when reading the header finds it (text 
+ ** files), otherwise -1.
  **
- ** RETURNS an intensity matrix with cel file intensities from
- ** each chip in columns
+ *************************************************************************/
+
+static long format_detailed_header(const char *filename, int format, detailed_header_info *header_info){
+
+  long data_offset = -1;
+
+  switch (format){
+  case CEL_FORMAT_TEXT:
+    get_detailed_header_info(filename,header_info,&data_offset);
+    break;
+  case CEL_FORMAT_GZTEXT:
+#if defined HAVE_ZLIB
+    gz_get_detailed_header_info(filename,header_info);
+#else
+    read_error("Compress option not supported on your platform\n");
+#endif
+    break;
+  case CEL_FORMAT_BINARY:
+    binary_get_detailed_header_info(filename,header_info);
+    break;
+  case CEL_FORMAT_GZBINARY:
+    gzbinary_get_detailed_header_info(filename,header_info);
+    break;
+  case CEL_FORMAT_GENERIC:
+    generic_get_detailed_header_info(filename,header_info);
+    break;
+  case CEL_FORMAT_GZGENERIC:
+    gzgeneric_get_detailed_header_info(filename,header_info);
+    break;
+  default:
+    not_a_cel_file_error(filename);
+  }
+  return data_offset;
+}
+
+
+/*************************************************************************
  **
- ** this function will read in all the cel files in a affybatch.
- ** this function will stop on possible errors with an error() call.
+ ** static double cel_data_offset(const char *filename, int format)
  **
- ** The intensity matrix will be allocated here. It will be given
- ** column names here. the column names that it will be given here are the 
- ** filenames.
+ ** the byte offset at which the intensities start, or -1 if this 
+ ** is not known for the format (it is for uncompressed binary and
+ ** command console files).
  **
  *************************************************************************/
 
-SEXP read_abatch(SEXP filenames, SEXP rm_mask, SEXP rm_outliers, SEXP rm_extra, SEXP ref_cdfName, SEXP ref_dim, SEXP verbose){
-  
-  int i; 
-  
-  int n_files;
-  int ref_dim_1, ref_dim_2;
+static double cel_data_offset(const char *filename, int format){
 
-  const char *cur_file_name;
-  const char *cdfName;
-  double *intensityMatrix;
+  binary_header *my_header;
+  double offset = -1.0;
+  int n_cells;
 
-  SEXP intensity,names,dimnames;
+  if (format == CEL_FORMAT_BINARY){
+    my_header = read_binary_header(filename,1);
+    offset = (double)ftell(my_header->infile);
+    fclose(my_header->infile);
+    delete_binary_header(my_header);
+  } else if (format == CEL_FORMAT_GENERIC){
+    offset = generic_intensities_offset(filename, &n_cells);
+  }
+  return offset;
+}
 
-  if (!isString(filenames))
-    error("read_abatch: filenames argument must be a character vector");
 
-  ref_dim_1 = INTEGER(ref_dim)[0];
-  ref_dim_2 = INTEGER(ref_dim)[1];
-  
-  n_files = GET_LENGTH(filenames);
-  
-  PROTECT(intensity = allocMatrix(REALSXP, ref_dim_1*ref_dim_2, n_files));
-  
-  cdfName = CHAR(STRING_ELT(ref_cdfName,0));
-  intensityMatrix = NUMERIC_POINTER(AS_NUMERIC(intensity));
+static char *copy_header_string(const char *x){
 
+  char *copy;
 
+  if (x == NULL){
+    return NULL;
+  }
+  copy = R_Calloc(strlen(x)+1, char);
+  strcpy(copy, x);
+  return copy;
+}
 
-  /* before we do any real reading check that all the files are of the same cdf type */
 
-  for (i =0; i < n_files; i++){
-    cur_file_name = CHAR(STRING_ELT(filenames, i));
-    if (isTextCelFile(cur_file_name)){
-      if (check_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-      }
-    } else if (isgzTextCelFile(cur_file_name)){
-#if defined HAVE_ZLIB
-      if (check_gzcel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-      }
-      
-#else
-       error("Compress option not supported on your platform\n");
-#endif
-     } else if (isBinaryCelFile(cur_file_name)){
-      
-       if (check_binary_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	 error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-       }
-     } else if (isgzBinaryCelFile(cur_file_name)){
-      
-       if (check_gzbinary_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	 error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-       }
-    } else if(isGenericCelFile(cur_file_name)){
-      if (check_generic_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	 error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-       }
-    } else if(isgzGenericCelFile(cur_file_name)){
-      if (check_gzgeneric_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	 error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-       }
-    } else {
+static void catalog_cel_file(const char *filename, int format, const detailed_header_info *header_info, long data_offset){
+  cel_catalog_store(filename, format, (data_offset >= 0) ? (double)data_offset : cel_data_offset(filename, format), header_info);
+}
+
+
+/*************************************************************************
+ **
+ ** static int catalog_matches_cdf(const cel_catalog_entry *entry, const char *ref_cdfName, int ref_dim_1, int ref_dim_2)
+ **
+ ** does the catalogued header pass the same test as the check_*cel_file
+ ** function for its format? For text files this is that a token of
+ ** the DatHeader starts with the CDF name, for others that the 
+ ** cdfName does.
+ **
+ *************************************************************************/
+
+static int catalog_matches_cdf(const cel_catalog_entry *entry, const char *ref_cdfName, int ref_dim_1, int ref_dim_2){
+
+  if (entry->header.cols != ref_dim_1 || entry->header.rows != ref_dim_2){
+    return 0;
+  }
+
+  if (entry->format == CEL_FORMAT_TEXT || entry->format == CEL_FORMAT_GZTEXT){
+    return entry->header.DatHeader != NULL && text_header_names_cdf(entry->header.DatHeader, ref_cdfName);
+  }
+  return entry->header.cdfName != NULL && strncasecmp(entry->header.cdfName, ref_cdfName, strlen(ref_cdfName)) == 0;
+}
+
+
+/*************************************************************************
+ **
+ ** static int check_cel_file_cdf(const char *cur_file_name, const char *cdfName, int ref_dim_1, int ref_dim_2,
+ **                               long *data_offset)
+ **
+ ** check that a CEL file is of the given CDF type and dimensions, 
+ ** calling read_error() if it is not. A file that passes is added to the
+ ** catalog (if there is one). Returns the CEL_FORMAT_ of the file and sets
+ ** data_offset to the offset of its intensities (-1 if not known), so
+ ** that reading the file need not look it up again. Finding the format
+ ** (in the catalog or from the file) is timed as the format phase and
+ ** the rest as the check phase.
+ **
+ *************************************************************************/
+
+static int check_cel_file_cdf(const char *cur_file_name, const char *cdfName, int ref_dim_1, int ref_dim_2, long *data_offset){
+
+  const cel_catalog_entry *entry;
+  int format, failed = 0;
+  detailed_header_info header_info;
+  read_timer timer;
+
+  read_timing_start(&timer, TIMING_FORMAT);
+  entry = cel_catalog_lookup(cur_file_name);
+  if (entry != NULL && catalog_matches_cdf(entry, cdfName, ref_dim_1, ref_dim_2)){
+    read_timing_stop(&timer, NULL);
+    *data_offset = (long)entry->data_offset;
+    return entry->format;
+  }
+  *data_offset = (entry != NULL) ? (long)entry->data_offset : -1;
+
+  format = (entry != NULL) ? entry->format : detect_cel_file_format(cur_file_name);
+  read_timing_stop(&timer, NULL);
+
+  read_timing_start(&timer, TIMING_CHECK);
+  switch (format){
+  case CEL_FORMAT_TEXT:
+    failed = check_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2, data_offset);
+    break;
+  case CEL_FORMAT_GZTEXT:
 #if defined HAVE_ZLIB
-       error("Is %s really a CEL file? tried reading as text, gzipped text, binary, gzipped binary, command console and gzipped command console formats..\n",cur_file_name);
+    failed = check_gzcel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2);
 #else
-       error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",cur_file_name);
+    read_error("Compress option not supported on your platform\n");
 #endif
-     }
+    break;
+  case CEL_FORMAT_BINARY:
+    failed = check_binary_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2);
+    break;
+  case CEL_FORMAT_GZBINARY:
+    failed = check_gzbinary_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2);
+    break;
+  case CEL_FORMAT_GENERIC:
+    failed = check_generic_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2);
+    break;
+  case CEL_FORMAT_GZGENERIC:
+    failed = check_gzgeneric_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2);
+    break;
+  default:
+    not_a_cel_file_error(cur_file_name);
+  }
+  if (failed){
+    read_error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
+  }
+
+  if (entry == NULL && cel_catalog_active()){
+    *data_offset = format_detailed_header(cur_file_name, format, &header_info);
+    catalog_cel_file(cur_file_name, format, &header_info, *data_offset);
+    free_detailed_header(&header_info);
+  }
+  read_timing_stop(&timer, NULL);
+  return format;
+}
+
+
+/*************************************************************************
+ **
+ ** static void apply_format_masks(const char *filename, int format, double *intensity, size_t chip_num,
+ **                                size_t rows, size_t cols, size_t chip_dim_rows, int rm_mask, int rm_outliers)
+ **
+ ** apply_masks() and friends for a file already known to be in the
+ ** given format.
+ **
+ *************************************************************************/
+
+static void apply_format_masks(const char *filename, int format, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows, int rm_mask, int rm_outliers){
+
+  switch (format){
+  case CEL_FORMAT_TEXT:
+    apply_masks(filename, intensity, chip_num, rows, cols, chip_dim_rows, rm_mask, rm_outliers);
+    break;
+  case CEL_FORMAT_GZTEXT:
+#if defined HAVE_ZLIB
+    gz_apply_masks(filename, intensity, chip_num, rows, cols, chip_dim_rows, rm_mask, rm_outliers);
+#else
+    read_error("Compress option not supported on your platform\n");
+#endif
+    break;
+  case CEL_FORMAT_BINARY:
+    binary_apply_masks(filename, intensity, chip_num, rows, cols, chip_dim_rows, rm_mask, rm_outliers);
+    break;
+  case CEL_FORMAT_GZBINARY:
+    gz_binary_apply_masks(filename, intensity, chip_num, rows, cols, chip_dim_rows, rm_mask, rm_outliers);
+    break;
+  case CEL_FORMAT_GENERIC:
+    generic_apply_masks(filename, intensity, chip_num, rows, cols, chip_dim_rows, rm_mask, rm_outliers);
+    break;
+  case CEL_FORMAT_GZGENERIC:
+    gzgeneric_apply_masks(filename, intensity, chip_num, rows, cols, chip_dim_rows, rm_mask, rm_outliers);
+    break;
+  default:
+    not_a_cel_file_error(filename);
+  }
+}
+
+
+/*************************************************************************
+ **
+ ** static int read_detailed_header(const char *cur_file_name, detailed_header_info *header_info)
+ **
+ ** work out the format of a CEL file and read its detailed header,
+ ** from the catalog if it is there, otherwise from the file (adding
+ ** it to the catalog). Returns 0 (with header_info untouched) if the
+ ** file is not in any supported format.
+ **
+ *************************************************************************/
+
+static int read_detailed_header(const char *cur_file_name, detailed_header_info *header_info){
+
+  const cel_catalog_entry *entry = cel_catalog_lookup(cur_file_name);
+  int format;
+  long data_offset;
+
+  if (entry != NULL){
+    *header_info = entry->header;
+    header_info->cdfName = copy_header_string(entry->header.cdfName);
+    header_info->DatHeader = copy_header_string(entry->header.DatHeader);
+    header_info->Algorithm = copy_header_string(entry->header.Algorithm);
+    header_info->AlgorithmParameters = copy_header_string(entry->header.AlgorithmParameters);
+    header_info->ScanDate = copy_header_string(entry->header.ScanDate);
+    return 1;
+  }
+
+  format = detect_cel_file_format(cur_file_name);
+  if (format == CEL_FORMAT_UNKNOWN){
+    return 0;
+  }
+  data_offset = format_detailed_header(cur_file_name, format, header_info);
+  if (cel_catalog_active()){
+    catalog_cel_file(cur_file_name, format, header_info, data_offset);
+  }
+  return 1;
+}
+
+
+/*************************************************************************
+ **
+ ** static const char **cel_file_names(SEXP filenames)
+ **
+ ** the file names of a character vector as C strings (R_alloc'ed), for
+ ** handing to read_prefetch_ahead() and to threads.
+ **
+ *************************************************************************/
+
+static const char **cel_file_names(SEXP filenames){
+
+  int i, n_files = GET_LENGTH(filenames);
+  const char **file_names = (const char **)R_alloc(n_files + 1, sizeof(char *));
+
+  for (i = 0; i < n_files; i++){
+    file_names[i] = CHAR(STRING_ELT(filenames, i));
+  }
+  return file_names;
+}
+
+
+/****************************************************************
+ ****************************************************************
+ **
+ ** This is the code that interfaces with R
+ **
+ ***************************************************************
+ ***************************************************************/
+
+/************************************************************************
+ **
+ **  SEXP read_abatch(SEXP filenames, SEXP compress,  
+ **                   SEXP rm_mask, SEXP rm_outliers, SEXP rm_extra, 
+ **                   SEXP ref_cdfName)
+ **
+ ** SEXP filenames - an R character vector of filenames to read
+ ** SEXP compress  - logical flag TRUE means files are *.gz
+ ** SEXP rm_mask   - if true set MASKS  to NA
+ ** SEXP rm_outliers - if true set OUTLIERS to NA
+ ** SEXP rm_extra    - if true  overrides rm_mask and rm_outliers settings
+ ** SEXP ref_cdfName - the reference CDF name to check each CEL file against 
+ ** SEXP ref_dim     - cols/rows of reference chip
+ ** SEXP verbose     - if verbose print out more information to the screen
+ **
+ ** RETURNS an intensity matrix with cel file intensities from
+ ** each chip in columns
+ **
+ ** this function will read in all the cel files in a affybatch.
+ ** this function will stop on possible errors with an read_error() call.
+ **
+ ** The intensity matrix will be allocated here. It will be given
+ ** column names here. the column names that it will be given here are the 
+ ** filenames.
+ **
+ *************************************************************************/
+
+SEXP read_abatch(SEXP filenames, SEXP rm_mask, SEXP rm_outliers, SEXP rm_extra, SEXP ref_cdfName, SEXP ref_dim, SEXP verbose){
+  
+  int i; 
+  
+  int n_files;
+  int ref_dim_1, ref_dim_2;
+
+  const char *cur_file_name;
+  const char **file_names;
+  const char *cdfName;
+  double *intensityMatrix;
+  int *formats;
+  long *data_offsets;
+  read_timer timer;
+
+  SEXP intensity,names,dimnames;
+
+  if (!isString(filenames))
+    error("read_abatch: filenames argument must be a character vector");
+
+  ref_dim_1 = INTEGER(ref_dim)[0];
+  ref_dim_2 = INTEGER(ref_dim)[1];
+  
+  n_files = GET_LENGTH(filenames);
+  
+  PROTECT(intensity = allocMatrix(REALSXP, ref_dim_1*ref_dim_2, n_files));
+  
+  cdfName = CHAR(STRING_ELT(ref_cdfName,0));
+  intensityMatrix = NUMERIC_POINTER(AS_NUMERIC(intensity));
+
+
+
+  /* before we do any real reading check that all the files are of the same cdf type,
+     keeping the format of each for the reading */
+
+  formats = (int *)R_alloc(n_files, sizeof(int));
+  data_offsets = (long *)R_alloc(n_files, sizeof(long));
+  cel_catalog_open();
+  for (i =0; i < n_files; i++){
+    formats[i] = check_cel_file_cdf(CHAR(STRING_ELT(filenames, i)), cdfName, ref_dim_1, ref_dim_2, &data_offsets[i]);
   }
+  cel_catalog_sync();
 
   /* 
      Now read in each of the cel files, one by one, filling out the columns of the intensity matrix.
   */
   
+  file_names = cel_file_names(filenames);
+  read_prefetch_begin();
   for (i=0; i < n_files; i++){ 
       cur_file_name = CHAR(STRING_ELT(filenames, i));
+      read_prefetch_ahead(file_names, n_files, i, 1, i == 0);
       if (asInteger(verbose)){
 	Rprintf("Reading in : %s\n",cur_file_name);
       }
-      if (isTextCelFile(cur_file_name)){
-	read_cel_file_intensities(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1);
-      } else if (isgzTextCelFile(cur_file_name)){
+      read_timing_start(&timer, TIMING_READ);
+      switch (formats[i]){
+      case CEL_FORMAT_TEXT:
+	read_cel_file_intensities(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,data_offsets[i]);
+	break;
+      case CEL_FORMAT_GZTEXT:
 #if defined HAVE_ZLIB
 	read_gzcel_file_intensities(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1);
 #else
 	error("Compress option not supported on your platform\n");
 #endif
-      } else if (isBinaryCelFile(cur_file_name)){
+	break;
+      case CEL_FORMAT_BINARY:
 	if (read_binarycel_file_intensities(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1)){
 	  error("It appears that the file %s is corrupted.\n",cur_file_name);
 	}
-      } else if (isgzBinaryCelFile(cur_file_name)){
+	break;
+      case CEL_FORMAT_GZBINARY:
 	if (gzread_binarycel_file_intensities(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1)){
 	  error("It appears that the file %s is corrupted.\n",cur_file_name);
 	}
-      } else if (isGenericCelFile(cur_file_name)){ 
+	break;
+      case CEL_FORMAT_GENERIC:
 	if (read_genericcel_file_intensities(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1)){
 	  error("It appears that the file %s is corrupted.\n",cur_file_name);
 	}
-      }  else if (isgzGenericCelFile(cur_file_name)){ 
+	break;
+      case CEL_FORMAT_GZGENERIC:
 	if (gzread_genericcel_file_intensities(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1)){
 	  error("It appears that the file %s is corrupted.\n",cur_file_name);
 	}
-      } else {
-#if defined HAVE_ZLIB
-       error("Is %s really a CEL file? tried reading as text, gzipped text, binary, gzipped binary, command console and gzipped command console formats.\n",cur_file_name);
-#else
-       error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",cur_file_name);
-#endif
-    }
-
+	break;
+      default:
+	not_a_cel_file_error(cur_file_name);
+      }
+      read_timing_stop(&timer, cur_file_name);
   }
   
 
@@ -4001,57 +4537,13 @@ SEXP read_abatch(SEXP filenames, SEXP rm_mask, SEXP rm_outliers, SEXP rm_extra,
   if (asInteger(rm_mask) || asInteger(rm_outliers) || asInteger(rm_extra)){
     for (i=0; i < n_files; i++){ 
       cur_file_name = CHAR(STRING_ELT(filenames,i));
-      if (isTextCelFile(cur_file_name)){
-	if (asInteger(rm_extra)){
-	  apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,1,1);
-	} else {
-	  apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,asInteger(rm_mask),asInteger(rm_outliers));
-	}
-      } else if (isgzTextCelFile(cur_file_name)){
-#if defined HAVE_ZLIB	
-	if (asInteger(rm_extra)){
-	  gz_apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,1,1);
-	} else {
-	  gz_apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,asInteger(rm_mask),asInteger(rm_outliers));
-	}
-#else
-	error("Compress option not supported on your platform\n");
-#endif
-      } else if (isBinaryCelFile(cur_file_name)){
-	if (asInteger(rm_extra)){
-	  binary_apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,1,1);
-	} else {
-	  binary_apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,asInteger(rm_mask),asInteger(rm_outliers));
-	}
-      } else if (isgzBinaryCelFile(cur_file_name)){
-	if (asInteger(rm_extra)){
-	  gz_binary_apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,1,1);
-	} else {
-	  gz_binary_apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,asInteger(rm_mask),asInteger(rm_outliers));
-	}
-      } else if (isGenericCelFile(cur_file_name)){
-	if (asInteger(rm_extra)){
-	  generic_apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,1,1);
-	} else {
-	  generic_apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,asInteger(rm_mask),asInteger(rm_outliers));
-	}
-      } else if (isgzGenericCelFile(cur_file_name)){
-	if (asInteger(rm_extra)){
-	  gzgeneric_apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,1,1);
-	} else {
-	  gzgeneric_apply_masks(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,asInteger(rm_mask),asInteger(rm_outliers));
-	}
+      read_timing_start(&timer, TIMING_MASK);
+      if (asInteger(rm_extra)){
+	apply_format_masks(cur_file_name, formats[i], intensityMatrix, i, ref_dim_1*ref_dim_2, n_files, ref_dim_1, 1, 1);
       } else {
-#if defined HAVE_ZLIB
-       error("Is %s really a CEL file? tried reading as text, gzipped text, binary and gzipped binary.\n",cur_file_name);
-#else
-       error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",cur_file_name);
-#endif
+	apply_format_masks(cur_file_name, formats[i], intensityMatrix, i, ref_dim_1*ref_dim_2, n_files, ref_dim_1, asInteger(rm_mask), asInteger(rm_outliers));
       }
-      
-
-
-
+      read_timing_stop(&timer, NULL);
     }
   }
   
@@ -4089,6 +4581,8 @@ SEXP ReadHeader(SEXP filename){
 
   const char *cur_file_name;
   const char *cdfName=0;
+  const cel_catalog_entry *entry;
+  detailed_header_info header_info;
 
   SEXP headInfo;
   SEXP name;
@@ -4104,28 +4598,48 @@ SEXP ReadHeader(SEXP filename){
 
   /* check for type text, gzipped text or binary then ReadHeader */
 
-  if (isTextCelFile(cur_file_name)){
-    cdfName = get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
-  } else if (isgzTextCelFile(cur_file_name)){
-#if defined HAVE_ZLIB
-    cdfName = gz_get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
-#else
-    error("Compress option not supported on your platform\n");
-#endif
-  } else if (isBinaryCelFile(cur_file_name)){
-    cdfName = binary_get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
-  } else if (isgzBinaryCelFile(cur_file_name)){
-    cdfName = gzbinary_get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
-  } else if (isGenericCelFile(cur_file_name)){
-    cdfName = generic_get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
-  } else if (isgzGenericCelFile(cur_file_name)){
-    cdfName = gzgeneric_get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
+  cel_catalog_open();
+  entry = cel_catalog_lookup(cur_file_name);
+  if (entry != NULL){
+    cdfName = copy_header_string(entry->header.cdfName);
+    ref_dim_1 = entry->header.cols;
+    ref_dim_2 = entry->header.rows;
+  } else if (cel_catalog_active()){
+    if (!read_detailed_header(cur_file_name, &header_info)){
+      not_a_cel_file_error(cur_file_name);
+    }
+    cdfName = copy_header_string(header_info.cdfName);
+    ref_dim_1 = header_info.cols;
+    ref_dim_2 = header_info.rows;
+    free_detailed_header(&header_info);
+    cel_catalog_sync();
   } else {
+    switch (detect_cel_file_format(cur_file_name)){
+    case CEL_FORMAT_TEXT:
+      cdfName = get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
+      break;
+    case CEL_FORMAT_GZTEXT:
 #if defined HAVE_ZLIB
-       error("Is %s really a CEL file? tried reading as text, gzipped text, binary, gzipped binary, command console and gzipped command console formats\n",cur_file_name);
+      cdfName = gz_get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
 #else
-       error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",cur_file_name);
+      error("Compress option not supported on your platform\n");
 #endif
+      break;
+    case CEL_FORMAT_BINARY:
+      cdfName = binary_get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
+      break;
+    case CEL_FORMAT_GZBINARY:
+      cdfName = gzbinary_get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
+      break;
+    case CEL_FORMAT_GENERIC:
+      cdfName = generic_get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
+      break;
+    case CEL_FORMAT_GZGENERIC:
+      cdfName = gzgeneric_get_header_info(cur_file_name, &ref_dim_1,&ref_dim_2);
+      break;
+    default:
+      not_a_cel_file_error(cur_file_name);
+    }
   }
   
   PROTECT(name = allocVector(STRSXP,1));
@@ -4174,30 +4688,11 @@ SEXP ReadHeaderDetailed(SEXP filename){
 
   cur_file_name = CHAR(STRING_ELT(filename,0));
  
-
-  if (isTextCelFile(cur_file_name)){
-    get_detailed_header_info(cur_file_name,&header_info);
-  } else if (isgzTextCelFile(cur_file_name)){
-#if defined HAVE_ZLIB
-    gz_get_detailed_header_info(cur_file_name,&header_info);
-#else
-    error("Compress option not supported on your platform\n");
-#endif
-  } else if (isBinaryCelFile(cur_file_name)){
-    binary_get_detailed_header_info(cur_file_name,&header_info);
-  } else if (isgzBinaryCelFile(cur_file_name)){
-    gzbinary_get_detailed_header_info(cur_file_name,&header_info);
-  }  else if (isGenericCelFile(cur_file_name)){
-    generic_get_detailed_header_info(cur_file_name,&header_info);
-  }  else if (isgzGenericCelFile(cur_file_name)){
-    gzgeneric_get_detailed_header_info(cur_file_name,&header_info);
-  } else {
-#if defined HAVE_ZLIB
-    error("Is %s really a CEL file? tried reading as text, gzipped text, binary, gzipped binary, command console and gzipped command console formats.\n",cur_file_name);
-#else
-    error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",cur_file_name);
-#endif
+  cel_catalog_open();
+  if (!read_detailed_header(cur_file_name,&header_info)){
+    not_a_cel_file_error(cur_file_name);
   }
+  cel_catalog_sync();
 
   /* Rprintf("%s\n",header_info.cdfName); */
 
@@ -4257,134 +4752,369 @@ SEXP ReadHeaderDetailed(SEXP filename){
   SET_VECTOR_ELT(HEADER,9,tmp_sexp);
   UNPROTECT(1);
   
-  R_Free(header_info.Algorithm);
-  R_Free(header_info.AlgorithmParameters);
-  R_Free(header_info.DatHeader);
-  R_Free(header_info.cdfName);
+  free_detailed_header(&header_info);
 
   UNPROTECT(1);
   return HEADER;
 }
 
-/* Refactored from read_probeintensities so both threaded and non-threaded versions can use the same code */
-void readfile(SEXP filenames, double *CurintensityMatrix, double *pmMatrix, double *mmMatrix,
-              int i, int ref_dim_1, int ref_dim_2, int n_files, int num_probes, SEXP cdfInfo, int which_flag, SEXP verbose){
-    const char *cur_file_name;
+
+
+/*************************************************************************
+ **
+ ** Reading the headers of many CEL files at once
+ **
+ ** ReadHeaderBatch reads the detailed header of each file in a 
+ ** character vector, spreading the files across threads (when 
+ ** available), and returns them as a data.frame with one row per
+ ** file. The threads only parse into detailed_header_info structures,
+ ** R objects are made afterwards.
+ **
+ *************************************************************************/
+
 #ifdef USE_PTHREADS
-    pthread_mutex_lock (&mutex_R);
-    cur_file_name = CHAR(STRING_ELT(filenames,i));
-    pthread_mutex_unlock (&mutex_R);
-#else
-    cur_file_name = CHAR(STRING_ELT(filenames,i));
-#endif
+struct header_thread_data{
+  const char **filenames;
+  detailed_header_info *headers;
+  int *found;
+  char **messages;
+  int n_files;
+  int t;
+  int num_threads;
+};
 
-    if (asInteger(verbose)){
-      Rprintf("Reading in : %s\n",cur_file_name);
+
+static void *read_header_group(void *data){
+  struct header_thread_data *args = (struct header_thread_data *) data;
+  read_error_trap trap;
+  int i;
+
+  /* a malformed header is reported back through messages, for error() on the main thread */
+  for (i = args->t; i < args->n_files; i+= args->num_threads){
+    read_error_catch(&trap);
+    if (setjmp(trap.env) == 0){
+      args->found[i] = read_detailed_header(args->filenames[i], &(args->headers[i]));
+    } else {
+      args->found[i] = -1;
+      args->messages[i] = read_error_message(&trap);
     }
-    if (isTextCelFile(cur_file_name)){
-      if(read_cel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1) !=0){
-	error("The CEL file %s was corrupted. Data not read.\n",cur_file_name);
-      }
-      storeIntensities(CurintensityMatrix,pmMatrix,mmMatrix,i,ref_dim_1*ref_dim_2, n_files,num_probes,cdfInfo,which_flag);
-    } else if (isgzTextCelFile(cur_file_name)){
-#if defined HAVE_ZLIB
-      if(read_gzcel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1)!=0){
-	error("The CEL file %s was corrupted. Data not read.\n",cur_file_name);
+  }
+  read_error_release();
+  return NULL;
+}
+#endif
+
+
+static SEXP header_string_column(detailed_header_info *headers, int n_files, size_t offset){
+  SEXP column;
+  int i;
+
+  PROTECT(column = allocVector(STRSXP, n_files));
+  for (i = 0; i < n_files; i++){
+    SET_STRING_ELT(column, i, mkChar(*(char **)((char *)&headers[i] + offset)));
+  }
+  UNPROTECT(1);
+  return column;
+}
+
+
+static SEXP header_int_column(detailed_header_info *headers, int n_files, size_t offset){
+  SEXP column;
+  int i;
+
+  PROTECT(column = allocVector(INTSXP, n_files));
+  for (i = 0; i < n_files; i++){
+    INTEGER(column)[i] = *(int *)((char *)&headers[i] + offset);
+  }
+  UNPROTECT(1);
+  return column;
+}
+
+
+/*************************************************************************
+ **
+ ** static int batch_num_threads(SEXP threads)
+ **
+ ** the number of threads asked for by the threads argument of the batch
+ ** readers. NULL uses the R_THREADS environment variable (1 if it is 
+ ** not set). Always 1 when built without pthreads.
+ **
+ *************************************************************************/
+
+static int batch_num_threads(SEXP threads){
+
+  int num_threads = 1;
+#ifdef USE_PTHREADS
+  char *nthreads;
+
+  if (isNull(threads)){
+    nthreads = getenv(THREADS_ENV_VAR);
+    if (nthreads != NULL){
+      num_threads = atoi(nthreads);
+      if (num_threads <= 0){
+	error("The number of threads (enviroment variable %s) must be a positive integer, but the specified value was %s", THREADS_ENV_VAR, nthreads);
       }
-      storeIntensities(CurintensityMatrix,pmMatrix,mmMatrix,i,ref_dim_1*ref_dim_2, n_files,num_probes,cdfInfo,which_flag);
-#else
-      error("Compress option not supported on your platform\n");
+    }
+  } else {
+    num_threads = asInteger(threads);
+    if (num_threads == NA_INTEGER || num_threads <= 0){
+      error("The number of threads must be a positive integer");
+    }
+  }
 #endif
-    } else if (isBinaryCelFile(cur_file_name)){
-       if(read_binarycel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1) !=0){
-	error("The CEL file %s was corrupted. Data not read.\n",cur_file_name);
-       }
-      storeIntensities(CurintensityMatrix,pmMatrix,mmMatrix,i,ref_dim_1*ref_dim_2, n_files,num_probes,cdfInfo,which_flag);
-    } else if (isgzBinaryCelFile(cur_file_name)){
-      if(gzread_binarycel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1) !=0){
-	error("The CEL file %s was corrupted. Data not read.\n",cur_file_name);
+  return num_threads;
+}
+
+
+/*************************************************************************
+ **
+ ** SEXP ReadHeaderBatch(SEXP filenames, SEXP threads)
+ **
+ ** SEXP filenames - character vector of CEL file names
+ ** SEXP threads - number of threads to use. NULL uses the R_THREADS
+ **                environment variable (1 if it is not set)
+ **
+ ** RETURNS a data.frame with columns cdfName, Cols, Rows, the grid 
+ ** corners (GridCornerULx, GridCornerULy, ... GridCornerLLy), 
+ ** DatHeader, Algorithm and ScanDate
+ **
+ *************************************************************************/
+
+SEXP ReadHeaderBatch(SEXP filenames, SEXP threads){
+
+  int i, n_files;
+  int bad_file = -1;
+  const char **file_names;
+  detailed_header_info *headers;
+  int *found;
+  SEXP frame, names, row_names;
+#ifdef USE_PTHREADS
+  int num_threads;
+  char **messages;
+  pthread_t *thread_ids;
+  pthread_attr_t attr;
+  struct header_thread_data *args;
+  size_t stacksize = PTHREAD_STACK_MIN + 0x40000;
+  int returnCode, t;
+#endif
+  const char *column_names[14] = {"cdfName", "Cols", "Rows", "GridCornerULx", "GridCornerULy", "GridCornerURx", "GridCornerURy",
+				  "GridCornerLRx", "GridCornerLRy", "GridCornerLLx", "GridCornerLLy", "DatHeader", "Algorithm", "ScanDate"};
+  size_t int_offsets[10] = {offsetof(detailed_header_info, cols), offsetof(detailed_header_info, rows),
+			    offsetof(detailed_header_info, GridCornerULx), offsetof(detailed_header_info, GridCornerULy),
+			    offsetof(detailed_header_info, GridCornerURx), offsetof(detailed_header_info, GridCornerURy),
+			    offsetof(detailed_header_info, GridCornerLRx), offsetof(detailed_header_info, GridCornerLRy),
+			    offsetof(detailed_header_info, GridCornerLLx), offsetof(detailed_header_info, GridCornerLLy)};
+
+  if (!isString(filenames))
+    error("ReadHeaderBatch: argument 'filenames' must be a character vector");
+
+#ifdef USE_PTHREADS
+  num_threads = batch_num_threads(threads);
+#endif
+
+  n_files = GET_LENGTH(filenames);
+  file_names = (const char **)R_alloc(n_files + 1, sizeof(char *));
+  for (i = 0; i < n_files; i++){
+    file_names[i] = CHAR(STRING_ELT(filenames, i));
+  }
+  cel_catalog_open();
+  headers = R_Calloc(n_files + 1, detailed_header_info);
+  found = R_Calloc(n_files + 1, int);
+
+#ifdef USE_PTHREADS
+  if (num_threads > n_files){
+    num_threads = n_files;
+  }
+  if (num_threads > 1){
+    thread_ids = (pthread_t *) R_Calloc(num_threads, pthread_t);
+    args = (struct header_thread_data *) R_Calloc(num_threads, struct header_thread_data);
+    messages = R_Calloc(n_files, char *);
+    
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    pthread_attr_setstacksize (&attr, stacksize);
+
+    for (t = 0; t < num_threads; t++){
+      args[t].filenames = file_names;
+      args[t].headers = headers;
+      args[t].found = found;
+      args[t].messages = messages;
+      args[t].n_files = n_files;
+      args[t].t = t;
+      args[t].num_threads = num_threads;
+      returnCode = pthread_create(&thread_ids[t], &attr, read_header_group, (void *) &(args[t]));
+      if (returnCode){
+	error("ERROR; return code from pthread_create() is %d\n", returnCode);
       }
-      storeIntensities(CurintensityMatrix,pmMatrix,mmMatrix,i,ref_dim_1*ref_dim_2, n_files,num_probes,cdfInfo,which_flag);
-    } else if (isGenericCelFile(cur_file_name)){
-      if(read_genericcel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1) !=0){
-	error("The CEL file %s was corrupted. Data not read.\n",cur_file_name);
+    }
+    for (t = 0; t < num_threads; t++){
+      returnCode = pthread_join(thread_ids[t], NULL);
+      if (returnCode){
+	error("ERROR; return code from pthread_join(thread #%d) is %d\n", t, returnCode);
       }
-      storeIntensities(CurintensityMatrix,pmMatrix,mmMatrix,i,ref_dim_1*ref_dim_2, n_files,num_probes,cdfInfo,which_flag);
-    }  else if (isgzGenericCelFile(cur_file_name)){
-      if(gzread_genericcel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1)!=0){
-	error("The CEL file %s was corrupted. Data not read.\n",cur_file_name);
+    }
+    pthread_attr_destroy(&attr);
+    R_Free(thread_ids);
+    R_Free(args);
+
+    if (read_error_first(messages, n_files, NULL) != NULL){
+      for (i = 0; i < n_files; i++){
+	if (found[i] == 1)
+	  free_detailed_header(&headers[i]);
       }
-      storeIntensities(CurintensityMatrix,pmMatrix,mmMatrix,i,ref_dim_1*ref_dim_2, n_files,num_probes,cdfInfo,which_flag);
-    } else {
-#if defined HAVE_ZLIB
-       error("Is %s really a CEL file? tried reading as text, gzipped text, binary, gzipped binary, command console and gzipped command console formats.\n",cur_file_name);
+      R_Free(headers);
+      R_Free(found);
+      cel_catalog_sync();
+    }
+    read_error_raise(messages, n_files);
+  } else {
+    for (i = 0; i < n_files; i++){
+      found[i] = read_detailed_header(file_names[i], &headers[i]);
+    }
+  }
 #else
-       error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",cur_file_name);
+  for (i = 0; i < n_files; i++){
+    found[i] = read_detailed_header(file_names[i], &headers[i]);
+  }
 #endif
+  cel_catalog_sync();
+
+  for (i = 0; i < n_files; i++){
+    if (!found[i]){
+      if (bad_file == -1)
+	bad_file = i;
+    }
+  }
+  if (bad_file != -1){
+    for (i = 0; i < n_files; i++){
+      if (found[i])
+	free_detailed_header(&headers[i]);
     }
+    R_Free(headers);
+    R_Free(found);
+    not_a_cel_file_error(file_names[bad_file]);
+  }
+
+  PROTECT(frame = allocVector(VECSXP, 14));
+  SET_VECTOR_ELT(frame, 0, header_string_column(headers, n_files, offsetof(detailed_header_info, cdfName)));
+  for (i = 0; i < 10; i++){
+    SET_VECTOR_ELT(frame, i + 1, header_int_column(headers, n_files, int_offsets[i]));
+  }
+  SET_VECTOR_ELT(frame, 11, header_string_column(headers, n_files, offsetof(detailed_header_info, DatHeader)));
+  SET_VECTOR_ELT(frame, 12, header_string_column(headers, n_files, offsetof(detailed_header_info, Algorithm)));
+  SET_VECTOR_ELT(frame, 13, header_string_column(headers, n_files, offsetof(detailed_header_info, ScanDate)));
+
+  for (i = 0; i < n_files; i++){
+    free_detailed_header(&headers[i]);
+  }
+  R_Free(headers);
+  R_Free(found);
+
+  PROTECT(names = allocVector(STRSXP, 14));
+  for (i = 0; i < 14; i++){
+    SET_STRING_ELT(names, i, mkChar(column_names[i]));
+  }
+  setAttrib(frame, R_NamesSymbol, names);
+
+  PROTECT(row_names = allocVector(INTSXP, 2));
+  INTEGER(row_names)[0] = NA_INTEGER;
+  INTEGER(row_names)[1] = -n_files;
+  setAttrib(frame, R_RowNamesSymbol, row_names);
+  setAttrib(frame, R_ClassSymbol, mkString("data.frame"));
+
+  UNPROTECT(3);
+  return frame;
 }
 
-void checkFileCDF(SEXP filenames, int i, const char *cdfName, int ref_dim_1, int ref_dim_2){
+/* Refactored from read_probeintensities so both threaded and non-threaded versions can use the same code */
+void readfile(SEXP filenames, double *CurintensityMatrix, double *pmMatrix, double *mmMatrix,
+              int i, int ref_dim_1, int ref_dim_2, int n_files, int num_probes, SEXP cdfInfo, int which_flag, SEXP verbose,
+              int format, long data_offset){
+    const char *cur_file_name;
+    int corrupted = 0;
+    read_timer timer;
 #ifdef USE_PTHREADS
     pthread_mutex_lock (&mutex_R);
-    const char *cur_file_name = CHAR(STRING_ELT(filenames,i));
-    pthread_mutex_unlock (&mutex_R);  
+    cur_file_name = CHAR(STRING_ELT(filenames,i));
+    pthread_mutex_unlock (&mutex_R);
 #else
-    const char *cur_file_name = CHAR(STRING_ELT(filenames,i));
+    cur_file_name = CHAR(STRING_ELT(filenames,i));
 #endif
-    if (isTextCelFile(cur_file_name)){
-      if (check_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-      }
-    } else if (isgzTextCelFile(cur_file_name)){
+
+    if (asInteger(verbose)){
+      Rprintf("Reading in : %s\n",cur_file_name);
+    }
+    read_timing_start(&timer, TIMING_READ);
+    switch (format){
+    case CEL_FORMAT_TEXT:
+      corrupted = read_cel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1,data_offset);
+      break;
+    case CEL_FORMAT_GZTEXT:
 #if defined HAVE_ZLIB
-      if (check_gzcel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-      }
-      
+      corrupted = read_gzcel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1);
 #else
-       error("Compress option not supported on your platform\n");
+      read_error("Compress option not supported on your platform\n");
 #endif
-    } else if (isBinaryCelFile(cur_file_name)){
-      
-      if (check_binary_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-       }
-    }  else if (isgzBinaryCelFile(cur_file_name)){
-      
-       if (check_gzbinary_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	 error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-       }
-    }  else if (isGenericCelFile(cur_file_name)){
-       if (check_generic_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	 error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-       }
-    }  else if (isgzGenericCelFile(cur_file_name)){
-       if (check_gzgeneric_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
-	 error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
-       }
-    } else {  
-#if defined HAVE_ZLIB
-       error("Is %s really a CEL file? tried reading as text, gzipped text, binary, gzipped binary, command console and gzipped command console formats.\n",cur_file_name);
+      break;
+    case CEL_FORMAT_BINARY:
+      corrupted = read_binarycel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1);
+      break;
+    case CEL_FORMAT_GZBINARY:
+      corrupted = gzread_binarycel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1);
+      break;
+    case CEL_FORMAT_GENERIC:
+      corrupted = read_genericcel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1);
+      break;
+    case CEL_FORMAT_GZGENERIC:
+      corrupted = gzread_genericcel_file_intensities(cur_file_name,CurintensityMatrix, 0, ref_dim_1*ref_dim_2, n_files,ref_dim_1);
+      break;
+    default:
+      not_a_cel_file_error(cur_file_name);
+    }
+    read_timing_stop(&timer, cur_file_name);
+    if (corrupted){
+      read_error("The CEL file %s was corrupted. Data not read.\n",cur_file_name);
+    }
+    read_timing_start(&timer, TIMING_STORE);
+    storeIntensities(CurintensityMatrix,pmMatrix,mmMatrix,i,ref_dim_1*ref_dim_2, n_files,num_probes,cdfInfo,which_flag);
+    read_timing_stop(&timer, NULL);
+}
+
+void checkFileCDF(SEXP filenames, int i, const char *cdfName, int ref_dim_1, int ref_dim_2, int *formats, long *data_offsets){
+#ifdef USE_PTHREADS
+    pthread_mutex_lock (&mutex_R);
+    const char *cur_file_name = CHAR(STRING_ELT(filenames,i));
+    pthread_mutex_unlock (&mutex_R);  
 #else
-       error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",cur_file_name);
+    const char *cur_file_name = CHAR(STRING_ELT(filenames,i));
 #endif
-     }
+    formats[i] = check_cel_file_cdf(cur_file_name, cdfName, ref_dim_1, ref_dim_2, &data_offsets[i]);
 }
 
 #ifdef USE_PTHREADS
-/* void * definitions are mandated by pthreads */
+/* void * definitions are mandated by pthreads. Each file is read under a
+   read_error() trap, its message being kept for the main thread to raise */
 void *readfile_group(void *data){
    int num;
    struct thread_data *args = (struct thread_data *) data;
-   
+   read_error_trap trap;
 
    args->CurintensityMatrix = R_Calloc(args->ref_dim_1*args->ref_dim_2, double);
 
+   read_timing_thread_begin();
    for(num = args->i; num < args->i+args->chunk_size; num++){
-     readfile(args->filenames, args->CurintensityMatrix, args->pmMatrix, args->mmMatrix, num,
-              args->ref_dim_1, args->ref_dim_2, args->n_files, args->num_probes, args->cdfInfo, args->which_flag, args->verbose);
+     read_prefetch_ahead(args->file_names, args->i+args->chunk_size, num, 1, num == args->i);
+     read_error_catch(&trap);
+     if (setjmp(trap.env) == 0){
+       readfile(args->filenames, args->CurintensityMatrix, args->pmMatrix, args->mmMatrix, num,
+		args->ref_dim_1, args->ref_dim_2, args->n_files, args->num_probes, args->cdfInfo, args->which_flag, args->verbose,
+		args->formats[num], args->data_offsets[num]);
+     } else {
+       args->messages[num] = read_error_message(&trap);
+     }
    }
+   read_error_release();
+   read_timing_thread_end();
    R_Free(args->CurintensityMatrix);
    return NULL;
 }
@@ -4392,12 +5122,34 @@ void *readfile_group(void *data){
 void *checkFileCDF_group(void *data){
   int num;
   struct thread_data *args = (struct thread_data *) data;
+  read_error_trap trap;
 
+  read_timing_thread_begin();
   for(num = args->i; num < args->i+args->chunk_size; num++){
-    checkFileCDF(args->filenames, num, args->refCdfName, args->ref_dim_1, args->ref_dim_2);
+    read_error_catch(&trap);
+    if (setjmp(trap.env) == 0){
+      checkFileCDF(args->filenames, num, args->refCdfName, args->ref_dim_1, args->ref_dim_2, args->formats, args->data_offsets);
+    } else {
+      args->messages[num] = read_error_message(&trap);
+    }
   }
+  read_error_release();
+  read_timing_thread_end();
   return NULL;
 }
+
+
+/* free the copies of the cdfInfo indices made for the threads */
+
+static void free_thread_indexes(void){
+  int i;
+
+  for(i = 0; i < n_probesets; i++){
+    R_Free(cur_indexes[i]);
+  }
+  R_Free(n_probes);
+  R_Free(cur_indexes);
+}
 #endif
 
 
@@ -4447,9 +5199,12 @@ SEXP read_probeintensities(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP
   const char *cur_file_name;
   const char *cdfName;
   double *pmMatrix=0, *mmMatrix=0;
+  int *formats;            /* of each file, found when checking it */
+  long *data_offsets;
 
 #ifndef USE_PTHREADS
   double *CurintensityMatrix;
+  const char **file_names;
 #endif
 
   SEXP PM_intensity= R_NilValue, MM_intensity= R_NilValue, Current_intensity, names, dimnames;
@@ -4457,6 +5212,8 @@ SEXP read_probeintensities(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP
   
 #ifdef USE_PTHREADS
   SEXP curIndices;
+  double *cur_index;
+  int j, total_probes;
 
   pthread_t *threads;
   char *nthreads;
@@ -4464,6 +5221,7 @@ SEXP read_probeintensities(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP
   double chunk_size_d, chunk_tot_d;
   pthread_attr_t attr;
   struct thread_data *args;
+  char **messages;
   void *status;
   size_t stacksize = PTHREAD_STACK_MIN + 0x40000;
 
@@ -4491,6 +5249,8 @@ SEXP read_probeintensities(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP
   PROTECT(Current_intensity = allocMatrix(REALSXP, ref_dim_1*ref_dim_2, 1));
  
   cdfName = CHAR(STRING_ELT(ref_cdfName,0));
+  formats = (int *)R_alloc(n_files, sizeof(int));
+  data_offsets = (long *)R_alloc(n_files, sizeof(long));
 
 #ifndef USE_PTHREADS
   CurintensityMatrix = NUMERIC_POINTER(AS_NUMERIC(Current_intensity));
@@ -4553,19 +5313,37 @@ SEXP read_probeintensities(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP
 
   n_probesets = GET_LENGTH(cdfInfo);
   n_probes = (int *) R_Calloc(n_probesets, int);
-  cur_indexes = (double **) R_Calloc(n_probesets, double *);
+  cur_indexes = (int **) R_Calloc(n_probesets, int *);
 
   /* Create the data structures required for each thread to independently
-     run the checkFileCDF and readfile functions */
+     run the checkFileCDF and readfile functions. Integer (INTSXP) 
+     location matrices are copied directly, REALSXP ones are converted.
+     The threads must not write past the output, so the probes are also
+     totalled to check the count used to size it */
+  total_probes = 0;
   for(i=0; i < n_probesets; i++){
     curIndices = VECTOR_ELT(cdfInfo,i);
     n_probes[i] = INTEGER(getAttrib(curIndices,R_DimSymbol))[0];
-    cur_indexes[i] = (double *) R_Calloc(n_probes[i]*2, double);
-    memcpy(cur_indexes[i], NUMERIC_POINTER(AS_NUMERIC(curIndices)), sizeof(double)*n_probes[i]*2);
+    total_probes+=n_probes[i];
+    cur_indexes[i] = (int *) R_Calloc(n_probes[i]*2, int);
+    if (TYPEOF(curIndices) == INTSXP){
+      memcpy(cur_indexes[i], INTEGER_POINTER(curIndices), sizeof(int)*n_probes[i]*2);
+    } else {
+      cur_index = NUMERIC_POINTER(AS_NUMERIC(curIndices));
+      for (j=0; j < n_probes[i]*2; j++){
+	cur_indexes[i][j] = cdf_location_index(cur_index[j]);
+      }
+    }
+  }
+  if (total_probes != num_probes){
+    free_thread_indexes();
+    R_Free(threads);
+    error("cdfInfo has %d probes, not the %d expected.", total_probes, num_probes);
   }
   args = (struct thread_data *) R_Calloc((n_files < num_threads ? n_files : num_threads), struct thread_data);
 
   args[0].filenames = filenames;
+  args[0].file_names = cel_file_names(filenames);
   args[0].pmMatrix = pmMatrix;
   args[0].mmMatrix = mmMatrix;
   args[0].ref_dim_1 = ref_dim_1;
@@ -4576,6 +5354,9 @@ SEXP read_probeintensities(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP
   args[0].refCdfName = cdfName;
   args[0].which_flag = which_flag;
   args[0].verbose = verbose;
+  args[0].formats = formats;
+  args[0].data_offsets = data_offsets;
+  args[0].messages = messages = R_Calloc(n_files, char *);
 
   pthread_mutex_init(&mutex_R, NULL);
   t = 0; /* t = number of actual threads doing work */
@@ -4601,6 +5382,7 @@ SEXP read_probeintensities(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP
 
   /* First check headers of cel files */
   /* before we do any real reading check that all the files are of the same cdf type */
+  cel_catalog_open();
   for (i =0; i < t; i++){
      returnCode = pthread_create(&threads[i], &attr, checkFileCDF_group, (void *) &(args[i]));
      if (returnCode){
@@ -4615,15 +5397,27 @@ SEXP read_probeintensities(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP
 	       i, returnCode, *((int *) status));
       }
   }
+  if (read_error_first(messages, n_files, NULL) != NULL){
+    cel_catalog_sync();
+    R_Free(args);
+    R_Free(threads);
+    pthread_attr_destroy(&attr);
+    pthread_mutex_destroy(&mutex_R);
+    free_thread_indexes();
+    read_error_raise(messages, n_files);
+  }
 #else
   /* First check headers of cel files */
   /* before we do any real reading check that all the files are of the same cdf type */
+  cel_catalog_open();
   for (i =0; i < n_files; i++){
-    checkFileCDF(filenames, i, cdfName, ref_dim_1, ref_dim_2);
+    checkFileCDF(filenames, i, cdfName, ref_dim_1, ref_dim_2, formats, data_offsets);
   }
 #endif
+  cel_catalog_sync();
   
   /* now lets read them in and store them in the PM and MM matrices */
+  read_prefetch_begin();
 
 #ifdef USE_PTHREADS
   for(int i = 0; i < t; i++){
@@ -4646,15 +5440,14 @@ SEXP read_probeintensities(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP
   pthread_mutex_destroy(&mutex_R);
 
   /* clear the old index data */
-  R_Free(n_probes);
-  for(i = 0; i < n_probesets; i++){
-    R_Free(cur_indexes[i]);
-  }
-  R_Free(cur_indexes);
+  free_thread_indexes();
+  read_error_raise(messages, n_files);
 #else
+  file_names = cel_file_names(filenames);
   for (i=0; i < n_files; i++){ 
+    read_prefetch_ahead(file_names, n_files, i, 1, i == 0);
     readfile(filenames, CurintensityMatrix, pmMatrix, mmMatrix, i, ref_dim_1, ref_dim_2, 
-	     n_files, num_probes, cdfInfo, which_flag, verbose);
+	     n_files, num_probes, cdfInfo, which_flag, verbose, formats[i], data_offsets[i]);
   }
 #endif
 
@@ -4738,8 +5531,10 @@ SEXP read_abatch_stddev(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP rm
   int ref_dim_1, ref_dim_2;
 
   const char *cur_file_name;
+  const char **file_names;
   const char *cdfName;
   double *intensityMatrix;
+  long *data_offsets;      /* of the [INTENSITY] section of text files, found when checking them */
 
   SEXP intensity,names,dimnames;
 
@@ -4760,10 +5555,12 @@ SEXP read_abatch_stddev(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP rm
 
   /* before we do any real reading check that all the files are of the same cdf type */
 
+  data_offsets = (long *)R_alloc(n_files, sizeof(long));
   for (i =0; i < n_files; i++){
     cur_file_name = CHAR(STRING_ELT(filenames, i));
+    data_offsets[i] = -1;
     if (isTextCelFile(cur_file_name)){
-      if (check_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
+      if (check_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2, &data_offsets[i])){
 	error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
       }
     } else if (isgzTextCelFile(cur_file_name)){
@@ -4806,13 +5603,16 @@ SEXP read_abatch_stddev(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP rm
      Now read in each of the cel files, one by one, filling out the columns of the intensity matrix.
   */
   
+  file_names = cel_file_names(filenames);
+  read_prefetch_begin();
   for (i=0; i < n_files; i++){ 
       cur_file_name = CHAR(STRING_ELT(filenames, i));
+      read_prefetch_ahead(file_names, n_files, i, 1, i == 0);
       if (asInteger(verbose)){
 	Rprintf("Reading in : %s\n",cur_file_name);
       }
       if (isTextCelFile(cur_file_name)){
-	read_cel_file_stddev(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1);
+	read_cel_file_stddev(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,data_offsets[i]);
       } else if (isgzTextCelFile(cur_file_name)){
 #if defined HAVE_ZLIB
       read_gzcel_file_stddev(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1);
@@ -4965,8 +5765,10 @@ SEXP read_abatch_npixels(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP r
   int ref_dim_1, ref_dim_2;
 
   const char *cur_file_name;
+  const char **file_names;
   const char *cdfName;
   double *intensityMatrix;
+  long *data_offsets;      /* of the [INTENSITY] section of text files, found when checking them */
 
   SEXP intensity,names,dimnames;
 
@@ -4987,10 +5789,12 @@ SEXP read_abatch_npixels(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP r
 
   /* before we do any real reading check that all the files are of the same cdf type */
 
+  data_offsets = (long *)R_alloc(n_files, sizeof(long));
   for (i =0; i < n_files; i++){
     cur_file_name = CHAR(STRING_ELT(filenames, i));
+    data_offsets[i] = -1;
     if (isTextCelFile(cur_file_name)){
-      if (check_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2)){
+      if (check_cel_file(cur_file_name,cdfName, ref_dim_1, ref_dim_2, &data_offsets[i])){
 	error("File %s does not seem to have correct dimension or is not of %s chip type.", cur_file_name, cdfName);
       }
     } else if (isgzTextCelFile(cur_file_name)){
@@ -5033,13 +5837,16 @@ SEXP read_abatch_npixels(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP r
      Now read in each of the cel files, one by one, filling out the columns of the intensity matrix.
   */
   
+  file_names = cel_file_names(filenames);
+  read_prefetch_begin();
   for (i=0; i < n_files; i++){ 
       cur_file_name = CHAR(STRING_ELT(filenames, i));
+      read_prefetch_ahead(file_names, n_files, i, 1, i == 0);
       if (asInteger(verbose)){
 	Rprintf("Reading in : %s\n",cur_file_name);
       }
       if (isTextCelFile(cur_file_name)){
-	read_cel_file_npixels(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1);
+	read_cel_file_npixels(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1,data_offsets[i]);
       } else if (isgzTextCelFile(cur_file_name)){
 #if defined HAVE_ZLIB
       read_gzcel_file_npixels(cur_file_name,intensityMatrix, i, ref_dim_1*ref_dim_2, n_files,ref_dim_1);
@@ -5165,145 +5972,494 @@ SEXP read_abatch_npixels(SEXP filenames,  SEXP rm_mask, SEXP rm_outliers, SEXP r
 
 /************************************************************************
  **
- ** CEL *read_cel_file(const char *filename)
- **  
- ** Reads the contents of the CEL file into a "CEL" structure.
- ** Currently slightly inefficient (should be reimplemented more
- ** cleanly later)
+ ** static void allocate_cel(CEL *my_CEL, int read_intensities_only)
  **
+ ** allocates space for the intensities, stddev, npixels, masks and
+ ** outliers of my_CEL once its header and number of channels are known.
+ ** stddev and npixels are left NULL if read_intensities_only.
  **
  ************************************************************************/
 
-CEL *read_cel_file(const char *filename, int read_intensities_only){
-  
-  CEL *my_CEL;
-  int i,k;
-
-  my_CEL = R_Calloc(1, CEL);
-  my_CEL->multichannel = 0;
-  my_CEL->channelnames = NULL;
-  
-  /** First get the header information **/
+static void allocate_cel(CEL *my_CEL, int read_intensities_only){
 
+  int i;
+  int n_channels = (my_CEL->multichannel ? my_CEL->multichannel : 1);
+  size_t n_cells = (size_t)(my_CEL->header.cols)*(my_CEL->header.rows);
 
-  if (isTextCelFile(filename)){
-    get_detailed_header_info(filename,&my_CEL->header);
-  } else if (isgzTextCelFile(filename)){
-#if defined HAVE_ZLIB
-    gz_get_detailed_header_info(filename,&my_CEL->header);
-#else
-    error("Compress option not supported on your platform\n");
-#endif
-  } else if (isBinaryCelFile(filename)){
-    binary_get_detailed_header_info(filename,&my_CEL->header);
-  } else if (isgzBinaryCelFile(filename)){
-    gzbinary_get_detailed_header_info(filename,&my_CEL->header);
-  } else if (isGenericCelFile(filename)){
-    generic_get_detailed_header_info(filename,&my_CEL->header);
-  }  else if (isgzGenericCelFile(filename)){
-    gzgeneric_get_detailed_header_info(filename,&my_CEL->header);
-  } else if (isGenericMultiChannelCelFile(filename)){
-    generic_get_detailed_header_info(filename,&my_CEL->header);
-    my_CEL->multichannel = multichannel_determine_number_channels(filename);
-    my_CEL->channelnames = R_Calloc(my_CEL->multichannel,char*);
-    for (k = 0; k <  my_CEL->multichannel; k++){
-      my_CEL->channelnames[k] =multichannel_determine_channel_name(filename, k);
-    }
-  }  else if (isgzGenericMultiChannelCelFile(filename)){
-    gzgeneric_get_detailed_header_info(filename,&my_CEL->header);
-    my_CEL->multichannel = gzmultichannel_determine_number_channels(filename);
-    my_CEL->channelnames = R_Calloc(my_CEL->multichannel,char*);
-    for (k = 0; k <  my_CEL->multichannel; k++){
-      my_CEL->channelnames[k] =gzmultichannel_determine_channel_name(filename, k);
+  my_CEL->intensities = R_Calloc(n_channels,double *);
+  for (i=0; i < n_channels; i++){
+    my_CEL->intensities[i] = R_Calloc(n_cells,double);
+  }
+  if (!read_intensities_only){
+    my_CEL->stddev = R_Calloc(n_channels,double *);
+    my_CEL->npixels = R_Calloc(n_channels,double *);
+    for (i=0; i < n_channels; i++){
+      my_CEL->stddev[i] = R_Calloc(n_cells,double);
+      my_CEL->npixels[i] = R_Calloc(n_cells,double);
     }
   } else {
-#if defined HAVE_ZLIB
-    error("Is %s really a CEL file? tried reading as text, gzipped text, binary and gzipped binary\n",filename);
-#else
-    error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",filename);
-#endif
+    my_CEL->stddev = NULL;
+    my_CEL->npixels = NULL;
   }
 
+  my_CEL->nmasks = R_Calloc(n_channels, int);
+  my_CEL->noutliers = R_Calloc(n_channels, int);
+  my_CEL->masks_x = R_Calloc(n_channels, short *);
+  my_CEL->masks_y = R_Calloc(n_channels, short *);
+  my_CEL->outliers_x = R_Calloc(n_channels, short *);
+  my_CEL->outliers_y = R_Calloc(n_channels, short *);
+}
 
-  /*** Now lets allocate the space for intensities, stdev, npixels ****/
-  if (!my_CEL->multichannel){
-    my_CEL->intensities = R_Calloc(1,double *);
-    my_CEL->intensities[0] = R_Calloc((my_CEL->header.cols)*(my_CEL->header.rows),double);
-    if (!read_intensities_only){
-      my_CEL->stddev = R_Calloc(1,double *);
-      my_CEL->npixels = R_Calloc(1,double *);
-      my_CEL->stddev[0] = R_Calloc((my_CEL->header.cols)*(my_CEL->header.rows),double);
-      my_CEL->npixels[0] = R_Calloc((my_CEL->header.cols)*(my_CEL->header.rows),double);
-    } else {
-      my_CEL->stddev = NULL;
-      my_CEL->npixels = NULL;
-    }
-  } else {
-    my_CEL->intensities = R_Calloc(my_CEL->multichannel,double *);
-    for (i=0; i < my_CEL->multichannel; i++){
-      my_CEL->intensities[i] = R_Calloc((my_CEL->header.cols)*(my_CEL->header.rows),double);
-    }
-    if (!read_intensities_only){
-      my_CEL->stddev = R_Calloc(my_CEL->multichannel,double *);
-      my_CEL->npixels = R_Calloc(my_CEL->multichannel,double *);
-      for (i=0; i < my_CEL->multichannel; i++){
-	my_CEL->stddev[i] = R_Calloc((my_CEL->header.cols)*(my_CEL->header.rows),double);
-	my_CEL->npixels[i] = R_Calloc((my_CEL->header.cols)*(my_CEL->header.rows),double);
-      }
-    } else {
-      my_CEL->stddev = NULL;
-      my_CEL->npixels = NULL;
-    }
 
+/************************************************************************
+ **
+ ** void delete_cel(CEL *my_CEL)
+ **
+ ** frees a CEL structure made by read_cel_file()
+ **
+ ************************************************************************/
+
+void delete_cel(CEL *my_CEL){
 
-  }
+  int k;
+  int n_channels = (my_CEL->multichannel ? my_CEL->multichannel : 1);
 
+  free_detailed_header(&my_CEL->header);
 
-  if (isTextCelFile(filename)){
-    read_cel_file_intensities(filename,my_CEL->intensities[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);	
-    if (!read_intensities_only){
-      read_cel_file_stddev(filename,my_CEL->stddev[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
-      read_cel_file_npixels(filename,my_CEL->npixels[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
-    }
-  }  else if (isgzTextCelFile(filename)){
-#if defined HAVE_ZLIB
-    read_gzcel_file_intensities(filename,my_CEL->intensities[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);  
-    if (!read_intensities_only){	
-      read_gzcel_file_stddev(filename,my_CEL->stddev[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
-      read_gzcel_file_npixels(filename,my_CEL->npixels[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
-    }
-#else
-    error("Compress option not supported on your platform\n");
-#endif
-  } else if (isBinaryCelFile(filename)){
-    if (read_binarycel_file_intensities(filename,my_CEL->intensities[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols)){
-      error("It appears that the file %s is corrupted.",filename);
+  for (k =0; k < n_channels; k++){
+    R_Free(my_CEL->intensities[k]);
+    if (my_CEL->stddev != NULL){
+      R_Free(my_CEL->stddev[k]);
+      R_Free(my_CEL->npixels[k]);
     }
-    if (!read_intensities_only){
-      read_binarycel_file_stddev(filename,my_CEL->stddev[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
-      read_binarycel_file_npixels(filename,my_CEL->npixels[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
+    R_Free(my_CEL->masks_x[k]);
+    R_Free(my_CEL->masks_y[k]);
+    R_Free(my_CEL->outliers_x[k]);
+    R_Free(my_CEL->outliers_y[k]);
+  }
+  R_Free(my_CEL->intensities);
+  if (my_CEL->stddev != NULL){
+    R_Free(my_CEL->stddev);
+    R_Free(my_CEL->npixels);
+  }
+  R_Free(my_CEL->nmasks);
+  R_Free(my_CEL->noutliers);
+  R_Free(my_CEL->masks_x);
+  R_Free(my_CEL->masks_y);
+  R_Free(my_CEL->outliers_x);
+  R_Free(my_CEL->outliers_y);
+
+  if (my_CEL->channelnames != NULL){
+    for (k =0; k < my_CEL->multichannel; k++){
+      R_Free(my_CEL->channelnames[k]);
     }
-  } else if (isgzBinaryCelFile(filename)){
+    R_Free(my_CEL->channelnames);
+  }
+  
+  R_Free(my_CEL);
+}
+
+
+/************************************************************************
+ **
+ ** static int parse_text_cel_line(char *buffer, int n_values, int *cur_x, int *cur_y, double *values)
+ **
+ ** parses a line of the [INTENSITY] section of a text CEL file: X, Y 
+ ** then n_values of MEAN, STDV and NPIXELS.
+ **
+ ** returns 1 if all the fields were found, 0 otherwise
+ **
+ ************************************************************************/
+
+static int parse_text_cel_line(char *buffer, int n_values, int *cur_x, int *cur_y, double *values){
+
+  char *start = buffer, *end;
+  int k;
+
+  *cur_x = (int)strtol(start, &end, 10);
+  if (end == start)
+    return 0;
+  start = end;
+  *cur_y = (int)strtol(start, &end, 10);
+  if (end == start)
+    return 0;
+  for (k = 0; k < n_values; k++){
+    start = end;
+    values[k] = strtod(start, &end);
+    if (end == start)
+      return 0;
+  }
+  return 1;
+}
+
+
+/************************************************************************
+ **
+ ** Where the single pass readers below put the values they read. 
+ ** stddev and npixels (or npixels_int) are NULL when not wanted, 
+ ** npixels_int is used when an integer rather than double destination
+ ** is wanted for npixels. The masks and outliers are allocated by
+ ** the readers.
+ **
+ ************************************************************************/
+
+typedef struct{
+  double *intensities;
+  double *stddev;
+  double *npixels;
+  int *npixels_int;
+  int nmasks;
+  int noutliers;
+  short *masks_x;
+  short *masks_y;
+  short *outliers_x;
+  short *outliers_y;
+} cel_contents;
+
+
+static void store_npixels(cel_contents *contents, size_t cur_index, double npixels){
+  if (contents->npixels != NULL){
+    contents->npixels[cur_index] = npixels;
+  } else if (contents->npixels_int != NULL){
+    contents->npixels_int[cur_index] = (int)npixels;
+  }
+}
+
+
+/************************************************************************
+ **
+ ** static FILE *open_text_cel_contents(const char *filename, detailed_header_info *header_info, long *intensity_offset)
+ **
+ ** opens a text CEL file and reads its header into header_info. The 
+ ** file is left open for read_text_cel_contents(), intensity_offset
+ ** is where the [INTENSITY] section starts.
+ **
+ ************************************************************************/
+
+static FILE *open_text_cel_contents(const char *filename, detailed_header_info *header_info, long *intensity_offset){
+
+  FILE *currentFile; 
+  text_cel_header header;
+
+  currentFile = open_cel_file(filename);
+  read_text_cel_header(currentFile, filename, &header);
+  text_detailed_header_info(&header, filename, header_info);
+  *intensity_offset = header.intensity_offset;
+  delete_text_cel_header(&header);
+
+  return currentFile;
+}
+
+
+/************************************************************************
+ **
+ ** static int read_text_cel_contents(FILE *currentFile, const char *filename, long intensity_offset, 
+ **                                   int cols, int rows, cel_contents *contents)
+ **
+ ** reads MEAN (and STDV, NPIXELS) from each line of the [INTENSITY] 
+ ** section of a text CEL file opened by open_text_cel_contents(), 
+ ** then the [MASKS] and [OUTLIERS] sections, in one pass.
+ **
+ ** returns 0 if successful, 1 if a cell is out of range (the file is 
+ ** corrupted)
+ **
+ ************************************************************************/
+
+static int read_text_cel_contents(FILE *currentFile, const char *filename, long intensity_offset, int cols, int rows, cel_contents *contents){
+
+  char buffer[BUF_SIZE];
+  size_t i, n_cells, cur_index;
+  int cur_x, cur_y;
+  double values[3];
+  int n_values = ((contents->stddev != NULL || contents->npixels != NULL || contents->npixels_int != NULL) ? 3 : 1);
+
+  position_at_intensities(currentFile, intensity_offset, buffer);
+  findStartsWith(currentFile,"CellHeader=",buffer);  
+
+  n_cells = (size_t)cols*rows;
+  for (i=0; i < n_cells; i++){
+    ReadFileLine(buffer, BUF_SIZE, currentFile);
+    if (strlen(buffer) <=2){
+      Rprintf("Warning: found an empty line where not expected in %s.\nThis means that there is a cel intensity missing from the cel file.\nSucessfully read to cel intensity %d of %d expected\n", filename, (int)i-1, (int)n_cells);
+      break;
+    }
+    if (!parse_text_cel_line(buffer, n_values, &cur_x, &cur_y, values)){
+      Rprintf("Warning: found an incomplete line where not expected in %s.\nThe CEL file may be truncated. \nSucessfully read to cel intensity %d of %d expected\n", filename, (int)i-1, (int)n_cells);
+      break;
+    }
+    if (cur_x < 0 || cur_x >= cols || cur_y < 0 || cur_y >= rows){
+      return 1;
+    }
+    cur_index = cur_x + (size_t)cols*cur_y;
+    contents->intensities[cur_index] = values[0];
+    if (contents->stddev != NULL){
+      contents->stddev[cur_index] = values[1];
+    }
+    store_npixels(contents, cur_index, values[2]);
+  }
+
+  read_text_cel_locations(currentFile, "[MASKS]", buffer, &contents->nmasks, &contents->masks_x, &contents->masks_y);
+  read_text_cel_locations(currentFile, "[OUTLIERS]", buffer, &contents->noutliers, &contents->outliers_x, &contents->outliers_y);
+
+  return 0;
+}
+
+
+/************************************************************************
+ **
+ ** static int read_binary_cel_contents(binary_header *my_header, cel_contents *contents)
+ **
+ ** reads each cell record, then the masks and outliers, of a binary 
+ ** CEL file whose header was read by read_binary_header(filename,1).
+ **
+ ** returns 0 if successful, 1 if the file is corrupted
+ **
+ ************************************************************************/
+
+static int read_binary_cel_contents(binary_header *my_header, cel_contents *contents){
+
+  celintens_record cur_intensity;
+  size_t i, n_cells;
+  int fread_err;
+
+  n_cells = (size_t)my_header->n_cells;
+  for (i = 0; i < n_cells; i++){
+    fread_err = fread_float32(&(cur_intensity.cur_intens),1,my_header->infile);
+    fread_err+= fread_float32(&(cur_intensity.cur_sd),1,my_header->infile);
+    fread_err+= fread_int16(&(cur_intensity.npixels),1,my_header->infile);
+    if (fread_err < 3 || cur_intensity.cur_intens < 0 || cur_intensity.cur_intens > 65536 || isnan(cur_intensity.cur_intens)){
+      return 1;
+    }
+    contents->intensities[i] = (double)cur_intensity.cur_intens;
+    if (contents->stddev != NULL){
+      contents->stddev[i] = (double)cur_intensity.cur_sd;
+    }
+    store_npixels(contents, i, (double)cur_intensity.npixels);
+  }
+
+  contents->nmasks = my_header->n_masks;
+  binary_read_locations(my_header->infile, my_header->n_masks, &contents->masks_x, &contents->masks_y);
+  contents->noutliers = my_header->n_outliers;
+  binary_read_locations(my_header->infile, my_header->n_outliers, &contents->outliers_x, &contents->outliers_y);
+
+  return 0;
+}
+
+
+/************************************************************************
+ **
+ ** static void cel_contents_of(CEL *my_CEL, cel_contents *contents)
+ ** static void cel_contents_to_cel(CEL *my_CEL, cel_contents *contents)
+ **
+ ** cel_contents_of() points contents at the (single channel) arrays 
+ ** of my_CEL, after reading cel_contents_to_cel() moves the masks and
+ ** outliers that were read into my_CEL.
+ **
+ ************************************************************************/
+
+static void cel_contents_of(CEL *my_CEL, cel_contents *contents){
+  memset(contents, 0, sizeof(cel_contents));
+  contents->intensities = my_CEL->intensities[0];
+  if (my_CEL->stddev != NULL){
+    contents->stddev = my_CEL->stddev[0];
+    contents->npixels = my_CEL->npixels[0];
+  }
+}
+
+
+static void cel_contents_to_cel(CEL *my_CEL, cel_contents *contents){
+  my_CEL->nmasks[0] = contents->nmasks;
+  my_CEL->masks_x[0] = contents->masks_x;
+  my_CEL->masks_y[0] = contents->masks_y;
+  my_CEL->noutliers[0] = contents->noutliers;
+  my_CEL->outliers_x[0] = contents->outliers_x;
+  my_CEL->outliers_y[0] = contents->outliers_y;
+}
+
+
+/************************************************************************
+ **
+ ** static CEL *read_text_cel_file(const char *filename, int read_intensities_only)
+ **
+ ** Reads a text CEL file into a "CEL" structure, opening it only once
+ **
+ ************************************************************************/
+
+static CEL *read_text_cel_file(const char *filename, int read_intensities_only){
+
+  CEL *my_CEL;
+  FILE *currentFile; 
+  long intensity_offset;
+  cel_contents contents;
+  int corrupted;
+
+  my_CEL = R_Calloc(1, CEL);
+  my_CEL->multichannel = 0;
+  my_CEL->channelnames = NULL;
+
+  currentFile = open_text_cel_contents(filename, &my_CEL->header, &intensity_offset);
+  allocate_cel(my_CEL, read_intensities_only);
+  cel_contents_of(my_CEL, &contents);
+  corrupted = read_text_cel_contents(currentFile, filename, intensity_offset, my_CEL->header.cols, my_CEL->header.rows, &contents);
+  fclose(currentFile);
+  cel_contents_to_cel(my_CEL, &contents);
+  if (corrupted){
+    delete_cel(my_CEL);
+    read_error("It appears that the file %s is corrupted.",filename);
+  }
+  return my_CEL;
+}
+
+
+/************************************************************************
+ **
+ ** static CEL *read_binary_cel_file(const char *filename, int read_intensities_only)
+ **
+ ** Reads a binary (version 4) CEL file into a "CEL" structure, opening
+ ** it only once
+ **
+ ************************************************************************/
+
+static CEL *read_binary_cel_file(const char *filename, int read_intensities_only){
+
+  CEL *my_CEL;
+  binary_header *my_header;
+  cel_contents contents;
+  int corrupted;
+
+  my_header = read_binary_header(filename,1);
+
+  my_CEL = R_Calloc(1, CEL);
+  my_CEL->multichannel = 0;
+  my_CEL->channelnames = NULL;
+  binary_detailed_header_info(my_header, filename, &my_CEL->header);
+  allocate_cel(my_CEL, read_intensities_only);
+  cel_contents_of(my_CEL, &contents);
+  corrupted = read_binary_cel_contents(my_header, &contents);
+  fclose(my_header->infile);
+  delete_binary_header(my_header);
+  cel_contents_to_cel(my_CEL, &contents);
+  if (corrupted){
+    delete_cel(my_CEL);
+    read_error("It appears that the file %s is corrupted.",filename);
+  }
+  return my_CEL;
+}
+
+
+/************************************************************************
+ **
+ ** static CEL *read_format_cel_file(const char *filename, int format, int read_intensities_only)
+ **  
+ ** Reads the contents of a CEL file already known to be in the given
+ ** CEL_FORMAT_ into a "CEL" structure, so that the file is not sniffed
+ ** again for each part. CEL_FORMAT_UNKNOWN tries the multichannel 
+ ** command console formats. Text and binary CEL files are read in a 
+ ** single pass (see above), the other formats still open the file 
+ ** once for each part.
+ **
+ ************************************************************************/
+
+static CEL *read_format_cel_file(const char *filename, int format, int read_intensities_only){
+  
+  CEL *my_CEL;
+  int i,k;
+  int is_multichannel = 0, is_gzmultichannel = 0;
+
+  if (format == CEL_FORMAT_TEXT){
+    return read_text_cel_file(filename, read_intensities_only);
+  } else if (format == CEL_FORMAT_BINARY){
+    return read_binary_cel_file(filename, read_intensities_only);
+  } else if (format == CEL_FORMAT_UNKNOWN){
+    is_multichannel = isGenericMultiChannelCelFile(filename);
+    is_gzmultichannel = !is_multichannel && isgzGenericMultiChannelCelFile(filename);
+  }
+
+  my_CEL = R_Calloc(1, CEL);
+  my_CEL->multichannel = 0;
+  my_CEL->channelnames = NULL;
+  
+  /** First get the header information **/
+
+
+  if (format == CEL_FORMAT_GZTEXT){
+#if defined HAVE_ZLIB
+    gz_get_detailed_header_info(filename,&my_CEL->header);
+#else
+    read_error("Compress option not supported on your platform\n");
+#endif
+  } else if (format == CEL_FORMAT_GZBINARY){
+    gzbinary_get_detailed_header_info(filename,&my_CEL->header);
+  } else if (format == CEL_FORMAT_GENERIC){
+    generic_get_detailed_header_info(filename,&my_CEL->header);
+  }  else if (format == CEL_FORMAT_GZGENERIC){
+    gzgeneric_get_detailed_header_info(filename,&my_CEL->header);
+  } else if (is_multichannel){
+    generic_get_detailed_header_info(filename,&my_CEL->header);
+    my_CEL->multichannel = multichannel_determine_number_channels(filename);
+    my_CEL->channelnames = R_Calloc(my_CEL->multichannel,char*);
+    for (k = 0; k <  my_CEL->multichannel; k++){
+      my_CEL->channelnames[k] =multichannel_determine_channel_name(filename, k);
+    }
+  }  else if (is_gzmultichannel){
+    gzgeneric_get_detailed_header_info(filename,&my_CEL->header);
+    my_CEL->multichannel = gzmultichannel_determine_number_channels(filename);
+    my_CEL->channelnames = R_Calloc(my_CEL->multichannel,char*);
+    for (k = 0; k <  my_CEL->multichannel; k++){
+      my_CEL->channelnames[k] =gzmultichannel_determine_channel_name(filename, k);
+    }
+  } else {
+#if defined HAVE_ZLIB
+    read_error("Is %s really a CEL file? tried reading as text, gzipped text, binary and gzipped binary\n",filename);
+#else
+    read_error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",filename);
+#endif
+  }
+
+
+  /*** Now lets allocate the space for intensities, stdev, npixels, masks and outliers ****/
+  allocate_cel(my_CEL, read_intensities_only);
+
+
+  if (format == CEL_FORMAT_GZTEXT){
+#if defined HAVE_ZLIB
+    read_gzcel_file_intensities(filename,my_CEL->intensities[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);  
+    if (!read_intensities_only){	
+      read_gzcel_file_stddev(filename,my_CEL->stddev[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
+      read_gzcel_file_npixels(filename,my_CEL->npixels[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
+    }
+#else
+    read_error("Compress option not supported on your platform\n");
+#endif
+  } else if (format == CEL_FORMAT_GZBINARY){
     if (gzread_binarycel_file_intensities(filename,my_CEL->intensities[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols)){
-      error("It appears that the file %s is corrupted.",filename);
+      read_error("It appears that the file %s is corrupted.",filename);
     }  
     if (!read_intensities_only){	
       gzread_binarycel_file_stddev(filename,my_CEL->stddev[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
       gzread_binarycel_file_npixels(filename,my_CEL->npixels[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
     }
-  } else if (isGenericCelFile(filename)){
-    read_genericcel_file_intensities(filename,my_CEL->intensities[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);  
+  } else if (format == CEL_FORMAT_GENERIC){
+    if (read_genericcel_file_intensities(filename,my_CEL->intensities[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols)){
+      read_error("It appears that the file %s is corrupted.",filename);
+    }  
     if (!read_intensities_only){	
-      read_genericcel_file_stddev(filename,my_CEL->stddev[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
-      read_genericcel_file_npixels(filename,my_CEL->npixels[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
+      if (read_genericcel_file_stddev(filename,my_CEL->stddev[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols) ||
+	  read_genericcel_file_npixels(filename,my_CEL->npixels[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols)){
+	read_error("It appears that the file %s is corrupted.",filename);
+      }
     }
-  } else if (isgzGenericCelFile(filename)){
-    gzread_genericcel_file_intensities(filename,my_CEL->intensities[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);  
+  } else if (format == CEL_FORMAT_GZGENERIC){
+    if (gzread_genericcel_file_intensities(filename,my_CEL->intensities[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols)){
+      read_error("It appears that the file %s is corrupted.",filename);
+    }  
     if (!read_intensities_only){	
-      gzread_genericcel_file_stddev(filename,my_CEL->stddev[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
-      gzread_genericcel_file_npixels(filename,my_CEL->npixels[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols);
+      if (gzread_genericcel_file_stddev(filename,my_CEL->stddev[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols) ||
+	  gzread_genericcel_file_npixels(filename,my_CEL->npixels[0], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols)){
+	read_error("It appears that the file %s is corrupted.",filename);
+      }
     }
-  } else if (isGenericMultiChannelCelFile(filename)){
+  } else if (is_multichannel){
     for (i=0; i < my_CEL->multichannel; i++){
       read_genericcel_file_intensities_multichannel(filename,my_CEL->intensities[i], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols, i);  
       if (!read_intensities_only){	
@@ -5311,7 +6467,7 @@ CEL *read_cel_file(const char *filename, int read_intensities_only){
 	read_genericcel_file_npixels_multichannel(filename,my_CEL->npixels[i], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols, i);
       }
     }
-  } else if (isgzGenericMultiChannelCelFile(filename)){
+  } else if (is_gzmultichannel){
     for (i=0; i < my_CEL->multichannel; i++){
       gzread_genericcel_file_intensities_multichannel(filename,my_CEL->intensities[i], 0, (my_CEL->header.cols)*(my_CEL->header.rows), 1,my_CEL->header.cols, i);  
       if (!read_intensities_only){	
@@ -5321,60 +6477,39 @@ CEL *read_cel_file(const char *filename, int read_intensities_only){
     }
   }else {
 #if defined HAVE_ZLIB
-    error("Is %s really a CEL file? tried reading as text, gzipped text, binary and gzipped binary\n",filename);
+    read_error("Is %s really a CEL file? tried reading as text, gzipped text, binary and gzipped binary\n",filename);
 #else
-    error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",filename);
+    read_error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",filename);
 #endif
   }
 
   /*** Now add masks and outliers ***/
 
-
-  if (!my_CEL->multichannel){
-    my_CEL->nmasks = R_Calloc(1, int);
-    my_CEL->noutliers = R_Calloc(1, int);
-    my_CEL->masks_x = R_Calloc(1, short *);
-    my_CEL->masks_y = R_Calloc(1, short *);
-    my_CEL->outliers_x = R_Calloc(1, short *);
-    my_CEL->outliers_y = R_Calloc(1, short *);
-  } else {
-    my_CEL->nmasks = R_Calloc(my_CEL->multichannel, int);
-    my_CEL->noutliers = R_Calloc(my_CEL->multichannel, int);
-    my_CEL->masks_x = R_Calloc(my_CEL->multichannel, short *);
-    my_CEL->masks_y = R_Calloc(my_CEL->multichannel, short *);
-    my_CEL->outliers_x = R_Calloc(my_CEL->multichannel, short *);
-    my_CEL->outliers_y = R_Calloc(my_CEL->multichannel, short *);
-  }
-
-  if (isTextCelFile(filename)){
-    get_masks_outliers(filename, &(my_CEL->nmasks[0]), &my_CEL->masks_x[0], &my_CEL->masks_y[0], &(my_CEL->noutliers[0]), &my_CEL->outliers_x[0], &my_CEL->outliers_y[0]);
-  } else if (isgzTextCelFile(filename)){
+  if (format == CEL_FORMAT_GZTEXT){
 #if defined HAVE_ZLIB
     gz_get_masks_outliers(filename, &(my_CEL->nmasks[0]), &my_CEL->masks_x[0], &my_CEL->masks_y[0], &(my_CEL->noutliers[0]), &my_CEL->outliers_x[0], &my_CEL->outliers_y[0]);
 #else
-    error("Compress option not supported on your platform\n");
+    read_error("Compress option not supported on your platform\n");
 #endif 
-  } else if (isBinaryCelFile(filename)){
-    binary_get_masks_outliers(filename, &(my_CEL->nmasks[0]), &my_CEL->masks_x[0], &my_CEL->masks_y[0], &(my_CEL->noutliers[0]), &my_CEL->outliers_x[0], &my_CEL->outliers_y[0]);
-  } else if (isgzBinaryCelFile(filename)){
+  } else if (format == CEL_FORMAT_GZBINARY){
     /****************************/ gzbinary_get_masks_outliers(filename, &(my_CEL->nmasks[0]), &my_CEL->masks_x[0], &my_CEL->masks_y[0], &(my_CEL->noutliers[0]), &my_CEL->outliers_x[0], &my_CEL->outliers_y[0]);
-  } else if (isGenericCelFile(filename)){
+  } else if (format == CEL_FORMAT_GENERIC){
     generic_get_masks_outliers(filename, &(my_CEL->nmasks[0]), &my_CEL->masks_x[0], &my_CEL->masks_y[0], &(my_CEL->noutliers[0]), &my_CEL->outliers_x[0], &my_CEL->outliers_y[0]);
-  } else if (isgzGenericCelFile(filename)){
+  } else if (format == CEL_FORMAT_GZGENERIC){
     gzgeneric_get_masks_outliers(filename, &(my_CEL->nmasks[0]), &my_CEL->masks_x[0], &my_CEL->masks_y[0], &(my_CEL->noutliers[0]), &my_CEL->outliers_x[0], &my_CEL->outliers_y[0]);
-  }  else if (isGenericMultiChannelCelFile(filename)){
+  }  else if (is_multichannel){
     for (i=0; i < my_CEL->multichannel; i++){
       generic_get_masks_outliers_multichannel(filename, &(my_CEL->nmasks[i]), &my_CEL->masks_x[i], &my_CEL->masks_y[i], &(my_CEL->noutliers[i]), &my_CEL->outliers_x[i], &my_CEL->outliers_y[i], i);
     }
-  } else if (isgzGenericMultiChannelCelFile(filename)){
+  } else if (is_gzmultichannel){
     for (i=0; i < my_CEL->multichannel; i++){
       gzgeneric_get_masks_outliers_multichannel(filename, &(my_CEL->nmasks[i]), &my_CEL->masks_x[i], &my_CEL->masks_y[i], &(my_CEL->noutliers[i]), &my_CEL->outliers_x[i], &my_CEL->outliers_y[i], i);
     }
   } else {
 #if defined HAVE_ZLIB
-    error("Is %s really a CEL file? tried reading as text, gzipped text, binary, gzipped binary, command console and gzipped command console formats.\n",filename);
+    read_error("Is %s really a CEL file? tried reading as text, gzipped text, binary, gzipped binary, command console and gzipped command console formats.\n",filename);
 #else
-    error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",filename);
+    read_error("Is %s really a CEL file? tried reading as text and binary. The gzipped text and binary formats are not supported on your platform.\n",filename);
 #endif
   }
 
@@ -5385,18 +6520,31 @@ CEL *read_cel_file(const char *filename, int read_intensities_only){
 }
 
 
-/**************************************************************************
- **
+/************************************************************************
  **
- ** Read a single CEL file into an R list structure
- ** Mostly just for testing the above
+ ** CEL *read_cel_file(const char *filename)
+ **  
+ ** Reads the contents of the CEL file into a "CEL" structure.
  **
- **************************************************************************/
+ ************************************************************************/
 
+CEL *read_cel_file(const char *filename, int read_intensities_only){
 
+  return read_format_cel_file(filename, detect_cel_file_format(filename), read_intensities_only);
+}
 
 
-SEXP R_read_cel_file(SEXP filename, SEXP intensities_mean_only){
+/**************************************************************************
+ **
+ ** static SEXP cel_to_R(CEL *myCEL, int read_intensities_only)
+ **
+ ** Makes an R list structure (HEADER, INTENSITY, MASKS, OUTLIERS and
+ ** for multichannel files MULTICHANNEL and CHANNELNAMES) from a CEL 
+ ** structure. 
+ **
+ **************************************************************************/
+
+static SEXP cel_to_R(CEL *myCEL, int read_intensities_only){
 
   SEXP theCEL;
   SEXP theCEL_names;
@@ -5425,14 +6573,6 @@ SEXP R_read_cel_file(SEXP filename, SEXP intensities_mean_only){
 
   int i,k;
 
-  int read_intensities_only;
-
-  const char *cur_file_name = CHAR(STRING_ELT(filename,0));
-
-
-  read_intensities_only = INTEGER_POINTER(intensities_mean_only)[0];
-
-  CEL *myCEL =read_cel_file(cur_file_name,read_intensities_only);
   if (!myCEL->multichannel){
     PROTECT(theCEL = allocVector(VECSXP,4));
   } else {
@@ -5727,56 +6867,1544 @@ SEXP R_read_cel_file(SEXP filename, SEXP intensities_mean_only){
     UNPROTECT(1);
 
   }
-  
-  R_Free(myCEL->header.cdfName);
-  R_Free(myCEL->header.DatHeader);
-  R_Free(myCEL->header.Algorithm);
-  R_Free(myCEL->header.AlgorithmParameters);
-  
-  if (!myCEL->multichannel){
-    R_Free(myCEL->intensities[0]);
-    if (!read_intensities_only){
-      R_Free(myCEL->stddev[0]);
-      R_Free(myCEL->npixels[0]);
-   }
-  } else {
-    for (k =0; k < myCEL->multichannel; k++){
-      R_Free(myCEL->intensities[k]);
-      if (!read_intensities_only){
-        R_Free(myCEL->stddev[k]);
-        R_Free(myCEL->npixels[k]);
+
+  UNPROTECT(1);
+  return theCEL;
+
+}
+
+
+/**************************************************************************
+ **
+ **
+ ** Read a single CEL file into an R list structure
+ ** Mostly just for testing the above
+ **
+ **************************************************************************/
+
+
+
+
+SEXP R_read_cel_file(SEXP filename, SEXP intensities_mean_only){
+
+  SEXP theCEL;
+  CEL *myCEL;
+
+  int read_intensities_only;
+
+  const char *cur_file_name = CHAR(STRING_ELT(filename,0));
+
+
+  read_intensities_only = INTEGER_POINTER(intensities_mean_only)[0];
+
+  myCEL =read_cel_file(cur_file_name,read_intensities_only);
+  PROTECT(theCEL = cel_to_R(myCEL, read_intensities_only));
+  delete_cel(myCEL);
+
+  UNPROTECT(1);
+  return theCEL;
+
+}
+
+
+
+/*************************************************************************
+ **
+ ** Reading many CEL files at once
+ **
+ ** R_read_cel_files reads each file in a character vector into a CEL
+ ** structure, spreading the files across threads (when available), and
+ ** returns a list with an R_read_cel_file() style element for each file.
+ ** As in ReadHeaderBatch the threads only fill the CEL structures, 
+ ** R objects are made afterwards.
+ **
+ *************************************************************************/
+
+/*************************************************************************
+ **
+ ** static int lookup_cel_file_format(const char *filename)
+ **
+ ** the CEL_FORMAT_ of a file, from the catalog when the file is there
+ ** and otherwise detected from the file.
+ **
+ *************************************************************************/
+
+static int lookup_cel_file_format(const char *filename){
+
+  const cel_catalog_entry *entry = cel_catalog_lookup(filename);
+
+  return (entry != NULL) ? entry->format : detect_cel_file_format(filename);
+}
+
+
+/*************************************************************************
+ **
+ ** static CEL *read_cel_file_if_known(const char *filename, int format, int read_intensities_only)
+ **
+ ** as read_cel_file() for a file whose format has already been found, 
+ ** but returns NULL rather than calling error() when the file is not 
+ ** in a format that is recognised
+ **
+ *************************************************************************/
+
+static CEL *read_cel_file_if_known(const char *filename, int format, int read_intensities_only){
+
+  if (format == CEL_FORMAT_UNKNOWN && !isGenericMultiChannelCelFile(filename) && !isgzGenericMultiChannelCelFile(filename)){
+    return NULL;
+  }
+  return read_format_cel_file(filename, format, read_intensities_only);
+}
+
+
+#ifdef USE_PTHREADS
+struct cel_thread_data{
+  const char **filenames;
+  CEL **cels;
+  char **messages;
+  int n_files;
+  int read_intensities_only;
+  int t;
+  int num_threads;
+};
+
+
+static void *read_cel_group(void *data){
+  struct cel_thread_data *args = (struct cel_thread_data *) data;
+  read_error_trap trap;
+  int i;
+
+  for (i = args->t; i < args->n_files; i+= args->num_threads){
+    read_prefetch_ahead(args->filenames, args->n_files, i, args->num_threads, i == args->t);
+    read_error_catch(&trap);
+    if (setjmp(trap.env) == 0){
+      args->cels[i] = read_cel_file_if_known(args->filenames[i], lookup_cel_file_format(args->filenames[i]), args->read_intensities_only);
+    } else {
+      args->messages[i] = read_error_message(&trap);
+    }
+  }
+  read_error_release();
+  return NULL;
+}
+#endif
+
+
+/*************************************************************************
+ **
+ ** SEXP R_read_cel_files(SEXP filenames, SEXP intensities_mean_only, SEXP threads)
+ **
+ ** SEXP filenames - character vector of CEL file names
+ ** SEXP intensities_mean_only - if TRUE only the MEAN intensities are read
+ ** SEXP threads - number of threads to use. NULL uses the R_THREADS
+ **                environment variable (1 if it is not set)
+ **
+ ** RETURNS a list (named by filenames) of the R_read_cel_file() result
+ ** for each file
+ **
+ *************************************************************************/
+
+SEXP R_read_cel_files(SEXP filenames, SEXP intensities_mean_only, SEXP threads){
+
+  int i, n_files;
+  int read_intensities_only;
+  int bad_file = -1;
+  const char **file_names;
+  CEL **cels;
+  SEXP theCELs;
+#ifdef USE_PTHREADS
+  int num_threads;
+  char **messages;
+  pthread_t *thread_ids;
+  pthread_attr_t attr;
+  struct cel_thread_data *args;
+  size_t stacksize = PTHREAD_STACK_MIN + 0x40000;
+  int returnCode, t;
+#endif
+
+  if (!isString(filenames))
+    error("R_read_cel_files: argument 'filenames' must be a character vector");
+
+  read_intensities_only = asLogical(intensities_mean_only);
+  if (read_intensities_only == NA_LOGICAL)
+    error("R_read_cel_files: argument 'intensities_mean_only' must be TRUE or FALSE");
+
+#ifdef USE_PTHREADS
+  num_threads = batch_num_threads(threads);
+#endif
+
+  n_files = GET_LENGTH(filenames);
+  file_names = (const char **)R_alloc(n_files + 1, sizeof(char *));
+  for (i = 0; i < n_files; i++){
+    file_names[i] = CHAR(STRING_ELT(filenames, i));
+  }
+  cels = R_Calloc(n_files + 1, CEL *);
+  /* the threads only look files up, so there is nothing to sync */
+  cel_catalog_open();
+  read_prefetch_begin();
+
+#ifdef USE_PTHREADS
+  if (num_threads > n_files){
+    num_threads = n_files;
+  }
+  if (num_threads > 1){
+    thread_ids = (pthread_t *) R_Calloc(num_threads, pthread_t);
+    args = (struct cel_thread_data *) R_Calloc(num_threads, struct cel_thread_data);
+    messages = R_Calloc(n_files, char *);
+    
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    pthread_attr_setstacksize (&attr, stacksize);
+
+    for (t = 0; t < num_threads; t++){
+      args[t].filenames = file_names;
+      args[t].cels = cels;
+      args[t].messages = messages;
+      args[t].n_files = n_files;
+      args[t].read_intensities_only = read_intensities_only;
+      args[t].t = t;
+      args[t].num_threads = num_threads;
+      returnCode = pthread_create(&thread_ids[t], &attr, read_cel_group, (void *) &(args[t]));
+      if (returnCode){
+	error("ERROR; return code from pthread_create() is %d\n", returnCode);
+      }
+    }
+    for (t = 0; t < num_threads; t++){
+      returnCode = pthread_join(thread_ids[t], NULL);
+      if (returnCode){
+	error("ERROR; return code from pthread_join(thread #%d) is %d\n", t, returnCode);
+      }
+    }
+    pthread_attr_destroy(&attr);
+    R_Free(thread_ids);
+    R_Free(args);
+
+    if (read_error_first(messages, n_files, NULL) != NULL){
+      for (i = 0; i < n_files; i++){
+	if (cels[i] != NULL)
+	  delete_cel(cels[i]);
+      }
+      R_Free(cels);
+    }
+    read_error_raise(messages, n_files);
+  } else {
+    for (i = 0; i < n_files; i++){
+      read_prefetch_ahead(file_names, n_files, i, 1, i == 0);
+      cels[i] = read_cel_file_if_known(file_names[i], lookup_cel_file_format(file_names[i]), read_intensities_only);
+    }
+  }
+#else
+  for (i = 0; i < n_files; i++){
+    read_prefetch_ahead(file_names, n_files, i, 1, i == 0);
+    cels[i] = read_cel_file_if_known(file_names[i], lookup_cel_file_format(file_names[i]), read_intensities_only);
+  }
+#endif
+
+  for (i = 0; i < n_files; i++){
+    if (cels[i] == NULL){
+      if (bad_file == -1)
+	bad_file = i;
+    }
+  }
+  if (bad_file != -1){
+    for (i = 0; i < n_files; i++){
+      if (cels[i] != NULL)
+	delete_cel(cels[i]);
+    }
+    R_Free(cels);
+    not_a_cel_file_error(file_names[bad_file]);
+  }
+
+  /* each CEL is freed as soon as it has been copied, to keep the peak memory down */
+  PROTECT(theCELs = allocVector(VECSXP, n_files));
+  for (i = 0; i < n_files; i++){
+    SET_VECTOR_ELT(theCELs, i, cel_to_R(cels[i], read_intensities_only));
+    delete_cel(cels[i]);
+    cels[i] = NULL;
+  }
+  R_Free(cels);
+  setAttrib(theCELs, R_NamesSymbol, filenames);
+
+  UNPROTECT(1);
+  return theCELs;
+}
+
+
+/*************************************************************************
+ **
+ ** Reading many CEL files at once into matrices
+ **
+ ** R_read_cel_files_matrices reads files that all have the same 
+ ** dimensions straight into a MEAN matrix, a STDEV matrix and an 
+ ** integer NPIXELS matrix with a column for each file, and gathers 
+ ** the masks and outliers into compressed index vectors. The matrices 
+ ** are allocated before the threads start and each thread fills the 
+ ** columns of its files.
+ **
+ *************************************************************************/
+
+#define CEL_COLUMNS_OK 0
+#define CEL_COLUMNS_UNKNOWN 1
+#define CEL_COLUMNS_DIMENSIONS 2
+#define CEL_COLUMNS_CORRUPTED 3
+#define CEL_COLUMNS_MULTICHANNEL 4
+#define CEL_COLUMNS_ERROR 5          /* read_error() was raised, see messages */
+
+
+/*************************************************************************
+ **
+ ** static int read_cel_columns(const char *filename, int cols, int rows, cel_contents *contents)
+ **
+ ** reads a CEL file into the destinations given by contents, which are
+ ** cols*rows long. Text and binary files are read in a single pass, the 
+ ** other formats through read_cel_file() and copied. 
+ **
+ ** returns one of the CEL_COLUMNS_ values
+ **
+ *************************************************************************/
+
+static int read_cel_columns(const char *filename, int cols, int rows, cel_contents *contents){
+
+  int format = detect_cel_file_format(filename);
+  int status = CEL_COLUMNS_OK;
+  size_t i, n_cells = (size_t)cols*rows;
+  FILE *currentFile;
+  long intensity_offset;
+  detailed_header_info header_info;
+  binary_header *my_header;
+  CEL *my_CEL;
+
+  if (format == CEL_FORMAT_TEXT){
+    currentFile = open_text_cel_contents(filename, &header_info, &intensity_offset);
+    if (header_info.cols != cols || header_info.rows != rows){
+      status = CEL_COLUMNS_DIMENSIONS;
+    } else if (read_text_cel_contents(currentFile, filename, intensity_offset, cols, rows, contents)){
+      status = CEL_COLUMNS_CORRUPTED;
+    }
+    fclose(currentFile);
+    free_detailed_header(&header_info);
+  } else if (format == CEL_FORMAT_BINARY){
+    my_header = read_binary_header(filename,1);
+    if (my_header->cols != cols || my_header->rows != rows){
+      status = CEL_COLUMNS_DIMENSIONS;
+    } else if (read_binary_cel_contents(my_header, contents)){
+      status = CEL_COLUMNS_CORRUPTED;
+    }
+    fclose(my_header->infile);
+    delete_binary_header(my_header);
+  } else {
+    my_CEL = read_cel_file_if_known(filename, format, contents->stddev == NULL);
+    if (my_CEL == NULL){
+      return CEL_COLUMNS_UNKNOWN;
+    }
+    if (my_CEL->multichannel){
+      status = CEL_COLUMNS_MULTICHANNEL;
+    } else if (my_CEL->header.cols != cols || my_CEL->header.rows != rows){
+      status = CEL_COLUMNS_DIMENSIONS;
+    } else {
+      memcpy(contents->intensities, my_CEL->intensities[0], n_cells*sizeof(double));
+      if (contents->stddev != NULL){
+	memcpy(contents->stddev, my_CEL->stddev[0], n_cells*sizeof(double));
+	for (i = 0; i < n_cells; i++){
+	  store_npixels(contents, i, my_CEL->npixels[0][i]);
+	}
+      }
+      /* the masks and outliers are handed over rather than copied */
+      contents->nmasks = my_CEL->nmasks[0];
+      contents->masks_x = my_CEL->masks_x[0];
+      contents->masks_y = my_CEL->masks_y[0];
+      contents->noutliers = my_CEL->noutliers[0];
+      contents->outliers_x = my_CEL->outliers_x[0];
+      contents->outliers_y = my_CEL->outliers_y[0];
+      my_CEL->masks_x[0] = NULL;
+      my_CEL->masks_y[0] = NULL;
+      my_CEL->outliers_x[0] = NULL;
+      my_CEL->outliers_y[0] = NULL;
+    }
+    delete_cel(my_CEL);
+  }
+  return status;
+}
+
+
+static void free_cel_contents_locations(cel_contents *contents){
+  R_Free(contents->masks_x);
+  R_Free(contents->masks_y);
+  R_Free(contents->outliers_x);
+  R_Free(contents->outliers_y);
+}
+
+
+/*************************************************************************
+ **
+ ** static void read_cel_columns_range(const char **filenames, cel_contents *contents,
+ **                                    int *status, char **messages, int cols, int rows,
+ **                                    int n_files, int first, int step)
+ **
+ ** reads files first, first + step, ... with read_cel_columns(). An error
+ ** reading a file is trapped, giving it the status CEL_COLUMNS_ERROR and
+ ** its message in messages, so that the caller can free what it has
+ ** allocated before raising it. Used both by the threads and on the
+ ** main thread.
+ **
+ *************************************************************************/
+
+static void read_cel_columns_range(const char **filenames, cel_contents *contents, int *status, char **messages, int cols, int rows, int n_files, int first, int step){
+
+  read_error_trap trap;
+  int i;
+
+  for (i = first; i < n_files; i+= step){
+    read_prefetch_ahead(filenames, n_files, i, step, i == first);
+    read_error_catch(&trap);
+    if (setjmp(trap.env) == 0){
+      status[i] = read_cel_columns(filenames[i], cols, rows, &contents[i]);
+    } else {
+      status[i] = CEL_COLUMNS_ERROR;
+      messages[i] = read_error_message(&trap);
+    }
+  }
+  read_error_release();
+}
+
+
+#ifdef USE_PTHREADS
+struct cel_columns_thread_data{
+  const char **filenames;
+  cel_contents *contents;
+  int *status;
+  char **messages;
+  int cols;
+  int rows;
+  int n_files;
+  int t;
+  int num_threads;
+};
+
+
+static void *read_cel_columns_group(void *data){
+  struct cel_columns_thread_data *args = (struct cel_columns_thread_data *) data;
+
+  read_cel_columns_range(args->filenames, args->contents, args->status, args->messages, args->cols, args->rows, args->n_files, args->t, args->num_threads);
+  return NULL;
+}
+#endif
+
+
+/*************************************************************************
+ **
+ ** static SEXP cel_locations_index(cel_contents *contents, int n_files, int cols, int outliers)
+ **
+ ** gathers the masks (or if outliers, the outliers) of all the files into
+ ** a list of two integer vectors: index, the cell (row of the intensity
+ ** matrices, counting from 1) of each location, and offset, of length 
+ ** n_files + 1, where those of file j are index[offset[j]+1 .. offset[j+1]]
+ **
+ *************************************************************************/
+
+static SEXP cel_locations_index(cel_contents *contents, int n_files, int cols, int outliers){
+
+  SEXP locations, index, offset, names;
+  int i, j, n, n_total = 0;
+  short *x, *y;
+
+  for (i = 0; i < n_files; i++){
+    n_total += (outliers ? contents[i].noutliers : contents[i].nmasks);
+  }
+
+  PROTECT(locations = allocVector(VECSXP, 2));
+  PROTECT(index = allocVector(INTSXP, n_total));
+  PROTECT(offset = allocVector(INTSXP, n_files + 1));
+
+  n_total = 0;
+  for (i = 0; i < n_files; i++){
+    INTEGER(offset)[i] = n_total;
+    if (outliers){
+      n = contents[i].noutliers;
+      x = contents[i].outliers_x;
+      y = contents[i].outliers_y;
+    } else {
+      n = contents[i].nmasks;
+      x = contents[i].masks_x;
+      y = contents[i].masks_y;
+    }
+    for (j = 0; j < n; j++){
+      INTEGER(index)[n_total++] = (int)x[j] + cols*(int)y[j] + 1;
+    }
+  }
+  INTEGER(offset)[n_files] = n_total;
+
+  SET_VECTOR_ELT(locations, 0, index);
+  SET_VECTOR_ELT(locations, 1, offset);
+  PROTECT(names = allocVector(STRSXP, 2));
+  SET_STRING_ELT(names, 0, mkChar("index"));
+  SET_STRING_ELT(names, 1, mkChar("offset"));
+  setAttrib(locations, R_NamesSymbol, names);
+
+  UNPROTECT(4);
+  return locations;
+}
+
+
+/*************************************************************************
+ **
+ ** SEXP R_read_cel_files_matrices(SEXP filenames, SEXP intensities_mean_only, SEXP threads)
+ **
+ ** SEXP filenames - character vector of CEL file names, all with the
+ **                  same dimensions
+ ** SEXP intensities_mean_only - if TRUE only the MEAN intensities are read
+ ** SEXP threads - number of threads to use. NULL uses the R_THREADS
+ **                environment variable (1 if it is not set)
+ **
+ ** RETURNS a list with items MEAN, STDEV (cells by files double matrices),
+ ** NPIXELS (cells by files integer matrix), MASKS and OUTLIERS (see 
+ ** cel_locations_index). STDEV and NPIXELS are NULL if intensities_mean_only.
+ **
+ *************************************************************************/
+
+SEXP R_read_cel_files_matrices(SEXP filenames, SEXP intensities_mean_only, SEXP threads){
+
+  int i, n_files;
+  int read_intensities_only;
+  int cols, rows;
+  size_t n_cells;
+  int bad_file = -1, bad_status;
+  const char **file_names;
+  detailed_header_info header_info;
+  cel_contents *contents;
+  int *status;
+  char **messages;
+  SEXP result, names, dimnames;
+  SEXP intensity, stddev = R_NilValue, npixels = R_NilValue;
+#ifdef USE_PTHREADS
+  int num_threads;
+  pthread_t *thread_ids;
+  pthread_attr_t attr;
+  struct cel_columns_thread_data *args;
+  size_t stacksize = PTHREAD_STACK_MIN + 0x40000;
+  int returnCode, t;
+#endif
+
+  if (!isString(filenames) || GET_LENGTH(filenames) == 0)
+    error("R_read_cel_files_matrices: argument 'filenames' must be a non-empty character vector");
+
+  read_intensities_only = asLogical(intensities_mean_only);
+  if (read_intensities_only == NA_LOGICAL)
+    error("R_read_cel_files_matrices: argument 'intensities_mean_only' must be TRUE or FALSE");
+
+#ifdef USE_PTHREADS
+  num_threads = batch_num_threads(threads);
+#endif
+
+  n_files = GET_LENGTH(filenames);
+  file_names = (const char **)R_alloc(n_files + 1, sizeof(char *));
+  for (i = 0; i < n_files; i++){
+    file_names[i] = CHAR(STRING_ELT(filenames, i));
+  }
+
+  /* the first file gives the dimensions */
+  if (!read_detailed_header(file_names[0], &header_info)){
+    not_a_cel_file_error(file_names[0]);
+  }
+  cols = header_info.cols;
+  rows = header_info.rows;
+  free_detailed_header(&header_info);
+  n_cells = (size_t)cols*rows;
+
+  PROTECT(intensity = allocMatrix(REALSXP, cols*rows, n_files));
+  if (!read_intensities_only){
+    PROTECT(stddev = allocMatrix(REALSXP, cols*rows, n_files));
+    PROTECT(npixels = allocMatrix(INTSXP, cols*rows, n_files));
+  }
+
+  contents = R_Calloc(n_files, cel_contents);
+  status = R_Calloc(n_files, int);
+  messages = R_Calloc(n_files, char *);
+  read_prefetch_begin();
+  for (i = 0; i < n_files; i++){
+    contents[i].intensities = REAL(intensity) + (size_t)i*n_cells;
+    if (!read_intensities_only){
+      contents[i].stddev = REAL(stddev) + (size_t)i*n_cells;
+      contents[i].npixels_int = INTEGER(npixels) + (size_t)i*n_cells;
+    }
+  }
+
+#ifdef USE_PTHREADS
+  if (num_threads > n_files){
+    num_threads = n_files;
+  }
+  if (num_threads > 1){
+    thread_ids = (pthread_t *) R_Calloc(num_threads, pthread_t);
+    args = (struct cel_columns_thread_data *) R_Calloc(num_threads, struct cel_columns_thread_data);
+    
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    pthread_attr_setstacksize (&attr, stacksize);
+
+    for (t = 0; t < num_threads; t++){
+      args[t].filenames = file_names;
+      args[t].contents = contents;
+      args[t].status = status;
+      args[t].messages = messages;
+      args[t].cols = cols;
+      args[t].rows = rows;
+      args[t].n_files = n_files;
+      args[t].t = t;
+      args[t].num_threads = num_threads;
+      returnCode = pthread_create(&thread_ids[t], &attr, read_cel_columns_group, (void *) &(args[t]));
+      if (returnCode){
+	error("ERROR; return code from pthread_create() is %d\n", returnCode);
+      }
+    }
+    for (t = 0; t < num_threads; t++){
+      returnCode = pthread_join(thread_ids[t], NULL);
+      if (returnCode){
+	error("ERROR; return code from pthread_join(thread #%d) is %d\n", t, returnCode);
+      }
+    }
+    pthread_attr_destroy(&attr);
+    R_Free(thread_ids);
+    R_Free(args);
+  } else {
+    read_cel_columns_range(file_names, contents, status, messages, cols, rows, n_files, 0, 1);
+  }
+#else
+  read_cel_columns_range(file_names, contents, status, messages, cols, rows, n_files, 0, 1);
+#endif
+
+  for (i = 0; i < n_files; i++){
+    if (status[i] != CEL_COLUMNS_OK){
+      bad_file = i;
+      break;
+    }
+  }
+  if (bad_file != -1){
+    bad_status = status[bad_file];
+    for (i = 0; i < n_files; i++){
+      free_cel_contents_locations(&contents[i]);
+    }
+    R_Free(contents);
+    R_Free(status);
+    /* files before bad_file have no message, so this raises that of bad_file */
+    if (bad_status == CEL_COLUMNS_ERROR){
+      read_error_raise(messages, n_files);
+    }
+    read_error_free_messages(messages, n_files);
+    if (bad_status == CEL_COLUMNS_UNKNOWN){
+      not_a_cel_file_error(file_names[bad_file]);
+    } else if (bad_status == CEL_COLUMNS_DIMENSIONS){
+      error("Cel file %s does not seem to have the correct dimensions",file_names[bad_file]);
+    } else if (bad_status == CEL_COLUMNS_MULTICHANNEL){
+      error("Cel file %s has multiple channels, which can not be read into a matrix",file_names[bad_file]);
+    } else {
+      error("It appears that the file %s is corrupted.",file_names[bad_file]);
+    }
+  }
+
+  PROTECT(result = allocVector(VECSXP, 5));
+  SET_VECTOR_ELT(result, 0, intensity);
+  SET_VECTOR_ELT(result, 1, stddev);
+  SET_VECTOR_ELT(result, 2, npixels);
+  SET_VECTOR_ELT(result, 3, cel_locations_index(contents, n_files, cols, 0));
+  SET_VECTOR_ELT(result, 4, cel_locations_index(contents, n_files, cols, 1));
+
+  for (i = 0; i < n_files; i++){
+    free_cel_contents_locations(&contents[i]);
+  }
+  R_Free(contents);
+  R_Free(status);
+  read_error_free_messages(messages, n_files);
+
+  PROTECT(dimnames = allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(dimnames, 1, filenames);
+  setAttrib(intensity, R_DimNamesSymbol, dimnames);
+  if (!read_intensities_only){
+    setAttrib(stddev, R_DimNamesSymbol, dimnames);
+    setAttrib(npixels, R_DimNamesSymbol, dimnames);
+  }
+
+  PROTECT(names = allocVector(STRSXP, 5));
+  SET_STRING_ELT(names, 0, mkChar("MEAN"));
+  SET_STRING_ELT(names, 1, mkChar("STDEV"));
+  SET_STRING_ELT(names, 2, mkChar("NPIXELS"));
+  SET_STRING_ELT(names, 3, mkChar("MASKS"));
+  SET_STRING_ELT(names, 4, mkChar("OUTLIERS"));
+  setAttrib(result, R_NamesSymbol, names);
+
+  UNPROTECT(read_intensities_only ? 4 : 6);
+  return result;
+}
+
+
+/*************************************************************************
+ **
+ ** Reading a batch of CEL files a block at a time
+ **
+ ** R_cel_block_iterator() checks the files and returns an external
+ ** pointer to a cel_block_iterator. Each call to R_cel_block_iterator_next()
+ ** returns the intensities of the next block_size files as a cells by
+ ** block_size matrix (the last block may be narrower), so a batch of any
+ ** size can be processed in the memory taken by a few blocks.
+ **
+ ** There are two block buffers, allocated once. While the block read 
+ ** into one is being used in R the next block is read into the other by
+ ** background threads (the files of the block spread across them), so 
+ ** reading overlaps with whatever is done with the current block. Each
+ ** block is copied from its buffer into a new matrix, as R code may keep
+ ** the matrix it is given.
+ **
+ ** The worker threads must not call error(), so files are checked and
+ ** their formats found on the main thread when the iterator is made. A 
+ ** worker traps the read_error() of each file it reads (see read_error.c),
+ ** keeping a status and message for it, and any problem is reported 
+ ** when that block is asked for. Nor may they print, so the warning 
+ ** about a truncated text file is also kept as the message of the file
+ ** and printed when its block is asked for.
+ **
+ *************************************************************************/
+
+#define CEL_BLOCK_OK 0
+#define CEL_BLOCK_CORRUPTED 1
+#define CEL_BLOCK_UNREADABLE 2
+#define CEL_BLOCK_ERROR 3          /* read_error() was raised, see messages */
+
+typedef struct cel_block_iterator cel_block_iterator;
+
+#ifdef USE_PTHREADS
+struct cel_block_thread_data{
+  cel_block_iterator *iter;
+  int t;
+  int num_threads;
+};
+#endif
+
+struct cel_block_iterator{
+  const char **filenames;   /* CHARs of the filenames kept by the external pointer */
+  int *formats;
+  long *data_offsets;
+  int n_files;
+  int block_size;
+  int ref_dim_1;
+  int ref_dim_2;
+  int rm_mask;
+  int rm_outliers;
+  int num_threads;
+  double *buffers[2];       /* the block buffers */
+  int *status;              /* of each file in the block being read */
+  char **messages;          /* and the read_error() message (or warning) of each */
+  int next_file;            /* first file of the block to be read next */
+  int pending;              /* is a block being read (or waiting to be handed out)? */
+  int pending_buffer;
+  int pending_first;
+  int pending_n;
+#ifdef USE_PTHREADS
+  pthread_t *thread_ids;
+  struct cel_block_thread_data *args;
+  int n_running;
+#endif
+};
+
+
+/*************************************************************************
+ **
+ ** static int read_cel_format_intensities(const char *filename, int format, long data_offset,
+ **                                        double *intensity, size_t chip_num, size_t rows, 
+ **                                        size_t cols, size_t chip_dim_rows)
+ **
+ ** read the intensities of a file already known to be in the given
+ ** format into column chip_num of intensity. Returns non zero if the
+ ** file is corrupted.
+ **
+ *************************************************************************/
+
+static int read_cel_format_intensities(const char *filename, int format, long data_offset, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows){
+
+  int corrupted = 0;
+
+  switch (format){
+  case CEL_FORMAT_TEXT:
+    corrupted = read_cel_file_intensities(filename, intensity, chip_num, rows, cols, chip_dim_rows, data_offset);
+    break;
+  case CEL_FORMAT_GZTEXT:
+#if defined HAVE_ZLIB
+    corrupted = read_gzcel_file_intensities(filename, intensity, chip_num, rows, cols, chip_dim_rows);
+#endif
+    break;
+  case CEL_FORMAT_BINARY:
+    corrupted = read_binarycel_file_intensities(filename, intensity, chip_num, rows, cols, chip_dim_rows);
+    break;
+  case CEL_FORMAT_GZBINARY:
+    corrupted = gzread_binarycel_file_intensities(filename, intensity, chip_num, rows, cols, chip_dim_rows);
+    break;
+  case CEL_FORMAT_GENERIC:
+    corrupted = read_genericcel_file_intensities(filename, intensity, chip_num, rows, cols, chip_dim_rows);
+    break;
+  case CEL_FORMAT_GZGENERIC:
+    corrupted = gzread_genericcel_file_intensities(filename, intensity, chip_num, rows, cols, chip_dim_rows);
+    break;
+  }
+  return corrupted;
+}
+
+
+/*************************************************************************
+ **
+ ** static int read_cel_block_file(cel_block_iterator *iter, int j)
+ **
+ ** read file j of the pending block into column j of its buffer and
+ ** apply the masks and outliers. Returns one of the CEL_BLOCK_ values.
+ **
+ *************************************************************************/
+
+static int read_cel_block_file(cel_block_iterator *iter, int j){
+
+  int i = iter->pending_first + j;
+  const char *filename = iter->filenames[i];
+  double *buffer = iter->buffers[iter->pending_buffer];
+  size_t n_cells = (size_t)iter->ref_dim_1*iter->ref_dim_2;
+  int corrupted = 0;
+  read_timer timer;
+
+  read_timing_start(&timer, TIMING_READ);
+  corrupted = read_cel_format_intensities(filename, iter->formats[i], iter->data_offsets[i], buffer, j, n_cells, iter->block_size, iter->ref_dim_1);
+  read_timing_stop(&timer, filename);
+  if (corrupted){
+    return CEL_BLOCK_CORRUPTED;
+  }
+
+  if (iter->rm_mask || iter->rm_outliers){
+    read_timing_start(&timer, TIMING_MASK);
+    apply_format_masks(filename, iter->formats[i], buffer, j, n_cells, iter->block_size, iter->ref_dim_1, iter->rm_mask, iter->rm_outliers);
+    read_timing_stop(&timer, NULL);
+  }
+  return CEL_BLOCK_OK;
+}
+
+
+/* read_cel_block_file(), keeping any read_error() (or warning) as the status and message of file j */
+
+static void read_cel_block_file_trapped(cel_block_iterator *iter, int j){
+
+  read_error_trap trap;
+
+  read_error_catch(&trap);
+  trap.keep_warnings = 1;
+  if (setjmp(trap.env) == 0){
+    iter->status[j] = read_cel_block_file(iter, j);
+    iter->messages[j] = read_error_warning(&trap);
+  } else {
+    iter->status[j] = CEL_BLOCK_ERROR;
+    iter->messages[j] = read_error_message(&trap);
+  }
+  read_error_release();
+}
+
+
+#ifdef USE_PTHREADS
+static void *read_cel_block_group(void *data){
+  struct cel_block_thread_data *args = (struct cel_block_thread_data *) data;
+  cel_block_iterator *iter = args->iter;
+  int j;
+
+  read_timing_thread_begin();
+  for (j = args->t; j < iter->pending_n; j+= args->num_threads){
+    read_prefetch_ahead(iter->filenames + iter->pending_first, iter->pending_n, j, args->num_threads, j == args->t);
+    read_cel_block_file_trapped(iter, j);
+  }
+  read_timing_thread_end();
+  return NULL;
+}
+#endif
+
+
+/*************************************************************************
+ **
+ ** static void start_cel_block(cel_block_iterator *iter, int buffer)
+ **
+ ** start reading the next block of files into the given buffer. With
+ ** pthreads this returns once the worker threads have been started, 
+ ** otherwise once the block has been read.
+ **
+ *************************************************************************/
+
+static void start_cel_block(cel_block_iterator *iter, int buffer){
+
+  int j;
+#ifdef USE_PTHREADS
+  pthread_attr_t attr;
+  size_t stacksize = PTHREAD_STACK_MIN + 0x40000;
+  int returnCode, t;
+#endif
+
+  if (iter->next_file >= iter->n_files){
+    return;
+  }
+
+  iter->pending = 1;
+  iter->pending_buffer = buffer;
+  iter->pending_first = iter->next_file;
+  iter->pending_n = iter->n_files - iter->next_file;
+  if (iter->pending_n > iter->block_size){
+    iter->pending_n = iter->block_size;
+  }
+  iter->next_file += iter->pending_n;
+  for (j = 0; j < iter->pending_n; j++){
+    iter->status[j] = CEL_BLOCK_OK;
+    if (iter->messages[j] != NULL){
+      R_Free(iter->messages[j]);
+    }
+  }
+
+#ifdef USE_PTHREADS
+  iter->n_running = (iter->num_threads < iter->pending_n) ? iter->num_threads : iter->pending_n;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+  pthread_attr_setstacksize (&attr, stacksize);
+  for (t = 0; t < iter->n_running; t++){
+    iter->args[t].iter = iter;
+    iter->args[t].t = t;
+    iter->args[t].num_threads = iter->n_running;
+    returnCode = pthread_create(&(iter->thread_ids[t]), &attr, read_cel_block_group, (void *) &(iter->args[t]));
+    if (returnCode){
+      /* read what would have been this thread's share here */
+      read_cel_block_group((void *) &(iter->args[t]));
+      iter->thread_ids[t] = pthread_self();
+    }
+  }
+  pthread_attr_destroy(&attr);
+#else
+  for (j = 0; j < iter->pending_n; j++){
+    read_prefetch_ahead(iter->filenames + iter->pending_first, iter->pending_n, j, 1, j == 0);
+    read_cel_block_file_trapped(iter, j);
+  }
+#endif
+}
+
+
+/*************************************************************************
+ **
+ ** static void finish_cel_block(cel_block_iterator *iter)
+ **
+ ** wait for the threads reading the pending block (if any)
+ **
+ *************************************************************************/
+
+static void finish_cel_block(cel_block_iterator *iter){
+#ifdef USE_PTHREADS
+  int t;
+
+  for (t = 0; t < iter->n_running; t++){
+    if (!pthread_equal(iter->thread_ids[t], pthread_self())){
+      pthread_join(iter->thread_ids[t], NULL);
+    }
+  }
+  iter->n_running = 0;
+#endif
+}
+
+
+static void free_cel_block_iterator(cel_block_iterator *iter){
+
+  finish_cel_block(iter);
+  R_Free(iter->buffers[0]);
+  R_Free(iter->buffers[1]);
+  R_Free(iter->filenames);
+  R_Free(iter->formats);
+  R_Free(iter->data_offsets);
+  R_Free(iter->status);
+  read_error_free_messages(iter->messages, iter->block_size);
+#ifdef USE_PTHREADS
+  R_Free(iter->thread_ids);
+  R_Free(iter->args);
+#endif
+  R_Free(iter);
+}
+
+
+static void cel_block_iterator_finalizer(SEXP iterator){
+
+  cel_block_iterator *iter = (cel_block_iterator *)R_ExternalPtrAddr(iterator);
+
+  if (iter != NULL){
+    free_cel_block_iterator(iter);
+    R_ClearExternalPtr(iterator);
+  }
+}
+
+
+static cel_block_iterator *get_cel_block_iterator(SEXP iterator){
+
+  if (TYPEOF(iterator) != EXTPTRSXP || R_ExternalPtrTag(iterator) != install("cel_block_iterator"))
+    error("argument 'iterator' is not a CEL block iterator");
+  return (cel_block_iterator *)R_ExternalPtrAddr(iterator);
+}
+
+
+/*************************************************************************
+ **
+ ** SEXP R_cel_block_iterator(SEXP filenames, SEXP block_size, SEXP rm_mask, 
+ **                           SEXP rm_outliers, SEXP rm_extra, SEXP ref_cdfName,
+ **                           SEXP ref_dim, SEXP threads)
+ **
+ ** SEXP filenames - character vector of CEL file names
+ ** SEXP block_size - the number of files in each block
+ ** SEXP rm_mask   - if true set MASKS  to NA
+ ** SEXP rm_outliers - if true set OUTLIERS to NA
+ ** SEXP rm_extra    - if true  overrides rm_mask and rm_outliers settings
+ ** SEXP ref_cdfName - the reference CDF name to check each CEL file against 
+ ** SEXP ref_dim     - cols/rows of reference chip
+ ** SEXP threads - number of threads to read each block with. NULL uses
+ **                the R_THREADS environment variable (1 if it is not set)
+ **
+ ** RETURNS an external pointer to a cel_block_iterator. All the files are
+ ** checked (as in read_abatch) and the reading of the first block started.
+ **
+ *************************************************************************/
+
+SEXP R_cel_block_iterator(SEXP filenames, SEXP block_size, SEXP rm_mask, SEXP rm_outliers, SEXP rm_extra, SEXP ref_cdfName, SEXP ref_dim, SEXP threads){
+
+  int i, n_files, n_block;
+  int ref_dim_1, ref_dim_2;
+  const char *cdfName;
+  int *formats;
+  long *data_offsets;
+  cel_block_iterator *iter;
+  SEXP iterator;
+
+  if (!isString(filenames) || GET_LENGTH(filenames) == 0)
+    error("R_cel_block_iterator: argument 'filenames' must be a non-empty character vector");
+
+  n_block = asInteger(block_size);
+  if (n_block == NA_INTEGER || n_block <= 0)
+    error("R_cel_block_iterator: argument 'block_size' must be a positive integer");
+
+  n_files = GET_LENGTH(filenames);
+  if (n_block > n_files){
+    n_block = n_files;
+  }
+  ref_dim_1 = INTEGER(ref_dim)[0];
+  ref_dim_2 = INTEGER(ref_dim)[1];
+  cdfName = CHAR(STRING_ELT(ref_cdfName,0));
+
+  /* check all the files first, so that the reading of the blocks can not fail on a wrong file */
+  formats = (int *)R_alloc(n_files, sizeof(int));
+  data_offsets = (long *)R_alloc(n_files, sizeof(long));
+  cel_catalog_open();
+  for (i = 0; i < n_files; i++){
+    formats[i] = check_cel_file_cdf(CHAR(STRING_ELT(filenames, i)), cdfName, ref_dim_1, ref_dim_2, &data_offsets[i]);
+  }
+  cel_catalog_sync();
+
+  iter = R_Calloc(1, cel_block_iterator);
+  iter->n_files = n_files;
+  iter->block_size = n_block;
+  iter->ref_dim_1 = ref_dim_1;
+  iter->ref_dim_2 = ref_dim_2;
+  if (asInteger(rm_extra)){
+    iter->rm_mask = 1;
+    iter->rm_outliers = 1;
+  } else {
+    iter->rm_mask = asInteger(rm_mask);
+    iter->rm_outliers = asInteger(rm_outliers);
+  }
+  iter->num_threads = batch_num_threads(threads);
+  iter->buffers[0] = R_Calloc((size_t)ref_dim_1*ref_dim_2*n_block, double);
+  iter->buffers[1] = R_Calloc((size_t)ref_dim_1*ref_dim_2*n_block, double);
+  iter->filenames = R_Calloc(n_files, const char *);
+  iter->formats = R_Calloc(n_files, int);
+  iter->data_offsets = R_Calloc(n_files, long);
+  iter->status = R_Calloc(n_block, int);
+  iter->messages = R_Calloc(n_block, char *);
+#ifdef USE_PTHREADS
+  iter->thread_ids = R_Calloc(iter->num_threads, pthread_t);
+  iter->args = R_Calloc(iter->num_threads, struct cel_block_thread_data);
+#endif
+
+  /* the external pointer keeps filenames, whose CHARs iter->filenames points to */
+  PROTECT(iterator = R_MakeExternalPtr(iter, install("cel_block_iterator"), filenames));
+  R_RegisterCFinalizerEx(iterator, cel_block_iterator_finalizer, TRUE);
+
+  for (i = 0; i < n_files; i++){
+    iter->filenames[i] = CHAR(STRING_ELT(filenames, i));
+    iter->formats[i] = formats[i];
+    iter->data_offsets[i] = data_offsets[i];
+#if !defined HAVE_ZLIB
+    if (iter->formats[i] == CEL_FORMAT_GZTEXT)
+      error("Compress option not supported on your platform\n");
+#endif
+  }
+
+  read_prefetch_begin();
+  start_cel_block(iter, 0);
+
+  UNPROTECT(1);
+  return iterator;
+}
+
+
+/*************************************************************************
+ **
+ ** SEXP R_cel_block_iterator_next(SEXP iterator)
+ **
+ ** SEXP iterator - made by R_cel_block_iterator
+ **
+ ** RETURNS the intensities of the next block of files as a cells by files
+ ** matrix with the file names as column names, or NULL when all the 
+ ** blocks have been returned. Each call returns a new matrix, which
+ ** is not touched by later calls.
+ **
+ *************************************************************************/
+
+SEXP R_cel_block_iterator_next(SEXP iterator){
+
+  cel_block_iterator *iter = get_cel_block_iterator(iterator);
+  int j, first, n, buffer;
+  size_t n_cells;
+  SEXP block, dimnames, names;
+  char message[READ_ERROR_MESSAGE_SIZE];
+
+  if (iter == NULL || !iter->pending){
+    return R_NilValue;
+  }
+
+  finish_cel_block(iter);
+  iter->pending = 0;
+  first = iter->pending_first;
+  n = iter->pending_n;
+  buffer = iter->pending_buffer;
+
+  /* the warnings kept by the threads, ahead of any error */
+  for (j = 0; j < n; j++){
+    if (iter->status[j] != CEL_BLOCK_ERROR && iter->messages[j] != NULL){
+      Rprintf("%s", iter->messages[j]);
+      R_Free(iter->messages[j]);
+    }
+  }
+
+  for (j = 0; j < n; j++){
+    if (iter->status[j] != CEL_BLOCK_OK){
+      /* nothing more is read after an error */
+      iter->next_file = iter->n_files;
+      if (iter->status[j] == CEL_BLOCK_ERROR){
+	strncpy(message, iter->messages[j], READ_ERROR_MESSAGE_SIZE - 1);
+	message[READ_ERROR_MESSAGE_SIZE - 1] = '\0';
+	for (j = 0; j < n; j++){
+	  if (iter->messages[j] != NULL){
+	    R_Free(iter->messages[j]);
+	  }
+	}
+	error("%s", message);
+      } else {
+	error("It appears that the file %s is corrupted.\n", iter->filenames[first + j]);
       }
     }
   }
 
-  R_Free(myCEL->intensities);
-  if (!read_intensities_only){
-    R_Free(myCEL->stddev);
-    R_Free(myCEL->npixels);
+  n_cells = (size_t)iter->ref_dim_1*iter->ref_dim_2;
+  PROTECT(block = allocMatrix(REALSXP, iter->ref_dim_1*iter->ref_dim_2, n));
+  memcpy(REAL(block), iter->buffers[buffer], n_cells*n*sizeof(double));
+
+  PROTECT(dimnames = allocVector(VECSXP, 2));
+  PROTECT(names = allocVector(STRSXP, n));
+  for (j = 0; j < n; j++){
+    SET_STRING_ELT(names, j, mkChar(iter->filenames[first + j]));
   }
+  SET_VECTOR_ELT(dimnames, 1, names);
+  setAttrib(block, R_DimNamesSymbol, dimnames);
 
-  if (!myCEL->multichannel){
-    R_Free(myCEL->masks_x[0]);
-    R_Free(myCEL->masks_y[0]);
-    R_Free(myCEL->outliers_x[0]);
-    R_Free(myCEL->outliers_y[0]);
+  /* read ahead into the other buffer while this block is used */
+  start_cel_block(iter, 1 - buffer);
+
+  UNPROTECT(3);
+  return block;
+}
+
+
+/*************************************************************************
+ **
+ ** SEXP R_cel_block_iterator_free(SEXP iterator)
+ **
+ ** stop a cel_block_iterator, waiting for any reading in progress, and
+ ** release its memory. Later calls to R_cel_block_iterator_next return NULL.
+ **
+ *************************************************************************/
+
+SEXP R_cel_block_iterator_free(SEXP iterator){
+
+  get_cel_block_iterator(iterator);
+  cel_block_iterator_finalizer(iterator);
+  R_SetExternalPtrProtected(iterator, R_NilValue);
+  return R_NilValue;
+}
+
+
+/*************************************************************************
+ **
+ ** Reading a subset of the cells of many CEL files
+ **
+ ** In uncompressed binary (version 4) and command console CEL files the
+ ** cells are fixed size records in cell order, starting at a known 
+ ** offset, so only the byte ranges holding the wanted cells need to be
+ ** read. The wanted cells are sorted once and gathered into runs, each
+ ** run being read with a single fseek() and fread(). Cells closer than
+ ** CELL_RUN_GAP records are put in the same run, as reading over a short
+ ** gap is cheaper than seeking past it. Files in other formats are read 
+ ** in full and the wanted cells picked out.
+ **
+ *************************************************************************/
+
+#define CELL_RUN_GAP 512
+#define CELL_RUN_MAX 65536
+
+#define BINARY_CELL_RECORD 10   /* float32 mean, float32 sd, int16 npixels */
+#define GENERIC_CELL_RECORD 4   /* float32 mean */
+
+typedef struct{
+  const char *filename;
+  int format;
+  long data_offset;       /* of the first cell, -1 if not known */
+  double *values;         /* n_wanted long */
+} cel_cells_file;
+
+typedef struct{
+  const int *sorted;      /* the wanted cells (from 0) in increasing order */
+  const int *position;    /* where each of sorted goes in the output */
+  int n_wanted;
+  int n_cells;
+  int cols;
+} cel_cells_wanted;
+
+
+static double cell_float32(const unsigned char *bytes, int big_endian){
+
+  union{
+    float f;
+    unsigned int u;
+  } value;
+
+  if (big_endian){
+    value.u = ((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16) | ((unsigned int)bytes[2] << 8) | (unsigned int)bytes[3];
   } else {
-    for (k =0; k < myCEL->multichannel; k++){
-         R_Free(myCEL->masks_x[k]);
-	 R_Free(myCEL->masks_y[k]);
-	 R_Free(myCEL->outliers_x[k]);
-	 R_Free(myCEL->outliers_y[k]);
+    value.u = ((unsigned int)bytes[3] << 24) | ((unsigned int)bytes[2] << 16) | ((unsigned int)bytes[1] << 8) | (unsigned int)bytes[0];
+  }
+  return (double)value.f;
+}
+
+
+/*************************************************************************
+ **
+ ** static int read_cel_cells_fixed(const cel_cells_file *file, const cel_cells_wanted *wanted)
+ **
+ ** read the wanted cells of a binary or command console file a run at a
+ ** time. Returns one of the CEL_BLOCK_ values.
+ **
+ *************************************************************************/
+
+static int read_cel_cells_fixed(const cel_cells_file *file, const cel_cells_wanted *wanted){
+
+  int record_size = (file->format == CEL_FORMAT_BINARY) ? BINARY_CELL_RECORD : GENERIC_CELL_RECORD;
+  int big_endian = (file->format == CEL_FORMAT_GENERIC);
+  int k = 0, end, m, span;
+  int status = CEL_BLOCK_OK;
+  unsigned char *buffer;
+  double value;
+  FILE *infile;
+
+  read_timing_opened();
+  if ((infile = fopen(file->filename, "rb")) == NULL){
+    return CEL_BLOCK_UNREADABLE;
+  }
+  buffer = R_Calloc((size_t)CELL_RUN_MAX*record_size, unsigned char);
+
+  while (k < wanted->n_wanted){
+    end = k;
+    while (end + 1 < wanted->n_wanted && wanted->sorted[end + 1] - wanted->sorted[end] <= CELL_RUN_GAP &&
+	   wanted->sorted[end + 1] - wanted->sorted[k] < CELL_RUN_MAX){
+      end++;
+    }
+    span = wanted->sorted[end] - wanted->sorted[k] + 1;
+    if (fseek(infile, file->data_offset + (long)wanted->sorted[k]*record_size, SEEK_SET) != 0 ||
+	fread(buffer, record_size, span, infile) != (size_t)span){
+      status = CEL_BLOCK_CORRUPTED;
+      break;
+    }
+    for (m = k; m <= end; m++){
+      value = cell_float32(&buffer[(size_t)(wanted->sorted[m] - wanted->sorted[k])*record_size], big_endian);
+      /* the same check as read_binarycel_file_intensities */
+      if (file->format == CEL_FORMAT_BINARY && (value < 0 || value > 65536 || ISNAN(value))){
+	status = CEL_BLOCK_CORRUPTED;
+	break;
+      }
+      file->values[wanted->position[m]] = value;
+    }
+    if (status != CEL_BLOCK_OK){
+      break;
     }
+    k = end + 1;
   }
 
-  R_Free(myCEL->masks_x);
-  R_Free(myCEL->masks_y);
-  R_Free(myCEL->outliers_x);
-  R_Free(myCEL->outliers_y);
-  
-  R_Free(myCEL);
+  R_Free(buffer);
+  fclose(infile);
+  return status;
+}
+
+
+/*************************************************************************
+ **
+ ** static int read_cel_cells_file(const cel_cells_file *file, const cel_cells_wanted *wanted)
+ **
+ ** read the wanted cells of a file, reading only them where the format
+ ** allows. Returns one of the CEL_BLOCK_ values.
+ **
+ *************************************************************************/
+
+static int read_cel_cells_file(const cel_cells_file *file, const cel_cells_wanted *wanted){
+
+  read_timer timer;
+  double *intensity;
+  int k, status = CEL_BLOCK_OK;
+
+  if ((file->format == CEL_FORMAT_BINARY || file->format == CEL_FORMAT_GENERIC) && file->data_offset >= 0){
+    read_timing_start(&timer, TIMING_READ);
+    status = read_cel_cells_fixed(file, wanted);
+    read_timing_stop(&timer, NULL);
+    return status;
+  }
+
+  intensity = R_Calloc(wanted->n_cells, double);
+  read_timing_start(&timer, TIMING_READ);
+  if (read_cel_format_intensities(file->filename, file->format, file->data_offset, intensity, 0, wanted->n_cells, 1, wanted->cols)){
+    status = CEL_BLOCK_CORRUPTED;
+  } else {
+    for (k = 0; k < wanted->n_wanted; k++){
+      file->values[wanted->position[k]] = intensity[wanted->sorted[k]];
+    }
+  }
+  read_timing_stop(&timer, file->filename);
+  R_Free(intensity);
+  return status;
+}
+
+
+#ifdef USE_PTHREADS
+struct cel_cells_thread_data{
+  cel_cells_file *files;
+  const cel_cells_wanted *wanted;
+  int *status;
+  char **messages;
+  int n_files;
+  int t;
+  int num_threads;
+};
+
+
+static void *read_cel_cells_group(void *data){
+  struct cel_cells_thread_data *args = (struct cel_cells_thread_data *) data;
+  read_error_trap trap;
+  int i;
+
+  read_timing_thread_begin();
+  for (i = args->t; i < args->n_files; i+= args->num_threads){
+    read_error_catch(&trap);
+    if (setjmp(trap.env) == 0){
+      args->status[i] = read_cel_cells_file(&(args->files[i]), args->wanted);
+    } else {
+      args->status[i] = CEL_BLOCK_ERROR;
+      args->messages[i] = read_error_message(&trap);
+    }
+  }
+  read_error_release();
+  read_timing_thread_end();
+  return NULL;
+}
+#endif
 
-  UNPROTECT(1);
-  return theCEL;
 
+/*************************************************************************
+ **
+ ** static void cel_cells_layout(cel_cells_file *file, int *cols, int *rows)
+ **
+ ** find the format, dimensions and (for binary and command console 
+ ** files) the offset of the first cell of a file, from the catalog when
+ ** it is there.
+ **
+ *************************************************************************/
+
+static void cel_cells_layout(cel_cells_file *file, int *cols, int *rows){
+
+  const cel_catalog_entry *entry = cel_catalog_lookup(file->filename);
+  detailed_header_info header_info;
+
+  if (entry != NULL){
+    file->format = entry->format;
+    file->data_offset = (long)entry->data_offset;
+    *cols = entry->header.cols;
+    *rows = entry->header.rows;
+  } else {
+    file->format = detect_cel_file_format(file->filename);
+    if (file->format == CEL_FORMAT_UNKNOWN){
+      not_a_cel_file_error(file->filename);
+    }
+    file->data_offset = format_detailed_header(file->filename, file->format, &header_info);
+    *cols = header_info.cols;
+    *rows = header_info.rows;
+    if (file->data_offset < 0){
+      file->data_offset = (long)cel_data_offset(file->filename, file->format);
+    }
+    if (cel_catalog_active()){
+      catalog_cel_file(file->filename, file->format, &header_info, file->data_offset);
+    }
+    free_detailed_header(&header_info);
+  }
+}
+
+
+/*************************************************************************
+ **
+ ** SEXP R_read_cel_cells(SEXP filenames, SEXP cells, SEXP threads)
+ **
+ ** SEXP filenames - character vector of CEL file names, all with the
+ **                  same dimensions
+ ** SEXP cells - integer vector of the cells to read, counting from 1 in
+ **              the order of read_abatch (cell x,y is x + cols*y + 1)
+ ** SEXP threads - number of threads to use. NULL uses the R_THREADS
+ **                environment variable (1 if it is not set)
+ **
+ ** RETURNS a numeric matrix of the intensities with a row for each of 
+ ** cells and a column for each file.
+ **
+ *************************************************************************/
+
+SEXP R_read_cel_cells(SEXP filenames, SEXP cells, SEXP threads){
+
+  int i, k, n_files, n_wanted;
+  int cols = 0, rows = 0, file_cols, file_rows;
+  int *sorted, *position, *status;
+  cel_cells_file *files;
+  cel_cells_wanted wanted;
+  read_timer timer;
+  SEXP intensity, dimnames;
+#ifdef USE_PTHREADS
+  int num_threads;
+  char **messages;
+  pthread_t *thread_ids;
+  pthread_attr_t attr;
+  struct cel_cells_thread_data *args;
+  size_t stacksize = PTHREAD_STACK_MIN + 0x40000;
+  int returnCode, t;
+#endif
+
+  if (!isString(filenames) || GET_LENGTH(filenames) == 0)
+    error("R_read_cel_cells: argument 'filenames' must be a non-empty character vector");
+  if (!isInteger(cells))
+    error("R_read_cel_cells: argument 'cells' must be an integer vector");
+
+#ifdef USE_PTHREADS
+  num_threads = batch_num_threads(threads);
+#endif
+  n_files = GET_LENGTH(filenames);
+  n_wanted = GET_LENGTH(cells);
+
+  files = (cel_cells_file *)R_alloc(n_files, sizeof(cel_cells_file));
+  status = (int *)R_alloc(n_files, sizeof(int));
+
+  /* the formats and offsets are found here, so the threads only read */
+  cel_catalog_open();
+  for (i = 0; i < n_files; i++){
+    files[i].filename = CHAR(STRING_ELT(filenames, i));
+    read_timing_start(&timer, TIMING_FORMAT);
+    cel_cells_layout(&files[i], &file_cols, &file_rows);
+    read_timing_stop(&timer, NULL);
+    if (i == 0){
+      cols = file_cols;
+      rows = file_rows;
+    } else if (file_cols != cols || file_rows != rows){
+      cel_catalog_sync();
+      error("Cel file %s does not seem to have the correct dimensions", files[i].filename);
+    }
+  }
+  cel_catalog_sync();
+
+  sorted = (int *)R_alloc(n_wanted + 1, sizeof(int));
+  position = (int *)R_alloc(n_wanted + 1, sizeof(int));
+  for (k = 0; k < n_wanted; k++){
+    if (INTEGER(cells)[k] == NA_INTEGER || INTEGER(cells)[k] < 1 || INTEGER(cells)[k] > cols*rows)
+      error("R_read_cel_cells: cells must be between 1 and %d", cols*rows);
+    sorted[k] = INTEGER(cells)[k] - 1;
+    position[k] = k;
+  }
+  if (n_wanted > 1){
+    R_qsort_int_I(sorted, position, 1, n_wanted);
+  }
+  wanted.sorted = sorted;
+  wanted.position = position;
+  wanted.n_wanted = n_wanted;
+  wanted.n_cells = cols*rows;
+  wanted.cols = cols;
+
+  PROTECT(intensity = allocMatrix(REALSXP, n_wanted, n_files));
+  for (i = 0; i < n_files; i++){
+    files[i].values = REAL(intensity) + (size_t)i*n_wanted;
+  }
+
+#ifdef USE_PTHREADS
+  if (num_threads > n_files){
+    num_threads = n_files;
+  }
+  if (num_threads > 1){
+    thread_ids = (pthread_t *) R_Calloc(num_threads, pthread_t);
+    args = (struct cel_cells_thread_data *) R_Calloc(num_threads, struct cel_cells_thread_data);
+    messages = R_Calloc(n_files, char *);
+    
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    pthread_attr_setstacksize (&attr, stacksize);
+
+    for (t = 0; t < num_threads; t++){
+      args[t].files = files;
+      args[t].wanted = &wanted;
+      args[t].status = status;
+      args[t].messages = messages;
+      args[t].n_files = n_files;
+      args[t].t = t;
+      args[t].num_threads = num_threads;
+      returnCode = pthread_create(&thread_ids[t], &attr, read_cel_cells_group, (void *) &(args[t]));
+      if (returnCode){
+	error("ERROR; return code from pthread_create() is %d\n", returnCode);
+      }
+    }
+    for (t = 0; t < num_threads; t++){
+      returnCode = pthread_join(thread_ids[t], NULL);
+      if (returnCode){
+	error("ERROR; return code from pthread_join(thread #%d) is %d\n", t, returnCode);
+      }
+    }
+    pthread_attr_destroy(&attr);
+    R_Free(thread_ids);
+    R_Free(args);
+    read_error_raise(messages, n_files);
+  } else {
+    for (i = 0; i < n_files; i++){
+      status[i] = read_cel_cells_file(&files[i], &wanted);
+    }
+  }
+#else
+  for (i = 0; i < n_files; i++){
+    status[i] = read_cel_cells_file(&files[i], &wanted);
+  }
+#endif
+
+  for (i = 0; i < n_files; i++){
+    if (status[i] == CEL_BLOCK_UNREADABLE){
+      error("Could not open file %s", files[i].filename);
+    } else if (status[i] != CEL_BLOCK_OK){
+      error("It appears that the file %s is corrupted.", files[i].filename);
+    }
+  }
+
+  PROTECT(dimnames = allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(dimnames, 1, filenames);
+  setAttrib(intensity, R_DimNamesSymbol, dimnames);
+
+  UNPROTECT(2);
+  return intensity;
 }
@@ -17,6 +17,11 @@
  ** Aug 25, 2007 - Move file reading functions to centralized location
  ** Mar 14, 2008 - Fix reading of version number for big endian platforms 
  ** Jan 15, 2008 - Fix VECTOR_ELT/STRING_ELT issues
+ ** Oct 16, 2026 - probe records are read a block at a time. Add ReadBPMAPFileIntoRListCompact
+ **                which avoids making a string for every probe
+ ** Oct 16, 2026 - table driven unpacking of probe sequences (with an SSSE3 version)
+ ** Oct 16, 2026 - Add ReadBPMAPSequences, which reads one sequence at a time and can 
+ **                select sequences by name and probes by position. Close the file when done.
  **
  *******************************************************************/
 
@@ -25,9 +30,14 @@
 
 #include "stdlib.h"
 #include "stdio.h"
+#include <string.h>
 
 #include "fread_functions.h"
 
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
 
 
 /****************************************************************
@@ -73,7 +83,7 @@ static SEXP ReadBPMAPHeader(FILE *infile){
   SEXP tmpSXP;
 
 
-  char *Magicnumber = R_alloc(8,sizeof(char));
+  char *Magicnumber = R_alloc(9,sizeof(char));
   float version_number = 0.0;
   
   unsigned int unsigned_version_number_int;
@@ -85,6 +95,7 @@ static SEXP ReadBPMAPHeader(FILE *infile){
 
 
   fread_be_char(Magicnumber,8,infile);
+  Magicnumber[8] = '\0';
 
   if (strncmp(Magicnumber,"PHT7",4) !=0){
     error("Based on the magic number which was %s, this does not appear to be a BPMAP file",Magicnumber);
@@ -193,7 +204,7 @@ static SEXP ReadBPMAPSeqDescription(FILE *infile, float version, int nseq){
 
     if (version == 3.00){
       PROTECT(CurSequenceDescription=allocVector(VECSXP,8)); 
-      PROTECT(tmpSXP=allocVector(STRSXP,7));
+      PROTECT(tmpSXP=allocVector(STRSXP,8));
       SET_STRING_ELT(tmpSXP,0,mkChar("Name"));
       SET_STRING_ELT(tmpSXP,1,mkChar("ProbeMappingType"));
       SET_STRING_ELT(tmpSXP,2,mkChar("SequenceFileOffset"));
@@ -382,432 +393,541 @@ static SEXP ReadBPMAPSeqDescription(FILE *infile, float version, int nseq){
 
 
 
-static void packedSeqTobaseStr(unsigned char probeseq[7], char *dest){
-
-  unsigned char currentchar;
-  
-  unsigned char firsttwobits;
-  unsigned char secondtwobits;
-  unsigned char thirdtwobits;
-  unsigned char fourthtwobits;
+/****************************************************************
+ **
+ ** Probe sequences are packed 4 bases to a byte, 2 bits per base 
+ ** (A=0, C=1, G=2, T=3) with the first base in the high bits. The 
+ ** 25 bases of a probe take 7 bytes (the last 3 bases of the last 
+ ** byte are unused).
+ **
+ ** unpackBPMAPSeqs() expands the sequences of a block of probes 
+ ** at once, giving 28 characters for each probe. It either looks 
+ ** up all 4 bases of each byte in a 256 entry table or, when 
+ ** compiled with SSSE3, expands 16 bytes at a time using pshufb 
+ ** to look up the 2 bases of each nibble.
+ **
+ *******************************************************************/
 
-  int i;
+#define BPMAP_UNPACKED_SEQ_SIZE 28
 
+static char bpmap_base_lut[256][4];
+static int bpmap_base_lut_ready = 0;
 
-  /* Rprintf("\n\n\n\n\n"); */
+static void init_bpmap_base_lut(void){
 
+  const char bases[4] = {'A','C','G','T'};
+  int i;
   
-  for (i =0; i < 6;i++){
-    currentchar = probeseq[i];
-    
-    /* extract first two bits */
-    firsttwobits = (currentchar & 192);
-    secondtwobits = (currentchar & 48);
-    thirdtwobits  = (currentchar & 12); 
-    fourthtwobits  = (currentchar & 3);
+  for (i = 0; i < 256; i++){
+    bpmap_base_lut[i][0] = bases[(i >> 6) & 3];
+    bpmap_base_lut[i][1] = bases[(i >> 4) & 3];
+    bpmap_base_lut[i][2] = bases[(i >> 2) & 3];
+    bpmap_base_lut[i][3] = bases[i & 3];
+  }
+  bpmap_base_lut_ready = 1;
+}
 
 
-    
-    firsttwobits = firsttwobits >> 6;
-    secondtwobits = secondtwobits >> 4;
-    thirdtwobits =  thirdtwobits >> 2;
-    
-    /*    Rprintf("%x %x %x %x\n",firsttwobits,secondtwobits,thirdtwobits,fourthtwobits); */
+static void unpackBPMAPSeqs(const unsigned char *packed, int nprobes, char *dest){
 
-    
-
-    
-    if (firsttwobits == 0){
-      dest[4*i +0]='A';
-    }
-    if (firsttwobits == 1){
-      dest[4*i +0]='C';
-    }
-    if (firsttwobits == 2){
-      dest[4*i +0]='G';
-    }
-    if (firsttwobits == 3){
-      dest[4*i +0]='T';
-    }
+  int n_bytes = 7*nprobes;
+  int i = 0;
   
-    if (secondtwobits == 0){
-      dest[4*i +1]='A';
-    }
-    if (secondtwobits == 1){
-      dest[4*i +1]='C';
-    }
-    if (secondtwobits == 2){
-      dest[4*i +1]='G';
-    }
-    if (secondtwobits == 3){
-      dest[4*i +1]='T';
-    }
-
-    if (thirdtwobits == 0){
-      dest[4*i +2]='A';
-    }
-    if (thirdtwobits == 1){
-      dest[4*i +2]='C';
-    }
-    if (thirdtwobits == 2){
-      dest[4*i +2]='G';
-    }
-    if (thirdtwobits == 3){
-      dest[4*i +2]='T';
-    }
-    
-    if (fourthtwobits == 0){
-      dest[4*i +3]='A';
+#if defined(__SSSE3__)
+  const __m128i first_base = _mm_setr_epi8('A','A','A','A','C','C','C','C','G','G','G','G','T','T','T','T');
+  const __m128i second_base = _mm_setr_epi8('A','C','G','T','A','C','G','T','A','C','G','T','A','C','G','T');
+  const __m128i low_nibble = _mm_set1_epi8(0x0f);
+  __m128i bytes, hi, lo, b0, b1, b2, b3, hi_pairs, lo_pairs;
+  int k;
+  char expanded[64];
+
+  /* destination is 4 characters per byte, except that the 7 bytes of 
+     a probe go to 28 characters so the stride happens to match */
+  for (; i + 16 <= n_bytes; i+= 16){
+    bytes = _mm_loadu_si128((const __m128i *)&packed[i]);
+    hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble);
+    lo = _mm_and_si128(bytes, low_nibble);
+    b0 = _mm_shuffle_epi8(first_base, hi);
+    b1 = _mm_shuffle_epi8(second_base, hi);
+    b2 = _mm_shuffle_epi8(first_base, lo);
+    b3 = _mm_shuffle_epi8(second_base, lo);
+    hi_pairs = _mm_unpacklo_epi8(b0, b1);
+    lo_pairs = _mm_unpacklo_epi8(b2, b3);
+    _mm_storeu_si128((__m128i *)&expanded[0], _mm_unpacklo_epi16(hi_pairs, lo_pairs));
+    _mm_storeu_si128((__m128i *)&expanded[16], _mm_unpackhi_epi16(hi_pairs, lo_pairs));
+    hi_pairs = _mm_unpackhi_epi8(b0, b1);
+    lo_pairs = _mm_unpackhi_epi8(b2, b3);
+    _mm_storeu_si128((__m128i *)&expanded[32], _mm_unpacklo_epi16(hi_pairs, lo_pairs));
+    _mm_storeu_si128((__m128i *)&expanded[48], _mm_unpackhi_epi16(hi_pairs, lo_pairs));
+    for (k = 0; k < 64; k++){
+      dest[4*i + k] = expanded[k];
     }
-    if (fourthtwobits == 1){
-      dest[4*i +3]='C';
-    }
-    if (fourthtwobits == 2){
-      dest[4*i +3]='G';
-    }
-    if (fourthtwobits == 3){
-      dest[4*i +3]='T';
-    }
-
-    /* Rprintf("%c%c%c%c\n",dest[4*i],dest[4*i +1],dest[4*i +2], dest[4*i +3]); */
   }
+#endif
 
-  currentchar = probeseq[6];
-  
-  /* extract first two bits */
-    
-  firsttwobits = (currentchar & 192);
-  firsttwobits = firsttwobits >> 6;
-  if (firsttwobits == 0){
-    dest[24]='A';
-  }
-  if (firsttwobits == 1){
-    dest[24]='C';
+  if (!bpmap_base_lut_ready){
+    init_bpmap_base_lut();
   }
-  if (firsttwobits == 2){
-    dest[24]='G';
-  }
-  if (firsttwobits == 3){
-    dest[24]='T';
+  for (; i < n_bytes; i++){
+    memcpy(&dest[4*i], bpmap_base_lut[packed[i]], 4);
   }
 }
 
 
 
 
+/****************************************************************
+ **
+ ** Probe records
+ **
+ ** Each probe is a fixed size record (all big endian)
+ **
+ ** x, y                  4 bytes each
+ ** x.mm, y.mm            4 bytes each (only when probe mapping type is 0, ie PM/MM)
+ ** probe length          1 byte
+ ** packed sequence       7 bytes
+ ** match score           4 bytes
+ ** PM position           4 bytes
+ ** strand                1 byte
+ **
+ ** Records are read BPMAP_PROBE_BLOCK at a time and decoded 
+ ** into columns.
+ **
+ *******************************************************************/
 
+#define BPMAP_PMMM_RECORD_SIZE 33
+#define BPMAP_PMONLY_RECORD_SIZE 25
+#define BPMAP_PROBE_BLOCK 4096
+
+typedef struct{
+  int *x;
+  int *y;
+  int *x_mm;                    /* NULL for PM only probes */
+  int *y_mm;
+  int *probe_length;
+  unsigned char *packed_seq;    /* 7 bytes for each probe */
+  double *match_score;
+  int *position;
+  int *strand;                  /* 1 forward, 2 reverse */
+} bpmap_probe_columns;
+
+
+static unsigned int bpmap_be_uint32(const unsigned char *buffer){
+  return ((unsigned int)buffer[0] << 24) | ((unsigned int)buffer[1] << 16) | ((unsigned int)buffer[2] << 8) | (unsigned int)buffer[3];
+}
 
 
+/****************************************************************
+ **
+ ** static double bpmap_match_score(const unsigned char *buffer)
+ **
+ ** matchScore is treated same as version number in header. This 
+ ** reproduces the conversions that were done when it was read 
+ ** with fread_float32/fread_be_float32 
+ **
+ ***************************************************************/
 
-static SEXP readBPMAPSeqIdPositionInfo(FILE *infile, float version, int nseq, SEXP seqDesc){
+static double bpmap_match_score(const unsigned char *buffer){
 
+  float matchScore;
+  int matchScore_int;
 
-  SEXP SeqIdPositionInfoList;
-  SEXP curSeqIdPositionInfo;
-  SEXP PositionInfo= R_NilValue;
-  SEXP PositionInfoRowNames;
+  memcpy(&matchScore, buffer, sizeof(float));
+#ifdef WORDS_BIGENDIAN
+  /* swap, cast to integer, swap bytes and cast back to float */
+  swap_float_4(&matchScore);
+#endif
+  /* cast to integer, swap bytes, cast to float */ 
+  matchScore_int = (int)matchScore;
+  matchScore_int=(((matchScore_int>>24)&0xff) | ((matchScore_int&0xff)<<24) |
+		  ((matchScore_int>>8)&0xff00) | ((matchScore_int&0xff00)<<8));
+  matchScore = (float)matchScore_int;
+
+  return (double)matchScore;
+}
 
 
-  SEXP tmpSEXP;
+/****************************************************************
+ **
+ ** static int bpmap_in_range(const unsigned char *record, int record_size, const double *range)
+ **
+ ** is the PM position of a probe record within range[0] to range[1]
+ ** (inclusive). A NULL range includes every probe.
+ **
+ ***************************************************************/
 
-  SEXP xPM= R_NilValue,yPM= R_NilValue,xMM= R_NilValue,yMM= R_NilValue;
-  SEXP PMprobeLength= R_NilValue;
-  SEXP probeSeqString= R_NilValue;
-  SEXP MatchScore= R_NilValue;
-  SEXP PMposition= R_NilValue;
-  SEXP Strand= R_NilValue;
+static int bpmap_in_range(const unsigned char *record, int record_size, const double *range){
 
-  char buf[10];
+  double position;
 
-  char *dest;
+  if (range == NULL){
+    return 1;
+  }
+  /* PM position is followed only by the strand byte */
+  position = (double)(int)bpmap_be_uint32(record + record_size - 5);
+  return (position >= range[0] && position <= range[1]);
+}
 
 
-  int nprobes=0;
-  int probe_mapping_type=0;
-  int i,j;
+/****************************************************************
+ **
+ ** static int readBPMAPProbes(FILE *infile, int probe_mapping_type, int nprobes, const double *range, bpmap_probe_columns *cols)
+ **
+ ** read the nprobes probe records of a sequence into cols, keeping
+ ** only those with PM position in range (all of them if range is NULL). 
+ ** Returns the number kept.
+ **
+ ***************************************************************/
 
+static int readBPMAPProbes(FILE *infile, int probe_mapping_type, int nprobes, const double *range, bpmap_probe_columns *cols){
 
-  unsigned int SeqId;
+  int record_size = (probe_mapping_type == 0) ? BPMAP_PMMM_RECORD_SIZE : BPMAP_PMONLY_RECORD_SIZE;
+  unsigned char *buffer = R_Calloc(BPMAP_PROBE_BLOCK*record_size, unsigned char);
+  unsigned char *record;
+  int n_block;
+  int i, n_read = 0, j = 0;
 
-  unsigned int x;
-  unsigned int y;
-  
-  unsigned int x_mm;
-  unsigned int y_mm;
+  while (n_read < nprobes){
+    n_block = (nprobes - n_read < BPMAP_PROBE_BLOCK) ? nprobes - n_read : BPMAP_PROBE_BLOCK;
+    if (fread(buffer, record_size, n_block, infile) != (size_t)n_block){
+      R_Free(buffer);
+      error("BPMAP file ended while reading probe information. Perhaps it is truncated.");
+    }
+    n_read+= n_block;
+    
+    for (i = 0; i < n_block; i++){
+      record = &buffer[i*record_size];
+      if (!bpmap_in_range(record, record_size, range)){
+	continue;
+      }
+      cols->x[j] = (int)bpmap_be_uint32(record);
+      cols->y[j] = (int)bpmap_be_uint32(record + 4);
+      record+= 8;
+      if (probe_mapping_type == 0){
+	cols->x_mm[j] = (int)bpmap_be_uint32(record);
+	cols->y_mm[j] = (int)bpmap_be_uint32(record + 4);
+	record+= 8;
+      }
+      cols->probe_length[j] = record[0];
+      memcpy(&cols->packed_seq[7*j], record + 1, 7);
+      cols->match_score[j] = bpmap_match_score(record + 8);
+      cols->position[j] = (int)bpmap_be_uint32(record + 12);
+      cols->strand[j] = (record[16] == 1) ? 1 : 2;
+      j++;
+    }
+  }
+  R_Free(buffer);
+  return j;
+}
 
-  unsigned char probelength;
 
-  unsigned char probeseq[7];
+/****************************************************************
+ **
+ ** static int countBPMAPProbesInRange(FILE *infile, int probe_mapping_type, int nprobes, const double *range)
+ **
+ ** count the probe records of a sequence with PM position in range
+ ** and then return to the start of the records, so that only the 
+ ** probes that are kept need to be allocated.
+ **
+ ***************************************************************/
 
-  float matchScore;
-  int matchScore_int;
+static int countBPMAPProbesInRange(FILE *infile, int probe_mapping_type, int nprobes, const double *range){
 
-  unsigned int positionPM;
-  unsigned char strand;
+  int record_size = (probe_mapping_type == 0) ? BPMAP_PMMM_RECORD_SIZE : BPMAP_PMONLY_RECORD_SIZE;
+  unsigned char *buffer = R_Calloc(BPMAP_PROBE_BLOCK*record_size, unsigned char);
+  int n_block;
+  int i, n_read = 0, n_kept = 0;
 
-  
-  PROTECT(SeqIdPositionInfoList = allocVector(VECSXP,nseq));
-  
-  for (i =0; i < nseq; i++){
-    fread_be_uint32(&SeqId,1,infile);
-    /*Rprintf("Seq id:%u\n",SeqId);*/
-    
-    PROTECT(curSeqIdPositionInfo = allocVector(VECSXP,2));
+  while (n_read < nprobes){
+    n_block = (nprobes - n_read < BPMAP_PROBE_BLOCK) ? nprobes - n_read : BPMAP_PROBE_BLOCK;
+    if (fread(buffer, record_size, n_block, infile) != (size_t)n_block){
+      R_Free(buffer);
+      error("BPMAP file ended while reading probe information. Perhaps it is truncated.");
+    }
+    n_read+= n_block;
+    for (i = 0; i < n_block; i++){
+      n_kept+= bpmap_in_range(&buffer[i*record_size], record_size, range);
+    }
+  }
+  R_Free(buffer);
 
+  if (fseek(infile, -(long)record_size*(long)nprobes, SEEK_CUR) != 0){
+    error("Unable to return to the start of the probe information in the BPMAP file.");
+  }
+  return n_kept;
+}
 
-    PROTECT(tmpSEXP=allocVector(INTSXP,1));
-    INTEGER(tmpSEXP)[0] = (int)SeqId;    
-    SET_VECTOR_ELT(curSeqIdPositionInfo,0,tmpSEXP);
-    UNPROTECT(1);
 
-    
-    PROTECT(tmpSEXP=allocVector(STRSXP,2));
-    SET_STRING_ELT(tmpSEXP,0,mkChar("Header"));
-    SET_STRING_ELT(tmpSEXP,1,mkChar("PositionInformation"));
-    setAttrib(curSeqIdPositionInfo,R_NamesSymbol,tmpSEXP);
-    UNPROTECT(1);
-      
+/****************************************************************
+ **
+ ** static SEXP allocBPMAPPositionInfo(int nprobes, int probe_mapping_type, int compact, int packed_seq)
+ **
+ ** Allocate the data.frame for the probes of one sequence. 
+ **
+ ** compact = 0 gives the original form (character row names, 
+ ** TargetStrand "F" or "R"). compact = 1 gives compact integer
+ ** row names and TargetStrand as a factor. With packed_seq = 1
+ ** ProbeSeq is a raw matrix with a row of 7 packed bytes (4 bases
+ ** to a byte, 2 bits per base A=0, C=1, G=2, T=3) for each probe.
+ **
+ ***************************************************************/
 
+static SEXP allocBPMAPPositionInfo(int nprobes, int probe_mapping_type, int compact, int packed_seq){
 
-    if ((version == 1.0) || (version == 2.0)){
-      nprobes = INTEGER(VECTOR_ELT(VECTOR_ELT(seqDesc,i),1))[0];
-      /* Rprintf("nprobes: %d\n",nprobes); */
-      probe_mapping_type = 0; /* PM/MM tiling */
-      
-      PROTECT(PositionInfo = allocVector(VECSXP,9));
-      PROTECT(xPM = allocVector(INTSXP,nprobes));
-      PROTECT(yPM = allocVector(INTSXP,nprobes));
-      PROTECT(xMM = allocVector(INTSXP,nprobes));
-      PROTECT(yMM = allocVector(INTSXP,nprobes));
-      PROTECT(PMprobeLength = allocVector(INTSXP,nprobes));
-      PROTECT(probeSeqString = allocVector(STRSXP,nprobes));
-      PROTECT(MatchScore = allocVector(REALSXP,nprobes));
-      PROTECT(PMposition = allocVector(INTSXP,nprobes));
-      PROTECT(Strand = allocVector(STRSXP,nprobes));
-      
-      SET_VECTOR_ELT(PositionInfo,0,xPM);
-      SET_VECTOR_ELT(PositionInfo,1,yPM);
-      SET_VECTOR_ELT(PositionInfo,2,xMM);
-      SET_VECTOR_ELT(PositionInfo,3,yMM);
-      SET_VECTOR_ELT(PositionInfo,4,PMprobeLength);
-      SET_VECTOR_ELT(PositionInfo,5,probeSeqString);
-      SET_VECTOR_ELT(PositionInfo,6,MatchScore);
-      SET_VECTOR_ELT(PositionInfo,7,PMposition);
-      SET_VECTOR_ELT(PositionInfo,8,Strand);
-      UNPROTECT(9);
-
-      setAttrib(PositionInfo,R_ClassSymbol,mkString("data.frame"));
-
-      PROTECT(PositionInfoRowNames = allocVector(STRSXP,nprobes));
-      for (j=0; j < nprobes; j++){
-	sprintf(buf, "%d", j+1);
-	SET_STRING_ELT(PositionInfoRowNames,j,mkChar(buf));
+  SEXP PositionInfo;
+  SEXP PositionInfoRowNames;
+  SEXP tmpSEXP;
+  const char *pmmm_names[9] = {"x", "y", "x.mm", "y.mm", "PMLength", "ProbeSeq", "MatchScore", "PMPosition", "TargetStrand"};
+  const char *pmonly_names[7] = {"x", "y", "PMLength", "ProbeSeq", "MatchScore", "PMPosition", "TargetStrand"};
+  const char **names = (probe_mapping_type == 0) ? pmmm_names : pmonly_names;
+  int ncols = (probe_mapping_type == 0) ? 9 : 7;
+  int i, j;
+  char buf[10];
+
+  PROTECT(PositionInfo = allocVector(VECSXP,ncols));
+  for (i = 0; i < ncols; i++){
+    if (strcmp(names[i],"ProbeSeq") == 0){
+      if (packed_seq){
+	PROTECT(tmpSEXP = allocMatrix(RAWSXP,nprobes,7));
+      } else {
+	PROTECT(tmpSEXP = allocVector(STRSXP,nprobes));
       }
-      setAttrib(PositionInfo, R_RowNamesSymbol, PositionInfoRowNames);
-      UNPROTECT(1);
+    } else if (strcmp(names[i],"MatchScore") == 0){
+      PROTECT(tmpSEXP = allocVector(REALSXP,nprobes));
+    } else if (strcmp(names[i],"TargetStrand") == 0 && !compact){
+      PROTECT(tmpSEXP = allocVector(STRSXP,nprobes));
+    } else {
+      PROTECT(tmpSEXP = allocVector(INTSXP,nprobes));
+    }
+    SET_VECTOR_ELT(PositionInfo,i,tmpSEXP);
+    UNPROTECT(1);
+  }
 
-      PROTECT(tmpSEXP = allocVector(STRSXP,9));
-      SET_STRING_ELT(tmpSEXP,0,mkChar("x"));
-      SET_STRING_ELT(tmpSEXP,1,mkChar("y"));
-      SET_STRING_ELT(tmpSEXP,2,mkChar("x.mm"));
-      SET_STRING_ELT(tmpSEXP,3,mkChar("y.mm"));
-      SET_STRING_ELT(tmpSEXP,4,mkChar("PMLength"));
-      SET_STRING_ELT(tmpSEXP,5,mkChar("ProbeSeq"));
-      SET_STRING_ELT(tmpSEXP,6,mkChar("MatchScore"));
-      SET_STRING_ELT(tmpSEXP,7,mkChar("PMPosition"));
-      SET_STRING_ELT(tmpSEXP,8,mkChar("TargetStrand"));
-
-      setAttrib(PositionInfo,R_NamesSymbol,tmpSEXP);
-      UNPROTECT(1);
+  setAttrib(PositionInfo,R_ClassSymbol,mkString("data.frame"));
 
-    } else if (version == 3.0){
-      nprobes = INTEGER(VECTOR_ELT(VECTOR_ELT(seqDesc,i),3))[0];
-      probe_mapping_type = INTEGER(VECTOR_ELT(VECTOR_ELT(seqDesc,i),1))[0];
+  if (compact){
+    tmpSEXP = VECTOR_ELT(PositionInfo,ncols-1);
+    PROTECT(PositionInfoRowNames = allocVector(STRSXP,2));
+    SET_STRING_ELT(PositionInfoRowNames,0,mkChar("F"));
+    SET_STRING_ELT(PositionInfoRowNames,1,mkChar("R"));
+    setAttrib(tmpSEXP,R_LevelsSymbol,PositionInfoRowNames);
+    setAttrib(tmpSEXP,R_ClassSymbol,mkString("factor"));
+    UNPROTECT(1);
 
+    PROTECT(PositionInfoRowNames = allocVector(INTSXP,2));
+    INTEGER(PositionInfoRowNames)[0] = NA_INTEGER;
+    INTEGER(PositionInfoRowNames)[1] = -nprobes;
+  } else {
+    PROTECT(PositionInfoRowNames = allocVector(STRSXP,nprobes));
+    for (j=0; j < nprobes; j++){
+      sprintf(buf, "%d", j+1);
+      SET_STRING_ELT(PositionInfoRowNames,j,mkChar(buf));
+    }
+  }
+  setAttrib(PositionInfo, R_RowNamesSymbol, PositionInfoRowNames);
+  UNPROTECT(1);
 
-      if (probe_mapping_type == 0){
-	PROTECT(PositionInfo = allocVector(VECSXP,9));
-	PROTECT(xPM = allocVector(INTSXP,nprobes));
-	PROTECT(yPM = allocVector(INTSXP,nprobes));
-	PROTECT(xMM = allocVector(INTSXP,nprobes));
-	PROTECT(yMM = allocVector(INTSXP,nprobes));
-	PROTECT(PMprobeLength = allocVector(INTSXP,nprobes));
-	PROTECT(probeSeqString = allocVector(STRSXP,nprobes));
-	PROTECT(MatchScore = allocVector(REALSXP,nprobes));
-	PROTECT(PMposition = allocVector(INTSXP,nprobes));
-	PROTECT(Strand = allocVector(STRSXP,nprobes));
-	
-	SET_VECTOR_ELT(PositionInfo,0,xPM);
-	SET_VECTOR_ELT(PositionInfo,1,yPM);
-	SET_VECTOR_ELT(PositionInfo,2,xMM);
-	SET_VECTOR_ELT(PositionInfo,3,yMM);
-	SET_VECTOR_ELT(PositionInfo,4,PMprobeLength);
-	SET_VECTOR_ELT(PositionInfo,5,probeSeqString);
-	SET_VECTOR_ELT(PositionInfo,6,MatchScore);
-	SET_VECTOR_ELT(PositionInfo,7,PMposition);
-	SET_VECTOR_ELT(PositionInfo,8,Strand);
-	UNPROTECT(9);
-
-	setAttrib(PositionInfo,R_ClassSymbol,mkString("data.frame"));
-	
-	PROTECT(PositionInfoRowNames = allocVector(STRSXP,nprobes));
-	for (j=0; j < nprobes; j++){
-	  sprintf(buf, "%d", j+1);
-	  SET_VECTOR_ELT(PositionInfoRowNames,j,mkChar(buf));
-	}
-	setAttrib(PositionInfo, R_RowNamesSymbol, PositionInfoRowNames);
-	UNPROTECT(1);
-	
-	PROTECT(tmpSEXP = allocVector(STRSXP,9));
-	SET_STRING_ELT(tmpSEXP,0,mkChar("x"));
-	SET_STRING_ELT(tmpSEXP,1,mkChar("y"));
-	SET_STRING_ELT(tmpSEXP,2,mkChar("x.mm"));
-	SET_STRING_ELT(tmpSEXP,3,mkChar("y.mm"));
-	SET_STRING_ELT(tmpSEXP,4,mkChar("PMLength"));
-	SET_STRING_ELT(tmpSEXP,5,mkChar("ProbeSeq"));
-	SET_STRING_ELT(tmpSEXP,6,mkChar("MatchScore"));
-	SET_STRING_ELT(tmpSEXP,7,mkChar("PMPosition"));
-	SET_STRING_ELT(tmpSEXP,8,mkChar("TargetStrand"));
-	
-	setAttrib(PositionInfo,R_NamesSymbol,tmpSEXP);
-	UNPROTECT(1);
-      } else {
+  PROTECT(tmpSEXP = allocVector(STRSXP,ncols));
+  for (i = 0; i < ncols; i++){
+    SET_STRING_ELT(tmpSEXP,i,mkChar(names[i]));
+  }
+  setAttrib(PositionInfo,R_NamesSymbol,tmpSEXP);
+  UNPROTECT(1);
+  
+  UNPROTECT(1);
+  return PositionInfo;
+}
 
-	PROTECT(PositionInfo = allocVector(VECSXP,7));
-	PROTECT(xPM = allocVector(INTSXP,nprobes));
-	PROTECT(yPM = allocVector(INTSXP,nprobes));
-	PROTECT(PMprobeLength = allocVector(INTSXP,nprobes));
-	PROTECT(probeSeqString = allocVector(STRSXP,nprobes));
-	PROTECT(MatchScore = allocVector(REALSXP,nprobes));
-	PROTECT(PMposition = allocVector(INTSXP,nprobes));
-	PROTECT(Strand = allocVector(STRSXP,nprobes));
-	
-	SET_VECTOR_ELT(PositionInfo,0,xPM);
-	SET_VECTOR_ELT(PositionInfo,1,yPM);
-	SET_VECTOR_ELT(PositionInfo,2,PMprobeLength);
-	SET_VECTOR_ELT(PositionInfo,3,probeSeqString);
-	SET_VECTOR_ELT(PositionInfo,4,MatchScore);
-	SET_VECTOR_ELT(PositionInfo,5,PMposition);
-	SET_VECTOR_ELT(PositionInfo,6,Strand);
-	UNPROTECT(7);
-
-	setAttrib(PositionInfo,R_ClassSymbol,mkString("data.frame"));
-	
-	PROTECT(PositionInfoRowNames = allocVector(STRSXP,nprobes));
-	for (j=0; j < nprobes; j++){
-	  sprintf(buf, "%d", j+1);
-	  SET_STRING_ELT(PositionInfoRowNames,j,mkChar(buf));
-	}
-	setAttrib(PositionInfo, R_RowNamesSymbol, PositionInfoRowNames);
-	UNPROTECT(1);
-	
-	PROTECT(tmpSEXP = allocVector(STRSXP,7));
-	SET_STRING_ELT(tmpSEXP,0,mkChar("x"));
-	SET_STRING_ELT(tmpSEXP,1,mkChar("y"));
-	SET_STRING_ELT(tmpSEXP,2,mkChar("PMLength"));
-	SET_STRING_ELT(tmpSEXP,3,mkChar("ProbeSeq"));
-	SET_STRING_ELT(tmpSEXP,4,mkChar("MatchScore"));
-	SET_STRING_ELT(tmpSEXP,5,mkChar("PMPosition"));
-	SET_STRING_ELT(tmpSEXP,6,mkChar("TargetStrand"));
-	
-	setAttrib(PositionInfo,R_NamesSymbol,tmpSEXP);
-	UNPROTECT(1);
-      }
 
+/****************************************************************
+ **
+ ** static void fillBPMAPPositionInfo(SEXP PositionInfo, FILE *infile, int nprobes, int probe_mapping_type, 
+ **                                   const double *range, int compact, int packed_seq)
+ **
+ ** read the nprobes probes of one sequence into a data.frame allocated 
+ ** by allocBPMAPPositionInfo (with the same arguments). When range 
+ ** is not NULL the data.frame should have been allocated with the
+ ** number of probes in range (see countBPMAPProbesInRange).
+ **
+ ***************************************************************/
 
-    }
-    
-    
+static void fillBPMAPPositionInfo(SEXP PositionInfo, FILE *infile, int nprobes, int probe_mapping_type, const double *range, int compact, int packed_seq){
 
+  bpmap_probe_columns cols;
+  int offset = (probe_mapping_type == 0) ? 2 : 0;
+  SEXP probeSeq = VECTOR_ELT(PositionInfo,3 + offset);
+  SEXP Strand = VECTOR_ELT(PositionInfo,6 + offset);
+  SEXP StrandF, StrandR;
+  char *dest;
+  int j, k, n_block;
+
+  cols.x = INTEGER(VECTOR_ELT(PositionInfo,0));
+  cols.y = INTEGER(VECTOR_ELT(PositionInfo,1));
+  cols.x_mm = NULL;
+  cols.y_mm = NULL;
+  if (probe_mapping_type == 0){
+    cols.x_mm = INTEGER(VECTOR_ELT(PositionInfo,2));
+    cols.y_mm = INTEGER(VECTOR_ELT(PositionInfo,3));
+  }
+  cols.probe_length = INTEGER(VECTOR_ELT(PositionInfo,2 + offset));
+  cols.match_score = REAL(VECTOR_ELT(PositionInfo,4 + offset));
+  cols.position = INTEGER(VECTOR_ELT(PositionInfo,5 + offset));
+  cols.packed_seq = R_Calloc(7*(size_t)nprobes + 1, unsigned char);
+  if (compact){
+    cols.strand = INTEGER(Strand);
+  } else {
+    cols.strand = R_Calloc(nprobes + 1, int);
+  }
 
+  nprobes = readBPMAPProbes(infile, probe_mapping_type, nprobes, range, &cols);
 
+  if (packed_seq){
     for (j=0; j < nprobes; j++){
-      fread_be_uint32(&x,1,infile);
-      fread_be_uint32(&y,1,infile);
-      /* Rprintf("x y :%u %u\n",x,y); */
-
-      if (probe_mapping_type == 0){
-	fread_be_uint32(&x_mm,1,infile);
-	fread_be_uint32(&y_mm,1,infile);
+      for (k=0; k < 7; k++){
+	RAW(probeSeq)[j + k*nprobes] = cols.packed_seq[7*j + k];
       }
+    }
+  } else {
+    dest = R_Calloc(BPMAP_UNPACKED_SEQ_SIZE*BPMAP_PROBE_BLOCK, char);
+    for (j=0; j < nprobes; j+= BPMAP_PROBE_BLOCK){
+      n_block = (nprobes - j < BPMAP_PROBE_BLOCK) ? nprobes - j : BPMAP_PROBE_BLOCK;
+      unpackBPMAPSeqs(&cols.packed_seq[7*j], n_block, dest);
+      for (k=0; k < n_block; k++){
+	SET_STRING_ELT(probeSeq,j+k,mkCharLen(&dest[BPMAP_UNPACKED_SEQ_SIZE*k],25));
+      }
+    }
+    R_Free(dest);
+  }
+  R_Free(cols.packed_seq);
 
-      /* Rprintf("mm x y :%u %u\n",x_mm,y_mm); */
-      
-      INTEGER(xPM)[j] = x;
-      INTEGER(yPM)[j] = y;
+  if (!compact){
+    PROTECT(StrandF = mkChar("F"));
+    PROTECT(StrandR = mkChar("R"));
+    for (j=0; j < nprobes; j++){
+      SET_STRING_ELT(Strand,j,(cols.strand[j] == 1) ? StrandF : StrandR);
+    }
+    UNPROTECT(2);
+    R_Free(cols.strand);
+  }
+}
 
-      if (probe_mapping_type == 0){
-	INTEGER(xMM)[j] = x_mm;
-	INTEGER(yMM)[j] = y_mm;
-      }
-      fread_be_uchar(&probelength,1,infile);
-      /* Rprintf("probelength : %d\n",(int)probelength);*/
-      
-      INTEGER(PMprobeLength)[j] = probelength;
-      
 
-      fread_be_uchar(probeseq,7,infile);
-      /* Rprintf("probeseq : %s\n",probeseq); */
 
+/****************************************************************
+ **
+ ** static void bpmapSeqProbeInfo(SEXP seqDesc, float version, int *nprobes, int *probe_mapping_type)
+ **
+ ** number of probes and the probe mapping type of a sequence, from 
+ ** its sequence description
+ **
+ ***************************************************************/
+
+static void bpmapSeqProbeInfo(SEXP seqDesc, float version, int *nprobes, int *probe_mapping_type){
+
+  *nprobes = 0;
+  *probe_mapping_type = 0;
+  if ((version == 1.0) || (version == 2.0)){
+    *nprobes = INTEGER(VECTOR_ELT(seqDesc,1))[0];
+    /* Rprintf("nprobes: %d\n",nprobes); */
+    *probe_mapping_type = 0; /* PM/MM tiling */
+  } else if (version == 3.0){
+    *nprobes = INTEGER(VECTOR_ELT(seqDesc,3))[0];
+    *probe_mapping_type = INTEGER(VECTOR_ELT(seqDesc,1))[0];
+  }
+}
 
 
-      dest = (char *)R_Calloc(25+1,char);
-      packedSeqTobaseStr(probeseq,dest);
+/****************************************************************
+ **
+ ** static SEXP readBPMAPSeqIdGroup(FILE *infile, float version, SEXP seqDesc, const double *range, int compact, int packed_seq)
+ **
+ ** read the sequence id and probes of one sequence, giving
+ ** list(Header, PositionInformation). When range is not NULL only
+ ** probes with PM position in range are kept.
+ **
+ ***************************************************************/
 
-      SET_STRING_ELT(probeSeqString,j,mkChar(dest));
-      R_Free(dest);
+static SEXP readBPMAPSeqIdGroup(FILE *infile, float version, SEXP seqDesc, const double *range, int compact, int packed_seq){
 
+  SEXP curSeqIdPositionInfo;
+  SEXP PositionInfo= R_NilValue;
 
+  SEXP tmpSEXP;
 
-      
-      /* matchScore is treated same as version number in header */
-#ifdef WORDS_BIGENDIAN
-      /* swap, cast to integer, swap bytes and cast back to float */
-      fread_be_float32(&matchScore,1,infile);
-      swap_float_4(&matchScore);
-      matchScore_int = (int)matchScore;
-      
-      
-      matchScore_int=(((matchScore_int>>24)&0xff) | ((matchScore_int&0xff)<<24) |
-		      ((matchScore_int>>8)&0xff00) | ((matchScore_int&0xff00)<<8));
-      matchScore = (float)matchScore_int;
-      
-#else
-      /* cast to integer, swap bytes, cast to float */ 
-      fread_float32(&matchScore,1,infile);
-      matchScore_int = (int)matchScore;
-      matchScore_int=(((matchScore_int>>24)&0xff) | ((matchScore_int&0xff)<<24) |
-		      ((matchScore_int>>8)&0xff00) | ((matchScore_int&0xff00)<<8));
-      matchScore = (float)matchScore_int;
-#endif
-      /* Rprintf("matchScore : %f\n",matchScore); */
-      
-      REAL(MatchScore)[j] = matchScore;
+  int nprobes=0;
+  int n_kept;
+  int probe_mapping_type=0;
 
+  unsigned int SeqId;
 
-      
-      fread_be_uint32(&positionPM,1,infile);
-      /* Rprintf("positionPM : %u\n",positionPM);*/
-      INTEGER(PMposition)[j] = positionPM;
-      
-      
-      fread_be_uchar(&strand,1,infile);
-      /* Rprintf("strand: %d\n",(int)strand);*/
+  fread_be_uint32(&SeqId,1,infile);
+  /*Rprintf("Seq id:%u\n",SeqId);*/
+    
+  PROTECT(curSeqIdPositionInfo = allocVector(VECSXP,2));
 
-      if ((int)strand ==1){
-	SET_STRING_ELT(Strand,j,mkChar("F"));
-      } else {
-	SET_STRING_ELT(Strand,j,mkChar("R"));
-      }
+  PROTECT(tmpSEXP=allocVector(INTSXP,1));
+  INTEGER(tmpSEXP)[0] = (int)SeqId;    
+  SET_VECTOR_ELT(curSeqIdPositionInfo,0,tmpSEXP);
+  UNPROTECT(1);
+    
+  PROTECT(tmpSEXP=allocVector(STRSXP,2));
+  SET_STRING_ELT(tmpSEXP,0,mkChar("Header"));
+  SET_STRING_ELT(tmpSEXP,1,mkChar("PositionInformation"));
+  setAttrib(curSeqIdPositionInfo,R_NamesSymbol,tmpSEXP);
+  UNPROTECT(1);
 
+  bpmapSeqProbeInfo(seqDesc, version, &nprobes, &probe_mapping_type);
+  n_kept = nprobes;
+  if (range != NULL){
+    n_kept = countBPMAPProbesInRange(infile, probe_mapping_type, nprobes, range);
+  }
     
-    }
+  PROTECT(PositionInfo = allocBPMAPPositionInfo(n_kept, probe_mapping_type, compact, packed_seq));
+  fillBPMAPPositionInfo(PositionInfo, infile, nprobes, probe_mapping_type, range, compact, packed_seq);
 
-    SET_VECTOR_ELT(curSeqIdPositionInfo,1,PositionInfo);
-    UNPROTECT(1);
+  SET_VECTOR_ELT(curSeqIdPositionInfo,1,PositionInfo);
+  UNPROTECT(2);
 
-    SET_VECTOR_ELT(SeqIdPositionInfoList,i,curSeqIdPositionInfo);
-    UNPROTECT(1);
+  return curSeqIdPositionInfo;
+}
+
+
+/****************************************************************
+ **
+ ** static void skipBPMAPSeqIdGroup(FILE *infile, float version, SEXP seqDesc)
+ **
+ ** move past the sequence id and probes of one sequence without 
+ ** reading them. Probe records are fixed size so the size of the 
+ ** group is known from the sequence description.
+ **
+ ***************************************************************/
+
+static void skipBPMAPSeqIdGroup(FILE *infile, float version, SEXP seqDesc){
+
+  int nprobes, probe_mapping_type;
+  int record_size;
+
+  bpmapSeqProbeInfo(seqDesc, version, &nprobes, &probe_mapping_type);
+  record_size = (probe_mapping_type == 0) ? BPMAP_PMMM_RECORD_SIZE : BPMAP_PMONLY_RECORD_SIZE;
+
+  if (fseek(infile, 4 + (long)record_size*(long)nprobes, SEEK_CUR) != 0){
+    error("Unable to skip a sequence in the BPMAP file. Perhaps it is truncated.");
+  }
+}
+
+
+
+static SEXP readBPMAPSeqIdPositionInfo(FILE *infile, float version, int nseq, SEXP seqDesc, int compact, int packed_seq){
+
+
+  SEXP SeqIdPositionInfoList;
+
+  int i;
+  
+  PROTECT(SeqIdPositionInfoList = allocVector(VECSXP,nseq));
+  
+  for (i =0; i < nseq; i++){
+    SET_VECTOR_ELT(SeqIdPositionInfoList,i,readBPMAPSeqIdGroup(infile,version,VECTOR_ELT(seqDesc,i),NULL,compact,packed_seq));
   }
 
   
@@ -821,7 +941,7 @@ static SEXP readBPMAPSeqIdPositionInfo(FILE *infile, float version, int nseq, SE
 
 
 
-SEXP ReadBPMAPFileIntoRList(SEXP filename){
+static SEXP read_bpmap_file(SEXP filename, int compact, int packed_seq){
 
 
 
@@ -870,7 +990,7 @@ SEXP ReadBPMAPFileIntoRList(SEXP filename){
 
   PROTECT(bpmapSeqDesc = ReadBPMAPSeqDescription(infile,version,n_seq));
   SET_VECTOR_ELT(bpmapRlist,1,bpmapSeqDesc);
-  SET_VECTOR_ELT(bpmapRlist,2,readBPMAPSeqIdPositionInfo(infile,version,n_seq,bpmapSeqDesc));
+  SET_VECTOR_ELT(bpmapRlist,2,readBPMAPSeqIdPositionInfo(infile,version,n_seq,bpmapSeqDesc,compact,packed_seq));
   UNPROTECT(1);
 
   PROTECT(tmpSXP=allocVector(STRSXP,3));
@@ -880,9 +1000,234 @@ SEXP ReadBPMAPFileIntoRList(SEXP filename){
   setAttrib(bpmapRlist,R_NamesSymbol,tmpSXP);
   UNPROTECT(1);
   
+  fclose(infile);
+
+  UNPROTECT(1);
+  return bpmapRlist;
+
+
+}
+
+
+
+SEXP ReadBPMAPFileIntoRList(SEXP filename){
+
+  return read_bpmap_file(filename, 0, 0);
+
+}
+
+
+/****************************************************************
+ **
+ ** SEXP ReadBPMAPFileIntoRListCompact(SEXP filename, SEXP packedSeq)
+ **
+ ** SEXP filename - name of BPMAP file
+ ** SEXP packedSeq - if TRUE ProbeSeq is left in its packed form 
+ **                  as a raw matrix
+ **
+ ** As ReadBPMAPFileIntoRList but the probe data.frames have compact
+ ** row names and TargetStrand is a factor (see allocBPMAPPositionInfo).
+ ** With packedSeq no strings at all are made for the probes.
+ **
+ ***************************************************************/
+
+SEXP ReadBPMAPFileIntoRListCompact(SEXP filename, SEXP packedSeq){
+
+  return read_bpmap_file(filename, 1, asLogical(packedSeq) == TRUE);
+
+}
+
+
+
+/****************************************************************
+ **
+ ** Streaming access
+ **
+ ** ReadBPMAPSequences() reads the header and sequence descriptions
+ ** and then the probes one sequence at a time. Sequences that are not
+ ** wanted are skipped over without being read, and within a sequence
+ ** only probes in a PM position range need be kept. If a callback is
+ ** given, it is called with the description and probes of each kept
+ ** sequence as it is read, and only its result is retained, so at most
+ ** one sequence worth of probes is in memory at a time.
+ **
+ ***************************************************************/
+
+typedef struct{
+  FILE *infile;
+  SEXP seqNames;         /* R_NilValue for all sequences */
+  double *range;         /* NULL for all positions */
+  SEXP callback;         /* R_NilValue for none */
+  SEXP rho;
+  int compact;
+  int packed_seq;
+} bpmap_stream;
+
+
+static int bpmap_wanted_seq(SEXP seqNames, SEXP seqDesc){
+
+  const char *name;
+  int i;
+
+  if (isNull(seqNames)){
+    return 1;
+  }
+  name = CHAR(STRING_ELT(VECTOR_ELT(seqDesc,0),0));
+  for (i = 0; i < length(seqNames); i++){
+    if (STRING_ELT(seqNames,i) != NA_STRING && strcmp(name, CHAR(STRING_ELT(seqNames,i))) == 0){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+static SEXP bpmap_stream_read(void *data){
+
+  bpmap_stream *stream = (bpmap_stream *)data;
+
+  SEXP bpmapRlist;
+  SEXP bpmapHeader;
+  SEXP bpmapSeqDesc;
+  SEXP keptSeqDesc;
+  SEXP keptSeqInfo;
+  SEXP curSeqInfo;
+  SEXP call;
+  SEXP tmpSXP;
+
+  int *wanted;
+  int i, k, n_seq, n_kept = 0;
+  float version;
+
+  PROTECT(bpmapRlist = allocVector(VECSXP,3));
+
+  PROTECT(bpmapHeader = ReadBPMAPHeader(stream->infile));
+  SET_VECTOR_ELT(bpmapRlist,0,bpmapHeader);
+  version = REAL(VECTOR_ELT(bpmapHeader,1))[0];
+  n_seq = INTEGER(VECTOR_ELT(bpmapHeader,2))[0];
+  UNPROTECT(1);
+
+  PROTECT(bpmapSeqDesc = ReadBPMAPSeqDescription(stream->infile,version,n_seq));
+
+  wanted = (int *)R_alloc(n_seq + 1, sizeof(int));
+  for (i = 0; i < n_seq; i++){
+    wanted[i] = bpmap_wanted_seq(stream->seqNames, VECTOR_ELT(bpmapSeqDesc,i));
+    n_kept+= wanted[i];
+  }
+
+  PROTECT(keptSeqDesc = allocVector(VECSXP,n_kept));
+  PROTECT(keptSeqInfo = allocVector(VECSXP,n_kept));
+  SET_VECTOR_ELT(bpmapRlist,1,keptSeqDesc);
+  SET_VECTOR_ELT(bpmapRlist,2,keptSeqInfo);
+  UNPROTECT(2);
+
+  for (i = 0, k = 0; i < n_seq; i++){
+    if (!wanted[i]){
+      skipBPMAPSeqIdGroup(stream->infile, version, VECTOR_ELT(bpmapSeqDesc,i));
+      continue;
+    }
+    SET_VECTOR_ELT(keptSeqDesc,k,VECTOR_ELT(bpmapSeqDesc,i));
+    PROTECT(curSeqInfo = readBPMAPSeqIdGroup(stream->infile, version, VECTOR_ELT(bpmapSeqDesc,i), stream->range, stream->compact, stream->packed_seq));
+    if (isNull(stream->callback)){
+      SET_VECTOR_ELT(keptSeqInfo,k,curSeqInfo);
+    } else {
+      PROTECT(call = lang3(stream->callback, VECTOR_ELT(bpmapSeqDesc,i), curSeqInfo));
+      SET_VECTOR_ELT(keptSeqInfo,k,eval(call, stream->rho));
+      UNPROTECT(1);
+    }
+    UNPROTECT(1);
+    k++;
+    R_CheckUserInterrupt();
+  }
+  UNPROTECT(1);
+
+  PROTECT(tmpSXP=allocVector(STRSXP,3));
+  SET_STRING_ELT(tmpSXP,0,mkChar("Header"));
+  SET_STRING_ELT(tmpSXP,1,mkChar("SequenceDescription"));
+  SET_STRING_ELT(tmpSXP,2,mkChar(isNull(stream->callback) ? "SeqHead.PosInfo" : "Results"));
+  setAttrib(bpmapRlist,R_NamesSymbol,tmpSXP);
+  UNPROTECT(1);
+
   UNPROTECT(1);
   return bpmapRlist;
+}
+
 
+static void bpmap_stream_close(void *data){
 
+  bpmap_stream *stream = (bpmap_stream *)data;
+  
+  if (stream->infile != NULL){
+    fclose(stream->infile);
+    stream->infile = NULL;
+  }
 }
 
+
+/****************************************************************
+ **
+ ** SEXP ReadBPMAPSequences(SEXP filename, SEXP seqNames, SEXP positionRange, 
+ **                         SEXP callback, SEXP rho, SEXP compact, SEXP packedSeq)
+ **
+ ** SEXP filename - name of BPMAP file
+ ** SEXP seqNames - NULL or a character vector of sequence names to keep
+ ** SEXP positionRange - NULL or c(start, end). Only probes with PM 
+ **                      position in start to end (inclusive) are kept
+ ** SEXP callback - NULL or a function(SequenceDescription, SeqHead.PosInfo)
+ **                 called for each kept sequence
+ ** SEXP rho - environment in which to call the callback
+ ** SEXP compact, packedSeq - as for ReadBPMAPFileIntoRListCompact. If
+ **                 compact is FALSE the probe data.frames are in the 
+ **                 form given by ReadBPMAPFileIntoRList
+ **
+ ** returns list(Header, SequenceDescription, SeqHead.PosInfo) as for
+ ** ReadBPMAPFileIntoRList but containing only the kept sequences. With
+ ** a callback the third item is instead "Results", the values the 
+ ** callback returned, and the probes of each sequence are released
+ ** once its callback has returned.
+ **
+ ***************************************************************/
+
+SEXP ReadBPMAPSequences(SEXP filename, SEXP seqNames, SEXP positionRange, SEXP callback, SEXP rho, SEXP compact, SEXP packedSeq){
+
+  bpmap_stream stream;
+  const char *cur_file_name;
+  SEXP range;
+  SEXP bpmapRlist;
+
+  if (!isNull(seqNames) && !isString(seqNames)){
+    error("seqNames should be NULL or a character vector");
+  }
+  if (!isNull(callback) && !isFunction(callback)){
+    error("callback should be NULL or a function");
+  }
+
+  stream.seqNames = seqNames;
+  stream.callback = callback;
+  stream.rho = rho;
+  stream.compact = asLogical(compact) == TRUE;
+  stream.packed_seq = asLogical(packedSeq) == TRUE;
+  stream.range = NULL;
+  
+  if (!isNull(positionRange)){
+    PROTECT(range = coerceVector(positionRange, REALSXP));
+    if (length(range) != 2 || ISNAN(REAL(range)[0]) || ISNAN(REAL(range)[1])){
+      error("positionRange should be NULL or c(start, end)");
+    }
+    stream.range = (double *)R_alloc(2, sizeof(double));
+    stream.range[0] = REAL(range)[0];
+    stream.range[1] = REAL(range)[1];
+    UNPROTECT(1);
+  }
+
+  cur_file_name = CHAR(STRING_ELT(filename,0));
+  if ((stream.infile = fopen(cur_file_name, "rb")) == NULL){
+    error("Unable to open the file %s",cur_file_name);
+  }
+  
+  /* the file is closed even if there is an error (or the callback fails) */
+  PROTECT(bpmapRlist = R_ExecWithCleanup(bpmap_stream_read, &stream, bpmap_stream_close, &stream));
+  
+  UNPROTECT(1);
+  return bpmapRlist;
+}
@@ -26,6 +26,20 @@
  ** Oct 27, 2007 - When building a cdfenv set NON identified values to NA (mostly affects MM for PM only arrays)
  ** Nov 12, 2008 - Fix crash 
  ** Jan 15, 2008 - Fix VECTOR_ELT/STRING_ELT issues
+ ** Oct 16, 2026 - Units are now read one at a time into reusable storage and converted
+ **                to R objects as they are read, rather than parsing the entire file
+ **                into memory first. Cells are read a block at a time.
+ ** Oct 16, 2026 - Add ReadCDFFileLocations which can return INTSXP location matrices
+ **                or a single flat index with probeset offsets
+ ** Oct 16, 2026 - ReadCDFFileLocations can return just the requested probesets, found via
+ **                a hash of the unit name table, decoding only those units
+ ** Oct 16, 2026 - QC probes are read with a single fread per QC unit. Add ReadCDFFileIntoRListQC
+ **                which can skip the QC section entirely
+ ** Oct 16, 2026 - Expression array locations carry "summary" and "n.probes" attributes.
+ **                Add CheckCDFType. check_cdf_xda now closes the file
+ ** Oct 16, 2026 - Requesting a probeset that is not in the file is an error rather than giving a NULL entry
+ ** Oct 16, 2026 - A QC unit whose probe count is negative or more than the rest of the file holds
+ **                is reported as corrupt rather than allocated
  **
  ****************************************************************/
 
@@ -35,6 +49,7 @@
 
 #include "stdlib.h"
 #include "stdio.h"
+#include <string.h>
 #include "fread_functions.h"
 #include <ctype.h>
 
@@ -182,10 +197,14 @@ typedef struct{
 
 /****************************************************************************
  **
- ** A data structure for holding CDF information read from a xda format cdf file
+ ** A data structure for holding the CDF information read from the start of a
+ ** xda format cdf file: the header, the probeset names and the file positions
+ ** of each QC unit and unit.
  **
- ** note that this structure reads in everything including things that might not
- ** be of any subsequent use.
+ ** The units themselves are not held here. They are decoded one at a time
+ ** into a cdf_unit_buffer (see below) from the still open file, so that the
+ ** R objects can be built unit by unit without keeping a parsed copy of the
+ ** entire file in memory.
  **
  ****************************************************************************/
 
@@ -194,23 +213,86 @@ typedef struct{
 typedef struct {
   
   cdf_xda_header header;  /* Header information */
-  char **probesetnames;   /* Names of probesets */
+  char *probesetnames;    /* Names of probesets, n_units consecutive 64 character fields */
+  int names_start;        /* file position of the probeset names */
   
   int *qc_start;          /* These are used for random access */
   int *units_start;
-  
-  cdf_qc_unit *qc_units;
-  cdf_unit *units;
 
+  FILE *infile;           /* remains open until close_cdf_xda() */
 
 } cdf_xda;
 
 
+/****************************************************************************
+ **
+ ** Reusable storage for decoding units. The blocks and cells allocated for
+ ** one unit are kept and grown as needed for the next, so streaming through
+ ** a CDF file does not allocate and free per unit.
+ **
+ ** On disk a unit header is 20 bytes, a block header is 82 bytes and each
+ ** cell is 14 bytes. The raw buffer holds the cell records of one block,
+ ** which are read with a single fread and then decoded. Similarly a QC
+ ** unit header is 6 bytes followed by 7 bytes for each QC probe.
+ **
+ ****************************************************************************/
+
+#define CDF_XDA_UNIT_HEADER_SIZE 20
+#define CDF_XDA_BLOCK_HEADER_SIZE 82
+#define CDF_XDA_CELL_SIZE 14
+#define CDF_XDA_QC_UNIT_HEADER_SIZE 6
+#define CDF_XDA_QC_PROBE_SIZE 7
+
+typedef struct{
+  cdf_unit unit;              /* the most recently read unit */
+  int block_capacity;         /* number of blocks allocated in unit.unit_block */
+  int *cell_capacity;         /* number of cells allocated in each block */
+  unsigned char *raw;         /* undecoded cell records */
+  size_t raw_capacity;
+} cdf_unit_buffer;
+
+
+typedef struct{
+  cdf_qc_unit qc_unit;        /* the most recently read QC unit */
+  unsigned int probe_capacity;
+  unsigned char *raw;         /* undecoded QC probe records */
+  size_t raw_capacity;
+} cdf_qc_unit_buffer;
+
+
+
+/*************************************************************************
+ **
+ ** Little endian decoding from a byte buffer. These work the same way
+ ** irrespective of the byte order of the machine.
+ **
+ *************************************************************************/
 
+static int decode_le_int32(const unsigned char *buffer){
+  return (int)((unsigned int)buffer[0] | ((unsigned int)buffer[1] << 8) | ((unsigned int)buffer[2] << 16) | ((unsigned int)buffer[3] << 24));
+}
 
+static unsigned short decode_le_uint16(const unsigned char *buffer){
+  return (unsigned short)(buffer[0] | (buffer[1] << 8));
+}
 
 
+/*************************************************************************
+ **
+ ** static int seek_cdf_xda(FILE *instream, int filelocation)
+ **
+ ** moves to filelocation. Units are usually stored one after another
+ ** so avoid the fseek (which discards the stdio buffer) when already there.
+ **
+ *************************************************************************/
 
+static int seek_cdf_xda(FILE *instream, int filelocation){
+  
+  if (ftell(instream) == filelocation){
+    return 1;
+  }
+  return !fseek(instream,filelocation,SEEK_SET);
+}
 
 
 
@@ -218,166 +300,314 @@ typedef struct {
 
 /*************************************************************************
  **
- ** int read_cdf_qcunit(cdf_qc_unit *my_unit,int filelocation,FILE *instream)
+ ** int read_cdf_qcunit(cdf_qc_unit_buffer *buffer,int filelocation,FILE *instream)
  **
- ** cdf_qc_unit *my_unit - preallocated space to store qc unit information
+ ** cdf_qc_unit_buffer *buffer - reusable space to store qc unit information
  ** int filelocation - indexing/location information used to read information
  **                    from file
  ** FILE *instream - a pre-opened file to read from
  **
- ** reads a specificed qc_unit from the file. Allocates space for the cdf_qc_probes
- ** and also reads them in
+ ** reads a specificed qc_unit from the file into buffer->qc_unit. Space for 
+ ** the cdf_qc_probes is grown as needed and reused between calls. The 
+ ** probe records are read with a single fread and then decoded.
  **
+ ** Returns 1 on success, 0 if the file is truncated or corrupt.
  ** 
  *************************************************************************/
 
-int read_cdf_qcunit(cdf_qc_unit *my_unit,int filelocation,FILE *instream){
+int read_cdf_qcunit(cdf_qc_unit_buffer *buffer,int filelocation,FILE *instream){
   
-  int i;
+  unsigned int i;
+  int n_probes;
+  long here, end;
+  unsigned char header[CDF_XDA_QC_UNIT_HEADER_SIZE];
+  unsigned char *cur_raw;
+  size_t raw_size;
+  cdf_qc_unit *my_unit = &(buffer->qc_unit);
+
+  if (!seek_cdf_xda(instream,filelocation)){
+    return 0;
+  }
 
+  if (fread(header,1,CDF_XDA_QC_UNIT_HEADER_SIZE,instream) != CDF_XDA_QC_UNIT_HEADER_SIZE){
+    return 0;
+  }
+  my_unit->type = decode_le_uint16(header);
+  n_probes = decode_le_int32(&header[2]);
 
-  fseek(instream,filelocation,SEEK_SET);
+  if (n_probes < 0){
+    return 0;
+  }
+  my_unit->n_probes = (unsigned int)n_probes;
 
-  fread_uint16(&(my_unit->type),1,instream);
-  fread_uint32(&(my_unit->n_probes),1,instream);
+  if (my_unit->n_probes > buffer->probe_capacity){
+    /* a count bigger than the rest of the file can hold is corrupt, not something to allocate */
+    if ((here = ftell(instream)) < 0 || fseek(instream,0,SEEK_END) != 0 || (end = ftell(instream)) < 0 ||
+	fseek(instream,here,SEEK_SET) != 0 || (double)n_probes*CDF_XDA_QC_PROBE_SIZE > (double)(end - here)){
+      return 0;
+    }
+    my_unit->qc_probes = R_Realloc(my_unit->qc_probes,my_unit->n_probes,cdf_qc_probe);
+    buffer->probe_capacity = my_unit->n_probes;
+  }
 
+  raw_size = (size_t)my_unit->n_probes*CDF_XDA_QC_PROBE_SIZE;
+  if (raw_size > buffer->raw_capacity){
+    buffer->raw = R_Realloc(buffer->raw,raw_size,unsigned char);
+    buffer->raw_capacity = raw_size;
+  }
 
-  my_unit->qc_probes = R_Calloc(my_unit->n_probes,cdf_qc_probe);
+  if (raw_size > 0 && fread(buffer->raw,1,raw_size,instream) != raw_size){
+    return 0;
+  }
 
+  cur_raw = buffer->raw;
   for (i=0; i < my_unit->n_probes; i++){
-    fread_uint16(&(my_unit->qc_probes[i].x),1,instream);
-    fread_uint16(&(my_unit->qc_probes[i].y),1,instream);
-    fread_uchar(&(my_unit->qc_probes[i].probelength),1,instream);
-    fread_uchar(&(my_unit->qc_probes[i].pmflag),1,instream);
-    fread_uchar(&(my_unit->qc_probes[i].bgprobeflag),1,instream);
-    
-     }
+    my_unit->qc_probes[i].x = decode_le_uint16(cur_raw);
+    my_unit->qc_probes[i].y = decode_le_uint16(&cur_raw[2]);
+    my_unit->qc_probes[i].probelength = cur_raw[4];
+    my_unit->qc_probes[i].pmflag = cur_raw[5];
+    my_unit->qc_probes[i].bgprobeflag = cur_raw[6];
+    cur_raw+=CDF_XDA_QC_PROBE_SIZE;
+  }
   return 1;
 }
 
 /*************************************************************************
  **
- ** int read_cdf_unit(cdf_unit *my_unit,int filelocation,FILE *instream)
+ ** int read_cdf_unit(cdf_unit_buffer *buffer,int filelocation,FILE *instream)
  **
- ** cdf_qc_unit *my_unit - preallocated space to store unit (aka probeset) information
+ ** cdf_unit_buffer *buffer - reusable space to store unit (aka probeset) information
  ** int filelocation - indexing/location information used to read information
  **                    from file
  ** FILE *instream - a pre-opened file to read from
  **
- ** reads a specified probeset into the my_unit, including all blocks and all probes
- ** it is assumed that the unit itself is preallocated. Blocks and probes within
- ** the blocks are allocated by this function.
+ ** reads a specified probeset into buffer->unit, including all blocks and all probes.
+ ** Blocks and the cells within them are only (re)allocated when the unit
+ ** is bigger than any previously read into this buffer. The cells of a block
+ ** are read in one go and decoded from the raw buffer.
+ **
+ ** Returns 1 on success, 0 if the file is truncated or corrupt.
  ** 
  *************************************************************************/
 
-int read_cdf_unit(cdf_unit *my_unit,int filelocation,FILE *instream){
+int read_cdf_unit(cdf_unit_buffer *buffer,int filelocation,FILE *instream){
 
   int i,j;
+  unsigned char header[CDF_XDA_BLOCK_HEADER_SIZE];
+  unsigned char *cur_raw;
+  size_t raw_size;
 
-  fseek(instream,filelocation,SEEK_SET);
+  cdf_unit *my_unit = &(buffer->unit);
+  cdf_unit_block *cur_block;
+  cdf_unit_cell *cur_cell;
 
-  fread_uint16(&(my_unit->unittype),1,instream);
-  fread_uchar(&(my_unit->direction),1,instream);
-  
+  if (!seek_cdf_xda(instream,filelocation)){
+    return 0;
+  }
 
-  fread_int32(&(my_unit->natoms),1,instream);
-  fread_int32(&(my_unit->nblocks),1,instream);
-  fread_int32(&(my_unit->ncells),1,instream);
-  fread_int32(&(my_unit->unitnumber),1,instream);
-  fread_uchar(&(my_unit->ncellperatom),1,instream);
+  if (fread(header,1,CDF_XDA_UNIT_HEADER_SIZE,instream) != CDF_XDA_UNIT_HEADER_SIZE){
+    return 0;
+  }
+
+  my_unit->unittype = decode_le_uint16(header);
+  my_unit->direction = header[2];
+  my_unit->natoms = decode_le_int32(&header[3]);
+  my_unit->nblocks = decode_le_int32(&header[7]);
+  my_unit->ncells = decode_le_int32(&header[11]);
+  my_unit->unitnumber = decode_le_int32(&header[15]);
+  my_unit->ncellperatom = header[19];
+
+  if (my_unit->nblocks < 0){
+    return 0;
+  }
 
-  my_unit->unit_block = R_Calloc(my_unit->nblocks,cdf_unit_block);
+  if (my_unit->nblocks > buffer->block_capacity){
+    my_unit->unit_block = R_Realloc(my_unit->unit_block,my_unit->nblocks,cdf_unit_block);
+    buffer->cell_capacity = R_Realloc(buffer->cell_capacity,my_unit->nblocks,int);
+    for (i= buffer->block_capacity; i < my_unit->nblocks; i++){
+      my_unit->unit_block[i].unit_cells = NULL;
+      buffer->cell_capacity[i] = 0;
+    }
+    buffer->block_capacity = my_unit->nblocks;
+  }
 
   for (i=0; i < my_unit->nblocks; i++){
-    fread_int32(&(my_unit->unit_block[i].natoms),1,instream);
-    fread_int32(&(my_unit->unit_block[i].ncells),1,instream);
-    fread_uchar(&(my_unit->unit_block[i].ncellperatom),1,instream);
-    fread_uchar(&(my_unit->unit_block[i].direction),1,instream);
-    fread_int32(&(my_unit->unit_block[i].firstatom),1,instream);
-    fread_int32(&(my_unit->unit_block[i].unused),1,instream);
-    fread_char(my_unit->unit_block[i].blockname,64,instream); 
-
-    my_unit->unit_block[i].unit_cells = R_Calloc(my_unit->unit_block[i].ncells,cdf_unit_cell);
-
-    for (j=0; j < my_unit->unit_block[i].ncells; j++){
-      fread_int32(&(my_unit->unit_block[i].unit_cells[j].atomnumber),1,instream);
-      fread_uint16(&(my_unit->unit_block[i].unit_cells[j].x),1,instream);
-      fread_uint16(&(my_unit->unit_block[i].unit_cells[j].y),1,instream);
-      fread_int32(&(my_unit->unit_block[i].unit_cells[j].indexpos),1,instream);
-      fread_char(&(my_unit->unit_block[i].unit_cells[j].pbase),1,instream);
-      fread_char(&(my_unit->unit_block[i].unit_cells[j].tbase),1,instream);
+    cur_block = &(my_unit->unit_block[i]);
+
+    if (fread(header,1,CDF_XDA_BLOCK_HEADER_SIZE,instream) != CDF_XDA_BLOCK_HEADER_SIZE){
+      return 0;
+    }
+    cur_block->natoms = decode_le_int32(header);
+    cur_block->ncells = decode_le_int32(&header[4]);
+    cur_block->ncellperatom = header[8];
+    cur_block->direction = header[9];
+    cur_block->firstatom = decode_le_int32(&header[10]);
+    cur_block->unused = decode_le_int32(&header[14]);
+    memcpy(cur_block->blockname,&header[18],64);
+
+    if (cur_block->ncells < 0){
+      return 0;
     }
 
+    if (cur_block->ncells > buffer->cell_capacity[i]){
+      cur_block->unit_cells = R_Realloc(cur_block->unit_cells,cur_block->ncells,cdf_unit_cell);
+      buffer->cell_capacity[i] = cur_block->ncells;
+    }
 
-  }
+    raw_size = (size_t)cur_block->ncells*CDF_XDA_CELL_SIZE;
+    if (raw_size > buffer->raw_capacity){
+      buffer->raw = R_Realloc(buffer->raw,raw_size,unsigned char);
+      buffer->raw_capacity = raw_size;
+    }
+    
+    if (fread(buffer->raw,1,raw_size,instream) != raw_size){
+      return 0;
+    }
 
+    cur_raw = buffer->raw;
+    for (j=0; j < cur_block->ncells; j++){
+      cur_cell = &(cur_block->unit_cells[j]);
+      cur_cell->atomnumber = decode_le_int32(cur_raw);
+      cur_cell->x = decode_le_uint16(&cur_raw[4]);
+      cur_cell->y = decode_le_uint16(&cur_raw[6]);
+      cur_cell->indexpos = decode_le_int32(&cur_raw[8]);
+      cur_cell->pbase = (char)cur_raw[12];
+      cur_cell->tbase = (char)cur_raw[13];
+      cur_raw+=CDF_XDA_CELL_SIZE;
+    }
+  }
 
   return 1;
 
 }
 
+
 /*************************************************************************
  **
- ** static void dealloc_cdf_xda(cdf_xda *my_cdf)
+ ** static void dealloc_cdf_unit_buffer(cdf_unit_buffer *buffer)
+ ** static void dealloc_cdf_qc_unit_buffer(cdf_qc_unit_buffer *buffer)
  **
- ** Deallocates all the previously allocated memory.
+ ** Deallocates the space used for decoding units.
  ** 
  *************************************************************************/
 
-static void dealloc_cdf_xda(cdf_xda *my_cdf){
+static void dealloc_cdf_unit_buffer(cdf_unit_buffer *buffer){
 
   int i;
 
-  for (i=0; i < my_cdf->header.n_units; i++){
-    R_Free(my_cdf->probesetnames[i]);
-  }              
-  R_Free(my_cdf->probesetnames);
+  for (i=0; i < buffer->block_capacity; i++){
+    if (buffer->unit.unit_block[i].unit_cells != NULL){
+      R_Free(buffer->unit.unit_block[i].unit_cells);
+    }
+  }
+  if (buffer->block_capacity > 0){
+    R_Free(buffer->unit.unit_block);
+    R_Free(buffer->cell_capacity);
+  }
+  if (buffer->raw != NULL){
+    R_Free(buffer->raw);
+  }
+  buffer->block_capacity = 0;
+  buffer->raw_capacity = 0;
+}
+
 
-  R_Free(my_cdf->qc_start);
-  R_Free(my_cdf->units_start);
+static void dealloc_cdf_qc_unit_buffer(cdf_qc_unit_buffer *buffer){
 
-  for (i=0; i < my_cdf->header.n_qc_units; i++){
-    R_Free(my_cdf->qc_units[i].qc_probes);
+  if (buffer->qc_unit.qc_probes != NULL){
+    R_Free(buffer->qc_unit.qc_probes);
   }
+  if (buffer->raw != NULL){
+    R_Free(buffer->raw);
+  }
+  buffer->probe_capacity = 0;
+  buffer->raw_capacity = 0;
 
-  R_Free(my_cdf->qc_units);
+}
 
 
-  for (i=0; i < my_cdf->header.n_units; i++){
-    R_Free(my_cdf->units[i].unit_block);
-  }
-  R_Free(my_cdf->units);
-  R_Free(my_cdf->header.ref_seq);
+/*************************************************************************
+ **
+ ** static void close_cdf_xda(cdf_xda *my_cdf)
+ **
+ ** Closes the file and deallocates all the previously allocated memory.
+ ** 
+ *************************************************************************/
+
+static void close_cdf_xda(cdf_xda *my_cdf){
 
+  if (my_cdf->infile != NULL){
+    fclose(my_cdf->infile);
+    my_cdf->infile = NULL;
+  }
+  if (my_cdf->probesetnames != NULL){
+    R_Free(my_cdf->probesetnames);
+  }
+  if (my_cdf->qc_start != NULL){
+    R_Free(my_cdf->qc_start);
+  }
+  if (my_cdf->units_start != NULL){
+    R_Free(my_cdf->units_start);
+  }
+  if (my_cdf->header.ref_seq != NULL){
+    R_Free(my_cdf->header.ref_seq);
+  }
 } 
 
 
+/*************************************************************************
+ **
+ ** static SEXP mkCharFixed(const char *name, int max_length)
+ **
+ ** names in a CDF file are stored in fixed width fields and are not
+ ** necessarily NULL terminated if they use the full width.
+ **
+ *************************************************************************/
+
+static SEXP mkCharFixed(const char *name, int max_length){
+  
+  int length = 0;
+
+  while (length < max_length && name[length] != '\0'){
+    length++;
+  }
+  return mkCharLen(name,length);
+}
+
+
 
 /*************************************************************
  **
- ** int read_cdf_xda(const char *filename)
- **
- ** filename - Name of the prospective binary cel file
+ ** static int open_cdf_xda(const char *filename,cdf_xda *my_cdf)
  **
- ** Returns 1 if the file was completely successfully parsed
- ** otherwise 0 (and possible prints a message to screen)
- ** 
+ ** filename - Name of the prospective binary cdf file
  **
+ ** Opens the file and reads the header, the probeset names and
+ ** the file positions of each of the QC units and units. The
+ ** file is left open (positioned at the first QC unit) so that
+ ** units may then be read using read_cdf_qcunit()/read_cdf_unit().
  **
+ ** Returns 1 if this was successful otherwise 0 (and possible
+ ** prints a message to screen). Either way close_cdf_xda() 
+ ** should be called when done.
  **
  *************************************************************/
 
-static int read_cdf_xda(const char *filename,cdf_xda *my_cdf){
+static int open_cdf_xda(const char *filename,cdf_xda *my_cdf){
 
   FILE *infile;
-
+#ifdef READ_CDF_DEBUG
   int i;
+#endif
+
+  memset(my_cdf,0,sizeof(cdf_xda));
 
   if ((infile = fopen(filename, "rb")) == NULL)
     {
       error("Unable to open the file %s",filename);
       return 0;
     }
+  my_cdf->infile = infile;
 
   if (!fread_int32(&my_cdf->header.magicnumber,1,infile)){
     return 0;
@@ -416,24 +646,26 @@ static int read_cdf_xda(const char *filename,cdf_xda *my_cdf){
   if (!fread_int32(&my_cdf->header.len_ref_seq,1,infile)){
     return 0;
   }
-  
-  my_cdf->header.ref_seq = R_Calloc(my_cdf->header.len_ref_seq,char);
-
-  fread_char(my_cdf->header.ref_seq, my_cdf->header.len_ref_seq, infile);
-  my_cdf->probesetnames = R_Calloc(my_cdf->header.n_units,char *);
 
+  if (my_cdf->header.n_units < 0 || my_cdf->header.n_qc_units < 0 || my_cdf->header.len_ref_seq < 0){
+    return 0;
+  }
+  
+  my_cdf->header.ref_seq = R_Calloc(my_cdf->header.len_ref_seq+1,char);
 
-  for (i =0; i < my_cdf->header.n_units;i++){
-    my_cdf->probesetnames[i] = R_Calloc(64,char);
-    if (!fread_char(my_cdf->probesetnames[i], 64, infile)){
-      return 0;
-    }
+  if (my_cdf->header.len_ref_seq > 0 && !fread_char(my_cdf->header.ref_seq, my_cdf->header.len_ref_seq, infile)){
+    return 0;
   }
 
+  my_cdf->names_start = (int)ftell(infile);
+  my_cdf->probesetnames = R_Calloc((size_t)my_cdf->header.n_units*64+1,char);
+  my_cdf->qc_start = R_Calloc(my_cdf->header.n_qc_units+1,int);
+  my_cdf->units_start = R_Calloc(my_cdf->header.n_units+1,int);
 
+  if (fread(my_cdf->probesetnames,1,(size_t)my_cdf->header.n_units*64,infile) != (size_t)my_cdf->header.n_units*64){
+    return 0;
+  }
 
-  my_cdf->qc_start = R_Calloc(my_cdf->header.n_qc_units,int);
-  my_cdf->units_start = R_Calloc(my_cdf->header.n_units,int);
 
   /*** Old code that might fail if there is 0 QCunits or 0 Units
        if (!fread_int32(my_cdf->qc_start,my_cdf->header.n_qc_units,infile) 
@@ -453,82 +685,24 @@ static int read_cdf_xda(const char *filename,cdf_xda *my_cdf){
       return 0;
     }
   }
-
-  /* We will read in all the QC and Standard Units, rather than  
-     random accessing what we need */
-  my_cdf->qc_units = R_Calloc(my_cdf->header.n_qc_units,cdf_qc_unit);
-  
-  
-  for (i =0; i < my_cdf->header.n_qc_units; i++){
-    if (!read_cdf_qcunit(&my_cdf->qc_units[i],my_cdf->qc_start[i],infile)){
-      return 0;
-    }
-  }
-    
-  my_cdf->units = R_Calloc(my_cdf->header.n_units,cdf_unit);
-
-
-  for (i=0; i < my_cdf->header.n_units; i++){
-    if (!read_cdf_unit(&my_cdf->units[i],my_cdf->units_start[i],infile)){
-      return 0;
-    }
-  }
   
 
 #ifdef READ_CDF_DEBUG
-   Rprintf("%d %d %d %d  %d\n",my_cdf->header.cols,my_cdf->header.rows,my_cdf->header.n_units,my_cdf->header.n_qc_units,my_cdf->header.len_ref_seq);
+  Rprintf("%d %d %d %d  %d\n",my_cdf->header.cols,my_cdf->header.rows,my_cdf->header.n_units,my_cdf->header.n_qc_units,my_cdf->header.len_ref_seq);
   for (i =0; i < my_cdf->header.n_units;i++){
-    Rprintf("%s\n",my_cdf->probesetnames[i]);
+    Rprintf("%.64s\n",&my_cdf->probesetnames[64*i]);
   }
 
   for (i =0; i < my_cdf->header.n_qc_units;i++){
     Rprintf("%d\n",my_cdf->qc_start[i]);
   }
   
-  for (i =0; i < my_cdf->header.n_qc_units;i++){
+  for (i =0; i < my_cdf->header.n_units;i++){
     Rprintf("%d\n",my_cdf->units_start[i]);
   }
-
-  Rprintf("%d %d\n",my_cdf->qc_units[0].type,my_cdf->qc_units[0].n_probes);
-  
-  for (i=0; i < my_cdf->qc_units[0].n_probes; i++){
-    Rprintf("%d %d %d %u %d\n",my_cdf->qc_units[0].qc_probes[i].x,my_cdf->qc_units[0].qc_probes[i].y,
-	    my_cdf->qc_units[0].qc_probes[i].probelength,
-	    my_cdf->qc_units[0].qc_probes[i].pmflag,
-	    my_cdf->qc_units[0].qc_probes[i].bgprobeflag);
-
-  }
-  
-
-  Rprintf("%u %u %d %d %d %d %u\n",my_cdf->units[0].unittype,my_cdf->units[0].direction,
-	  my_cdf->units[0].natoms,
-	  my_cdf->units[0].nblocks,
-	  my_cdf->units[0].ncells,
-	  my_cdf->units[0].unitnumber,
-	  my_cdf->units[0].ncellperatom);
-
-    Rprintf("%d %d %u %u %d %d %s\n",my_cdf->units[0].unit_block[0].natoms,my_cdf->units[0].unit_block[0].ncells,
-	    my_cdf->units[0].unit_block[0].ncellperatom,
-	    my_cdf->units[0].unit_block[0].direction,
-	    my_cdf->units[0].unit_block[0].firstatom,
-	    my_cdf->units[0].unit_block[0].unused,
-	    my_cdf->units[0].unit_block[0].blockname);
-    
-    for (i=0; i <my_cdf->units[0].unit_block[0].ncells  ; i++){
-      Rprintf("%d %u %u %d %c %c\n",
-	      my_cdf->units[0].unit_block[0].unit_cells[i].atomnumber,
-	      my_cdf->units[0].unit_block[0].unit_cells[i].x,
-	      my_cdf->units[0].unit_block[0].unit_cells[i].y,
-	      my_cdf->units[0].unit_block[0].unit_cells[i].indexpos,
-	      my_cdf->units[0].unit_block[0].unit_cells[i].pbase,
-	      my_cdf->units[0].unit_block[0].unit_cells[i].tbase);
-    }
 #endif
-    
-  fclose(infile);
-  return 1;
 
-  /* fseek() */
+  return 1;
 }
 
 
@@ -560,14 +734,17 @@ static int check_cdf_xda(const char *filename){
     }
 
   if (!fread_int32(&magicnumber,1,infile)){
+    fclose(infile);
     error("File corrupt or truncated?");
     return 0;
   }
 
   if (!fread_int32(&version_number,1,infile)){ 
+    fclose(infile);
     error("File corrupt or truncated?");
     return 0;
   }
+  fclose(infile);
 
 
   if (magicnumber != 67){
@@ -661,120 +838,589 @@ SEXP CheckCDFXDA(SEXP filename){
 
 
 
+/*************************************************************
+ **
+ ** SEXP CheckCDFType(SEXP filename)
+ ** 
+ ** Opens the file once and returns "text", "xda" or "unknown"
+ ** depending on whether it looks like a text CDF file (starts
+ ** with [CDF]) or a binary one (magic number 67, version 1).
+ **
+ *************************************************************/
 
+SEXP CheckCDFType(SEXP filename){
 
+  FILE *infile;
+  unsigned char buffer[8];
+  size_t n_read;
+  const char *cur_file_name;
+  const char *type = "unknown";
+
+  cur_file_name = CHAR(STRING_ELT(filename,0));
+
+  if ((infile = fopen(cur_file_name, "rb")) == NULL){
+    error("Unable to open the file %s",cur_file_name);
+  }
+  n_read = fread(buffer,1,8,infile);
+  fclose(infile);
+
+  if (n_read >= 5 && strncmp("[CDF]",(const char *)buffer,5) == 0){
+    type = "text";
+  } else if (n_read == 8 && decode_le_int32(buffer) == 67 && decode_le_int32(&buffer[4]) == 1){
+    type = "xda";
+  }
+  return mkString(type);
+}
+
+
+
+
+
+
+/*************************************************************
+ **
+ ** The PM/MM locations may be returned in one of three forms
+ **
+ ** CDF_LOCATIONS_DOUBLE  - a list of (natoms by 2) REALSXP matrices
+ **                         (the traditional cdfenv style)
+ ** CDF_LOCATIONS_INTEGER - the same but INTSXP matrices, with NA
+ **                         for locations that are not present
+ ** CDF_LOCATIONS_FLAT    - a single integer PM and MM index for the 
+ **                         entire chip along with per probeset offsets
+ **
+ *************************************************************/
+
+#define CDF_LOCATIONS_DOUBLE 0
+#define CDF_LOCATIONS_INTEGER 1
+#define CDF_LOCATIONS_FLAT 2
+
+
+typedef struct{
+  int n_probes;   /* number of PM (and MM) entries stored */
+  int capacity;   /* space allocated in pm and mm */
+  int *pm;
+  int *mm;
+} cdf_flat_index;
+
+
+
+/*************************************************************
+ **
+ ** static SEXP cdf_block_locations(const cdf_unit_block *block, int cols, int storage)
+ **
+ ** builds the (natoms by 2) matrix of PM and MM indices for an
+ ** expression block, in the BioC cdfenv style. Locations that
+ ** are not present in the block are NaN (NA for integer storage).
+ **
+ ** returns R_NilValue if the block refers to atoms outside its
+ ** declared range (ie the file is corrupt)
+ **
+ *************************************************************/
+
+static SEXP cdf_block_locations(const cdf_unit_block *block, int cols, int storage){
 
-SEXP ReadCDFFile(SEXP filename){
-  
-  SEXP CDFInfo;
-  SEXP Dimensions;
-  SEXP LocMap= R_NilValue,tempLocMap;
   SEXP CurLocs;
-  SEXP PSnames = R_NilValue,tempPSnames;
   SEXP ColNames;
   SEXP dimnames;
 
-  cdf_xda my_cdf;
-  const char *cur_file_name;
-  /* char *tmp_name; */
+  int k;
+  int cur_cells = block->ncells;
+  int cur_atoms = block->natoms;
+  int location;
 
-  int i,j,k;
-  int cur_blocks,cur_cells, cur_atoms;
-  /* int which_probetype; */
-  int which_psname=0;
+  const cdf_unit_cell *current_cell;
+  double *curlocs = NULL;
+  int *curlocs_int = NULL;
 
-  cdf_unit_cell *current_cell;
+  if (cur_atoms < 0){
+    return R_NilValue;
+  }
 
-  double *curlocs;
-  
-  /* int nrows, ncols; */
+  if (storage == CDF_LOCATIONS_INTEGER){
+    PROTECT(CurLocs = allocMatrix(INTSXP,cur_atoms,2));
+    curlocs_int = INTEGER_POINTER(CurLocs);
+    for (k=0; k < cur_atoms*2; k++){
+      curlocs_int[k] = NA_INTEGER;
+    }
+  } else {
+    PROTECT(CurLocs = allocMatrix(REALSXP,cur_atoms,2));
+    curlocs = NUMERIC_POINTER(CurLocs);
+    for (k=0; k < cur_atoms*2; k++){
+      curlocs[k] = R_NaN;
+    }
+  }
+  PROTECT(ColNames = allocVector(STRSXP,2));
+  PROTECT(dimnames = allocVector(VECSXP,2));
+  SET_STRING_ELT(ColNames,0,mkChar("pm"));
+  SET_STRING_ELT(ColNames,1,mkChar("mm"));
 
- 
-  cur_file_name = CHAR(STRING_ELT(filename,0));
+  for (k=0; k < cur_cells; k++){
+    current_cell = &(block->unit_cells[k]);
 
-  if (!read_cdf_xda(cur_file_name,&my_cdf)){
-    error("Problem reading binary cdf file %s. Possibly corrupted or truncated?\n",cur_file_name);
+    if (current_cell->atomnumber < 0 || current_cell->atomnumber >= cur_atoms){
+      UNPROTECT(3);
+      return R_NilValue;
+    }
+	  
+    location = current_cell->x + current_cell->y*(cols) + 1;   /*  current_cell->x + current_cell->y*(my_cdf.header.rows) + 1; */          /* "y*", sizex, "+x+1"; */
+
+    if(isPM(current_cell->pbase,current_cell->tbase)){
+      if (curlocs_int != NULL){
+	curlocs_int[current_cell->atomnumber] = location;
+      } else {
+	curlocs[current_cell->atomnumber] = location;
+      }
+    } else {
+      if (curlocs_int != NULL){
+	curlocs_int[current_cell->atomnumber+ cur_atoms] = location;
+      } else {
+	curlocs[current_cell->atomnumber+ cur_atoms] = location;
+      }
+    }
   }
-  
+	
+  SET_VECTOR_ELT(dimnames,1,ColNames);
+  setAttrib(CurLocs, R_DimNamesSymbol, dimnames);
+  UNPROTECT(3);
+  return CurLocs;
 
-  /* We output:
-     nrows, ncols in an integer vector, plus a list of probesets PM MM locations (in the BioC style) */
-  PROTECT(CDFInfo = allocVector(VECSXP,2));
-  PROTECT(Dimensions = allocVector(REALSXP,2));
+}
 
-  if (my_cdf.units[0].unittype ==1){ 
-    PROTECT(LocMap = allocVector(VECSXP,my_cdf.header.n_units));
-    PROTECT(PSnames = allocVector(STRSXP,my_cdf.header.n_units));
-  } else {
-    PROTECT(tempLocMap = allocVector(VECSXP,2*my_cdf.header.n_units));
-    PROTECT(tempPSnames = allocVector(STRSXP,2*my_cdf.header.n_units));
+
+/*************************************************************
+ **
+ ** static int cdf_block_flat_locations(const cdf_unit_block *block, int cols, cdf_flat_index *index)
+ **
+ ** appends the PM and MM indices of an expression block to the
+ ** flat index. Locations that are not present are NA.
+ **
+ ** returns 0 if the block refers to atoms outside its
+ ** declared range (ie the file is corrupt)
+ **
+ *************************************************************/
+
+static int cdf_block_flat_locations(const cdf_unit_block *block, int cols, cdf_flat_index *index){
+
+  int k;
+  int cur_atoms = block->natoms;
+  int location;
+  const cdf_unit_cell *current_cell;
+
+  if (cur_atoms < 0){
+    return 0;
   }
 
-  NUMERIC_POINTER(Dimensions)[0] = (double)my_cdf.header.rows;
-  NUMERIC_POINTER(Dimensions)[1] = (double)my_cdf.header.cols;
-  
+  if (index->n_probes + cur_atoms > index->capacity){
+    index->capacity = 2*index->capacity > index->n_probes + cur_atoms ? 2*index->capacity : index->n_probes + cur_atoms;
+    index->pm = R_Realloc(index->pm,index->capacity,int);
+    index->mm = R_Realloc(index->mm,index->capacity,int);
+  }
 
-  for (i=0; i < my_cdf.header.n_units; i++){
-#ifdef READ_CDF_DEBUG
-    printf("%d\n",i);
-#endif
-    cur_blocks = my_cdf.units[i].nblocks;
+  for (k=0; k < cur_atoms; k++){
+    index->pm[index->n_probes + k] = NA_INTEGER;
+    index->mm[index->n_probes + k] = NA_INTEGER;
+  }
 
-#ifdef READ_CDF_DEBUG
-    Rprintf("New Block: ");
-#endif
-    if (my_cdf.units[i].unittype ==1){
-      /* Expression analysis */
-      for (j=0; j < cur_blocks; j++){
-	
-#ifdef READ_CDF_DEBUG
-	Rprintf("%s ",my_cdf.units[i].unit_block[j].blockname);
-#endif
+  for (k=0; k < block->ncells; k++){
+    current_cell = &(block->unit_cells[k]);
 
-	cur_cells = my_cdf.units[i].unit_block[j].ncells;
-	cur_atoms = my_cdf.units[i].unit_block[j].natoms; 
-	
-	SET_STRING_ELT(PSnames,i,mkChar(my_cdf.units[i].unit_block[j].blockname));
-	
-	PROTECT(CurLocs = allocMatrix(REALSXP,cur_atoms,2));
-	PROTECT(ColNames = allocVector(STRSXP,2));
-	PROTECT(dimnames = allocVector(VECSXP,2));
-	SET_STRING_ELT(ColNames,0,mkChar("pm"));
-	SET_STRING_ELT(ColNames,1,mkChar("mm"));
-	
-	curlocs = NUMERIC_POINTER(AS_NUMERIC(CurLocs));
-	
-        for (k=0; k < cur_atoms*2; k++){
-	  curlocs[k] = R_NaN;
-	}
+    if (current_cell->atomnumber < 0 || current_cell->atomnumber >= cur_atoms){
+      return 0;
+    }
+    location = current_cell->x + current_cell->y*(cols) + 1;
+    if (isPM(current_cell->pbase,current_cell->tbase)){
+      index->pm[index->n_probes + current_cell->atomnumber] = location;
+    } else {
+      index->mm[index->n_probes + current_cell->atomnumber] = location;
+    }
+  }
+  index->n_probes+=cur_atoms;
+  return 1;
+}
 
-	for (k=0; k < cur_cells; k++){
-	  current_cell = &(my_cdf.units[i].unit_block[j].unit_cells[k]);
-	  
-	  if(isPM(current_cell->pbase,current_cell->tbase)){
-	    curlocs[current_cell->atomnumber] =  current_cell->x + current_cell->y*(my_cdf.header.cols) + 1;   /*  current_cell->x + current_cell->y*(my_cdf.header.rows) + 1; */          /* "y*", sizex, "+x+1"; */
-	  } else {
-	    curlocs[current_cell->atomnumber+ cur_atoms] =   current_cell->x + current_cell->y*(my_cdf.header.cols) + 1;                /* current_cell->x + current_cell->y*(my_cdf.header.rows) + 1; */
-	  }
+
+
+/*************************************************************
+ **
+ ** static void count_cdf_block_probes(const cdf_unit_block *block, int *n_pm, int *n_mm)
+ **
+ ** adds the number of PM and MM cells in an expression block
+ ** to n_pm and n_mm
+ **
+ *************************************************************/
+
+static void count_cdf_block_probes(const cdf_unit_block *block, int *n_pm, int *n_mm){
+
+  int k;
+
+  for (k=0; k < block->ncells; k++){
+    if (isPM(block->unit_cells[k].pbase,block->unit_cells[k].tbase)){
+      (*n_pm)++;
+    } else {
+      (*n_mm)++;
+    }
+  }
+}
+
+
+
+/*************************************************************
+ **
+ ** A hash table mapping probeset (unit) names to unit numbers. It
+ ** is built from the name table at the start of the file, so 
+ ** together with the unit file positions (also in the header) a
+ ** probeset can be located without reading any of the units.
+ **
+ ** Open addressing with linear probing. slots holds unit number + 1, 
+ ** 0 being an empty slot.
+ **
+ *************************************************************/
+
+typedef struct{
+  unsigned int size;   /* always a power of 2 */
+  int *slots;
+} cdf_name_index;
+
+
+static unsigned int cdf_name_hash(const char *name, int max_length){
+
+  /* FNV-1a */
+  unsigned int hash = 2166136261U;
+  int i;
+
+  for (i=0; i < max_length && name[i] != '\0'; i++){
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+
+static int cdf_name_equal(const char *stored_name, const char *name){
+
+  size_t length = strlen(name);
+
+  if (length > 64 || strncmp(stored_name,name,length) != 0){
+    return 0;
+  }
+  return (length == 64 || stored_name[length] == '\0');
+}
+
+
+/*************************************************************
+ **
+ ** static void build_cdf_name_index(const cdf_xda *my_cdf, cdf_name_index *index)
+ **
+ ** indexes the probeset names of an opened cdf file. Where a name 
+ ** occurs more than once the first unit is used. Storage is
+ ** allocated with R_alloc so is released when the .Call returns.
+ **
+ *************************************************************/
+
+static void build_cdf_name_index(const cdf_xda *my_cdf, cdf_name_index *index){
+
+  int i;
+  unsigned int slot;
+  const char *cur_name;
+
+  index->size = 16;
+  while (index->size < 2*(unsigned int)my_cdf->header.n_units){
+    index->size*=2;
+  }
+  index->slots = (int *)R_alloc(index->size,sizeof(int));
+  memset(index->slots,0,index->size*sizeof(int));
+
+  for (i=0; i < my_cdf->header.n_units; i++){
+    cur_name = &(my_cdf->probesetnames[64*i]);
+    slot = cdf_name_hash(cur_name,64) & (index->size - 1);
+    while (index->slots[slot] != 0){
+      if (strncmp(&(my_cdf->probesetnames[64*(index->slots[slot]-1)]),cur_name,64) == 0){
+	break;
+      }
+      slot = (slot + 1) & (index->size - 1);
+    }
+    if (index->slots[slot] == 0){
+      index->slots[slot] = i + 1;
+    }
+  }
+}
+
+
+/*************************************************************
+ **
+ ** static int lookup_cdf_name_index(const cdf_xda *my_cdf, const cdf_name_index *index,
+ **                                  const char *name)
+ **
+ ** returns the unit number for name or -1 if there is no such unit
+ **
+ *************************************************************/
+
+static int lookup_cdf_name_index(const cdf_xda *my_cdf, const cdf_name_index *index, const char *name){
+
+  unsigned int slot = cdf_name_hash(name,(int)strlen(name)) & (index->size - 1);
+
+  while (index->slots[slot] != 0){
+    if (cdf_name_equal(&(my_cdf->probesetnames[64*(index->slots[slot]-1)]),name)){
+      return index->slots[slot] - 1;
+    }
+    slot = (slot + 1) & (index->size - 1);
+  }
+  return -1;
+}
+
+
+
+/*************************************************************
+ **
+ ** static SEXP cdf_locations_summary(const cdf_xda *my_cdf, int n_probes, int n_pm, int n_mm)
+ **
+ ** a named integer vector describing the file: Rows, Cols, 
+ ** n.units, n.qcunits, the number of probes (n.probes), PM and
+ ** MM cells (n.pm, n.mm) in the probesets read and the file 
+ ** position of the probeset name table (NameTableOffset)
+ **
+ *************************************************************/
+
+static SEXP cdf_locations_summary(const cdf_xda *my_cdf, int n_probes, int n_pm, int n_mm){
+
+  SEXP Summary;
+  SEXP SummaryNames;
+
+  PROTECT(Summary = allocVector(INTSXP,8));
+  INTEGER_POINTER(Summary)[0] = my_cdf->header.rows;
+  INTEGER_POINTER(Summary)[1] = my_cdf->header.cols;
+  INTEGER_POINTER(Summary)[2] = my_cdf->header.n_units;
+  INTEGER_POINTER(Summary)[3] = my_cdf->header.n_qc_units;
+  INTEGER_POINTER(Summary)[4] = n_probes;
+  INTEGER_POINTER(Summary)[5] = n_pm;
+  INTEGER_POINTER(Summary)[6] = n_mm;
+  INTEGER_POINTER(Summary)[7] = my_cdf->names_start;
+
+  PROTECT(SummaryNames = allocVector(STRSXP,8));
+  SET_STRING_ELT(SummaryNames,0,mkChar("Rows"));
+  SET_STRING_ELT(SummaryNames,1,mkChar("Cols"));
+  SET_STRING_ELT(SummaryNames,2,mkChar("n.units"));
+  SET_STRING_ELT(SummaryNames,3,mkChar("n.qcunits"));
+  SET_STRING_ELT(SummaryNames,4,mkChar("n.probes"));
+  SET_STRING_ELT(SummaryNames,5,mkChar("n.pm"));
+  SET_STRING_ELT(SummaryNames,6,mkChar("n.mm"));
+  SET_STRING_ELT(SummaryNames,7,mkChar("NameTableOffset"));
+  setAttrib(Summary,R_NamesSymbol,SummaryNames);
+  UNPROTECT(2);
+  return Summary;
+}
+
+
+
+/*************************************************************
+ **
+ ** static void dealloc_cdf_locations(cdf_xda *my_cdf, cdf_unit_buffer *unit_buffer,
+ **                                   cdf_flat_index *flat_index)
+ **
+ ** releases everything held while reading locations. Used both
+ ** on completion and before signalling an error.
+ **
+ *************************************************************/
+
+static void dealloc_cdf_locations(cdf_xda *my_cdf, cdf_unit_buffer *unit_buffer, cdf_flat_index *flat_index){
+
+  close_cdf_xda(my_cdf);
+  dealloc_cdf_unit_buffer(unit_buffer);
+  if (flat_index->pm != NULL){
+    R_Free(flat_index->pm);
+    R_Free(flat_index->mm);
+  }
+  flat_index->capacity = 0;
+}
+
+
+
+/*************************************************************
+ **
+ ** static SEXP read_cdf_locations(const char *cur_file_name, int storage, SEXP probesets)
+ **
+ ** Reads a binary CDF file returning the dimensions of the 
+ ** array and the PM/MM indices of each probeset in the form
+ ** given by storage (see CDF_LOCATIONS_DOUBLE etc above).
+ **
+ ** If probesets is a character vector only those probesets are
+ ** returned (in the order given). They are found by looking up
+ ** the unit name table and only the requested units are decoded.
+ ** A name that is not in the file is an error, naming the first
+ ** such probeset.
+ **
+ ** Units are decoded one at a time, each one being converted 
+ ** to its R representation before the next is read.
+ **
+ ** For expression arrays the result has a "summary" attribute 
+ ** (see cdf_locations_summary() below) and the list of location 
+ ** matrices has an "n.probes" attribute giving the number of
+ ** probesets and the total number of rows of their matrices, 
+ ** which lets read_probeintensities size its output without
+ ** visiting every probeset.
+ **
+ *************************************************************/
+
+
+static SEXP read_cdf_locations(const char *cur_file_name, int storage, SEXP probesets){
+  
+  SEXP CDFInfo;
+  SEXP Dimensions;
+  SEXP LocMap= R_NilValue,tempLocMap;
+  SEXP CurLocs;
+  SEXP PSnames = R_NilValue,tempPSnames;
+  SEXP Offsets = R_NilValue;
+  SEXP FlatIndex;
+  SEXP FlatNames;
+  SEXP ProbeCounts;
+#ifndef READ_CDF_NOSNP
+  SEXP ColNames;
+  SEXP dimnames;
+#endif
+
+  cdf_xda my_cdf;
+  cdf_unit_buffer unit_buffer;
+  cdf_unit *cur_unit;
+  cdf_flat_index flat_index;
+  cdf_name_index name_index;
+  /* char *tmp_name; */
+
+  int i,j;
+#ifndef READ_CDF_NOSNP
+  int k;
+  int cur_cells, cur_atoms;
+  cdf_unit_cell *current_cell;
+  double *curlocs;
+#endif
+  int cur_blocks;
+  unsigned short first_unittype = 1;
+  /* int which_probetype; */
+  int which_psname=0;
+  int n_protected = 0;
+  int n_output, cur_output;
+  int *which_units = NULL;   /* unit to output at each position. NULL means all units in order */
+  int n_probes = 0, n_pm = 0, n_mm = 0;
+
+  /* int nrows, ncols; */
+
+ 
+  memset(&unit_buffer,0,sizeof(cdf_unit_buffer));
+  memset(&flat_index,0,sizeof(cdf_flat_index));
+  cur_unit = &(unit_buffer.unit);
+
+  if (!open_cdf_xda(cur_file_name,&my_cdf)){
+    dealloc_cdf_locations(&my_cdf,&unit_buffer,&flat_index);
+    error("Problem reading binary cdf file %s. Possibly corrupted or truncated?\n",cur_file_name);
+  }
+
+  n_output = my_cdf.header.n_units;
+  if (probesets != R_NilValue){
+    n_output = GET_LENGTH(probesets);
+    which_units = (int *)R_alloc(n_output,sizeof(int));
+    build_cdf_name_index(&my_cdf,&name_index);
+    for (cur_output=0; cur_output < n_output; cur_output++){
+      which_units[cur_output] = lookup_cdf_name_index(&my_cdf,&name_index,CHAR(STRING_ELT(probesets,cur_output)));
+      if (which_units[cur_output] < 0){
+	dealloc_cdf_locations(&my_cdf,&unit_buffer,&flat_index);
+	error("The probeset %s is not in the cdf file %s.\n",CHAR(STRING_ELT(probesets,cur_output)),cur_file_name);
+      }
+    }
+  }
+  
+  /* the type of the first unit decides how the output is structured */
+  if (n_output > 0){
+    i = (which_units == NULL ? 0 : which_units[0]);
+    if (!read_cdf_unit(&unit_buffer,my_cdf.units_start[i],my_cdf.infile)){
+      dealloc_cdf_locations(&my_cdf,&unit_buffer,&flat_index);
+      error("Problem reading binary cdf file %s. Possibly corrupted or truncated?\n",cur_file_name);
+    }
+    first_unittype = cur_unit->unittype;
+  }
+
+  /* We output:
+     nrows, ncols in an integer vector, plus a list of probesets PM MM locations (in the BioC style) */
+  PROTECT(CDFInfo = allocVector(VECSXP,2));
+  PROTECT(Dimensions = allocVector(REALSXP,2));
+  n_protected+=2;
+
+  if (first_unittype ==1){ 
+    if (storage == CDF_LOCATIONS_FLAT){
+      PROTECT(Offsets = allocVector(INTSXP,n_output+1));
+      INTEGER_POINTER(Offsets)[0] = 0;
+    } else {
+      PROTECT(LocMap = allocVector(VECSXP,n_output));
+    }
+    PROTECT(PSnames = allocVector(STRSXP,n_output));
+  } else {
+    PROTECT(tempLocMap = allocVector(VECSXP,2*n_output));
+    PROTECT(tempPSnames = allocVector(STRSXP,2*n_output));
+  }
+  n_protected+=2;
+
+  NUMERIC_POINTER(Dimensions)[0] = (double)my_cdf.header.rows;
+  NUMERIC_POINTER(Dimensions)[1] = (double)my_cdf.header.cols;
+  
+
+  for (cur_output=0; cur_output < n_output; cur_output++){
+    i = (which_units == NULL ? cur_output : which_units[cur_output]);
+#ifdef READ_CDF_DEBUG
+    printf("%d\n",i);
+#endif
+    if (!read_cdf_unit(&unit_buffer,my_cdf.units_start[i],my_cdf.infile)){
+      dealloc_cdf_locations(&my_cdf,&unit_buffer,&flat_index);
+      error("Problem reading binary cdf file %s. Possibly corrupted or truncated?\n",cur_file_name);
+    }
+
+    cur_blocks = cur_unit->nblocks;
+
+#ifdef READ_CDF_DEBUG
+    Rprintf("New Block: ");
+#endif
+    if (cur_unit->unittype ==1 && storage == CDF_LOCATIONS_FLAT){
+      /* Expression analysis. As with the matrix forms only the last block of a unit is kept */
+      if (cur_blocks > 0){
+	SET_STRING_ELT(PSnames,cur_output,mkCharFixed(cur_unit->unit_block[cur_blocks-1].blockname,64));
+	if (!cdf_block_flat_locations(&(cur_unit->unit_block[cur_blocks-1]),my_cdf.header.cols,&flat_index)){
+	  dealloc_cdf_locations(&my_cdf,&unit_buffer,&flat_index);
+	  error("Problem reading binary cdf file %s. Possibly corrupted or truncated?\n",cur_file_name);
 	}
+      }
+      INTEGER_POINTER(Offsets)[cur_output+1] = flat_index.n_probes;
+      if (cur_blocks > 0){
+	n_probes+=cur_unit->unit_block[cur_blocks-1].natoms;
+	count_cdf_block_probes(&(cur_unit->unit_block[cur_blocks-1]),&n_pm,&n_mm);
+      }
+    } else if (cur_unit->unittype ==1){
+      /* Expression analysis */
+      for (j=0; j < cur_blocks; j++){
 	
+#ifdef READ_CDF_DEBUG
+	Rprintf("%s ",cur_unit->unit_block[j].blockname);
+#endif
 
-      
-	SET_VECTOR_ELT(dimnames,1,ColNames);
-	setAttrib(CurLocs, R_DimNamesSymbol, dimnames);
-	SET_VECTOR_ELT(LocMap,i,CurLocs);
-	UNPROTECT(3);
+	SET_STRING_ELT(PSnames,cur_output,mkCharFixed(cur_unit->unit_block[j].blockname,64));
+	
+	CurLocs = cdf_block_locations(&(cur_unit->unit_block[j]),my_cdf.header.cols,storage);
+	if (CurLocs == R_NilValue){
+	  dealloc_cdf_locations(&my_cdf,&unit_buffer,&flat_index);
+	  error("Problem reading binary cdf file %s. Possibly corrupted or truncated?\n",cur_file_name);
+	}
+	SET_VECTOR_ELT(LocMap,cur_output,CurLocs);
+      }
+      if (cur_blocks > 0){
+	n_probes+=cur_unit->unit_block[cur_blocks-1].natoms;
+	count_cdf_block_probes(&(cur_unit->unit_block[cur_blocks-1]),&n_pm,&n_mm);
       }
-    } else if (my_cdf.units[i].unittype == 2){
+    } else if (cur_unit->unittype == 2){
       /* Genotyping array */
 
 #ifndef READ_CDF_NOSNP
       if (cur_blocks == 1){
 	
-	cur_cells = my_cdf.units[i].unit_block[0].ncells;
-	cur_atoms = my_cdf.units[i].unit_block[0].natoms; 
+	cur_cells = cur_unit->unit_block[0].ncells;
+	cur_atoms = cur_unit->unit_block[0].natoms; 
 	
-	SET_STRING_ELT(tempPSnames,which_psname,mkChar(my_cdf.units[i].unit_block[0].blockname));
+	SET_STRING_ELT(tempPSnames,which_psname,mkChar(cur_unit->unit_block[0].blockname));
 	
 	PROTECT(CurLocs = allocMatrix(REALSXP,cur_atoms,2));
 	PROTECT(ColNames = allocVector(STRSXP,2));
@@ -785,7 +1431,7 @@ SEXP ReadCDFFile(SEXP filename){
 	curlocs = NUMERIC_POINTER(AS_NUMERIC(CurLocs));
 	
 	for (k=0; k < cur_cells; k++){
-	  current_cell = &(my_cdf.units[i].unit_block[0].unit_cells[k]);
+	  current_cell = &(cur_unit->unit_block[0].unit_cells[k]);
 	  
 	  if(isPM(current_cell->pbase,current_cell->tbase)){
 	    curlocs[current_cell->atomnumber] =   current_cell->x + current_cell->y*(my_cdf.header.cols) + 1;   /* current_cell->x + current_cell->y*(my_cdf.header.rows) + 1;    */       /* "y*", sizex, "+x+1"; */
@@ -805,21 +1451,21 @@ SEXP ReadCDFFile(SEXP filename){
       } else if (cur_blocks == 4){
 	for (j=0; j < cur_blocks; j++){
 #ifdef READ_CDF_DEBUG_SNP
-	  Rprintf("%s %s\n",my_cdf.probesetnames[i],my_cdf.units[i].unit_block[j].blockname);
+	  Rprintf("%s %s\n",&my_cdf.probesetnames[64*i],cur_unit->unit_block[j].blockname);
 #endif
 	}
 	
 	j = 0;
-	cur_cells = my_cdf.units[i].unit_block[0].ncells;
-	cur_atoms = my_cdf.units[i].unit_block[0].natoms; 
-	if (strlen(my_cdf.units[i].unit_block[j].blockname) == 1){
-	  tmp_name = R_Calloc(strlen(my_cdf.probesetnames[i])+2,char);
-	  tmp_name = strcpy(tmp_name,my_cdf.probesetnames[i]);
-	  tmp_name = strcat(tmp_name,my_cdf.units[i].unit_block[j].blockname);
+	cur_cells = cur_unit->unit_block[0].ncells;
+	cur_atoms = cur_unit->unit_block[0].natoms; 
+	if (strlen(cur_unit->unit_block[j].blockname) == 1){
+	  tmp_name = R_Calloc(strlen(&my_cdf.probesetnames[64*i])+2,char);
+	  tmp_name = strcpy(tmp_name,&my_cdf.probesetnames[64*i]);
+	  tmp_name = strcat(tmp_name,cur_unit->unit_block[j].blockname);
 	  SET_STRING_ELT(tempPSnames,which_psname,mkChar(tmp_name));
 	  R_Free(tmp_name);
 	} else {
-	  SET_STRING_ELT(tempPSnames,which_psname,mkChar(my_cdf.units[i].unit_block[0].blockname));
+	  SET_STRING_ELT(tempPSnames,which_psname,mkChar(cur_unit->unit_block[0].blockname));
 	}
 
 	PROTECT(CurLocs = allocMatrix(REALSXP,2*cur_atoms,2));
@@ -832,7 +1478,7 @@ SEXP ReadCDFFile(SEXP filename){
 
 
 	for (k=0; k < cur_cells; k++){
-	  current_cell = &(my_cdf.units[i].unit_block[0].unit_cells[k]);
+	  current_cell = &(cur_unit->unit_block[0].unit_cells[k]);
 	  /*	  Rprintf("%d %d  %u %u \n",cur_cells, current_cell->atomnumber,current_cell->x,current_cell->y); */
 	  if(isPM(current_cell->pbase,current_cell->tbase)){
 	    curlocs[current_cell->atomnumber] = current_cell->x + current_cell->y*(my_cdf.header.rows) + 1;           /* "y*", sizex, "+x+1"; */
@@ -845,10 +1491,10 @@ SEXP ReadCDFFile(SEXP filename){
 	}
 
 	j=2;
-	cur_cells = my_cdf.units[i].unit_block[2].ncells;
-	cur_atoms = my_cdf.units[i].unit_block[2].natoms; 
+	cur_cells = cur_unit->unit_block[2].ncells;
+	cur_atoms = cur_unit->unit_block[2].natoms; 
 	for (k=0; k < cur_cells; k++){
-	  current_cell = &(my_cdf.units[i].unit_block[2].unit_cells[k]);
+	  current_cell = &(cur_unit->unit_block[2].unit_cells[k]);
 	  /* Rprintf("half : %d %d  %u %u \n",cur_cells, current_cell->atomnumber,current_cell->x,current_cell->y); */
 	  if(isPM(current_cell->pbase,current_cell->tbase)){
 	    curlocs[current_cell->atomnumber - (cur_atoms)] = current_cell->x + current_cell->y*(my_cdf.header.rows) + 1;           /* "y*", sizex, "+x+1"; */
@@ -868,16 +1514,16 @@ SEXP ReadCDFFile(SEXP filename){
 
 
 	j = 1;	
-	cur_cells = my_cdf.units[i].unit_block[1].ncells;
-	cur_atoms = my_cdf.units[i].unit_block[1].natoms; 
-	if (strlen(my_cdf.units[i].unit_block[j].blockname) == 1){
-	  tmp_name = R_Calloc(strlen(my_cdf.probesetnames[i])+2,char);
-	  tmp_name = strcpy(tmp_name,my_cdf.probesetnames[i]);
-	  tmp_name = strcat(tmp_name,my_cdf.units[i].unit_block[j].blockname);
+	cur_cells = cur_unit->unit_block[1].ncells;
+	cur_atoms = cur_unit->unit_block[1].natoms; 
+	if (strlen(cur_unit->unit_block[j].blockname) == 1){
+	  tmp_name = R_Calloc(strlen(&my_cdf.probesetnames[64*i])+2,char);
+	  tmp_name = strcpy(tmp_name,&my_cdf.probesetnames[64*i]);
+	  tmp_name = strcat(tmp_name,cur_unit->unit_block[j].blockname);
 	  SET_STRING_ELT(tempPSnames,which_psname,mkChar(tmp_name));
 	  R_Free(tmp_name);
 	} else {
-	  SET_STRING_ELT(tempPSnames,which_psname,mkChar(my_cdf.units[i].unit_block[1].blockname));
+	  SET_STRING_ELT(tempPSnames,which_psname,mkChar(cur_unit->unit_block[1].blockname));
 	}
 	PROTECT(CurLocs = allocMatrix(REALSXP,2*cur_atoms,2));
 	PROTECT(ColNames = allocVector(STRSXP,2));
@@ -887,7 +1533,7 @@ SEXP ReadCDFFile(SEXP filename){
 	curlocs = NUMERIC_POINTER(AS_NUMERIC(CurLocs));
 	
 	for (k=0; k < cur_cells; k++){
-	  current_cell = &(my_cdf.units[i].unit_block[1].unit_cells[k]);
+	  current_cell = &(cur_unit->unit_block[1].unit_cells[k]);
 	  /* Rprintf("Dual : %d %d  %u %u \n",cur_cells, current_cell->atomnumber,current_cell->x,current_cell->y); */
 	  if(isPM(current_cell->pbase,current_cell->tbase)){
 	    curlocs[current_cell->atomnumber - (cur_atoms)] = current_cell->x + current_cell->y*(my_cdf.header.rows) + 1;           /* "y*", sizex, "+x+1"; */
@@ -897,10 +1543,10 @@ SEXP ReadCDFFile(SEXP filename){
 	}
 		
 	j=3;
-	cur_cells = my_cdf.units[i].unit_block[3].ncells;
-	cur_atoms = my_cdf.units[i].unit_block[3].natoms; 
+	cur_cells = cur_unit->unit_block[3].ncells;
+	cur_atoms = cur_unit->unit_block[3].natoms; 
 	for (k=0; k < cur_cells; k++){
-	  current_cell = &(my_cdf.units[i].unit_block[3].unit_cells[k]);
+	  current_cell = &(cur_unit->unit_block[3].unit_cells[k]);
 	  /* Rprintf("half deux : %d %d  %d %u %u \n",cur_cells, current_cell->atomnumber, cur_atoms,current_cell->x,current_cell->y); */
 	  if(isPM(current_cell->pbase,current_cell->tbase)){
 	    curlocs[current_cell->atomnumber - (2*cur_atoms)] = current_cell->x + current_cell->y*(my_cdf.header.rows) + 1;           /* "y*", sizex, "+x+1"; */
@@ -919,6 +1565,7 @@ SEXP ReadCDFFile(SEXP filename){
 	error("makecdfenv does not currently know how to handle cdf files of this type (genotyping with blocks != 1 or 4.)"); 	
       }
 #else
+      dealloc_cdf_locations(&my_cdf,&unit_buffer,&flat_index);
       error("makecdfenv does not currently know how to handle cdf files of this type (genotyping).");
 #endif
 
@@ -926,6 +1573,7 @@ SEXP ReadCDFFile(SEXP filename){
 
 
     } else { 
+      dealloc_cdf_locations(&my_cdf,&unit_buffer,&flat_index);
       error("makecdfenv does not currently know how to handle cdf files of this type (ie not expression or genotyping)"); 
     }
 
@@ -935,9 +1583,49 @@ SEXP ReadCDFFile(SEXP filename){
 #endif
   }
 
-  if (my_cdf.units[0].unittype ==2){
+  if (first_unittype ==1 && storage == CDF_LOCATIONS_FLAT){
+    PROTECT(LocMap = allocVector(VECSXP,4));
+    PROTECT(FlatIndex = allocVector(INTSXP,flat_index.n_probes));
+    if (flat_index.n_probes > 0){
+      memcpy(INTEGER_POINTER(FlatIndex),flat_index.pm,flat_index.n_probes*sizeof(int));
+    }
+    SET_VECTOR_ELT(LocMap,2,FlatIndex);
+    UNPROTECT(1);
+    PROTECT(FlatIndex = allocVector(INTSXP,flat_index.n_probes));
+    if (flat_index.n_probes > 0){
+      memcpy(INTEGER_POINTER(FlatIndex),flat_index.mm,flat_index.n_probes*sizeof(int));
+    }
+    SET_VECTOR_ELT(LocMap,3,FlatIndex);
+    UNPROTECT(1);
+    SET_VECTOR_ELT(LocMap,0,PSnames);
+    SET_VECTOR_ELT(LocMap,1,Offsets);
+    
+    PROTECT(FlatNames = allocVector(STRSXP,4));
+    SET_STRING_ELT(FlatNames,0,mkChar("ProbesetNames"));
+    SET_STRING_ELT(FlatNames,1,mkChar("Offsets"));
+    SET_STRING_ELT(FlatNames,2,mkChar("pm"));
+    SET_STRING_ELT(FlatNames,3,mkChar("mm"));
+    PSnames = FlatNames;
+    n_protected+=2;
+  }
+
+  if (first_unittype ==1){
+    if (storage != CDF_LOCATIONS_FLAT){
+      PROTECT(ProbeCounts = allocVector(INTSXP,2));
+      INTEGER_POINTER(ProbeCounts)[0] = n_output;
+      INTEGER_POINTER(ProbeCounts)[1] = n_probes;
+      setAttrib(LocMap,install("n.probes"),ProbeCounts);
+      UNPROTECT(1);
+    }
+    setAttrib(CDFInfo,install("summary"),cdf_locations_summary(&my_cdf,n_probes,n_pm,n_mm));
+  }
+
+  dealloc_cdf_locations(&my_cdf,&unit_buffer,&flat_index);
+
+  if (first_unittype ==2){
     PROTECT(PSnames = allocVector(STRSXP,which_psname));
     PROTECT(LocMap = allocVector(VECSXP,which_psname));
+    n_protected+=2;
     for (i =0; i < which_psname; i++){
       SET_STRING_ELT(PSnames,i,mkChar(CHAR(STRING_ELT(tempPSnames,i))));
       SET_VECTOR_ELT(LocMap,i,VECTOR_ELT(tempLocMap,i));
@@ -950,46 +1638,83 @@ SEXP ReadCDFFile(SEXP filename){
   setAttrib(LocMap,R_NamesSymbol,PSnames);
   SET_VECTOR_ELT(CDFInfo,0,Dimensions);
   SET_VECTOR_ELT(CDFInfo,1,LocMap);
-  if (my_cdf.units[0].unittype ==2){
-    UNPROTECT(6);
-  } else {
-    UNPROTECT(4);
-  }
+  UNPROTECT(n_protected);
 
-  dealloc_cdf_xda(&my_cdf);
   return CDFInfo;
 
 }
 
 
 
+/*************************************************************
+ **
+ ** SEXP ReadCDFFile(SEXP filename)
+ **
+ ** Reads a binary CDF file returning the dimensions of the 
+ ** array and a list of PM/MM index matrices (REALSXP), one for 
+ ** each probeset.
+ **
+ *************************************************************/
 
-/* This function is for reading in the entire binary cdf file and then 
- * returing the structure in a complex list object.
- * The fullstructure argument is expected to be a BOOLEAN. If TRUE the
- * entire contents of the CDF file are returned.
- * If False, a modified CDFENV style structure is returned
- */
+SEXP ReadCDFFile(SEXP filename){
 
+  return read_cdf_locations(CHAR(STRING_ELT(filename,0)),CDF_LOCATIONS_DOUBLE,R_NilValue);
 
+}
 
-SEXP ReadCDFFileIntoRList(SEXP filename,SEXP fullstructure){
 
-  SEXP CDFInfo = R_NilValue;  /* this is the object that will be returned */
-  SEXP CDFInfoNames;
-  SEXP HEADER;  /* Will store the header information */
-  SEXP HEADERNames;
-  SEXP Dimensions;
-  SEXP DimensionsNames;
-  SEXP REFSEQ;  /* Resequencing reference sequence */
-  SEXP UNITNAMES;
 
-  SEXP FILEPOSITIONS;
-  SEXP FILEPOSITIONSQC;
-  SEXP FILEPOSITIONSUNITS;
-  SEXP FILEPOSITIONSNames;
+/*************************************************************
+ **
+ ** SEXP ReadCDFFileLocations(SEXP filename, SEXP storage, SEXP probesets)
+ **
+ ** SEXP filename - name of binary CDF file
+ ** SEXP storage - "double", "integer" or "flat"
+ ** SEXP probesets - NULL for all probesets, otherwise a character
+ **                  vector of the probesets wanted
+ **
+ ** As ReadCDFFile, but the locations may instead be returned
+ ** as INTSXP matrices, or as a single flat index. In the flat
+ ** form the second element of the result is a list with
+ ** components ProbesetNames, Offsets, pm and mm. The probes of
+ ** the i'th probeset (counting from 0) are at positions
+ ** Offsets[i] to Offsets[i+1]-1 of pm and mm.
+ **
+ *************************************************************/
+
+SEXP ReadCDFFileLocations(SEXP filename, SEXP storage, SEXP probesets){
+
+  const char *storage_name = CHAR(STRING_ELT(storage,0));
+  
+  if (probesets != R_NilValue && !isString(probesets)){
+    error("probesets should be NULL or a character vector.");
+  }
+
+  if (strcmp(storage_name,"double") == 0){
+    return read_cdf_locations(CHAR(STRING_ELT(filename,0)),CDF_LOCATIONS_DOUBLE,probesets);
+  } else if (strcmp(storage_name,"integer") == 0){
+    return read_cdf_locations(CHAR(STRING_ELT(filename,0)),CDF_LOCATIONS_INTEGER,probesets);
+  } else if (strcmp(storage_name,"flat") == 0){
+    return read_cdf_locations(CHAR(STRING_ELT(filename,0)),CDF_LOCATIONS_FLAT,probesets);
+  }
+  error("Unknown storage type %s for CDF locations.",storage_name);
+  return R_NilValue;
+}
+
+
+
+
+/*************************************************************
+ **
+ ** static SEXP cdf_qcunit_to_RList(const cdf_qc_unit *qc_unit)
+ **
+ ** converts a single QC unit into its R list representation
+ ** (QCUnitHeader and a QCUnitInfo data.frame)
+ **
+ *************************************************************/
+
+static SEXP cdf_qcunit_to_RList(const cdf_qc_unit *qc_unit){
 
-  SEXP QCUNITS;
   SEXP QCUNITSsub;
   SEXP QCUNITSsubNames;
   SEXP QCHEADER;
@@ -1003,7 +1728,87 @@ SEXP ReadCDFFileIntoRList(SEXP filename,SEXP fullstructure){
   SEXP QCUNITSProbeInfoNames;
   SEXP QCUNITSProbeInforow_names;
 
-  SEXP UNITS;
+  char buf[11];
+  int j;
+
+  PROTECT(QCUNITSsub = allocVector(VECSXP,2));
+  PROTECT(QCUNITSsubNames= allocVector(STRSXP,2));
+  SET_STRING_ELT(QCUNITSsubNames,0,mkChar("QCUnitHeader"));
+  SET_STRING_ELT(QCUNITSsubNames,1,mkChar("QCUnitInfo"));
+  setAttrib(QCUNITSsub,R_NamesSymbol,QCUNITSsubNames);
+
+  PROTECT(QCHEADER = allocVector(REALSXP,2));
+  NUMERIC_POINTER(QCHEADER)[0] = (double)qc_unit->type;
+  NUMERIC_POINTER(QCHEADER)[1] = (double)qc_unit->n_probes;
+  PROTECT(QCHEADERNames = allocVector(STRSXP,2));
+  SET_STRING_ELT(QCHEADERNames,0,mkChar("Type"));
+  SET_STRING_ELT(QCHEADERNames,1,mkChar("n.probes"));
+
+  setAttrib(QCHEADER,R_NamesSymbol,QCHEADERNames);
+  SET_VECTOR_ELT(QCUNITSsub,0,QCHEADER);
+
+
+  PROTECT(QCUNITSProbeInfo = allocVector(VECSXP,5));
+  PROTECT(QCUNITSProbeInfoX = allocVector(REALSXP,qc_unit->n_probes));
+  PROTECT(QCUNITSProbeInfoY = allocVector(REALSXP,qc_unit->n_probes));
+  PROTECT(QCUNITSProbeInfoPL = allocVector(REALSXP,qc_unit->n_probes));
+  PROTECT(QCUNITSProbeInfoPMFLAG = allocVector(REALSXP,qc_unit->n_probes));
+  PROTECT(QCUNITSProbeInfoBGFLAG = allocVector(REALSXP,qc_unit->n_probes));
+
+  for (j=0; j < qc_unit->n_probes; j++){
+	NUMERIC_POINTER(QCUNITSProbeInfoX)[j] = (double)qc_unit->qc_probes[j].x;	
+	NUMERIC_POINTER(QCUNITSProbeInfoY)[j] = (double)qc_unit->qc_probes[j].y;
+	NUMERIC_POINTER(QCUNITSProbeInfoPL)[j] = (double)qc_unit->qc_probes[j].probelength;
+	NUMERIC_POINTER(QCUNITSProbeInfoPMFLAG)[j] = (double)qc_unit->qc_probes[j].pmflag;
+	NUMERIC_POINTER(QCUNITSProbeInfoBGFLAG)[j] = (double)qc_unit->qc_probes[j].bgprobeflag;
+  }
+
+  SET_VECTOR_ELT(QCUNITSProbeInfo,0,QCUNITSProbeInfoX);
+  SET_VECTOR_ELT(QCUNITSProbeInfo,1,QCUNITSProbeInfoY);
+  SET_VECTOR_ELT(QCUNITSProbeInfo,2,QCUNITSProbeInfoPL);
+  SET_VECTOR_ELT(QCUNITSProbeInfo,3,QCUNITSProbeInfoPMFLAG);
+  SET_VECTOR_ELT(QCUNITSProbeInfo,4,QCUNITSProbeInfoBGFLAG);
+
+  PROTECT(QCUNITSProbeInfoNames = allocVector(STRSXP,5));
+  SET_STRING_ELT(QCUNITSProbeInfoNames,0,mkChar("x"));
+  SET_STRING_ELT(QCUNITSProbeInfoNames,1,mkChar("y"));
+  SET_STRING_ELT(QCUNITSProbeInfoNames,2,mkChar("ProbeLength"));
+  SET_STRING_ELT(QCUNITSProbeInfoNames,3,mkChar("PMFlag"));
+  SET_STRING_ELT(QCUNITSProbeInfoNames,4,mkChar("BGProbeFlag"));
+
+  setAttrib(QCUNITSProbeInfo,R_NamesSymbol,QCUNITSProbeInfoNames);
+
+  PROTECT(QCUNITSProbeInforow_names= allocVector(STRSXP,qc_unit->n_probes)); 
+  
+  for (j=0; j < qc_unit->n_probes; j++){
+	sprintf(buf, "%d", j+1);
+	SET_STRING_ELT(QCUNITSProbeInforow_names,j,mkChar(buf));
+  }
+
+
+
+  setAttrib(QCUNITSProbeInfo, R_RowNamesSymbol, QCUNITSProbeInforow_names);
+
+
+  setAttrib(QCUNITSProbeInfo,R_ClassSymbol,mkString("data.frame"));
+
+  SET_VECTOR_ELT(QCUNITSsub,1,QCUNITSProbeInfo);
+  UNPROTECT(12);
+  return QCUNITSsub;
+}
+
+
+/*************************************************************
+ **
+ ** static SEXP cdf_unit_to_RList(const cdf_unit *unit)
+ **
+ ** converts a single unit into its R list representation
+ ** (UnitHeader and a list of Blocks)
+ **
+ *************************************************************/
+
+static SEXP cdf_unit_to_RList(const cdf_unit *unit){
+
   SEXP tmpUNIT;
   SEXP tmpUNITNames;
   SEXP UNITSHeader;
@@ -1022,23 +1827,191 @@ SEXP ReadCDFFileIntoRList(SEXP filename,SEXP fullstructure){
   SEXP UNITSBlockIndexPos;
   SEXP UNITSBlockPbase;
   SEXP UNITSBlockTbase;
+
+  char buf[11];
+  int j,k;
+
+  PROTECT(tmpUNIT = allocVector(VECSXP,2));
+  PROTECT(tmpUNITNames = allocVector(STRSXP,2));
+  SET_STRING_ELT(tmpUNITNames,0,mkChar("UnitHeader"));
+  SET_STRING_ELT(tmpUNITNames,1,mkChar("Block"));
+  setAttrib(tmpUNIT,R_NamesSymbol,tmpUNITNames);
+
+
+  PROTECT(UNITSHeader = allocVector(REALSXP,7));
+  PROTECT(UNITSHeaderNames = allocVector(STRSXP,7));
+  SET_STRING_ELT(UNITSHeaderNames,0,mkChar("UnitType"));
+  SET_STRING_ELT(UNITSHeaderNames,1,mkChar("Direction"));
+  SET_STRING_ELT(UNITSHeaderNames,2,mkChar("n.atoms"));
+  SET_STRING_ELT(UNITSHeaderNames,3,mkChar("n.blocks"));
+  SET_STRING_ELT(UNITSHeaderNames,4,mkChar("n.cells"));
+  SET_STRING_ELT(UNITSHeaderNames,5,mkChar("UnitNumber"));
+  SET_STRING_ELT(UNITSHeaderNames,6,mkChar("n.cellsperatom"));
+
+  setAttrib(UNITSHeader,R_NamesSymbol,UNITSHeaderNames);
+
+  NUMERIC_POINTER(UNITSHeader)[0] = (double)unit->unittype;
+  NUMERIC_POINTER(UNITSHeader)[1] = (double)unit->direction;
+  NUMERIC_POINTER(UNITSHeader)[2] = (double)unit->natoms;
+  NUMERIC_POINTER(UNITSHeader)[3] = (double)unit->nblocks;
+  NUMERIC_POINTER(UNITSHeader)[4] = (double)unit->ncells;
+  NUMERIC_POINTER(UNITSHeader)[5] = (double)unit->unitnumber;
+  NUMERIC_POINTER(UNITSHeader)[6] = (double)unit->ncellperatom;
+
+  PROTECT(tmpUNITSBlock = allocVector(VECSXP,unit->nblocks));
+  for (j=0; j < unit->nblocks; j++){
+	PROTECT(UNITSBlock = allocVector(VECSXP,3));
+	PROTECT(UNITSBlockNames = allocVector(STRSXP,3));
+	SET_STRING_ELT(UNITSBlockNames,0,mkChar("Header"));
+	SET_STRING_ELT(UNITSBlockNames,1,mkChar("Name"));
+	SET_STRING_ELT(UNITSBlockNames,2,mkChar("UnitInfo"));
+	setAttrib(UNITSBlock,R_NamesSymbol,UNITSBlockNames);
+
+	PROTECT(UNITSBlockHeader = allocVector(REALSXP,6));
+	PROTECT(UNITSBlockHeaderNames= allocVector(STRSXP,6));
+	SET_STRING_ELT(UNITSBlockHeaderNames,0,mkChar("n.atoms"));
+	SET_STRING_ELT(UNITSBlockHeaderNames,1,mkChar("n.cells"));
+	SET_STRING_ELT(UNITSBlockHeaderNames,2,mkChar("n.cellsperatom"));
+	SET_STRING_ELT(UNITSBlockHeaderNames,3,mkChar("Direction"));
+	SET_STRING_ELT(UNITSBlockHeaderNames,4,mkChar("firstatom"));
+	SET_STRING_ELT(UNITSBlockHeaderNames,5,mkChar("unused"));
+	
+	NUMERIC_POINTER(UNITSBlockHeader)[0] = (double)unit->unit_block[j].natoms;
+	NUMERIC_POINTER(UNITSBlockHeader)[1] = (double)unit->unit_block[j].ncells;
+	NUMERIC_POINTER(UNITSBlockHeader)[2] = (double)unit->unit_block[j].ncellperatom;
+	NUMERIC_POINTER(UNITSBlockHeader)[3] = (double)unit->unit_block[j].direction;
+	NUMERIC_POINTER(UNITSBlockHeader)[4] = (double)unit->unit_block[j].firstatom;
+	NUMERIC_POINTER(UNITSBlockHeader)[5] = (double)unit->unit_block[j].unused;
+	
+
+	setAttrib(UNITSBlockHeader,R_NamesSymbol,UNITSBlockHeaderNames);
+	
+	SET_VECTOR_ELT(UNITSBlock,0,UNITSBlockHeader);
+	
+	SET_VECTOR_ELT(UNITSBlock,1,ScalarString(mkCharFixed(unit->unit_block[j].blockname,64)));
+
+	PROTECT(UNITSBlockInfo = allocVector(VECSXP,6));
+	
+	PROTECT(UNITSBlockInfoNames = allocVector(STRSXP,6));
+	SET_STRING_ELT(UNITSBlockInfoNames,0,mkChar("atom.number"));
+	SET_STRING_ELT(UNITSBlockInfoNames,1,mkChar("x"));
+	SET_STRING_ELT(UNITSBlockInfoNames,2,mkChar("y"));
+	SET_STRING_ELT(UNITSBlockInfoNames,3,mkChar("index.position"));
+	SET_STRING_ELT(UNITSBlockInfoNames,4,mkChar("pbase"));
+	SET_STRING_ELT(UNITSBlockInfoNames,5,mkChar("tbase"));
+
+	setAttrib(UNITSBlockInfo,R_NamesSymbol,UNITSBlockInfoNames);
+	
+
+	PROTECT(UNITSBlockInforow_names = allocVector(STRSXP,unit->unit_block[j].ncells)); 
   
+	for (k=0; k < unit->unit_block[j].ncells; k++){
+	  sprintf(buf, "%d", k+1);
+	  SET_STRING_ELT(UNITSBlockInforow_names,k,mkChar(buf));
+	}
+	
+	PROTECT(UNITSBlockAtom = allocVector(INTSXP,unit->unit_block[j].ncells));
+	PROTECT(UNITSBlockX = allocVector(INTSXP,unit->unit_block[j].ncells));
+	PROTECT(UNITSBlockY = allocVector(INTSXP,unit->unit_block[j].ncells));
+	PROTECT(UNITSBlockIndexPos = allocVector(INTSXP,unit->unit_block[j].ncells));
+	PROTECT(UNITSBlockPbase = allocVector(STRSXP,unit->unit_block[j].ncells));
+	PROTECT(UNITSBlockTbase = allocVector(STRSXP,unit->unit_block[j].ncells));
+	
+	for (k=0; k < unit->unit_block[j].ncells; k++){
+	  /*  Rprintf("%d %d %d\n",i,j,k);
+	  //  NUMERIC_POINTER(UNITSBlockAtom)[k] = (double)unit->unit_block[j].unit_cells[k].atomnumber;
+	  //  NUMERIC_POINTER(UNITSBlockX)[k] = (double)unit->unit_block[j].unit_cells[k].x;
+	  //  NUMERIC_POINTER(UNITSBlockY)[k] = (double)unit->unit_block[j].unit_cells[k].y;
+	  //  NUMERIC_POINTER(UNITSBlockIndexPos)[k] = (double)unit->unit_block[j].unit_cells[k].indexpos; */
+	  INTEGER_POINTER(UNITSBlockAtom)[k] = (int)unit->unit_block[j].unit_cells[k].atomnumber;
+	  INTEGER_POINTER(UNITSBlockX)[k] = (int)unit->unit_block[j].unit_cells[k].x;
+	  INTEGER_POINTER(UNITSBlockY)[k] = (int)unit->unit_block[j].unit_cells[k].y;
+	  INTEGER_POINTER(UNITSBlockIndexPos)[k] = (int)unit->unit_block[j].unit_cells[k].indexpos;
+	  sprintf(buf, "%c",unit->unit_block[j].unit_cells[k].pbase);
+	  SET_STRING_ELT(UNITSBlockPbase,k,mkChar(buf)); 
 
+	  sprintf(buf, "%c",unit->unit_block[j].unit_cells[k].tbase);
+	  SET_STRING_ELT(UNITSBlockTbase,k,mkChar(buf));
+	}
 
+	SET_VECTOR_ELT(UNITSBlockInfo,0,UNITSBlockAtom);
+	SET_VECTOR_ELT(UNITSBlockInfo,1,UNITSBlockX);
+	SET_VECTOR_ELT(UNITSBlockInfo,2,UNITSBlockY);
+	SET_VECTOR_ELT(UNITSBlockInfo,3,UNITSBlockIndexPos);
+	SET_VECTOR_ELT(UNITSBlockInfo,4,UNITSBlockPbase);
+	SET_VECTOR_ELT(UNITSBlockInfo,5,UNITSBlockTbase);
+	UNPROTECT(6);
 
 
 
 
+	setAttrib(UNITSBlockInfo, R_RowNamesSymbol, UNITSBlockInforow_names);
+	setAttrib(UNITSBlockInfo,R_ClassSymbol,mkString("data.frame"));
 
-  char buf[11];
-  int i,j,k;
+	SET_VECTOR_ELT(UNITSBlock,2,UNITSBlockInfo);
+
+	SET_VECTOR_ELT(tmpUNITSBlock,j,UNITSBlock);
+	UNPROTECT(7);
+  }
+
+  SET_VECTOR_ELT(tmpUNIT,0,UNITSHeader);
+  SET_VECTOR_ELT(tmpUNIT,1,tmpUNITSBlock);
+
+  UNPROTECT(5);
+  return tmpUNIT;
+}
+
+
+
+
+/* This function is for reading in the entire binary cdf file and then 
+ * returing the structure in a complex list object.
+ * The fullstructure argument is expected to be a BOOLEAN. If TRUE the
+ * entire contents of the CDF file are returned.
+ * If False, a modified CDFENV style structure is returned
+ *
+ * The QC units and units are read one at a time, each being converted
+ * to its R representation before the next is read.
+ *
+ * If read_qc is 0 the QC section of the file is never read (the units
+ * are found using their file positions) and the QCUnits item is NULL.
+ */
+
+
+
+static SEXP read_cdf_xda_list(SEXP filename,SEXP fullstructure, int read_qc){
+
+  SEXP CDFInfo = R_NilValue;  /* this is the object that will be returned */
+  SEXP CDFInfoNames;
+  SEXP HEADER;  /* Will store the header information */
+  SEXP HEADERNames;
+  SEXP Dimensions;
+  SEXP DimensionsNames;
+  SEXP REFSEQ;  /* Resequencing reference sequence */
+  SEXP UNITNAMES;
+
+  SEXP FILEPOSITIONS;
+  SEXP FILEPOSITIONSQC;
+  SEXP FILEPOSITIONSUNITS;
+  SEXP FILEPOSITIONSNames;
+
+  SEXP QCUNITS;
+  SEXP UNITS;
+
+  int i;
 
   cdf_xda my_cdf;
+  cdf_qc_unit_buffer qc_unit_buffer;
+  cdf_unit_buffer unit_buffer;
   const char *cur_file_name;
   cur_file_name = CHAR(STRING_ELT(filename,0));
 
-  /* Read in the xda style CDF file into memory */
-  if (!read_cdf_xda(cur_file_name,&my_cdf)){
+  memset(&qc_unit_buffer,0,sizeof(cdf_qc_unit_buffer));
+  memset(&unit_buffer,0,sizeof(cdf_unit_buffer));
+
+  /* Read in the header, names and file positions of the xda style CDF file */
+  if (!open_cdf_xda(cur_file_name,&my_cdf)){
+    close_cdf_xda(&my_cdf);
     error("Problem reading binary cdf file %s. Possibly corrupted or truncated?\n",cur_file_name);
   }
   
@@ -1094,7 +2067,7 @@ SEXP ReadCDFFileIntoRList(SEXP filename,SEXP fullstructure){
     
     PROTECT(UNITNAMES = allocVector(STRSXP,my_cdf.header.n_units));
     for (i =0; i < my_cdf.header.n_units; i++){
-      SET_STRING_ELT(UNITNAMES,i,mkChar(my_cdf.probesetnames[i]));
+      SET_STRING_ELT(UNITNAMES,i,mkCharFixed(&my_cdf.probesetnames[64*i],64));
     }
     SET_VECTOR_ELT(CDFInfo,1,UNITNAMES);
     UNPROTECT(1);
@@ -1117,214 +2090,39 @@ SEXP ReadCDFFileIntoRList(SEXP filename,SEXP fullstructure){
     SET_VECTOR_ELT(CDFInfo,2,FILEPOSITIONS);
     UNPROTECT(4);
     
-    PROTECT(QCUNITS = allocVector(VECSXP,my_cdf.header.n_qc_units));
-    for (i =0; i < my_cdf.header.n_qc_units; i++){
-      PROTECT(QCUNITSsub = allocVector(VECSXP,2));
-      PROTECT(QCUNITSsubNames= allocVector(STRSXP,2));
-      SET_STRING_ELT(QCUNITSsubNames,0,mkChar("QCUnitHeader"));
-      SET_STRING_ELT(QCUNITSsubNames,1,mkChar("QCUnitInfo"));
-      setAttrib(QCUNITSsub,R_NamesSymbol,QCUNITSsubNames);
-
-      PROTECT(QCHEADER = allocVector(REALSXP,2));
-      NUMERIC_POINTER(QCHEADER)[0] = (double)my_cdf.qc_units[i].type;
-      NUMERIC_POINTER(QCHEADER)[1] = (double)my_cdf.qc_units[i].n_probes;
-      PROTECT(QCHEADERNames = allocVector(STRSXP,2));
-      SET_STRING_ELT(QCHEADERNames,0,mkChar("Type"));
-      SET_STRING_ELT(QCHEADERNames,1,mkChar("n.probes"));
-
-      setAttrib(QCHEADER,R_NamesSymbol,QCHEADERNames);
-      SET_VECTOR_ELT(QCUNITSsub,0,QCHEADER);
-
-
-      PROTECT(QCUNITSProbeInfo = allocVector(VECSXP,5));
-      PROTECT(QCUNITSProbeInfoX = allocVector(REALSXP,my_cdf.qc_units[i].n_probes));
-      PROTECT(QCUNITSProbeInfoY = allocVector(REALSXP,my_cdf.qc_units[i].n_probes));
-      PROTECT(QCUNITSProbeInfoPL = allocVector(REALSXP,my_cdf.qc_units[i].n_probes));
-      PROTECT(QCUNITSProbeInfoPMFLAG = allocVector(REALSXP,my_cdf.qc_units[i].n_probes));
-      PROTECT(QCUNITSProbeInfoBGFLAG = allocVector(REALSXP,my_cdf.qc_units[i].n_probes));
-
-      for (j=0; j < my_cdf.qc_units[i].n_probes; j++){
-	NUMERIC_POINTER(QCUNITSProbeInfoX)[j] = (double)my_cdf.qc_units[i].qc_probes[j].x;	
-	NUMERIC_POINTER(QCUNITSProbeInfoY)[j] = (double)my_cdf.qc_units[i].qc_probes[j].y;
-	NUMERIC_POINTER(QCUNITSProbeInfoPL)[j] = (double)my_cdf.qc_units[i].qc_probes[j].probelength;
-	NUMERIC_POINTER(QCUNITSProbeInfoPMFLAG)[j] = (double)my_cdf.qc_units[i].qc_probes[j].pmflag;
-	NUMERIC_POINTER(QCUNITSProbeInfoBGFLAG)[j] = (double)my_cdf.qc_units[i].qc_probes[j].bgprobeflag;
-      }
-
-      SET_VECTOR_ELT(QCUNITSProbeInfo,0,QCUNITSProbeInfoX);
-      SET_VECTOR_ELT(QCUNITSProbeInfo,1,QCUNITSProbeInfoY);
-      SET_VECTOR_ELT(QCUNITSProbeInfo,2,QCUNITSProbeInfoPL);
-      SET_VECTOR_ELT(QCUNITSProbeInfo,3,QCUNITSProbeInfoPMFLAG);
-      SET_VECTOR_ELT(QCUNITSProbeInfo,4,QCUNITSProbeInfoBGFLAG);
-
-      PROTECT(QCUNITSProbeInfoNames = allocVector(STRSXP,5));
-      SET_STRING_ELT(QCUNITSProbeInfoNames,0,mkChar("x"));
-      SET_STRING_ELT(QCUNITSProbeInfoNames,1,mkChar("y"));
-      SET_STRING_ELT(QCUNITSProbeInfoNames,2,mkChar("ProbeLength"));
-      SET_STRING_ELT(QCUNITSProbeInfoNames,3,mkChar("PMFlag"));
-      SET_STRING_ELT(QCUNITSProbeInfoNames,4,mkChar("BGProbeFlag"));
-
-      setAttrib(QCUNITSProbeInfo,R_NamesSymbol,QCUNITSProbeInfoNames);
-
-      PROTECT(QCUNITSProbeInforow_names= allocVector(STRSXP,my_cdf.qc_units[i].n_probes)); 
-      
-      for (j=0; j < my_cdf.qc_units[i].n_probes; j++){
-	sprintf(buf, "%d", j+1);
-	SET_STRING_ELT(QCUNITSProbeInforow_names,j,mkChar(buf));
+    if (read_qc){
+      PROTECT(QCUNITS = allocVector(VECSXP,my_cdf.header.n_qc_units));
+      for (i =0; i < my_cdf.header.n_qc_units; i++){
+	if (!read_cdf_qcunit(&qc_unit_buffer,my_cdf.qc_start[i],my_cdf.infile)){
+	  close_cdf_xda(&my_cdf);
+	  dealloc_cdf_qc_unit_buffer(&qc_unit_buffer);
+	  error("Problem reading binary cdf file %s. Possibly corrupted or truncated?\n",cur_file_name);
+	}
+	SET_VECTOR_ELT(QCUNITS,i,cdf_qcunit_to_RList(&(qc_unit_buffer.qc_unit)));
       }
-
-
-
-      setAttrib(QCUNITSProbeInfo, R_RowNamesSymbol, QCUNITSProbeInforow_names);
-
-
-      setAttrib(QCUNITSProbeInfo,R_ClassSymbol,mkString("data.frame"));
-
-      SET_VECTOR_ELT(QCUNITSsub,1,QCUNITSProbeInfo);
-      SET_VECTOR_ELT(QCUNITS,i,QCUNITSsub);
-      UNPROTECT(12);
+      SET_VECTOR_ELT(CDFInfo,3,QCUNITS);
+      UNPROTECT(1);
+      dealloc_cdf_qc_unit_buffer(&qc_unit_buffer);
     }
-    SET_VECTOR_ELT(CDFInfo,3,QCUNITS);
-    UNPROTECT(1);
 
     
     PROTECT(UNITS = allocVector(VECSXP,my_cdf.header.n_units));
     for (i =0; i < my_cdf.header.n_units; i++){
-      PROTECT(tmpUNIT = allocVector(VECSXP,2));
-      PROTECT(tmpUNITNames = allocVector(STRSXP,2));
-      SET_STRING_ELT(tmpUNITNames,0,mkChar("UnitHeader"));
-      SET_STRING_ELT(tmpUNITNames,1,mkChar("Block"));
-      setAttrib(tmpUNIT,R_NamesSymbol,tmpUNITNames);
-
-
-      PROTECT(UNITSHeader = allocVector(REALSXP,7));
-      PROTECT(UNITSHeaderNames = allocVector(STRSXP,7));
-      SET_STRING_ELT(UNITSHeaderNames,0,mkChar("UnitType"));
-      SET_STRING_ELT(UNITSHeaderNames,1,mkChar("Direction"));
-      SET_STRING_ELT(UNITSHeaderNames,2,mkChar("n.atoms"));
-      SET_STRING_ELT(UNITSHeaderNames,3,mkChar("n.blocks"));
-      SET_STRING_ELT(UNITSHeaderNames,4,mkChar("n.cells"));
-      SET_STRING_ELT(UNITSHeaderNames,5,mkChar("UnitNumber"));
-      SET_STRING_ELT(UNITSHeaderNames,6,mkChar("n.cellsperatom"));
-
-      setAttrib(UNITSHeader,R_NamesSymbol,UNITSHeaderNames);
-
-      NUMERIC_POINTER(UNITSHeader)[0] = (double)my_cdf.units[i].unittype;
-      NUMERIC_POINTER(UNITSHeader)[1] = (double)my_cdf.units[i].direction;
-      NUMERIC_POINTER(UNITSHeader)[2] = (double)my_cdf.units[i].natoms;
-      NUMERIC_POINTER(UNITSHeader)[3] = (double)my_cdf.units[i].nblocks;
-      NUMERIC_POINTER(UNITSHeader)[4] = (double)my_cdf.units[i].ncells;
-      NUMERIC_POINTER(UNITSHeader)[5] = (double)my_cdf.units[i].unitnumber;
-      NUMERIC_POINTER(UNITSHeader)[6] = (double)my_cdf.units[i].ncellperatom;
-
-      PROTECT(tmpUNITSBlock = allocVector(VECSXP,my_cdf.units[i].nblocks));
-      for (j=0; j < my_cdf.units[i].nblocks; j++){
-	PROTECT(UNITSBlock = allocVector(VECSXP,3));
-	PROTECT(UNITSBlockNames = allocVector(STRSXP,3));
-	SET_STRING_ELT(UNITSBlockNames,0,mkChar("Header"));
-	SET_STRING_ELT(UNITSBlockNames,1,mkChar("Name"));
-	SET_STRING_ELT(UNITSBlockNames,2,mkChar("UnitInfo"));
-	setAttrib(UNITSBlock,R_NamesSymbol,UNITSBlockNames);
-
-	PROTECT(UNITSBlockHeader = allocVector(REALSXP,6));
-	PROTECT(UNITSBlockHeaderNames= allocVector(STRSXP,6));
-	SET_STRING_ELT(UNITSBlockHeaderNames,0,mkChar("n.atoms"));
-	SET_STRING_ELT(UNITSBlockHeaderNames,1,mkChar("n.cells"));
-	SET_STRING_ELT(UNITSBlockHeaderNames,2,mkChar("n.cellsperatom"));
-	SET_STRING_ELT(UNITSBlockHeaderNames,3,mkChar("Direction"));
-	SET_STRING_ELT(UNITSBlockHeaderNames,4,mkChar("firstatom"));
-	SET_STRING_ELT(UNITSBlockHeaderNames,5,mkChar("unused"));
-	
-	NUMERIC_POINTER(UNITSBlockHeader)[0] = (double)my_cdf.units[i].unit_block[j].natoms;
-	NUMERIC_POINTER(UNITSBlockHeader)[1] = (double)my_cdf.units[i].unit_block[j].ncells;
-	NUMERIC_POINTER(UNITSBlockHeader)[2] = (double)my_cdf.units[i].unit_block[j].ncellperatom;
-	NUMERIC_POINTER(UNITSBlockHeader)[3] = (double)my_cdf.units[i].unit_block[j].direction;
-	NUMERIC_POINTER(UNITSBlockHeader)[4] = (double)my_cdf.units[i].unit_block[j].firstatom;
-	NUMERIC_POINTER(UNITSBlockHeader)[5] = (double)my_cdf.units[i].unit_block[j].unused;
-	
-
-	setAttrib(UNITSBlockHeader,R_NamesSymbol,UNITSBlockHeaderNames);
-	
-	SET_VECTOR_ELT(UNITSBlock,0,UNITSBlockHeader);
-	
-	SET_VECTOR_ELT(UNITSBlock,1,mkString(my_cdf.units[i].unit_block[j].blockname));
-
-	PROTECT(UNITSBlockInfo = allocVector(VECSXP,6));
-	
-	PROTECT(UNITSBlockInfoNames = allocVector(STRSXP,6));
-	SET_STRING_ELT(UNITSBlockInfoNames,0,mkChar("atom.number"));
-	SET_STRING_ELT(UNITSBlockInfoNames,1,mkChar("x"));
-	SET_STRING_ELT(UNITSBlockInfoNames,2,mkChar("y"));
-	SET_STRING_ELT(UNITSBlockInfoNames,3,mkChar("index.position"));
-	SET_STRING_ELT(UNITSBlockInfoNames,4,mkChar("pbase"));
-	SET_STRING_ELT(UNITSBlockInfoNames,5,mkChar("tbase"));
-
-	setAttrib(UNITSBlockInfo,R_NamesSymbol,UNITSBlockInfoNames);
-	
-
-	PROTECT(UNITSBlockInforow_names = allocVector(STRSXP,my_cdf.units[i].unit_block[j].ncells)); 
-      
-	for (k=0; k < my_cdf.units[i].unit_block[j].ncells; k++){
-	  sprintf(buf, "%d", k+1);
-	  SET_STRING_ELT(UNITSBlockInforow_names,k,mkChar(buf));
-	}
-	
-	PROTECT(UNITSBlockAtom = allocVector(INTSXP,my_cdf.units[i].unit_block[j].ncells));
-	PROTECT(UNITSBlockX = allocVector(INTSXP,my_cdf.units[i].unit_block[j].ncells));
-	PROTECT(UNITSBlockY = allocVector(INTSXP,my_cdf.units[i].unit_block[j].ncells));
-	PROTECT(UNITSBlockIndexPos = allocVector(INTSXP,my_cdf.units[i].unit_block[j].ncells));
-	PROTECT(UNITSBlockPbase = allocVector(STRSXP,my_cdf.units[i].unit_block[j].ncells));
-	PROTECT(UNITSBlockTbase = allocVector(STRSXP,my_cdf.units[i].unit_block[j].ncells));
-	
-	for (k=0; k < my_cdf.units[i].unit_block[j].ncells; k++){
-	  /*  Rprintf("%d %d %d\n",i,j,k);
-	  //  NUMERIC_POINTER(UNITSBlockAtom)[k] = (double)my_cdf.units[i].unit_block[j].unit_cells[k].atomnumber;
-	  //  NUMERIC_POINTER(UNITSBlockX)[k] = (double)my_cdf.units[i].unit_block[j].unit_cells[k].x;
-	  //  NUMERIC_POINTER(UNITSBlockY)[k] = (double)my_cdf.units[i].unit_block[j].unit_cells[k].y;
-	  //  NUMERIC_POINTER(UNITSBlockIndexPos)[k] = (double)my_cdf.units[i].unit_block[j].unit_cells[k].indexpos; */
-	  INTEGER_POINTER(UNITSBlockAtom)[k] = (int)my_cdf.units[i].unit_block[j].unit_cells[k].atomnumber;
-	  INTEGER_POINTER(UNITSBlockX)[k] = (int)my_cdf.units[i].unit_block[j].unit_cells[k].x;
-	  INTEGER_POINTER(UNITSBlockY)[k] = (int)my_cdf.units[i].unit_block[j].unit_cells[k].y;
-	  INTEGER_POINTER(UNITSBlockIndexPos)[k] = (int)my_cdf.units[i].unit_block[j].unit_cells[k].indexpos;
-	  sprintf(buf, "%c",my_cdf.units[i].unit_block[j].unit_cells[k].pbase);
-	  SET_STRING_ELT(UNITSBlockPbase,k,mkChar(buf)); 
-
-	  sprintf(buf, "%c",my_cdf.units[i].unit_block[j].unit_cells[k].tbase);
-	  SET_STRING_ELT(UNITSBlockTbase,k,mkChar(buf));
-	}
-
-	SET_VECTOR_ELT(UNITSBlockInfo,0,UNITSBlockAtom);
-	SET_VECTOR_ELT(UNITSBlockInfo,1,UNITSBlockX);
-	SET_VECTOR_ELT(UNITSBlockInfo,2,UNITSBlockY);
-	SET_VECTOR_ELT(UNITSBlockInfo,3,UNITSBlockIndexPos);
-	SET_VECTOR_ELT(UNITSBlockInfo,4,UNITSBlockPbase);
-	SET_VECTOR_ELT(UNITSBlockInfo,5,UNITSBlockTbase);
-	UNPROTECT(6);
-
-
-
-
-	setAttrib(UNITSBlockInfo, R_RowNamesSymbol, UNITSBlockInforow_names);
-	setAttrib(UNITSBlockInfo,R_ClassSymbol,mkString("data.frame"));
-
-	SET_VECTOR_ELT(UNITSBlock,2,UNITSBlockInfo);
-
-	SET_VECTOR_ELT(tmpUNITSBlock,j,UNITSBlock);
-	UNPROTECT(7);
+      if (!read_cdf_unit(&unit_buffer,my_cdf.units_start[i],my_cdf.infile)){
+	close_cdf_xda(&my_cdf);
+	dealloc_cdf_unit_buffer(&unit_buffer);
+	error("Problem reading binary cdf file %s. Possibly corrupted or truncated?\n",cur_file_name);
       }
-
-      SET_VECTOR_ELT(tmpUNIT,0,UNITSHeader);
-      SET_VECTOR_ELT(tmpUNIT,1,tmpUNITSBlock);
-
-      SET_VECTOR_ELT(UNITS,i,tmpUNIT);
-      UNPROTECT(5);
+      SET_VECTOR_ELT(UNITS,i,cdf_unit_to_RList(&(unit_buffer.unit)));
     }
     SET_VECTOR_ELT(CDFInfo,4,UNITS);
     UNPROTECT(1);
+    dealloc_cdf_unit_buffer(&unit_buffer);
 
 
   } else {
     /* return the abbreviated structure */
+    close_cdf_xda(&my_cdf);
     error("Abbreviated structure not yet implemented.\n");
     
 
@@ -1334,9 +2132,33 @@ SEXP ReadCDFFileIntoRList(SEXP filename,SEXP fullstructure){
 
 
 
-  dealloc_cdf_xda(&my_cdf);
+  close_cdf_xda(&my_cdf);
   UNPROTECT(1);
   return CDFInfo;
 
 
 }
+
+
+
+SEXP ReadCDFFileIntoRList(SEXP filename,SEXP fullstructure){
+
+  return read_cdf_xda_list(filename,fullstructure,1);
+
+}
+
+
+/*************************************************************
+ **
+ ** SEXP ReadCDFFileIntoRListQC(SEXP filename, SEXP fullstructure, SEXP qcunits)
+ **
+ ** As ReadCDFFileIntoRList but the QC units are only read
+ ** when qcunits is TRUE.
+ **
+ *************************************************************/
+
+SEXP ReadCDFFileIntoRListQC(SEXP filename,SEXP fullstructure, SEXP qcunits){
+
+  return read_cdf_xda_list(filename,fullstructure,asLogical(qcunits) == TRUE);
+
+}
@@ -25,6 +25,10 @@
  ** May 18, 2009 - Add Ability to extract scan date from CEL file header
  ** Sep 19, 2013 - Improve ability to deal with large 64bit matrices
  ** Sept 4, 2017 - change gzFile * to gzFile
+ ** Oct 16, 2026 - count files opened for the read timing (see read_timing.c)
+ ** Oct 16, 2026 - Add generic_intensities_offset, where the intensities start in the file
+ ** Oct 16, 2026 - errors are raised with read_error() so that they can be caught on worker threads
+ ** Oct 16, 2026 - the single channel data sets are read by generic_cel_data_set(), so that a file cut short is reported as corrupted. The masks are no longer written over the outliers
  **
  *************************************************************/
 #include <R.h>
@@ -46,6 +50,8 @@
 #include "read_generic.h"
 #include "read_celfile_generic.h"
 #include "read_abatch.h"
+#include "read_timing.h"
+#include "read_error.h"
 
 int isGenericCelFile(const char *filename){
 
@@ -53,9 +59,10 @@ int isGenericCelFile(const char *filename){
   generic_file_header file_header;
   generic_data_header data_header;
   
+  read_timing_opened();
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
       return 0;
     }
 
@@ -101,9 +108,10 @@ char *generic_get_header_info(const char *filename, int *dim1, int *dim2){
 
   wchar_t *wchartemp=0;
   
+  read_timing_opened();
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
       return 0;
     }
   
@@ -161,9 +169,10 @@ void generic_get_detailed_header_info(const char *filename, detailed_header_info
   wchar_t *wchartemp=0;
   char *chartemp=0;
   
+  read_timing_opened();
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
     }
   
   read_generic_file_header(&file_header,infile);
@@ -648,9 +657,10 @@ int check_generic_cel_file(const char *filename, const char *ref_cdfName, int re
   wchar_t *wchartemp=0;
   
 
+  read_timing_opened();
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
       return 0;
     }
 
@@ -678,11 +688,11 @@ int check_generic_cel_file(const char *filename, const char *ref_cdfName, int re
   Free_generic_data_header(&data_header);
   
   if ((dim1 != ref_dim_1) || (dim2 != ref_dim_2)){
-    error("Cel file %s does not seem to have the correct dimensions",filename);
+    read_error("Cel file %s does not seem to have the correct dimensions",filename);
   }
   
   if (strncasecmp(cdfName,ref_cdfName,strlen(ref_cdfName)) != 0){
-    error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
+    read_error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
   }
 
   R_Free(cdfName);
@@ -695,6 +705,61 @@ int check_generic_cel_file(const char *filename, const char *ref_cdfName, int re
 
 
 
+/***************************************************************
+ **
+ ** static int generic_cel_data_set(FILE *infile, int which, generic_data_header *data_header, generic_data_set *data_set)
+ **
+ ** read the headers of the command console CEL file infile and then data set
+ ** which of its data group (0 intensities, 1 stddev, 2 npixels, 3 outliers,
+ ** 4 masks) with its rows, passing by the data sets before it. The data 
+ ** header is kept in data_header unless it is NULL. Returns 0 if the file
+ ** ends first, leaving data_set and data_header empty (so that they may be
+ ** freed).
+ **
+ **************************************************************/
+
+static int generic_cel_data_set(FILE *infile, int which, generic_data_header *data_header, generic_data_set *data_set){
+
+  generic_file_header my_header;
+  generic_data_header my_data_header;
+  generic_data_group my_data_group;
+  int i, ok;
+
+  memset(&my_data_header, 0, sizeof(generic_data_header));
+  memset(&my_data_group, 0, sizeof(generic_data_group));
+  memset(data_set, 0, sizeof(generic_data_set));
+
+  rewind(infile);
+  ok = read_generic_file_header(&my_header, infile) &&
+    read_generic_data_header(&my_data_header, infile) &&
+    read_generic_data_group(&my_data_group, infile);
+  for (i = 0; ok && i <= which; i++){
+    ok = read_generic_data_set(data_set, infile);
+    if (ok && i < which){
+      ok = (fseek(infile, data_set->file_pos_last, SEEK_SET) >= 0);
+      Free_generic_data_set(data_set);
+      memset(data_set, 0, sizeof(generic_data_set));
+    }
+  }
+  ok = ok && read_generic_data_set_rows(data_set, infile);
+
+  if (!ok){
+    Free_generic_data_set(data_set);
+    memset(data_set, 0, sizeof(generic_data_set));
+    Free_generic_data_header(&my_data_header);
+    memset(&my_data_header, 0, sizeof(generic_data_header));
+  }
+  if (data_header != NULL){
+    *data_header = my_data_header;
+  } else {
+    Free_generic_data_header(&my_data_header);
+  }
+  Free_generic_data_group(&my_data_group);
+  return ok;
+}
+
+
+
 /***************************************************************
  **
  ** static int read_binarycel_file_intensities(const char *filename, double *intensity, int chip_num, int rows, int cols,int chip_dim_rows)
@@ -710,39 +775,29 @@ int read_genericcel_file_intensities(const char *filename, double *intensity, si
   
   FILE *infile;
 
-  generic_file_header my_header;
-  generic_data_header my_data_header;
-  generic_data_group my_data_group;
-
   generic_data_set my_data_set;
 
 
+  read_timing_opened();
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
-
-  
-  read_generic_file_header(&my_header, infile);
-  read_generic_data_header(&my_data_header, infile);
-  read_generic_data_group(&my_data_group,infile);
-
-  read_generic_data_set(&my_data_set,infile); 
-  read_generic_data_set_rows(&my_data_set,infile); 
+  /* a file cut short, or with the wrong number of cells, is corrupted */
+  if (!generic_cel_data_set(infile, 0, NULL, &my_data_set) || my_data_set.nrows != rows){
+    Free_generic_data_set(&my_data_set);
+    fclose(infile);
+    return 1;
+  }
 
   for (i =0; i < my_data_set.nrows; i++){
     intensity[chip_num*my_data_set.nrows + i] = (double)(((float *)my_data_set.Data[0])[i]);
   }
-  
-  fclose(infile);
   Free_generic_data_set(&my_data_set);
-  Free_generic_data_header(&my_data_header);
-  Free_generic_data_group(&my_data_group);
-
-
 
+  fclose(infile);
 
   return(0);
 }
@@ -751,11 +806,21 @@ int read_genericcel_file_intensities(const char *filename, double *intensity, si
 
 
 
-int read_genericcel_file_stddev(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows){
+/***************************************************************
+ **
+ ** double generic_intensities_offset(const char *filename, int *n_cells)
+ **
+ ** the byte offset of the first intensity of a (uncompressed) command
+ ** console CEL file, or -1 if the intensities are not stored as a single 
+ ** float32 column. n_cells is set to the number of intensities. The
+ ** intensity of cell i is then the big endian float32 at offset + 4*i.
+ **
+ **************************************************************/
+
+double generic_intensities_offset(const char *filename, int *n_cells){
 
-  size_t i=0;
-  
   FILE *infile;
+  double offset = -1.0;
 
   generic_file_header my_header;
   generic_data_header my_data_header;
@@ -764,40 +829,67 @@ int read_genericcel_file_stddev(const char *filename, double *intensity, size_t
   generic_data_set my_data_set;
 
 
+  read_timing_opened();
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
-      return 0;
+      read_error("Unable to open the file %s\n",filename);
+      return -1.0;
     }
-  
 
-  
   read_generic_file_header(&my_header, infile);
   read_generic_data_header(&my_data_header, infile);
   read_generic_data_group(&my_data_group,infile);
 
-  read_generic_data_set(&my_data_set,infile); 
-  fseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
-  read_generic_data_set(&my_data_set,infile); 
-  read_generic_data_set_rows(&my_data_set,infile); 
-  for (i =0; i < my_data_set.nrows; i++){
-    intensity[chip_num*my_data_set.nrows + i] = (double)(((float *)my_data_set.Data[0])[i]);
+  if (read_generic_data_set(&my_data_set,infile)){
+    if (my_data_set.ncols == 1 && my_data_set.col_name_type_value[0].type == 6){
+      offset = (double)ftell(infile);
+      *n_cells = my_data_set.nrows;
+    }
+    Free_generic_data_set(&my_data_set);
   }
-  Free_generic_data_set(&my_data_set);
+
+  fclose(infile);
   Free_generic_data_header(&my_data_header);
   Free_generic_data_group(&my_data_group);
 
-  fclose(infile);
+  return offset;
+}
+
+
 
 
-  return(0);
 
+int read_genericcel_file_stddev(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows){
+
+  size_t i=0;
+  
+  FILE *infile;
 
+  generic_data_set my_data_set;
+
+
+  read_timing_opened();
+  if ((infile = fopen(filename, "rb")) == NULL)
+    {
+      read_error("Unable to open the file %s\n",filename);
+      return 0;
+    }
+  
+  /* a file cut short, or with the wrong number of cells, is corrupted */
+  if (!generic_cel_data_set(infile, 1, NULL, &my_data_set) || my_data_set.nrows != rows){
+    Free_generic_data_set(&my_data_set);
+    fclose(infile);
+    return 1;
+  }
 
+  for (i =0; i < my_data_set.nrows; i++){
+    intensity[chip_num*my_data_set.nrows + i] = (double)(((float *)my_data_set.Data[0])[i]);
+  }
+  Free_generic_data_set(&my_data_set);
 
+  fclose(infile);
 
+  return(0);
 }
 
 
@@ -808,51 +900,31 @@ int read_genericcel_file_npixels(const char *filename, double *intensity, size_t
   
   FILE *infile;
 
-  generic_file_header my_header;
-  generic_data_header my_data_header;
-  generic_data_group my_data_group;
-
   generic_data_set my_data_set;
 
 
+  read_timing_opened();
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
+  /* a file cut short, or with the wrong number of cells, is corrupted */
+  if (!generic_cel_data_set(infile, 2, NULL, &my_data_set) || my_data_set.nrows != rows){
+    Free_generic_data_set(&my_data_set);
+    fclose(infile);
+    return 1;
+  }
 
-  
-  read_generic_file_header(&my_header, infile);
-  read_generic_data_header(&my_data_header, infile);
-  read_generic_data_group(&my_data_group,infile);
-
-  read_generic_data_set(&my_data_set,infile); 
-  fseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
-  read_generic_data_set(&my_data_set,infile); 
-  fseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
-  
-
-  read_generic_data_set(&my_data_set,infile); 
-  read_generic_data_set_rows(&my_data_set,infile); 
   for (i =0; i < my_data_set.nrows; i++){
     intensity[chip_num*my_data_set.nrows + i] = (double)(((short *)my_data_set.Data[0])[i]);
   }
   Free_generic_data_set(&my_data_set);
-  Free_generic_data_header(&my_data_header);
-  Free_generic_data_group(&my_data_group);
 
   fclose(infile);
 
-
   return(0);
-
-
-
-
 }
 
 
@@ -860,83 +932,53 @@ int read_genericcel_file_npixels(const char *filename, double *intensity, size_t
 
 void generic_get_masks_outliers(const char *filename, int *nmasks, short **masks_x, short **masks_y, int *noutliers, short **outliers_x, short **outliers_y){
 
-
-
-
   int i=0;
   
   FILE *infile;
 
-  generic_file_header my_header;
-  generic_data_header my_data_header;
-  generic_data_group my_data_group;
-
   generic_data_set my_data_set;
 
 
+  read_timing_opened();
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       
     }
   
-
-  
-  read_generic_file_header(&my_header, infile);
-  read_generic_data_header(&my_data_header, infile);
-  read_generic_data_group(&my_data_group,infile);
-
-  /* passing the intensities */
-  read_generic_data_set(&my_data_set,infile); 
-  fseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
-  /* passing by the stddev */
-  read_generic_data_set(&my_data_set,infile); 
-  fseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
-  
-  /* passing by the npixels */
-  read_generic_data_set(&my_data_set,infile); 
-  fseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
   /* Now lets go for the "Outlier" */
-  read_generic_data_set(&my_data_set,infile); 
-   
+  if (!generic_cel_data_set(infile, 3, NULL, &my_data_set)){
+    fclose(infile);
+    read_error("It appears that the file %s is corrupted.",filename);
+  }
   
   *noutliers = my_data_set.nrows;
 
   *outliers_x = R_Calloc(my_data_set.nrows,short); 
   *outliers_y = R_Calloc(my_data_set.nrows,short);
   
-  read_generic_data_set_rows(&my_data_set,infile); 
-  
   for (i=0; i < my_data_set.nrows; i++){
     (*outliers_x)[i] = ((short *)my_data_set.Data[0])[i];
     (*outliers_y)[i] = ((short *)my_data_set.Data[1])[i];
   }
-  
-  fseek(infile, my_data_set.file_pos_last, SEEK_SET); 
   Free_generic_data_set(&my_data_set);
 
   /* Now lets go for the "Mask" */
-  read_generic_data_set(&my_data_set,infile); 
+  if (!generic_cel_data_set(infile, 4, NULL, &my_data_set)){
+    fclose(infile);
+    read_error("It appears that the file %s is corrupted.",filename);
+  }
    
   *nmasks = my_data_set.nrows;
 
   *masks_x = R_Calloc(my_data_set.nrows,short); 
   *masks_y = R_Calloc(my_data_set.nrows,short);
   
-  
-  read_generic_data_set_rows(&my_data_set,infile); 
   for (i=0; i < my_data_set.nrows; i++){
-    (*outliers_x)[i] = ((short *)my_data_set.Data[0])[i];
-    (*outliers_y)[i] = ((short *)my_data_set.Data[1])[i];
+    (*masks_x)[i] = ((short *)my_data_set.Data[0])[i];
+    (*masks_y)[i] = ((short *)my_data_set.Data[1])[i];
   }
   Free_generic_data_set(&my_data_set);
-  Free_generic_data_header(&my_data_header);
-  Free_generic_data_group(&my_data_group);
 
   fclose(infile);
   
@@ -960,53 +1002,31 @@ void generic_apply_masks(const char *filename, double *intensity, size_t chip_nu
 
   FILE *infile;
 
-  generic_file_header my_header;
   generic_data_header my_data_header;
-  generic_data_group my_data_group;
 
   generic_data_set my_data_set;
   nvt_triplet *triplet;
   AffyMIMEtypes cur_mime_type;
 
+  read_timing_opened();
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       
     }
  
+  /* Now lets go for the "Outlier" */
+  if (!generic_cel_data_set(infile, 3, &my_data_header, &my_data_set)){
+    fclose(infile);
+    read_error("It appears that the file %s is corrupted.",filename);
+  }
 
-  
-  read_generic_file_header(&my_header, infile);
-  read_generic_data_header(&my_data_header, infile);
-  read_generic_data_group(&my_data_group,infile);
-
-    
   triplet =  find_nvt(&my_data_header,"affymetrix-cel-rows");
   cur_mime_type = determine_MIMETYPE(*triplet);
   decode_MIME_value(*triplet,cur_mime_type, &nrows, &size);
-  
-
-
-  /* passing the intensities */
-  read_generic_data_set(&my_data_set,infile); 
-  fseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
-  /* passing by the stddev */
-  read_generic_data_set(&my_data_set,infile); 
-  fseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
-  
-  /* passing by the npixels */
-  read_generic_data_set(&my_data_set,infile); 
-  fseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
-  /* Now lets go for the "Outlier" */
-  read_generic_data_set(&my_data_set,infile); 
+  Free_generic_data_header(&my_data_header);
   
   if (rm_outliers){
-    read_generic_data_set_rows(&my_data_set,infile); 
     for (i=0; i < my_data_set.nrows; i++){
       cur_x = ((short *)my_data_set.Data[0])[i];
       cur_y = ((short *)my_data_set.Data[1])[i];
@@ -1014,24 +1034,22 @@ void generic_apply_masks(const char *filename, double *intensity, size_t chip_nu
       intensity[chip_num*rows + cur_index] =  R_NaN;
     }
   }
-  
-  fseek(infile, my_data_set.file_pos_last, SEEK_SET); 
   Free_generic_data_set(&my_data_set);
 
   /* Now lets go for the "Mask" */
-  read_generic_data_set(&my_data_set,infile); 
   if (rm_mask){
-    read_generic_data_set_rows(&my_data_set,infile); 
+    if (!generic_cel_data_set(infile, 4, NULL, &my_data_set)){
+      fclose(infile);
+      read_error("It appears that the file %s is corrupted.",filename);
+    }
     for (i=0; i < my_data_set.nrows; i++){
       cur_x = ((short *)my_data_set.Data[0])[i];
       cur_y = ((short *)my_data_set.Data[1])[i];
       cur_index = (int)cur_x + nrows*(int)cur_y; 
       intensity[chip_num*rows + cur_index] =  R_NaN;
     }
+    Free_generic_data_set(&my_data_set);
   }
-  Free_generic_data_set(&my_data_set);
-  Free_generic_data_header(&my_data_header);
-  Free_generic_data_group(&my_data_group);
 
   fclose(infile);
   
@@ -1052,9 +1070,10 @@ int isgzGenericCelFile(const char *filename){
   generic_file_header file_header;
   generic_data_header data_header;
   
+  read_timing_opened();
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
       return 0;
     }
 
@@ -1100,9 +1119,10 @@ char *gzgeneric_get_header_info(const char *filename, int *dim1, int *dim2){
 
   wchar_t *wchartemp=0;
   
+  read_timing_opened();
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
       return 0;
     }
   
@@ -1160,9 +1180,10 @@ void gzgeneric_get_detailed_header_info(const char *filename, detailed_header_in
   wchar_t *wchartemp = 0;
   char *chartemp = 0;
   
+  read_timing_opened();
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
     }
   
   gzread_generic_file_header(&file_header,infile);
@@ -1646,9 +1667,10 @@ int check_gzgeneric_cel_file(const char *filename, const char *ref_cdfName, int
   wchar_t *wchartemp=0;
   
 
+  read_timing_opened();
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
       return 0;
     }
 
@@ -1676,11 +1698,11 @@ int check_gzgeneric_cel_file(const char *filename, const char *ref_cdfName, int
   Free_generic_data_header(&data_header);
   
   if ((dim1 != ref_dim_1) || (dim2 != ref_dim_2)){
-    error("Cel file %s does not seem to have the correct dimensions",filename);
+    read_error("Cel file %s does not seem to have the correct dimensions",filename);
   }
   
   if (strncasecmp(cdfName,ref_cdfName,strlen(ref_cdfName)) != 0){
-    error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
+    read_error("Cel file %s does not seem to be of %s type",filename,ref_cdfName);
   }
 
   R_Free(cdfName);
@@ -1695,45 +1717,90 @@ int check_gzgeneric_cel_file(const char *filename, const char *ref_cdfName, int
 
 
 
-int gzread_genericcel_file_intensities(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows){
+/***************************************************************
+ **
+ ** static int gzgeneric_cel_data_set(gzFile infile, int which, generic_data_header *data_header, generic_data_set *data_set)
+ **
+ ** read the headers of the gzipped command console CEL file infile and then data set
+ ** which of its data group (0 intensities, 1 stddev, 2 npixels, 3 outliers,
+ ** 4 masks) with its rows, passing by the data sets before it. The data 
+ ** header is kept in data_header unless it is NULL. Returns 0 if the file
+ ** ends first, leaving data_set and data_header empty (so that they may be
+ ** freed).
+ **
+ **************************************************************/
 
-  size_t i=0;
-  
-  gzFile infile;
+static int gzgeneric_cel_data_set(gzFile infile, int which, generic_data_header *data_header, generic_data_set *data_set){
 
   generic_file_header my_header;
   generic_data_header my_data_header;
   generic_data_group my_data_group;
+  int i, ok;
+
+  memset(&my_data_header, 0, sizeof(generic_data_header));
+  memset(&my_data_group, 0, sizeof(generic_data_group));
+  memset(data_set, 0, sizeof(generic_data_set));
+
+  gzrewind(infile);
+  ok = gzread_generic_file_header(&my_header, infile) &&
+    gzread_generic_data_header(&my_data_header, infile) &&
+    gzread_generic_data_group(&my_data_group, infile);
+  for (i = 0; ok && i <= which; i++){
+    ok = gzread_generic_data_set(data_set, infile);
+    if (ok && i < which){
+      ok = (gzseek(infile, data_set->file_pos_last, SEEK_SET) >= 0);
+      Free_generic_data_set(data_set);
+      memset(data_set, 0, sizeof(generic_data_set));
+    }
+  }
+  ok = ok && gzread_generic_data_set_rows(data_set, infile);
+
+  if (!ok){
+    Free_generic_data_set(data_set);
+    memset(data_set, 0, sizeof(generic_data_set));
+    Free_generic_data_header(&my_data_header);
+    memset(&my_data_header, 0, sizeof(generic_data_header));
+  }
+  if (data_header != NULL){
+    *data_header = my_data_header;
+  } else {
+    Free_generic_data_header(&my_data_header);
+  }
+  Free_generic_data_group(&my_data_group);
+  return ok;
+}
+
+
+
+int gzread_genericcel_file_intensities(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows){
+
+  size_t i=0;
+  
+  gzFile infile;
 
   generic_data_set my_data_set;
 
 
+  read_timing_opened();
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
-
-  
-  gzread_generic_file_header(&my_header, infile);
-  gzread_generic_data_header(&my_data_header, infile);
-  gzread_generic_data_group(&my_data_group,infile);
-
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzread_generic_data_set_rows(&my_data_set,infile); 
+  /* a file cut short, or with the wrong number of cells, is corrupted */
+  if (!gzgeneric_cel_data_set(infile, 0, NULL, &my_data_set) || my_data_set.nrows != rows){
+    Free_generic_data_set(&my_data_set);
+    gzclose(infile);
+    return 1;
+  }
 
   for (i =0; i < my_data_set.nrows; i++){
     intensity[chip_num*my_data_set.nrows + i] = (double)(((float *)my_data_set.Data[0])[i]);
   }
-  
-  gzclose(infile);
   Free_generic_data_set(&my_data_set);
-  Free_generic_data_header(&my_data_header);
-  Free_generic_data_group(&my_data_group);
-
-
 
+  gzclose(infile);
 
   return(0);
 }
@@ -1749,47 +1816,31 @@ int gzread_genericcel_file_stddev(const char *filename, double *intensity, size_
   
   gzFile infile;
 
-  generic_file_header my_header;
-  generic_data_header my_data_header;
-  generic_data_group my_data_group;
-
   generic_data_set my_data_set;
 
 
+  read_timing_opened();
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
+  /* a file cut short, or with the wrong number of cells, is corrupted */
+  if (!gzgeneric_cel_data_set(infile, 1, NULL, &my_data_set) || my_data_set.nrows != rows){
+    Free_generic_data_set(&my_data_set);
+    gzclose(infile);
+    return 1;
+  }
 
-  
-  gzread_generic_file_header(&my_header, infile);
-  gzread_generic_data_header(&my_data_header, infile);
-  gzread_generic_data_group(&my_data_group,infile);
-
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzread_generic_data_set_rows(&my_data_set,infile); 
   for (i =0; i < my_data_set.nrows; i++){
     intensity[chip_num*my_data_set.nrows + i] = (double)(((float *)my_data_set.Data[0])[i]);
   }
   Free_generic_data_set(&my_data_set);
-  Free_generic_data_header(&my_data_header);
-  Free_generic_data_group(&my_data_group);
 
   gzclose(infile);
 
-
   return(0);
-
-
-
-
-
 }
 
 
@@ -1800,51 +1851,31 @@ int gzread_genericcel_file_npixels(const char *filename, double *intensity, size
   
   gzFile infile;
 
-  generic_file_header my_header;
-  generic_data_header my_data_header;
-  generic_data_group my_data_group;
-
   generic_data_set my_data_set;
 
 
+  read_timing_opened();
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
+  /* a file cut short, or with the wrong number of cells, is corrupted */
+  if (!gzgeneric_cel_data_set(infile, 2, NULL, &my_data_set) || my_data_set.nrows != rows){
+    Free_generic_data_set(&my_data_set);
+    gzclose(infile);
+    return 1;
+  }
 
-  
-  gzread_generic_file_header(&my_header, infile);
-  gzread_generic_data_header(&my_data_header, infile);
-  gzread_generic_data_group(&my_data_group,infile);
-
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
-  
-
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzread_generic_data_set_rows(&my_data_set,infile); 
   for (i =0; i < my_data_set.nrows; i++){
     intensity[chip_num*my_data_set.nrows + i] = (double)(((short *)my_data_set.Data[0])[i]);
   }
   Free_generic_data_set(&my_data_set);
-  Free_generic_data_header(&my_data_header);
-  Free_generic_data_group(&my_data_group);
 
   gzclose(infile);
 
-
   return(0);
-
-
-
-
 }
 
 
@@ -1855,83 +1886,53 @@ int gzread_genericcel_file_npixels(const char *filename, double *intensity, size
 
 void gzgeneric_get_masks_outliers(const char *filename, int *nmasks, short **masks_x, short **masks_y, int *noutliers, short **outliers_x, short **outliers_y){
 
-
-
-
   int i=0;
   
   gzFile infile;
 
-  generic_file_header my_header;
-  generic_data_header my_data_header;
-  generic_data_group my_data_group;
-
   generic_data_set my_data_set;
 
 
+  read_timing_opened();
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       
     }
   
-
-  
-  gzread_generic_file_header(&my_header, infile);
-  gzread_generic_data_header(&my_data_header, infile);
-  gzread_generic_data_group(&my_data_group,infile);
-
-  /* passing the intensities */
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
-  /* passing by the stddev */
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
-  
-  /* passing by the npixels */
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
   /* Now lets go for the "Outlier" */
-  gzread_generic_data_set(&my_data_set,infile); 
-   
+  if (!gzgeneric_cel_data_set(infile, 3, NULL, &my_data_set)){
+    gzclose(infile);
+    read_error("It appears that the file %s is corrupted.",filename);
+  }
   
   *noutliers = my_data_set.nrows;
 
   *outliers_x = R_Calloc(my_data_set.nrows,short); 
   *outliers_y = R_Calloc(my_data_set.nrows,short);
   
-  gzread_generic_data_set_rows(&my_data_set,infile); 
-  
   for (i=0; i < my_data_set.nrows; i++){
     (*outliers_x)[i] = ((short *)my_data_set.Data[0])[i];
     (*outliers_y)[i] = ((short *)my_data_set.Data[1])[i];
   }
-  
-  gzseek(infile, my_data_set.file_pos_last, SEEK_SET); 
   Free_generic_data_set(&my_data_set);
 
   /* Now lets go for the "Mask" */
-  gzread_generic_data_set(&my_data_set,infile); 
+  if (!gzgeneric_cel_data_set(infile, 4, NULL, &my_data_set)){
+    gzclose(infile);
+    read_error("It appears that the file %s is corrupted.",filename);
+  }
    
   *nmasks = my_data_set.nrows;
 
   *masks_x = R_Calloc(my_data_set.nrows,short); 
   *masks_y = R_Calloc(my_data_set.nrows,short);
   
-  
-  gzread_generic_data_set_rows(&my_data_set,infile); 
   for (i=0; i < my_data_set.nrows; i++){
-    (*outliers_x)[i] = ((short *)my_data_set.Data[0])[i];
-    (*outliers_y)[i] = ((short *)my_data_set.Data[1])[i];
+    (*masks_x)[i] = ((short *)my_data_set.Data[0])[i];
+    (*masks_y)[i] = ((short *)my_data_set.Data[1])[i];
   }
   Free_generic_data_set(&my_data_set);
-  Free_generic_data_header(&my_data_header);
-  Free_generic_data_group(&my_data_group);
 
   gzclose(infile);
   
@@ -1955,53 +1956,31 @@ void gzgeneric_apply_masks(const char *filename, double *intensity, size_t chip_
 
   gzFile infile;
 
-  generic_file_header my_header;
   generic_data_header my_data_header;
-  generic_data_group my_data_group;
 
   generic_data_set my_data_set;
   nvt_triplet *triplet;
   AffyMIMEtypes cur_mime_type;
 
+  read_timing_opened();
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       
     }
  
+  /* Now lets go for the "Outlier" */
+  if (!gzgeneric_cel_data_set(infile, 3, &my_data_header, &my_data_set)){
+    gzclose(infile);
+    read_error("It appears that the file %s is corrupted.",filename);
+  }
 
-  
-  gzread_generic_file_header(&my_header, infile);
-  gzread_generic_data_header(&my_data_header, infile);
-  gzread_generic_data_group(&my_data_group,infile);
-
-    
   triplet =  find_nvt(&my_data_header,"affymetrix-cel-rows");
   cur_mime_type = determine_MIMETYPE(*triplet);
   decode_MIME_value(*triplet,cur_mime_type, &nrows, &size);
-  
-
-
-  /* passing the intensities */
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
-  /* passing by the stddev */
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
-  
-  /* passing by the npixels */
-  gzread_generic_data_set(&my_data_set,infile); 
-  gzseek(infile, my_data_set.file_pos_last, SEEK_SET); 
-  Free_generic_data_set(&my_data_set);
- 
-  /* Now lets go for the "Outlier" */
-  gzread_generic_data_set(&my_data_set,infile); 
+  Free_generic_data_header(&my_data_header);
   
   if (rm_outliers){
-    gzread_generic_data_set_rows(&my_data_set,infile); 
     for (i=0; i < my_data_set.nrows; i++){
       cur_x = ((short *)my_data_set.Data[0])[i];
       cur_y = ((short *)my_data_set.Data[1])[i];
@@ -2009,25 +1988,23 @@ void gzgeneric_apply_masks(const char *filename, double *intensity, size_t chip_
       intensity[chip_num*rows + cur_index] =  R_NaN;
     }
   }
-  
-  gzseek(infile, my_data_set.file_pos_last, SEEK_SET); 
   Free_generic_data_set(&my_data_set);
 
   /* Now lets go for the "Mask" */
-  gzread_generic_data_set(&my_data_set,infile); 
   if (rm_mask){
-    gzread_generic_data_set_rows(&my_data_set,infile); 
+    if (!gzgeneric_cel_data_set(infile, 4, NULL, &my_data_set)){
+      gzclose(infile);
+      read_error("It appears that the file %s is corrupted.",filename);
+    }
     for (i=0; i < my_data_set.nrows; i++){
       cur_x = ((short *)my_data_set.Data[0])[i];
       cur_y = ((short *)my_data_set.Data[1])[i];
       cur_index = (int)cur_x + nrows*(int)cur_y; 
       intensity[chip_num*rows + cur_index] =  R_NaN;
     }
+    Free_generic_data_set(&my_data_set);
   }
-  Free_generic_data_set(&my_data_set);
-  Free_generic_data_header(&my_data_header);
-  Free_generic_data_group(&my_data_group);
-  
+
   gzclose(infile);
   
 }
@@ -12,6 +12,7 @@ int read_genericcel_file_stddev(const char *filename, double *intensity, size_t
 int read_genericcel_file_npixels(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows);
 void generic_get_masks_outliers(const char *filename, int *nmasks, short **masks_x, short **masks_y, int *noutliers, short **outliers_x, short **outliers_y);
 void generic_apply_masks(const char *filename, double *intensity, size_t chip_num, size_t rows, size_t cols, size_t chip_dim_rows, int rm_mask, int rm_outliers);
+double generic_intensities_offset(const char *filename, int *n_cells);
 
 
 
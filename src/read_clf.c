@@ -13,15 +13,35 @@
  ** Dec 31, 2007 - Add function for checking that required headers were found
  ** Jan 2, 2008 - port x,y to probe_id and probe_id to x,y functions from RMAExpress parsers
  ** Mar 18, 2008 - fix error in read_clf_header function
+ ** Oct 16, 2026 - ReadCLFFile returns the parsed file to R. sequential now defaults to -1 (not present)
+ **                so that non sequential files have their probe_ids read
+ ** Oct 16, 2026 - probe_id to x,y uses an index built when the file is read rather than a linear
+ **                search. Fix x,y arithmetic for non sequential files. Add CLFProbeIdToIndex
+ ** Oct 16, 2026 - data lines are scanned in place rather than tokenized. The probe_ids can be 
+ **                saved to (and memory mapped from) a binary sidecar file. The probe_id
+ **                index is built on the first lookup
+ ** Oct 16, 2026 - Add clf_probe_id_indices (see read_clf.h) for mapping PGF probes to cells
  **
  **
  ** 
  ******************************************************************/
 
 #include <R.h>
+#include <Rdefines.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "read_clf.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
  
 
 #define BUFFERSIZE 1024
@@ -108,8 +128,28 @@ typedef struct{
 
 typedef struct{
   int *probe_id;
+  int n_cells;
+  int index_built;
+  int *id_index;
+  int id_index_size;
+  int id_min;
+  int hashed;
+  void *map;           /* when probe_id was loaded from a sidecar file (see below) */
+  size_t map_length;
 } clf_data;
 
+/*******************************************************************
+ **
+ ** id_index is the inverse of probe_id: it gives the index of the 
+ ** cell holding a given probe_id (-1 if none). When the probe_ids 
+ ** cover a range not much bigger than the array, it is a dense array
+ ** with id_index[probe_id - id_min] = index. Otherwise (hashed = 1) it 
+ ** is an open addressing hash table of cell indices with 
+ ** id_index_size (a power of 2) slots. It is only built (index_built)
+ ** when the first lookup is made.
+ **
+ *******************************************************************/
+
 
 /*******************************************************************
  *******************************************************************
@@ -422,7 +462,7 @@ void initialize_clf_header(clf_headers *header){
 
   header->rows = -1;
   header->cols = -1;
-  header->n_other_headers = -1;
+  header->sequential = -1;
 
 }
 
@@ -641,6 +681,176 @@ void read_clf_header(FILE *cur_file, char *buffer, clf_headers *header){
  
 }
 
+/****************************************************************
+ **
+ ** static unsigned int clf_hash_id(int probe_id, unsigned int mask)
+ **
+ ** Fibonacci hashing of a probe_id into a table of mask + 1 slots
+ **
+ ***************************************************************/
+
+static unsigned int clf_hash_id(int probe_id, unsigned int mask){
+  return (((unsigned int)probe_id)*2654435761U >> 7) & mask;
+}
+
+
+/****************************************************************
+ **
+ ** static void clf_build_id_index(clf_data *data, int n_cells)
+ **
+ ** Build the probe_id to index lookup (see clf_data). If a probe_id
+ ** appears more than once the lowest index is kept.
+ **
+ ***************************************************************/
+
+static void clf_build_id_index(clf_data *data, int n_cells){
+
+  int i, n_ids = 0;
+  int id_min = 0, id_max = -1;
+  unsigned int mask, slot;
+  double range;
+
+  data->id_index = NULL;
+  data->id_index_size = 0;
+  data->id_min = 0;
+  data->hashed = 0;
+  data->index_built = 1;
+
+  for (i = 0; i < n_cells; i++){
+    if (data->probe_id[i] == -1)
+      continue;
+    if (n_ids == 0 || data->probe_id[i] < id_min)
+      id_min = data->probe_id[i];
+    if (n_ids == 0 || data->probe_id[i] > id_max)
+      id_max = data->probe_id[i];
+    n_ids++;
+  }
+  if (n_ids == 0){
+    return;
+  }
+
+  range = (double)id_max - (double)id_min + 1.0;
+
+  if (range <= 2.0*n_cells + 1024.0){
+    data->id_index_size = (int)range;
+    data->id_min = id_min;
+    data->id_index = R_Calloc(data->id_index_size, int);
+    for (i = 0; i < data->id_index_size; i++){
+      data->id_index[i] = -1;
+    }
+    for (i = n_cells - 1; i >= 0; i--){
+      if (data->probe_id[i] != -1){
+	data->id_index[data->probe_id[i] - id_min] = i;
+      }
+    }
+  } else {
+    data->hashed = 1;
+    data->id_index_size = 1024;
+    while (data->id_index_size < 2*n_ids){
+      data->id_index_size*= 2;
+    }
+    mask = (unsigned int)data->id_index_size - 1;
+    data->id_index = R_Calloc(data->id_index_size, int);
+    for (i = 0; i < data->id_index_size; i++){
+      data->id_index[i] = -1;
+    }
+    for (i = 0; i < n_cells; i++){
+      if (data->probe_id[i] == -1)
+	continue;
+      slot = clf_hash_id(data->probe_id[i], mask);
+      while (data->id_index[slot] != -1 && data->probe_id[data->id_index[slot]] != data->probe_id[i]){
+	slot = (slot + 1) & mask;
+      }
+      if (data->id_index[slot] == -1){
+	data->id_index[slot] = i;
+      }
+    }
+  }
+}
+
+
+/****************************************************************
+ **
+ ** static int clf_lookup_id_index(clf_data *data, int probe_id)
+ **
+ ** returns the index of the cell with probe_id or -1 if there is none
+ **
+ ***************************************************************/
+
+static int clf_lookup_id_index(clf_data *data, int probe_id){
+
+  unsigned int mask, slot;
+
+  if (!data->index_built){
+    clf_build_id_index(data, data->n_cells);
+  }
+  if (data->id_index == NULL || probe_id == -1){
+    return -1;
+  }
+
+  if (!data->hashed){
+    if (probe_id < data->id_min || (double)probe_id - data->id_min >= data->id_index_size){
+      return -1;
+    }
+    return data->id_index[probe_id - data->id_min];
+  }
+  
+  mask = (unsigned int)data->id_index_size - 1;
+  slot = clf_hash_id(probe_id, mask);
+  while (data->id_index[slot] != -1){
+    if (data->probe_id[data->id_index[slot]] == probe_id){
+      return data->id_index[slot];
+    }
+    slot = (slot + 1) & mask;
+  }
+  return -1;
+}
+
+
+
+/****************************************************************
+ **
+ ** static int clf_scan_line(const char *p, header_0 *header0, int max_column, int *values)
+ **
+ ** Scan a data line in place for the probe_id, x and y columns 
+ ** (stored in values[0], values[1], values[2]). Fields are split on
+ ** runs of tab, carriage return or newline characters (as tokenize 
+ ** does) and converted as by atoi. 
+ **
+ ** returns 1 if the line had at least max_column + 1 fields, 0 otherwise
+ **
+ ***************************************************************/
+
+#define CLF_IS_DELIMITER(c) ((c) == '\t' || (c) == '\r' || (c) == '\n')
+
+static int clf_scan_line(const char *p, header_0 *header0, int max_column, int *values){
+
+  int column;
+
+  for (column = 0; column <= max_column; column++){
+    while (CLF_IS_DELIMITER(*p)){
+      p++;
+    }
+    if (*p == '\0'){
+      return 0;
+    }
+    if (column == header0->probe_id){
+      values[0] = atoi(p);
+    }
+    if (column == header0->x){
+      values[1] = atoi(p);
+    }
+    if (column == header0->y){
+      values[2] = atoi(p);
+    }
+    while (*p != '\0' && !CLF_IS_DELIMITER(*p)){
+      p++;
+    }
+  }
+  return 1;
+}
+
+
 /****************************************************************
  **
  ** void read_clf_data(FILE *cur_file, char *buffer, clf_data *data, clf_headers *header)
@@ -651,38 +861,192 @@ void read_clf_header(FILE *cur_file, char *buffer, clf_headers *header){
  ****************************************************************/
 
 void read_clf_data(FILE *cur_file, char *buffer, clf_data *data, clf_headers *header){
-  tokenset *cur_tokenset;
-  int x, y, cur_id;
+  int x, y;
+  int max_column;
+  int values[3];
 
   /* Check to see if the header information includes enough to know that probe_ids are deterministic */
   /* if the are deterministic then don't need to read the rest of the file */
 
+  data->n_cells = (header->rows)*(header->cols);
 
   if (header->sequential > -1){
     data->probe_id = NULL;
     return;
   } else {
     data->probe_id = R_Calloc((header->rows)*(header->cols), int);
-    cur_tokenset = tokenize(buffer,"\t\r\n");
-    cur_id = atoi(get_token(cur_tokenset,header->header0->probe_id));
-    x = atoi(get_token(cur_tokenset,header->header0->x));
-    y = atoi(get_token(cur_tokenset,header->header0->y));
-    data->probe_id[y*header->cols + x] = cur_id;
-
-    delete_tokens(cur_tokenset);
-    while(ReadFileLine(buffer, 1024, cur_file)){
-      cur_tokenset = tokenize(buffer,"\t\r\n");
-      cur_id = atoi(get_token(cur_tokenset,header->header0->probe_id));
-      x = atoi(get_token(cur_tokenset,header->header0->x));
-      y = atoi(get_token(cur_tokenset,header->header0->y));
-      data->probe_id[y*header->cols + x] = cur_id;
-
-      delete_tokens(cur_tokenset);
+    /* cells not listed in the file have probe_id -1 (ie missing) */
+    for (x = 0; x < (header->rows)*(header->cols); x++){
+      data->probe_id[x] = -1;
     }
+    max_column = header->header0->probe_id;
+    if (header->header0->x > max_column)
+      max_column = header->header0->x;
+    if (header->header0->y > max_column)
+      max_column = header->header0->y;
+    do {
+      if (buffer[0] == '#'){
+	continue;
+      }
+      if (clf_scan_line(buffer, header->header0, max_column, values)){
+	x = values[1];
+	y = values[2];
+	if (x < 0 || x >= header->cols || y < 0 || y >= header->rows){
+	  error("CLF file has a probe at x=%d, y=%d which is outside the %d by %d array.", x, y, header->cols, header->rows);
+	}
+	data->probe_id[y*header->cols + x] = values[0];
+      }
+    } while(ReadFileLine(buffer, 1024, cur_file));
   }
 }
 
 
+/****************************************************************
+ ****************************************************************
+ **
+ ** Sidecar files
+ **
+ ** The probe_ids of a non sequential CLF file can be saved in a 
+ ** binary sidecar file so that later reads need not parse the text.
+ ** The sidecar is a clf_sidecar_header followed by the rows*cols 
+ ** probe_ids as native ints. It records the size and modification 
+ ** time of the CLF file it was made from and is ignored (and 
+ ** rewritten) if these do not match. Where possible it is memory 
+ ** mapped, otherwise (on Windows) it is read into memory.
+ **
+ ****************************************************************
+ ****************************************************************/
+
+#define CLF_SIDECAR_MAGIC "AFFYCLFI"
+#define CLF_SIDECAR_VERSION 1
+#define CLF_SIDECAR_BYTE_ORDER 0x01020304
+
+typedef struct{
+  char magic[8];
+  int version;
+  int byte_order;
+  int rows;
+  int cols;
+  double source_size;
+  double source_mtime;
+} clf_sidecar_header;
+
+
+static int clf_sidecar_source(const char *filename, clf_headers *header, clf_sidecar_header *sidecar_header){
+
+  struct stat file_info;
+
+  if (stat(filename, &file_info) != 0){
+    return 0;
+  }
+  memset(sidecar_header, 0, sizeof(clf_sidecar_header));
+  memcpy(sidecar_header->magic, CLF_SIDECAR_MAGIC, 8);
+  sidecar_header->version = CLF_SIDECAR_VERSION;
+  sidecar_header->byte_order = CLF_SIDECAR_BYTE_ORDER;
+  sidecar_header->rows = header->rows;
+  sidecar_header->cols = header->cols;
+  sidecar_header->source_size = (double)file_info.st_size;
+  sidecar_header->source_mtime = (double)file_info.st_mtime;
+  return 1;
+}
+
+
+/****************************************************************
+ **
+ ** static int clf_load_sidecar(const char *sidecar, const char *filename, clf_data *data, clf_headers *header)
+ **
+ ** load probe_ids from the sidecar file if it exists and matches
+ ** the CLF file. Returns 1 if it was loaded, 0 otherwise.
+ **
+ ***************************************************************/
+
+static int clf_load_sidecar(const char *sidecar, const char *filename, clf_data *data, clf_headers *header){
+
+  clf_sidecar_header expected, found;
+  FILE *infile;
+#ifndef _WIN32
+  size_t length;
+  int fd;
+  void *map;
+  struct stat sidecar_info;
+#endif
+  
+  if (!clf_sidecar_source(filename, header, &expected)){
+    return 0;
+  }
+  if ((infile = fopen(sidecar, "rb")) == NULL){
+    return 0;
+  }
+  if (fread(&found, sizeof(clf_sidecar_header), 1, infile) != 1 || memcmp(&found, &expected, sizeof(clf_sidecar_header)) != 0){
+    fclose(infile);
+    return 0;
+  }
+  
+  data->n_cells = (header->rows)*(header->cols);
+
+#ifndef _WIN32
+  fclose(infile);
+  length = sizeof(clf_sidecar_header) + (size_t)data->n_cells*sizeof(int);
+  if ((fd = open(sidecar, O_RDONLY)) < 0){
+    return 0;
+  }
+  /* a truncated sidecar would only show up as a fault when mapped */
+  if (fstat(fd, &sidecar_info) != 0 || sidecar_info.st_size < (off_t)length){
+    close(fd);
+    return 0;
+  }
+  map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED){
+    return 0;
+  }
+  data->map = map;
+  data->map_length = length;
+  data->probe_id = (int *)((char *)map + sizeof(clf_sidecar_header));
+#else
+  data->probe_id = R_Calloc(data->n_cells + 1, int);
+  if (fread(data->probe_id, sizeof(int), data->n_cells, infile) != (size_t)data->n_cells){
+    R_Free(data->probe_id);
+    data->probe_id = NULL;
+    fclose(infile);
+    return 0;
+  }
+  fclose(infile);
+#endif
+  return 1;
+}
+
+
+/****************************************************************
+ **
+ ** static void clf_write_sidecar(const char *sidecar, const char *filename, clf_data *data, clf_headers *header)
+ **
+ ** save the probe_ids read from filename to the sidecar file. 
+ ** Failing to write it is only a warning.
+ **
+ ***************************************************************/
+
+static void clf_write_sidecar(const char *sidecar, const char *filename, clf_data *data, clf_headers *header){
+
+  clf_sidecar_header sidecar_header;
+  FILE *outfile;
+  int ok;
+  
+  if (!clf_sidecar_source(filename, header, &sidecar_header)){
+    return;
+  }
+  if ((outfile = fopen(sidecar, "wb")) == NULL){
+    warning("Unable to write CLF sidecar file %s", sidecar);
+    return;
+  }
+  ok = (fwrite(&sidecar_header, sizeof(clf_sidecar_header), 1, outfile) == 1);
+  ok = ok && (fwrite(data->probe_id, sizeof(int), data->n_cells, outfile) == (size_t)data->n_cells);
+  ok = (fclose(outfile) == 0) && ok;
+  if (!ok){
+    remove(sidecar);
+    warning("Unable to write CLF sidecar file %s", sidecar);
+  }
+}
 
 
 
@@ -746,9 +1110,19 @@ void dealloc_clf_headers(clf_headers *header){
 
 
 void dealloc_clf_data(clf_data *data){
+#ifndef _WIN32
+  if (data->map != NULL){
+    munmap(data->map, data->map_length);
+    data->map = NULL;
+    data->probe_id = NULL;
+  }
+#endif
   if (data->probe_id != NULL){
     R_Free(data->probe_id);
   }
+  if (data->id_index != NULL){
+    R_Free(data->id_index);
+  }
 }
 
 
@@ -781,7 +1155,9 @@ void clf_get_probe_id(clf_file *clf, int *probe_id, int x, int y){
   if (clf->headers->sequential > -1){
     /* Check if order is "col_major" or "row_major" */
 
-    if (strcmp(clf->headers->order,"col_major") == 0){
+    if (clf->headers->order == NULL){
+      *probe_id = -1;  /* ie missing */
+    } else if (strcmp(clf->headers->order,"col_major") == 0){
       *probe_id = y*clf->headers->cols + x + clf->headers->sequential;
     } else if (strcmp(clf->headers->order,"row_major") == 0){
       *probe_id = x*clf->headers->rows + y + clf->headers->sequential;
@@ -791,7 +1167,7 @@ void clf_get_probe_id(clf_file *clf, int *probe_id, int x, int y){
 
   } else {
 
-    *probe_id = clf->data->probe_id[y*clf->headers->rows + x];
+    *probe_id = clf->data->probe_id[y*clf->headers->cols + x];
   }
 }
 
@@ -808,12 +1184,14 @@ void clf_get_x_y(clf_file *clf, int probe_id, int *x, int *y){
   if (clf->headers->sequential > -1){
     /* Check if order is "col_major" or "row_major" */
 
-    if (strcmp(clf->headers->order,"col_major") == 0){
-      ind = (probe_id - clf->headers->sequential); 
+    ind = (probe_id - clf->headers->sequential); 
+    if (clf->headers->order == NULL || ind < 0 || ind >= clf->headers->cols*clf->headers->rows){
+      *x = -1;  /* ie missing */
+      *y = -1;
+    } else if (strcmp(clf->headers->order,"col_major") == 0){
       *x = ind%clf->headers->cols;
       *y = ind/clf->headers->cols;
     } else if (strcmp(clf->headers->order,"row_major") == 0){
-      ind = (probe_id - clf->headers->sequential); 
       *x = ind/clf->headers->rows;
       *y = ind%clf->headers->rows;
     } else {
@@ -821,25 +1199,111 @@ void clf_get_x_y(clf_file *clf, int probe_id, int *x, int *y){
       *y = -1;
     }
   } else {
-    /* Linear Search (this should be improved for routine use) */
-    ind = 0;
+    ind = clf_lookup_id_index(clf->data, probe_id);
 
-    while (ind < (clf->headers->cols*clf->headers->rows)){
-      if (clf->data->probe_id[ind] == probe_id){
-	break;
-      }
-      ind++;
+    if (ind == -1){
+      *x = -1; *y = -1;
+    } else {
+      *x = ind%clf->headers->cols;
+      *y = ind/clf->headers->cols;
     }
+  }
+}
 
-    if (ind == (clf->headers->cols*clf->headers->rows)){
-      *x = -1; *y = -1;
+
+/**********************************************************************
+ ***
+ *** void clf_get_indices(clf_file *clf, const int *probe_id, int n, int *index)
+ ***
+ *** Look up n probe_ids at once, storing the index (y*cols + x) of 
+ *** each in index. Missing probe_ids give -1.
+ ***
+ *********************************************************************/
+
+void clf_get_indices(clf_file *clf, const int *probe_id, int n, int *index){
+
+  int i, x, y;
+
+  for (i = 0; i < n; i++){
+    if (clf->headers->sequential > -1){
+      clf_get_x_y(clf, probe_id[i], &x, &y);
+      index[i] = (x == -1) ? -1 : y*clf->headers->cols + x;
     } else {
-      *x = ind/clf->headers->rows;
-      *y = ind%clf->headers->rows;
+      index[i] = clf_lookup_id_index(clf->data, probe_id[i]);
     }
   }
 }
 
+/****************************************************************
+ **
+ ** static int read_clf(const char *filename, const char *sidecar, clf_file *my_clf)
+ **
+ ** parse the named file into my_clf. Returns 0 if the header 
+ ** is missing required fields (in which case the body is not
+ ** read) and 1 otherwise. my_clf should be freed with 
+ ** dealloc_clf_file either way.
+ **
+ ** If sidecar is not NULL the probe_ids are loaded from that 
+ ** file when it is up to date and otherwise saved to it after 
+ ** being read.
+ **
+ ***************************************************************/
+
+static int read_clf(const char *filename, const char *sidecar, clf_file *my_clf){
+
+  FILE *cur_file;
+  char *buffer = R_Calloc(1024, char);
+  int valid;
+  
+  cur_file = open_clf_file(filename);
+  
+  my_clf->headers = R_Calloc(1, clf_headers);
+  my_clf->data = R_Calloc(1, clf_data);
+
+  read_clf_header(cur_file,buffer,my_clf->headers);
+  valid = validate_clf_header(my_clf->headers);
+  if (valid){
+    if (sidecar == NULL || my_clf->headers->sequential > -1){
+      read_clf_data(cur_file, buffer, my_clf->data, my_clf->headers);
+    } else if (!clf_load_sidecar(sidecar, filename, my_clf->data, my_clf->headers)){
+      read_clf_data(cur_file, buffer, my_clf->data, my_clf->headers);
+      clf_write_sidecar(sidecar, filename, my_clf->data, my_clf->headers);
+    }
+  }
+
+  R_Free(buffer);
+  fclose(cur_file);
+
+  return valid;
+}
+
+
+/****************************************************************
+ **
+ ** void clf_probe_id_indices(const char *filename, const char *sidecar, const int *probe_id, int n, 
+ **                           int *index, int *n_cells)
+ **
+ ** read the named CLF file (using sidecar as in read_clf, may be NULL)
+ ** and store the (0 based) cell index y*cols + x of each of the n 
+ ** probe_ids in index, -1 for those not in the file. n_cells is set
+ ** to rows*cols.
+ **
+ ***************************************************************/
+
+void clf_probe_id_indices(const char *filename, const char *sidecar, const int *probe_id, int n, int *index, int *n_cells){
+
+  clf_file my_clf;
+
+  if (!read_clf(filename, sidecar, &my_clf)){
+    dealloc_clf_file(&my_clf);
+    error("%s is missing required CLF header fields. Is it a CLF file?", filename);
+  }
+  clf_get_indices(&my_clf, probe_id, n, index);
+  *n_cells = (my_clf.headers->rows)*(my_clf.headers->cols);
+  dealloc_clf_file(&my_clf);
+}
+
+
 /*
  * Note this function is only for testing purposes. It provides no methodology for accessing anything
  * stored in the CLF file in R.
@@ -848,23 +1312,242 @@ void clf_get_x_y(clf_file *clf, int probe_id, int *x, int *y){
 
 void read_clf_file(char **filename){
 
-  FILE *cur_file;
   clf_file my_clf;
-  char *buffer = R_Calloc(1024, char);
 
+  read_clf(filename[0], NULL, &my_clf);
+  dealloc_clf_file(&my_clf);
+
+}
+
+
+/****************************************************************
+ ****************************************************************
+ **
+ ** Functionality for returning the parsed file to R
+ **
+ ** The file is returned as a list with components
+ **
+ ** header - a list of the #% header values 
+ ** cells  - data.frame: probe_id, x, y with one row for each 
+ **          cell on the array, in the order index = y*cols + x
+ **
+ ** Cells which have no probe are NA.
+ **
+ ****************************************************************
+ ****************************************************************/
+
+static SEXP clf_scalar_string(const char *str){
+  if (str == NULL){
+    return ScalarString(NA_STRING);
+  }
+  return mkString(str);
+}
+
+
+static SEXP clf_header_list(clf_headers *header){
+
+  SEXP header_list, names, chip_type;
+  int i;
+  int n = 10 + header->n_other_headers;
 
+  PROTECT(header_list = allocVector(VECSXP, n));
+  PROTECT(names = allocVector(STRSXP, n));
   
-  cur_file = open_clf_file(filename[0]);
+  PROTECT(chip_type = allocVector(STRSXP, header->n_chip_type));
+  for (i = 0; i < header->n_chip_type; i++){
+    SET_STRING_ELT(chip_type, i, mkChar(header->chip_type[i]));
+  }
+  SET_VECTOR_ELT(header_list, 0, chip_type);
+  SET_VECTOR_ELT(header_list, 1, clf_scalar_string(header->lib_set_name));
+  SET_VECTOR_ELT(header_list, 2, clf_scalar_string(header->lib_set_version));
+  SET_VECTOR_ELT(header_list, 3, clf_scalar_string(header->clf_format_version));
+  SET_VECTOR_ELT(header_list, 4, ScalarInteger(header->rows));
+  SET_VECTOR_ELT(header_list, 5, ScalarInteger(header->cols));
+  SET_VECTOR_ELT(header_list, 6, ScalarInteger(header->sequential > -1 ? header->sequential : NA_INTEGER));
+  SET_VECTOR_ELT(header_list, 7, clf_scalar_string(header->order));
+  SET_VECTOR_ELT(header_list, 8, clf_scalar_string(header->create_date));
+  SET_VECTOR_ELT(header_list, 9, clf_scalar_string(header->guid));
+  SET_STRING_ELT(names, 0, mkChar("chip_type"));
+  SET_STRING_ELT(names, 1, mkChar("lib_set_name"));
+  SET_STRING_ELT(names, 2, mkChar("lib_set_version"));
+  SET_STRING_ELT(names, 3, mkChar("clf_format_version"));
+  SET_STRING_ELT(names, 4, mkChar("rows"));
+  SET_STRING_ELT(names, 5, mkChar("cols"));
+  SET_STRING_ELT(names, 6, mkChar("sequential"));
+  SET_STRING_ELT(names, 7, mkChar("order"));
+  SET_STRING_ELT(names, 8, mkChar("create_date"));
+  SET_STRING_ELT(names, 9, mkChar("guid"));
+
+  for (i = 0; i < header->n_other_headers; i++){
+    SET_VECTOR_ELT(header_list, 10 + i, mkString(header->other_headers_values[i]));
+    SET_STRING_ELT(names, 10 + i, mkChar(header->other_headers_keys[i]));
+  }
+  setAttrib(header_list, R_NamesSymbol, names);
+
+  UNPROTECT(3);
+  return header_list;
+}
+
+
+static SEXP clf_cell_frame(clf_file *my_clf){
+
+  int rows = my_clf->headers->rows;
+  int cols = my_clf->headers->cols;
+  int n = rows*cols;
+  int i, cur_id;
+  SEXP frame, names, row_names, probe_id, x, y;
+
+  PROTECT(frame = allocVector(VECSXP, 3));
+  probe_id = allocVector(INTSXP, n);
+  SET_VECTOR_ELT(frame, 0, probe_id);
+  x = allocVector(INTSXP, n);
+  SET_VECTOR_ELT(frame, 1, x);
+  y = allocVector(INTSXP, n);
+  SET_VECTOR_ELT(frame, 2, y);
+
+  for (i = 0; i < n; i++){
+    INTEGER(x)[i] = i % cols;
+    INTEGER(y)[i] = i / cols;
+    if (my_clf->headers->sequential > -1){
+      clf_get_probe_id(my_clf, &cur_id, i % cols, i / cols);
+    } else {
+      cur_id = my_clf->data->probe_id[i];
+    }
+    INTEGER(probe_id)[i] = (cur_id == -1) ? NA_INTEGER : cur_id;
+  }
   
-  my_clf.headers = R_Calloc(1, clf_headers);
-  my_clf.data = R_Calloc(1, clf_data);
+  PROTECT(names = allocVector(STRSXP, 3));
+  SET_STRING_ELT(names, 0, mkChar("probe_id"));
+  SET_STRING_ELT(names, 1, mkChar("x"));
+  SET_STRING_ELT(names, 2, mkChar("y"));
+  setAttrib(frame, R_NamesSymbol, names);
+
+  PROTECT(row_names = allocVector(INTSXP, 2));
+  INTEGER(row_names)[0] = NA_INTEGER;
+  INTEGER(row_names)[1] = -n;
+  setAttrib(frame, R_RowNamesSymbol, row_names);
+  setAttrib(frame, R_ClassSymbol, mkString("data.frame"));
+
+  UNPROTECT(3);
+  return frame;
+}
 
-  read_clf_header(cur_file,buffer,my_clf.headers);
-  if (validate_clf_header(my_clf.headers))
-    read_clf_data(cur_file, buffer, my_clf.data, my_clf.headers);
 
-  R_Free(buffer);
+/****************************************************************
+ **
+ ** static const char *clf_sidecar_name(SEXP sidecar)
+ **
+ ** the sidecar file name given to ReadCLFFile or CLFProbeIdToIndex,
+ ** NULL if there is none
+ **
+ ***************************************************************/
+
+static const char *clf_sidecar_name(SEXP sidecar){
+
+  if (isNull(sidecar)){
+    return NULL;
+  }
+  if (!isString(sidecar) || length(sidecar) != 1){
+    error("sidecar should be NULL or a single character string");
+  }
+  if (STRING_ELT(sidecar,0) == NA_STRING){
+    return NULL;
+  }
+  return CHAR(STRING_ELT(sidecar,0));
+}
+
+
+/****************************************************************
+ **
+ ** SEXP ReadCLFFile(SEXP filename, SEXP sidecar)
+ **
+ ** SEXP filename - name of CLF file
+ ** SEXP sidecar - NULL or name of binary sidecar file for the probe_ids
+ **
+ ** RETURNS list(header, cells) as described above
+ **
+ ***************************************************************/
+
+SEXP ReadCLFFile(SEXP filename, SEXP sidecar){
+
+  clf_file my_clf;
+  SEXP return_value, names;
+  const char *cur_file_name;
+
+  if (!isString(filename) || length(filename) != 1){
+    error("filename should be a single character string");
+  }
+  cur_file_name = CHAR(STRING_ELT(filename,0));
+
+  if (!read_clf(cur_file_name, clf_sidecar_name(sidecar), &my_clf)){
+    dealloc_clf_file(&my_clf);
+    error("%s is missing required CLF header fields. Is it a CLF file?", cur_file_name);
+  }
+  
+  PROTECT(return_value = allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(return_value, 0, clf_header_list(my_clf.headers));
+  SET_VECTOR_ELT(return_value, 1, clf_cell_frame(&my_clf));
+
   dealloc_clf_file(&my_clf);
-  fclose(cur_file);
 
+  PROTECT(names = allocVector(STRSXP, 2));
+  SET_STRING_ELT(names, 0, mkChar("header"));
+  SET_STRING_ELT(names, 1, mkChar("cells"));
+  setAttrib(return_value, R_NamesSymbol, names);
+
+  UNPROTECT(2);
+  return return_value;
+}
+
+
+/****************************************************************
+ **
+ ** SEXP CLFProbeIdToIndex(SEXP filename, SEXP probe_ids, SEXP sidecar)
+ **
+ ** SEXP filename - name of CLF file
+ ** SEXP probe_ids - integer vector of probe_ids
+ ** SEXP sidecar - NULL or name of binary sidecar file for the probe_ids
+ **
+ ** RETURNS integer vector of (1 based) cell indices y*cols + x + 1,
+ ** NA for probe_ids that are not in the file
+ **
+ ***************************************************************/
+
+SEXP CLFProbeIdToIndex(SEXP filename, SEXP probe_ids, SEXP sidecar){
+
+  clf_file my_clf;
+  SEXP index;
+  const char *cur_file_name;
+  int i, n;
+  int *ids;
+
+  if (!isString(filename) || length(filename) != 1){
+    error("filename should be a single character string");
+  }
+  if (!isInteger(probe_ids)){
+    error("probe_ids should be an integer vector");
+  }
+  cur_file_name = CHAR(STRING_ELT(filename,0));
+
+  if (!read_clf(cur_file_name, clf_sidecar_name(sidecar), &my_clf)){
+    dealloc_clf_file(&my_clf);
+    error("%s is missing required CLF header fields. Is it a CLF file?", cur_file_name);
+  }
+  
+  n = length(probe_ids);
+  ids = INTEGER(probe_ids);
+  PROTECT(index = allocVector(INTSXP, n));
+
+  clf_get_indices(&my_clf, ids, n, INTEGER(index));
+  for (i = 0; i < n; i++){
+    if (ids[i] == NA_INTEGER || INTEGER(index)[i] == -1){
+      INTEGER(index)[i] = NA_INTEGER;
+    } else {
+      INTEGER(index)[i]++;
+    }
+  }
+  
+  dealloc_clf_file(&my_clf);
+  UNPROTECT(1);
+  return index;
 }
@@ -0,0 +1,14 @@
+#ifndef READ_CLF_H
+#define READ_CLF_H
+
+
+
+/****************************************************************
+ **
+ ** Cell index lookup for use by other parsers (see read_clf.c)
+ **
+ ***************************************************************/
+
+void clf_probe_id_indices(const char *filename, const char *sidecar, const int *probe_id, int n, int *index, int *n_cells);
+
+#endif
@@ -0,0 +1,278 @@
+/******************************************************************
+ **
+ ** file: read_error.c
+ **
+ ** Aim: let the CEL file readers report errors from worker threads
+ **      without calling error() there
+ **
+ ** Created on Oct 16, 2026
+ **
+ ** History
+ ** Oct 16, 2026 - Initial version
+ ** Oct 16, 2026 - read_warning() lets a trap keep the warnings of a reader for the main thread
+ **
+ **
+ ** error() longjmps to the R top level, which must not happen on any
+ ** thread but the main one. The readers therefore call read_error()
+ ** instead. On a thread which has set a trap with read_error_catch()
+ ** the message is kept in the trap and read_error() longjmps back to
+ ** the setjmp() of the trap, typically in a worker's loop over its
+ ** files:
+ **
+ **    read_error_catch(&trap);
+ **    if (setjmp(trap.env) == 0){
+ **      status[i] = read_the_file(...);
+ **    } else {
+ **      messages[i] = read_error_message(&trap);
+ **    }
+ **    read_error_release();
+ **
+ ** The thread which started the workers then calls error() with the
+ ** first message after joining them. Without a trap read_error() is
+ ** just error(), so the readers behave as always on the main thread.
+ **
+ ** Warnings about a file that can still be read (a truncated text 
+ ** file, say) are given with read_warning(). These are printed as
+ ** they always were, unless the thread has set a trap with 
+ ** keep_warnings set, in which case the first is kept in the trap 
+ ** for read_error_warning() and the main thread to print.
+ **
+ ** Anything the reader allocated or opened before failing is not
+ ** released when the trap is sprung. This only happens for corrupt
+ ** or truncated files, where the batch is abandoned anyway.
+ **
+ ******************************************************************/
+
+#include <R.h>
+#include <Rdefines.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "read_error.h"
+
+#if USE_PTHREADS
+#include <pthread.h>
+#endif
+
+
+#if USE_PTHREADS
+static pthread_key_t trap_key;
+static pthread_once_t trap_key_once = PTHREAD_ONCE_INIT;
+
+static void make_trap_key(void){
+  pthread_key_create(&trap_key, NULL);
+}
+#else
+static read_error_trap *current_trap = NULL;
+#endif
+
+
+static void set_trap(read_error_trap *trap){
+#if USE_PTHREADS
+  pthread_once(&trap_key_once, make_trap_key);
+  pthread_setspecific(trap_key, trap);
+#else
+  current_trap = trap;
+#endif
+}
+
+
+static read_error_trap *get_trap(void){
+#if USE_PTHREADS
+  pthread_once(&trap_key_once, make_trap_key);
+  return (read_error_trap *)pthread_getspecific(trap_key);
+#else
+  return current_trap;
+#endif
+}
+
+
+/****************************************************************
+ **
+ ** void read_error(const char *format, ...)
+ **
+ ** Raise a reading error. With a trap set on this thread the
+ ** formatted message is stored in the trap and control returns to
+ ** its setjmp(), otherwise error() is called.
+ **
+ ***************************************************************/
+
+void read_error(const char *format, ...){
+
+  read_error_trap *trap = get_trap();
+  char buffer[READ_ERROR_MESSAGE_SIZE];
+  va_list args;
+
+  va_start(args, format);
+  if (trap != NULL){
+    vsnprintf(trap->message, READ_ERROR_MESSAGE_SIZE, format, args);
+    va_end(args);
+    longjmp(trap->env, 1);
+  }
+  vsnprintf(buffer, READ_ERROR_MESSAGE_SIZE, format, args);
+  va_end(args);
+  error("%s", buffer);
+}
+
+
+/****************************************************************
+ **
+ ** void read_warning(const char *format, ...)
+ **
+ ** Warn about a file that is still being read. With a trap set on
+ ** this thread that keeps warnings, the first formatted message is
+ ** stored in the trap, otherwise it is printed with Rprintf().
+ **
+ ***************************************************************/
+
+void read_warning(const char *format, ...){
+
+  read_error_trap *trap = get_trap();
+  char buffer[READ_ERROR_MESSAGE_SIZE];
+  va_list args;
+
+  va_start(args, format);
+  if (trap != NULL && trap->keep_warnings){
+    if (trap->warning[0] == '\0'){
+      vsnprintf(trap->warning, READ_ERROR_MESSAGE_SIZE, format, args);
+    }
+    va_end(args);
+    return;
+  }
+  vsnprintf(buffer, READ_ERROR_MESSAGE_SIZE, format, args);
+  va_end(args);
+  Rprintf("%s", buffer);
+}
+
+
+/****************************************************************
+ **
+ ** void read_error_catch(read_error_trap *trap)
+ ** void read_error_release(void)
+ **
+ ** Set, and clear, the trap for read_error() on the calling
+ ** thread. The caller must setjmp(trap->env) after setting it and
+ ** release it before the frame holding the trap returns. Warnings
+ ** are printed unless trap->keep_warnings is then set.
+ **
+ ***************************************************************/
+
+void read_error_catch(read_error_trap *trap){
+  trap->message[0] = '\0';
+  trap->keep_warnings = 0;
+  trap->warning[0] = '\0';
+  set_trap(trap);
+}
+
+
+void read_error_release(void){
+  set_trap(NULL);
+}
+
+
+/****************************************************************
+ **
+ ** char *read_error_message(const read_error_trap *trap)
+ **
+ ** A copy of the message of a sprung trap, to be kept for the
+ ** main thread. Free with read_error_free_messages().
+ **
+ ***************************************************************/
+
+char *read_error_message(const read_error_trap *trap){
+
+  char *message = R_Calloc(strlen(trap->message) + 1, char);
+
+  strcpy(message, trap->message);
+  return message;
+}
+
+
+/****************************************************************
+ **
+ ** char *read_error_warning(const read_error_trap *trap)
+ **
+ ** A copy of the warning kept by a trap, NULL if there was none.
+ ** Free with R_Free() (or read_error_free_messages()).
+ **
+ ***************************************************************/
+
+char *read_error_warning(const read_error_trap *trap){
+
+  char *warning;
+
+  if (trap->warning[0] == '\0'){
+    return NULL;
+  }
+  warning = R_Calloc(strlen(trap->warning) + 1, char);
+  strcpy(warning, trap->warning);
+  return warning;
+}
+
+
+/****************************************************************
+ **
+ ** const char *read_error_first(char **messages, int n, int *which)
+ **
+ ** The first non NULL of n messages, setting *which (if not NULL)
+ ** to its index. NULL when there are none.
+ **
+ ***************************************************************/
+
+const char *read_error_first(char **messages, int n, int *which){
+
+  int i;
+
+  for (i = 0; i < n; i++){
+    if (messages[i] != NULL){
+      if (which != NULL){
+	*which = i;
+      }
+      return messages[i];
+    }
+  }
+  return NULL;
+}
+
+
+/****************************************************************
+ **
+ ** void read_error_raise(char **messages, int n)
+ ** void read_error_free_messages(char **messages, int n)
+ **
+ ** Free n messages (and the array holding them). read_error_raise()
+ ** then calls error() with the first, if there was one. Call on 
+ ** the main thread once the workers are done, having released 
+ ** anything else that is held.
+ **
+ ***************************************************************/
+
+void read_error_raise(char **messages, int n){
+
+  const char *message = read_error_first(messages, n, NULL);
+  char buffer[READ_ERROR_MESSAGE_SIZE];
+
+  if (message == NULL){
+    read_error_free_messages(messages, n);
+    return;
+  }
+  strncpy(buffer, message, READ_ERROR_MESSAGE_SIZE - 1);
+  buffer[READ_ERROR_MESSAGE_SIZE - 1] = '\0';
+  read_error_free_messages(messages, n);
+  error("%s", buffer);
+}
+
+
+void read_error_free_messages(char **messages, int n){
+
+  int i;
+
+  for (i = 0; i < n; i++){
+    if (messages[i] != NULL){
+      R_Free(messages[i]);
+    }
+  }
+  R_Free(messages);
+}
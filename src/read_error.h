@@ -0,0 +1,39 @@
+#ifndef READ_ERROR_H
+#define READ_ERROR_H
+
+#include <setjmp.h>
+
+
+/****************************************************************
+ **
+ ** Errors raised by the CEL file readers, which may be running on
+ ** worker threads (see read_error.c)
+ **
+ ***************************************************************/
+
+#define READ_ERROR_MESSAGE_SIZE 512
+
+#ifndef NORET
+#define NORET
+#endif
+
+
+typedef struct{
+  jmp_buf env;
+  char message[READ_ERROR_MESSAGE_SIZE];
+  int keep_warnings;                       /* keep read_warning() messages rather than print them */
+  char warning[READ_ERROR_MESSAGE_SIZE];   /* the first warning kept */
+} read_error_trap;
+
+
+NORET void read_error(const char *format, ...);
+void read_warning(const char *format, ...);
+void read_error_catch(read_error_trap *trap);
+void read_error_release(void);
+char *read_error_message(const read_error_trap *trap);
+char *read_error_warning(const read_error_trap *trap);
+void read_error_raise(char **messages, int n);
+void read_error_free_messages(char **messages, int n);
+const char *read_error_first(char **messages, int n, int *which);
+
+#endif
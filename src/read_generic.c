@@ -29,6 +29,7 @@
  ** Nov, 2011 - Some additional fixed to deal with fixed width fields for strings in dataset rows
  ** Sept 4, 2017 - change gzFile * to gzFile
  ** August 26, 2021 - Handling fixed width strings of length 0, Better handling for situations where logical ordering and physical ordering of data groups do not agree
+ ** Oct 16, 2026 - Data headers, groups and sets cut short by the end of the file can be freed. Strings whose length can not be read fail
  **
  *************************************************************/
 
@@ -47,6 +48,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 #include "fread_functions.h"
@@ -157,7 +159,11 @@ void Free_generic_data_set(generic_data_set *data_set){
 
 static int fread_ASTRING(ASTRING *destination, FILE *instream){
 
-  fread_be_int32(&(destination->len),1,instream);
+  if (!fread_be_int32(&(destination->len),1,instream)){
+    destination->len = 0;
+    destination->value = 0;
+    return 0;
+  }
   if (destination->len > 0){
     destination->value = R_Calloc(destination->len+1,char);
     fread_be_char(destination->value,destination->len,instream);
@@ -192,7 +198,11 @@ static int fread_AWSTRING(AWSTRING *destination, FILE *instream){
 
   int i;
 
-  fread_be_int32(&(destination->len),1,instream);
+  if (!fread_be_int32(&(destination->len),1,instream)){
+    destination->len = 0;
+    destination->value = 0;
+    return 0;
+  }
   if ((destination->len) > 0){
     destination->value = R_Calloc(destination->len+1,wchar_t);
   
@@ -709,6 +719,8 @@ int read_generic_data_header(generic_data_header *data_header, FILE *instream){
   int i;
   generic_data_header *temp_header;
   
+  /* on failure only what has been read is set, for Free_generic_data_header() */
+  memset(data_header, 0, sizeof(generic_data_header));
 
   if (!fread_ASTRING(&(data_header->data_type_id), instream) ||
       !fread_ASTRING(&(data_header->unique_file_id), instream) ||
@@ -718,6 +730,7 @@ int read_generic_data_header(generic_data_header *data_header, FILE *instream){
   }
 
   if (!fread_be_int32(&(data_header->n_name_type_value),1,instream)){
+    data_header->n_name_type_value = 0;
     return 0;
   }
   
@@ -730,6 +743,7 @@ int read_generic_data_header(generic_data_header *data_header, FILE *instream){
   }
   
   if (!fread_be_int32(&(data_header->n_parent_headers),1,instream)){
+    data_header->n_parent_headers = 0;
     return 0;
   }
   
@@ -740,10 +754,11 @@ int read_generic_data_header(generic_data_header *data_header, FILE *instream){
   }
   for (i =0; i < data_header->n_parent_headers; i++){
     temp_header = (generic_data_header *)R_Calloc(1,generic_data_header);
+    data_header->parent_headers[i] = temp_header;
     if (!read_generic_data_header(temp_header,instream)){
+      data_header->n_parent_headers = i + 1;
       return 0;
     }
-    data_header->parent_headers[i] = temp_header;
   }
   return 1;
 }
@@ -751,6 +766,8 @@ int read_generic_data_header(generic_data_header *data_header, FILE *instream){
 
 
 int read_generic_data_group(generic_data_group *data_group, FILE *instream){
+
+  memset(data_group, 0, sizeof(generic_data_group));
   
   if (!fread_be_uint32(&(data_group->file_position_nextgroup),1,instream) ||
       !fread_be_uint32(&(data_group->file_position_first_data),1,instream) ||
@@ -768,10 +785,14 @@ int read_generic_data_set(generic_data_set *data_set, FILE *instream){
 
   int i;
 
+  /* on failure only what has been read is set, for Free_generic_data_set() */
+  memset(data_set, 0, sizeof(generic_data_set));
+
   if (!fread_be_uint32(&(data_set->file_pos_first),1,instream) ||
       !fread_be_uint32(&(data_set->file_pos_last),1,instream) ||
       !fread_AWSTRING(&(data_set->data_set_name), instream) ||
       !fread_be_int32(&(data_set->n_name_type_value),1,instream)){
+    data_set->n_name_type_value = 0;
     return 0;
   }
   
@@ -785,10 +806,12 @@ int read_generic_data_set(generic_data_set *data_set, FILE *instream){
   }
 
   if (!fread_be_uint32(&(data_set->ncols),1,instream)){
+    data_set->ncols = 0;
     return 0;
   }
   
   data_set->col_name_type_value = R_Calloc(data_set->ncols,col_nvts_triplet);
+  data_set->Data = R_Calloc(data_set->ncols, void *);
 
   for (i =0; i < data_set->ncols; i++){
     if (!fread_nvts_triplet(&data_set->col_name_type_value[i], instream)){
@@ -797,11 +820,10 @@ int read_generic_data_set(generic_data_set *data_set, FILE *instream){
   }
 
   if (!fread_be_uint32(&(data_set->nrows),1,instream)){
+    data_set->nrows = 0;
     return 0;
   }
 
-  data_set->Data = R_Calloc(data_set->ncols, void *);
-
   for (i=0; i < data_set->ncols; i++){
     switch(data_set->col_name_type_value[i].type){
     case 0: data_set->Data[i] = R_Calloc(data_set->nrows,char);
@@ -909,7 +931,11 @@ int read_generic_data_set_rows(generic_data_set *data_set, FILE *instream){
 
 static int gzread_ASTRING(ASTRING *destination, gzFile instream){
 
-  gzread_be_int32(&(destination->len),1,instream);
+  if (!gzread_be_int32(&(destination->len),1,instream)){
+    destination->len = 0;
+    destination->value = 0;
+    return 0;
+  }
   if (destination->len > 0){
     destination->value = R_Calloc(destination->len+1,char);
     gzread_be_char(destination->value,destination->len,instream);
@@ -944,7 +970,11 @@ static int gzread_AWSTRING(AWSTRING *destination, gzFile instream){
 
   int i;
 
-  gzread_be_int32(&(destination->len),1,instream);
+  if (!gzread_be_int32(&(destination->len),1,instream)){
+    destination->len = 0;
+    destination->value = 0;
+    return 0;
+  }
   if ((destination->len) > 0){
     destination->value = R_Calloc(destination->len+1,wchar_t);
   
@@ -1042,6 +1072,9 @@ int gzread_generic_data_header(generic_data_header *data_header, gzFile instream
   
   int i;
 
+  /* on failure only what has been read is set, for Free_generic_data_header() */
+  memset(data_header, 0, sizeof(generic_data_header));
+
   if (!gzread_ASTRING(&(data_header->data_type_id), instream) ||
       !gzread_ASTRING(&(data_header->unique_file_id), instream) ||
       !gzread_AWSTRING(&(data_header->Date_time), instream) ||
@@ -1050,6 +1083,7 @@ int gzread_generic_data_header(generic_data_header *data_header, gzFile instream
   }
 
   if (!gzread_be_int32(&(data_header->n_name_type_value),1,instream)){
+    data_header->n_name_type_value = 0;
     return 0;
   }
   
@@ -1062,6 +1096,7 @@ int gzread_generic_data_header(generic_data_header *data_header, gzFile instream
   }
   
   if (!gzread_be_int32(&(data_header->n_parent_headers),1,instream)){
+    data_header->n_parent_headers = 0;
     return 0;
   }
   
@@ -1070,6 +1105,7 @@ int gzread_generic_data_header(generic_data_header *data_header, gzFile instream
   for (i =0; i < data_header->n_parent_headers; i++){
     data_header->parent_headers[i] = (generic_data_header *)R_Calloc(1,generic_data_header);
     if (!gzread_generic_data_header((generic_data_header *)data_header->parent_headers[i],instream)){
+      data_header->n_parent_headers = i + 1;
       return 0;
     }
   }
@@ -1081,6 +1117,8 @@ int gzread_generic_data_header(generic_data_header *data_header, gzFile instream
 
 
 int gzread_generic_data_group(generic_data_group *data_group, gzFile instream){
+
+  memset(data_group, 0, sizeof(generic_data_group));
   
   if (!gzread_be_uint32(&(data_group->file_position_nextgroup),1,instream) ||
       !gzread_be_uint32(&(data_group->file_position_first_data),1,instream) ||
@@ -1100,10 +1138,14 @@ int gzread_generic_data_set(generic_data_set *data_set, gzFile instream){
 
   int i;
 
+  /* on failure only what has been read is set, for Free_generic_data_set() */
+  memset(data_set, 0, sizeof(generic_data_set));
+
   if (!gzread_be_uint32(&(data_set->file_pos_first),1,instream) ||
       !gzread_be_uint32(&(data_set->file_pos_last),1,instream) ||
       !gzread_AWSTRING(&(data_set->data_set_name), instream) ||
       !gzread_be_int32(&(data_set->n_name_type_value),1,instream)){
+    data_set->n_name_type_value = 0;
     return 0;
   }
   
@@ -1117,10 +1159,12 @@ int gzread_generic_data_set(generic_data_set *data_set, gzFile instream){
   }
 
   if (!gzread_be_uint32(&(data_set->ncols),1,instream)){
+    data_set->ncols = 0;
     return 0;
   }
   
   data_set->col_name_type_value = R_Calloc(data_set->ncols,col_nvts_triplet);
+  data_set->Data = R_Calloc(data_set->ncols, void *);
 
   for (i =0; i < data_set->ncols; i++){
     if (!gzread_nvts_triplet(&data_set->col_name_type_value[i], instream)){
@@ -1129,11 +1173,10 @@ int gzread_generic_data_set(generic_data_set *data_set, gzFile instream){
   }
 
   if (!gzread_be_uint32(&(data_set->nrows),1,instream)){
+    data_set->nrows = 0;
     return 0;
   }
 
-  data_set->Data = R_Calloc(data_set->ncols, void *);
-
   for (i=0; i < data_set->ncols; i++){
     switch(data_set->col_name_type_value[i].type){
     case 0: data_set->Data[i] = R_Calloc(data_set->nrows,char);
@@ -25,6 +25,7 @@
  ** May 18, 2009 - Add Ability to extract scan date from CEL file header
  ** May 25, 2010 - Multichannel CELfile support adapted from single channel parser
  ** Sep 4, 2017 - change gzFile* to gzFile
+ ** Oct 16, 2026 - errors are raised with read_error() so that they can be caught on worker threads
  **
  *************************************************************/
 #include <R.h>
@@ -47,6 +48,7 @@
 #include "read_celfile_generic.h"
 #include "read_multichannel_celfile_generic.h"
 #include "read_abatch.h"
+#include "read_error.h"
 
 int isGenericMultiChannelCelFile(const char *filename){
 
@@ -56,7 +58,7 @@ int isGenericMultiChannelCelFile(const char *filename){
   
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
       return 0;
     }
 
@@ -120,7 +122,7 @@ int multichannel_determine_number_channels(const char *filename){
 
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
@@ -171,7 +173,7 @@ char *multichannel_determine_channel_name(const char *filename, int channelindex
 
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
@@ -226,7 +228,7 @@ int read_genericcel_file_intensities_multichannel(const char *filename, double *
 
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
@@ -280,7 +282,7 @@ int read_genericcel_file_stddev_multichannel(const char *filename, double *inten
 
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
@@ -341,7 +343,7 @@ int read_genericcel_file_npixels_multichannel(const char *filename, double *inte
 
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
@@ -409,7 +411,7 @@ void generic_get_masks_outliers_multichannel(const char *filename, int *nmasks,
 
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       
     }
   
@@ -513,7 +515,7 @@ void generic_apply_masks_multichannel(const char *filename, double *intensity, i
 
   if ((infile = fopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       
     }
  
@@ -597,7 +599,7 @@ int isgzGenericMultiChannelCelFile(const char *filename){
   
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s",filename);
+      read_error("Unable to open the file %s",filename);
       return 0;
     }
 
@@ -652,7 +654,7 @@ int gzmultichannel_determine_number_channels(const char *filename){
 
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
@@ -700,7 +702,7 @@ char *gzmultichannel_determine_channel_name(const char *filename, int channelind
 
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
@@ -746,7 +748,7 @@ int gzread_genericcel_file_intensities_multichannel(const char *filename, double
 
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
@@ -799,7 +801,7 @@ int gzread_genericcel_file_stddev_multichannel(const char *filename, double *int
 
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
@@ -858,7 +860,7 @@ int gzread_genericcel_file_npixels_multichannel(const char *filename, double *in
 
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       return 0;
     }
   
@@ -922,7 +924,7 @@ void gzgeneric_get_masks_outliers_multichannel(const char *filename, int *nmasks
 
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       
     }
   
@@ -1024,7 +1026,7 @@ void gzgeneric_apply_masks_multichannel(const char *filename, double *intensity,
 
   if ((infile = gzopen(filename, "rb")) == NULL)
     {
-      error("Unable to open the file %s\n",filename);
+      read_error("Unable to open the file %s\n",filename);
       
     }
  
@@ -13,15 +13,32 @@
  ** Dec 17. 2007 - add function for counting number of each type of probeset
  ** Dec 31, 2007 - add function which checks that all required fields are present
  ** Mar 18, 2008 - fix error in read_pgf_header function
+ ** Oct 16, 2026 - probesets, atoms and probes are now stored in column tables with all strings
+ **                in a single arena rather than linked lists (appending was quadratic). 
+ **                determine_order_header0 now finds the probeset_name column
+ ** Oct 16, 2026 - ReadPGFFile returns the parsed file to R as column vectors
+ ** Oct 16, 2026 - type strings are stored once in a dictionary with each row holding a 16 bit code
+ ** Oct 16, 2026 - only requested optional columns are read. Data lines are split in place rather
+ **                than tokenized
+ ** Oct 16, 2026 - Add ReadPGFCLFLocations which gives PM/MM cell index matrices for each probeset
+ ** Oct 16, 2026 - ReadPGFCLFLocations no longer crashes selecting types from a PGF file without a
+ **                type column. Requested types are matched once per type code rather than per probeset
+ ** Oct 16, 2026 - the parser returns a status rather than calling error() part way through a
+ **                file, so the file is closed and the tables freed before the error is raised
  **
  **
  ** 
  ******************************************************************/
 
 #include <R.h>
+#include <Rdefines.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "read_clf.h"
  
 
 #define BUFFERSIZE 1024
@@ -97,89 +114,139 @@ typedef struct{
 /********************************************************************
  *******************************************************************
  **
- ** Structures for dealing with data stored at the probelevel
+ ** Storage for strings
  **
+ ** The type, probeset_name, exon_position and probe_sequence strings
+ ** are all appended to a single growable buffer and referred to by 
+ ** their offset into it (-1 meaning not present). Offsets rather than
+ ** pointers are kept since the buffer moves when it is grown.
  **
  *******************************************************************
  *******************************************************************/
 
 typedef struct{
-  
-  int probe_id;
-  char *type;
-  int gc_count;
-  int probe_length;
-  int interrogation_position;
-  char *probe_sequence;
-  struct probe_list_node *next;
-} probe_list_node;
-
-
-typedef struct{
-  int n_probes;
-  probe_list_node *first;
-} probe_list_header;
+  char *data;
+  size_t length;
+  size_t capacity;
+} pgf_string_arena;
 
 
 
 /********************************************************************
  *******************************************************************
  **
- ** Structures for dealing with data stored at the atom level
+ ** Dictionary of type strings
  **
+ ** There are only a handful of distinct probeset, atom and probe
+ ** types (eg "main", "pm:st") so each is stored once and rows hold
+ ** its code, an index into this dictionary. PGF_NO_TYPE marks a
+ ** row with no type.
  **
  *******************************************************************
  *******************************************************************/
 
-typedef struct{
-  int atom_id;
-  char *type;
-  char *exon_position;
-  probe_list_header *probes;
-  struct atom_list_node *next;
-} atom_list_node;
+#define PGF_NO_TYPE 0xFFFF
 
+typedef unsigned short pgf_type_code;
 
 typedef struct{
-  int n_atoms;
-  atom_list_node *first;
-} atom_list_header;
+  int n_types;
+  int last;                     /* most recently matched code */
+  int *string;                  /* offsets into the string arena */
+} pgf_type_dictionary;
 
 
 
-/*******************************************************************
+/********************************************************************
  *******************************************************************
  **
- ** Structures for dealing with data as stored at the probeset level
- **
+ ** Problems found while parsing
  **
+ ** The parsing functions return one of these rather than calling
+ ** error(), so that the file can be closed and the partly built 
+ ** tables freed before pgf_read_error() reports it.
  **
  *******************************************************************
  *******************************************************************/
 
-typedef struct probeset_list_node *node_pointer;
+#define PGF_OK 0
+#define PGF_MISSING_HEADER 1
+#define PGF_SHORT_LINE 2
+#define PGF_LEVEL2_BEFORE_LEVEL0 3
+#define PGF_LEVEL2_BEFORE_LEVEL1 4
+#define PGF_LEVEL1_BEFORE_LEVEL0 5
+#define PGF_TOO_MANY_ROWS 6
+#define PGF_TOO_MUCH_STRING_DATA 7
+#define PGF_TOO_MANY_TYPES 8
+
 
 
+/********************************************************************
+ *******************************************************************
+ **
+ ** Structures for dealing with data stored at the probelevel
+ **
+ ** Each level of the file is stored as a table with one array per
+ ** column. Rows are appended in file order, so the atoms of a 
+ ** probeset (and the probes of an atom) are consecutive rows.
+ **
+ *******************************************************************
+ *******************************************************************/
+
 typedef struct{
-  int probeset_id;
-  char *type;
-  char *probeset_name;
+  int n_probes;
+  int capacity;
+  int *probe_id;
+  pgf_type_code *type;
+  int *gc_count;
+  int *probe_length;
+  int *interrogation_position;
+  int *probe_sequence;          /* offsets into the string arena */
+} pgf_probe_table;
 
-  atom_list_header *atoms;
-  
-  struct probeset_list_node *next;
-} probeset_list_node;
 
 
+/********************************************************************
+ *******************************************************************
+ **
+ ** Structures for dealing with data stored at the atom level
+ **
+ ** The probes of atom i are rows first_probe[i] to first_probe[i+1]-1
+ ** of the probe table. first_probe has n_atoms + 1 elements.
+ **
+ *******************************************************************
+ *******************************************************************/
 
 typedef struct{
+  int n_atoms;
+  int capacity;
+  int *atom_id;
+  pgf_type_code *type;
+  int *exon_position;           /* offsets into the string arena */
+  int *first_probe;
+} pgf_atom_table;
 
-  int n_probesets;
 
-  probeset_list_node *first;
-  probeset_list_node *current;
-  probeset_list_node *last;
-} probeset_list_header;
+
+/*******************************************************************
+ *******************************************************************
+ **
+ ** Structures for dealing with data as stored at the probeset level
+ **
+ ** The atoms of probeset i are rows first_atom[i] to first_atom[i+1]-1
+ ** of the atom table. first_atom has n_probesets + 1 elements.
+ **
+ *******************************************************************
+ *******************************************************************/
+
+typedef struct{
+  int n_probesets;
+  int capacity;
+  int *probeset_id;
+  pgf_type_code *type;
+  int *probeset_name;           /* offsets into the string arena */
+  int *first_atom;
+} pgf_probeset_table;
 
 
 
@@ -194,7 +261,14 @@ typedef struct{
 
 typedef struct{
   pgf_headers *headers;
-  probeset_list_header *probesets;
+  pgf_probeset_table *probesets;
+  pgf_atom_table *atoms;
+  pgf_probe_table *probes;
+  pgf_string_arena *strings;
+  pgf_type_dictionary *types;
+  char **fields;                /* the current line split into fields */
+  int n_fields[3];              /* number of fields needed from level 0, 1 and 2 lines */
+  int column_selected[8];       /* which of pgf_optional_columns were asked for */
 } pgf_file;
 
 
@@ -572,87 +646,68 @@ void dealloc_pgf_headers(pgf_headers *header){
 }
 
 
-void dealloc_probes(probe_list_header *probes){
-
-  probe_list_node *temp_node;
-
-  if (probes->first != NULL){
-    temp_node = probes->first;
-    while (temp_node != NULL){
-      probes->first = (probe_list_node *)temp_node->next;
-      if (temp_node->type != NULL){
-	R_Free(temp_node->type);
-      }
-      if (temp_node->probe_sequence != NULL){
-	R_Free(temp_node->probe_sequence);
-      }
-      R_Free(temp_node);
-      temp_node = probes->first;
-    }
-    
+void dealloc_pgf_strings(pgf_string_arena *strings){
 
+  if (strings->data != NULL){
+    R_Free(strings->data);
   }
+  strings->length = 0;
+  strings->capacity = 0;
 }
 
 
+void dealloc_probes(pgf_probe_table *probes){
 
-void dealloc_atoms(atom_list_header *atoms){
+  /* the optional columns are NULL when they were not read */
+  if (probes->capacity > 0){
+    R_Free(probes->probe_id);
+    R_Free(probes->type);
+  }
+  if (probes->gc_count != NULL)
+    R_Free(probes->gc_count);
+  if (probes->probe_length != NULL)
+    R_Free(probes->probe_length);
+  if (probes->interrogation_position != NULL)
+    R_Free(probes->interrogation_position);
+  if (probes->probe_sequence != NULL)
+    R_Free(probes->probe_sequence);
+  probes->n_probes = 0;
+  probes->capacity = 0;
+}
 
-  atom_list_node *temp_node;
 
-  if (atoms->first != NULL){
-    temp_node = atoms->first;
-    while (temp_node != NULL){
-      atoms->first = (atom_list_node *)temp_node->next;
-      if (temp_node->type != NULL){
-	R_Free(temp_node->type);
-      }
-      if (temp_node->exon_position != NULL){
-	R_Free(temp_node->exon_position);
-      }
-      if (temp_node->probes != NULL){
-	dealloc_probes(temp_node->probes);
-	R_Free(temp_node->probes);
-      }
 
-      R_Free(temp_node);
-      temp_node = atoms->first;
-    }
-    
+void dealloc_atoms(pgf_atom_table *atoms){
 
+  if (atoms->capacity > 0){
+    R_Free(atoms->atom_id);
   }
-
-  
-
+  if (atoms->type != NULL)
+    R_Free(atoms->type);
+  if (atoms->exon_position != NULL)
+    R_Free(atoms->exon_position);
+  if (atoms->first_probe != NULL){
+    R_Free(atoms->first_probe);
+  }
+  atoms->n_atoms = 0;
+  atoms->capacity = 0;
 }
 
 
-void dealloc_pgf_probesets(probeset_list_header *probesets){
+void dealloc_pgf_probesets(pgf_probeset_table *probesets){
 
-  probeset_list_node *temp_node;
-
-  if (probesets->first != NULL){
-    temp_node = probesets->first;
-    while (temp_node != NULL){
-      probesets->first = (probeset_list_node *)temp_node->next;
-      
-      if (temp_node->type != NULL){
-	R_Free(temp_node->type);
-      }
-      if (temp_node->probeset_name != NULL){
-	R_Free(temp_node->probeset_name);
-      }
-      
-      if (temp_node->atoms != NULL){
-	dealloc_atoms(temp_node->atoms);
-	R_Free(temp_node->atoms);
-      }
-
-      R_Free(temp_node);
-      temp_node = probesets->first;
-    }
+  if (probesets->capacity > 0){
+    R_Free(probesets->probeset_id);
   }
-
+  if (probesets->type != NULL)
+    R_Free(probesets->type);
+  if (probesets->probeset_name != NULL)
+    R_Free(probesets->probeset_name);
+  if (probesets->first_atom != NULL){
+    R_Free(probesets->first_atom);
+  }
+  probesets->n_probesets = 0;
+  probesets->capacity = 0;
 }
 
 
@@ -671,6 +726,31 @@ void dealloc_pgf_file(pgf_file* my_pgf){
     R_Free(my_pgf->probesets);
   }
 
+  if (my_pgf->atoms !=NULL){
+    dealloc_atoms(my_pgf->atoms);
+    R_Free(my_pgf->atoms);
+  }
+
+  if (my_pgf->probes !=NULL){
+    dealloc_probes(my_pgf->probes);
+    R_Free(my_pgf->probes);
+  }
+
+  if (my_pgf->strings !=NULL){
+    dealloc_pgf_strings(my_pgf->strings);
+    R_Free(my_pgf->strings);
+  }
+
+  if (my_pgf->types !=NULL){
+    if (my_pgf->types->string != NULL){
+      R_Free(my_pgf->types->string);
+    }
+    R_Free(my_pgf->types);
+  }
+
+  if (my_pgf->fields !=NULL){
+    R_Free(my_pgf->fields);
+  }
 
 }
 
@@ -725,7 +805,7 @@ static void determine_order_header0(char *header_str, header_0 *header0){
       header0->probeset_id = i;
     } else if (strcmp(get_token(cur_tokenset,i),"type")==0){
       header0->type = i;
-    } else if (strcmp(get_token(cur_tokenset,i),"type")==0){
+    } else if (strcmp(get_token(cur_tokenset,i),"probeset_name")==0){
       header0->probeset_name = i;
     }
   }
@@ -994,229 +1074,462 @@ void read_pgf_header(FILE *cur_file, char *buffer, pgf_headers *header){
  **
  ***************************************************************/
 
-void initialize_probeset_list(probeset_list_header *probeset_list){
+void initialize_probeset_list(pgf_file *my_pgf){
 
-  probeset_list->n_probesets = 0;
-  probeset_list->first = NULL;
-  probeset_list->current = NULL;
-  probeset_list->last = NULL;
+  my_pgf->probesets = R_Calloc(1, pgf_probeset_table);
+  my_pgf->atoms = R_Calloc(1, pgf_atom_table);
+  my_pgf->probes = R_Calloc(1, pgf_probe_table);
+  my_pgf->strings = R_Calloc(1, pgf_string_arena);
+  my_pgf->types = R_Calloc(1, pgf_type_dictionary);
+
+  /* the first_ arrays always hold a final entry marking the end of the last range */
+  my_pgf->probesets->first_atom = R_Calloc(1, int);
+  my_pgf->atoms->first_probe = R_Calloc(1, int);
 }
 
 
+/****************************************************************
+ **
+ ** static int pgf_store_string(pgf_string_arena *strings, const char *str, int *offset)
+ **
+ ** appends str to the string arena, setting offset to where it 
+ ** starts. The arena grows geometrically so storing is amortized 
+ ** constant time per character. Returns PGF_OK, or 
+ ** PGF_TOO_MUCH_STRING_DATA if the offset would not fit an int.
+ **
+ ***************************************************************/
 
-void insert_probe(char *buffer, probe_list_header *probe_list, header_2 *header2){
+static int pgf_store_string(pgf_string_arena *strings, const char *str, int *offset){
 
-  char *temp_str;
-  tokenset *cur_tokenset;
-  probe_list_node *temp_ptr;
+  size_t length = strlen(str) + 1;
 
-  probe_list_node *temp_node = R_Calloc(1,probe_list_node);
+  if (strings->length + length > INT_MAX){
+    return PGF_TOO_MUCH_STRING_DATA;
+  }
+  if (strings->length + length > strings->capacity){
+    strings->capacity = 2*strings->capacity > strings->length + length ? 2*strings->capacity : strings->length + length + 1024;
+    strings->data = R_Realloc(strings->data, strings->capacity, char);
+  }
+  *offset = (int)strings->length;
+  memcpy(&strings->data[strings->length], str, length);
+  strings->length+= length;
+  
+  return PGF_OK;
+}
 
-  cur_tokenset = tokenize(buffer,"\t\r\n");
-  temp_node->probe_id = atoi(get_token(cur_tokenset,header2->probe_id));
 
-  if (header2->type != -1){
-    temp_str = R_Calloc(strlen(get_token(cur_tokenset,header2->type)) + 1,char);
-    strcpy(temp_str,get_token(cur_tokenset,header2->type));
-    temp_node->type = temp_str;
+/****************************************************************
+ **
+ ** static const char *pgf_get_string(pgf_file *my_pgf, int offset)
+ **
+ ** returns the string stored at offset or NULL for -1
+ **
+ ***************************************************************/
+
+static const char *pgf_get_string(pgf_file *my_pgf, int offset){
+  
+  if (offset < 0){
+    return NULL;
   }
-  if (header2->gc_count != -1){
-    temp_node->gc_count = atoi(get_token(cur_tokenset,header2->gc_count));
+  return &(my_pgf->strings->data[offset]);
+}
+
+
+
+/****************************************************************
+ **
+ ** static int pgf_intern_type(pgf_file *my_pgf, const char *type, pgf_type_code *code)
+ **
+ ** sets code to the code for type, adding it to the dictionary if
+ ** it has not been seen before. Consecutive rows usually share a 
+ ** type so the last match is checked first. Returns PGF_OK or why 
+ ** the type could not be added.
+ **
+ ***************************************************************/
+
+static int pgf_intern_type(pgf_file *my_pgf, const char *type, pgf_type_code *code){
+
+  pgf_type_dictionary *types = my_pgf->types;
+  int i, offset, status;
+
+  if (types->n_types > 0 && strcmp(type, pgf_get_string(my_pgf, types->string[types->last])) == 0){
+    *code = (pgf_type_code)types->last;
+    return PGF_OK;
   }
-  if (header2->probe_length != -1){
-    temp_node->probe_length = atoi(get_token(cur_tokenset,header2->probe_length));
+  
+  for (i = 0; i < types->n_types; i++){
+    if (strcmp(type, pgf_get_string(my_pgf, types->string[i])) == 0){
+      types->last = i;
+      *code = (pgf_type_code)i;
+      return PGF_OK;
+    }
   }
-  if (header2->interrogation_position != -1){
-    temp_node->interrogation_position = atoi(get_token(cur_tokenset,header2->interrogation_position));
+
+  if (types->n_types == PGF_NO_TYPE){
+    return PGF_TOO_MANY_TYPES;
   }
-  if (header2->probe_sequence != -1){
-    temp_str = R_Calloc(strlen(get_token(cur_tokenset,header2->probe_sequence)) + 1,char);
-    strcpy(temp_str,get_token(cur_tokenset,header2->probe_sequence));
-    temp_node->probe_sequence = temp_str;
+  if ((status = pgf_store_string(my_pgf->strings, type, &offset)) != PGF_OK){
+    return status;
   }
- 
+  types->string = R_Realloc(types->string, types->n_types + 1, int);
+  types->string[types->n_types] = offset;
+  types->last = types->n_types;
+  types->n_types++;
 
-  
-  temp_node->next = NULL;
-  if (probe_list->n_probes == 0){    
-    probe_list->first = temp_node;
-    probe_list->n_probes = 1;
-  } else {
-    /* figure out where the end of the list is. Insert there */
-    temp_ptr = probe_list->first;
-    
-    while (temp_ptr->next != NULL){
-      temp_ptr = (probe_list_node*)temp_ptr->next;
-    }
-    temp_ptr->next = (struct probe_list_node*)temp_node;
-    probe_list->n_probes++;
+  *code = (pgf_type_code)types->last;
+  return PGF_OK;
+}
+
+
+static const char *pgf_type_string(pgf_file *my_pgf, pgf_type_code code){
+
+  if (code == PGF_NO_TYPE){
+    return NULL;
   }
-  delete_tokens(cur_tokenset);
+  return pgf_get_string(my_pgf, my_pgf->types->string[code]);
 }
 
 
-void insert_level2(char *buffer, probeset_list_header *probeset_list, header_2 *header2){
 
-  atom_list_header *current_level1;
-  atom_list_node *current_atom;
+/****************************************************************
+ **
+ ** static int grow_capacity(int capacity)
+ **
+ ** table sizes are doubled when more room is needed. Returns 0 
+ ** when the table can not grow any more.
+ **
+ ***************************************************************/
 
-  if (probeset_list->current == NULL){
-    /* Oh Boy, this is a problem no header0 level object to insert into. */
-    error("Can not read a level 2 line before seeing a level 0 line. File corrupted?");
+static int grow_capacity(int capacity){
+
+  if (capacity < 16){
+    return 16;
   }
-  
-  if (probeset_list->current->atoms == NULL){
-    /* Oh Boy, this is a problem no header1 level object to insert into. */
-    error("Can not read a level 2 line before seeing a level 1 line. File corrupted?");
+  if (capacity > INT_MAX/2){
+    return 0;
   }
+  return 2*capacity;
+}
 
-  current_level1 = probeset_list->current->atoms;
-  
-  current_atom = current_level1->first;
 
-  while (current_atom->next != NULL){
-    current_atom = (atom_list_node *)current_atom->next;
+
+/****************************************************************
+ **
+ ** static int pgf_split_fields(char *buffer, pgf_file *my_pgf, int level)
+ **
+ ** Split a data line into tab separated fields in place, storing
+ ** pointers to the first my_pgf->n_fields[level] of them in 
+ ** my_pgf->fields.
+ ** Leading tabs (which give the level of the line) are skipped and 
+ ** the rest of the line after the last needed field is not examined.
+ ** Returns PGF_OK, or PGF_SHORT_LINE if the line has too few fields.
+ **
+ ***************************************************************/
+
+static int pgf_split_fields(char *buffer, pgf_file *my_pgf, int level){
+
+  char *cur = buffer;
+  int n_fields = my_pgf->n_fields[level];
+  int i;
+
+  while (*cur == '\t'){
+    cur++;
   }
 
-  if (current_atom->probes == NULL){
-    current_atom->probes = R_Calloc(1,probe_list_header);
+  for (i = 0; i < n_fields; i++){
+    my_pgf->fields[i] = cur;
+    while (*cur != '\t' && *cur != '\r' && *cur != '\n' && *cur != '\0'){
+      cur++;
+    }
+    if (*cur != '\t'){
+      *cur = '\0';
+      break;
+    }
+    *cur = '\0';
+    cur++;
   }
-  
-  insert_probe(buffer, current_atom->probes, header2);
+  if (i < n_fields - 1){
+    return PGF_SHORT_LINE;
+  }
+  return PGF_OK;
 }
 
 
+static int max_column(int current, int column){
+  return (column > current) ? column : current;
+}
 
 
+/****************************************************************
+ **
+ ** static void pgf_select_columns(pgf_file *my_pgf, const char **columns, int n_columns)
+ **
+ ** Mark the optional columns not named in columns as not present 
+ ** in the header, so that they are neither split out nor stored. 
+ ** n_columns = -1 keeps all columns. The names recognised are 
+ ** listed in pgf_optional_columns. 
+ **
+ ** Also sizes my_pgf->fields for the columns which remain.
+ **
+ ***************************************************************/
 
-void insert_atom(char *buffer, atom_list_header *atoms_list, header_1 *header1){
+static const char *pgf_optional_columns[8] = {"probeset_type", "probeset_name", "atom_type", "exon_position", "gc_count", "probe_length", "interrogation_position", "probe_sequence"};
+
+static void pgf_select_columns(pgf_file *my_pgf, const char **columns, int n_columns){
+
+  pgf_headers *header = my_pgf->headers;
+  int *column_position[8];
+  int i, j;
+
+  column_position[0] = &header->header0->type;
+  column_position[1] = &header->header0->probeset_name;
+  column_position[2] = &header->header1->type;
+  column_position[3] = &header->header1->exon_position;
+  column_position[4] = &header->header2->gc_count;
+  column_position[5] = &header->header2->probe_length;
+  column_position[6] = &header->header2->interrogation_position;
+  column_position[7] = &header->header2->probe_sequence;
+
+  for (i = 0; i < 8; i++){
+    my_pgf->column_selected[i] = 1;
+    if (n_columns >= 0){
+      for (j = 0; j < n_columns; j++){
+	if (strcmp(columns[j], pgf_optional_columns[i]) == 0){
+	  break;
+	}
+      }
+      if (j == n_columns){
+	my_pgf->column_selected[i] = 0;
+	*column_position[i] = -1;
+      }
+    }
+  }
 
-  char *temp_str;
-  tokenset *cur_tokenset;
-  atom_list_node *temp_ptr;
+  my_pgf->n_fields[0] = max_column(header->header0->probeset_id, max_column(header->header0->type, header->header0->probeset_name)) + 1;
+  my_pgf->n_fields[1] = max_column(header->header1->atom_id, max_column(header->header1->type, header->header1->exon_position)) + 1;
+  my_pgf->n_fields[2] = max_column(header->header2->probe_id, header->header2->type);
+  for (i = 4; i < 8; i++){
+    my_pgf->n_fields[2] = max_column(my_pgf->n_fields[2], *column_position[i]);
+  }
+  my_pgf->n_fields[2]++;
+  my_pgf->fields = R_Calloc(max_column(my_pgf->n_fields[0], max_column(my_pgf->n_fields[1], my_pgf->n_fields[2])), char *);
+}
 
-  atom_list_node *temp_node = R_Calloc(1,atom_list_node);
 
-  cur_tokenset = tokenize(buffer,"\t\r\n");
 
-  temp_node->atom_id = atoi(get_token(cur_tokenset,header1->atom_id));
+int insert_probe(char *buffer, pgf_file *my_pgf, header_2 *header2){
 
-  if (header1->type != -1){
-    temp_str = R_Calloc(strlen(get_token(cur_tokenset,header1->type)) + 1,char);
-    strcpy(temp_str,get_token(cur_tokenset,header1->type));
-    temp_node->type = temp_str;
-  }
-  if (header1->exon_position != -1){
-    temp_str = R_Calloc(strlen(get_token(cur_tokenset,header1->exon_position)) + 1,char);
-    strcpy(temp_str,get_token(cur_tokenset,header1->exon_position));
-    temp_node->exon_position = temp_str;
+  pgf_probe_table *probes = my_pgf->probes;
+  char **fields = my_pgf->fields;
+  int n, capacity, status;
+
+  /* only the columns being kept get storage */
+  if (probes->n_probes == probes->capacity){
+    if ((capacity = grow_capacity(probes->capacity)) == 0){
+      return PGF_TOO_MANY_ROWS;
+    }
+    probes->capacity = capacity;
+    probes->probe_id = R_Realloc(probes->probe_id, probes->capacity, int);
+    probes->type = R_Realloc(probes->type, probes->capacity, pgf_type_code);
+    if (header2->gc_count != -1)
+      probes->gc_count = R_Realloc(probes->gc_count, probes->capacity, int);
+    if (header2->probe_length != -1)
+      probes->probe_length = R_Realloc(probes->probe_length, probes->capacity, int);
+    if (header2->interrogation_position != -1)
+      probes->interrogation_position = R_Realloc(probes->interrogation_position, probes->capacity, int);
+    if (header2->probe_sequence != -1)
+      probes->probe_sequence = R_Realloc(probes->probe_sequence, probes->capacity, int);
   }
-  temp_node->probes = NULL;
-  temp_node->next = NULL;
+  n = probes->n_probes;
   
-  if (atoms_list->n_atoms == 0){    
-    atoms_list->first = temp_node;
-    atoms_list->n_atoms = 1;
-  } else {
-    /* figure out where the end of the list is. Insert there */
-    temp_ptr = (atom_list_node*)atoms_list->first;
-    
-    while (temp_ptr->next != NULL){
-      temp_ptr= (atom_list_node*)temp_ptr->next;
-    }
-    temp_ptr->next = (struct atom_list_node*)temp_node;
-    atoms_list->n_atoms++;
+  if ((status = pgf_split_fields(buffer, my_pgf, 2)) != PGF_OK){
+    return status;
   }
-  delete_tokens(cur_tokenset);
-}
+  probes->probe_id[n] = atoi(fields[header2->probe_id]);
 
+  probes->type[n] = PGF_NO_TYPE;
+  if (header2->type != -1 && (status = pgf_intern_type(my_pgf,fields[header2->type],&probes->type[n])) != PGF_OK){
+    return status;
+  }
+  if (header2->gc_count != -1){
+    probes->gc_count[n] = atoi(fields[header2->gc_count]);
+  }
+  if (header2->probe_length != -1){
+    probes->probe_length[n] = atoi(fields[header2->probe_length]);
+  }
+  if (header2->interrogation_position != -1){
+    probes->interrogation_position[n] = atoi(fields[header2->interrogation_position]);
+  }
+  if (header2->probe_sequence != -1 && (status = pgf_store_string(my_pgf->strings,fields[header2->probe_sequence],&probes->probe_sequence[n])) != PGF_OK){
+    return status;
+  }
+ 
+  probes->n_probes++;
+  return PGF_OK;
+}
 
-void insert_level1(char *buffer, probeset_list_header *probeset_list, header_1 *header1){
 
-  probeset_list_node *current_level0;
+int insert_level2(char *buffer, pgf_file *my_pgf){
 
+  pgf_probeset_table *probesets = my_pgf->probesets;
+  pgf_atom_table *atoms = my_pgf->atoms;
+  int status;
 
-  if (probeset_list->current == NULL){
+  if (probesets->n_probesets == 0){
     /* Oh Boy, this is a problem no header0 level object to insert into. */
-    error("Can not read a level 1 line before seeing a level 0 line. File corrupted?");
+    return PGF_LEVEL2_BEFORE_LEVEL0;
   }
   
-  current_level0 = probeset_list->current;
-  
-  if (current_level0->atoms == NULL){
-    current_level0->atoms = R_Calloc(1,atom_list_header);
+  if (probesets->first_atom[probesets->n_probesets-1] == atoms->n_atoms){
+    /* Oh Boy, this is a problem no header1 level object to insert into. */
+    return PGF_LEVEL2_BEFORE_LEVEL1;
   }
 
-  /* Now lets insert the data */
-  
-  insert_atom(buffer, current_level0->atoms, header1);
+  /* the probe always belongs to the most recently read atom */
+  if ((status = insert_probe(buffer, my_pgf, my_pgf->headers->header2)) != PGF_OK){
+    return status;
+  }
+  atoms->first_probe[atoms->n_atoms] = my_pgf->probes->n_probes;
+  return PGF_OK;
+}
+
+
+
 
 
+int insert_atom(char *buffer, pgf_file *my_pgf, header_1 *header1, int first_probe){
 
+  pgf_atom_table *atoms = my_pgf->atoms;
+  char **fields = my_pgf->fields;
+  int n, capacity, status;
 
+  if (atoms->n_atoms == atoms->capacity){
+    if ((capacity = grow_capacity(atoms->capacity)) == 0){
+      return PGF_TOO_MANY_ROWS;
+    }
+    atoms->capacity = capacity;
+    atoms->atom_id = R_Realloc(atoms->atom_id, atoms->capacity, int);
+    if (header1->type != -1)
+      atoms->type = R_Realloc(atoms->type, atoms->capacity, pgf_type_code);
+    if (header1->exon_position != -1)
+      atoms->exon_position = R_Realloc(atoms->exon_position, atoms->capacity, int);
+    atoms->first_probe = R_Realloc(atoms->first_probe, atoms->capacity + 1, int);
+  }
+  n = atoms->n_atoms;
+
+  if ((status = pgf_split_fields(buffer, my_pgf, 1)) != PGF_OK){
+    return status;
+  }
 
+  atoms->atom_id[n] = atoi(fields[header1->atom_id]);
+
+  if (header1->type != -1 && (status = pgf_intern_type(my_pgf,fields[header1->type],&atoms->type[n])) != PGF_OK){
+    return status;
+  }
+  if (header1->exon_position != -1 && (status = pgf_store_string(my_pgf->strings,fields[header1->exon_position],&atoms->exon_position[n])) != PGF_OK){
+    return status;
+  }
+  atoms->first_probe[n] = first_probe;
+  atoms->first_probe[n+1] = first_probe;
+  atoms->n_atoms++;
+  return PGF_OK;
 }
 
 
+int insert_level1(char *buffer, pgf_file *my_pgf){
+
+  pgf_probeset_table *probesets = my_pgf->probesets;
+  int status;
 
+  if (probesets->n_probesets == 0){
+    /* Oh Boy, this is a problem no header0 level object to insert into. */
+    return PGF_LEVEL1_BEFORE_LEVEL0;
+  }
+  
+  /* Now lets insert the data. It always belongs to the most recently read probeset */
+  
+  if ((status = insert_atom(buffer, my_pgf, my_pgf->headers->header1, my_pgf->probes->n_probes)) != PGF_OK){
+    return status;
+  }
+  probesets->first_atom[probesets->n_probesets] = my_pgf->atoms->n_atoms;
+  return PGF_OK;
+}
 
-void insert_level0(char *buffer, probeset_list_header *probeset_list, header_0 *header0){
 
-  char *temp_str;
-  tokenset *cur_tokenset;
 
 
-  probeset_list_node *temp_node = R_Calloc(1,probeset_list_node);
+int insert_level0(char *buffer, pgf_file *my_pgf){
 
-  cur_tokenset = tokenize(buffer,"\t\r\n");
+  pgf_probeset_table *probesets = my_pgf->probesets;
+  header_0 *header0 = my_pgf->headers->header0;
+  char **fields = my_pgf->fields;
+  int n, capacity, status;
 
-  temp_node->probeset_id = atoi(get_token(cur_tokenset,header0->probeset_id));
+  if (probesets->n_probesets == probesets->capacity){
+    if ((capacity = grow_capacity(probesets->capacity)) == 0){
+      return PGF_TOO_MANY_ROWS;
+    }
+    probesets->capacity = capacity;
+    probesets->probeset_id = R_Realloc(probesets->probeset_id, probesets->capacity, int);
+    if (header0->type != -1)
+      probesets->type = R_Realloc(probesets->type, probesets->capacity, pgf_type_code);
+    if (header0->probeset_name != -1)
+      probesets->probeset_name = R_Realloc(probesets->probeset_name, probesets->capacity, int);
+    probesets->first_atom = R_Realloc(probesets->first_atom, probesets->capacity + 1, int);
+  }
+  n = probesets->n_probesets;
 
-  if (header0->type != -1){
-    temp_str = R_Calloc(strlen(get_token(cur_tokenset,header0->type)) + 1,char);
-    strcpy(temp_str,get_token(cur_tokenset,header0->type));
-    temp_node->type = temp_str;
+  if ((status = pgf_split_fields(buffer, my_pgf, 0)) != PGF_OK){
+    return status;
   }
-  if (header0->probeset_name != -1){
-    temp_str = R_Calloc(strlen(get_token(cur_tokenset,header0->probeset_name)) + 1,char);
-    strcpy(temp_str,get_token(cur_tokenset,header0->probeset_name));
-    temp_node->probeset_name = temp_str;
+
+  probesets->probeset_id[n] = atoi(fields[header0->probeset_id]);
+
+  if (header0->type != -1 && (status = pgf_intern_type(my_pgf,fields[header0->type],&probesets->type[n])) != PGF_OK){
+    return status;
   }
-  temp_node->atoms = NULL;
-  temp_node->next = NULL;
-  
-  if (probeset_list->first == NULL){
-    probeset_list->first = temp_node;
-    probeset_list->current = temp_node;
-    probeset_list->last = temp_node; 
-    probeset_list->n_probesets = 1;
-  } else {
-    probeset_list->last->next = (struct probeset_list_node *)temp_node;
-    probeset_list->last = temp_node;
-    probeset_list->current = temp_node;
-    probeset_list->n_probesets++;
+  if (header0->probeset_name != -1 && (status = pgf_store_string(my_pgf->strings,fields[header0->probeset_name],&probesets->probeset_name[n])) != PGF_OK){
+    return status;
   }
-  delete_tokens(cur_tokenset);
+  probesets->first_atom[n] = my_pgf->atoms->n_atoms;
+  probesets->first_atom[n+1] = my_pgf->atoms->n_atoms;
+  probesets->n_probesets++;
+  return PGF_OK;
 }
 
 
-void read_pgf_probesets(FILE *cur_file, char *buffer, probeset_list_header *probeset_list, pgf_headers *header){
+/****************************************************************
+ **
+ ** int read_pgf_probesets(FILE *cur_file, char *buffer, pgf_file *my_pgf)
+ **
+ ** read the data lines, starting with the one in buffer. Returns
+ ** PGF_OK, or the problem with the first line that could not be 
+ ** stored (the lines after it are not read).
+ **
+ ***************************************************************/
+
+int read_pgf_probesets(FILE *cur_file, char *buffer, pgf_file *my_pgf){
 
-  initialize_probeset_list(probeset_list);
+  int status = PGF_OK;
+
+  initialize_probeset_list(my_pgf);
   
-  insert_level0(buffer, probeset_list, header->header0);
+  if (!IsCommentLine(buffer)){
+    status = insert_level0(buffer, my_pgf);
+  }
   
-  while(ReadFileLine(buffer, 1024, cur_file)){
+  while(status == PGF_OK && ReadFileLine(buffer, 1024, cur_file)){
     if (IsLevel2(buffer)){
-      insert_level2(buffer, probeset_list, header->header2);
+      status = insert_level2(buffer, my_pgf);
     } else if (IsLevel1(buffer)){
-      insert_level1(buffer, probeset_list, header->header1);
+      status = insert_level1(buffer, my_pgf);
     } else if (IsCommentLine(buffer)){
       /*Ignore */
     } else {
-       insert_level0(buffer, probeset_list, header->header0);
+      status = insert_level0(buffer, my_pgf);
     }
   }
+  return status;
 }
 
 /****************************************************************
@@ -1239,54 +1552,45 @@ probeset_type_list *pgf_count_probeset_types(pgf_file *my_pgf, int *number){
 
   probeset_type_list *my_type_list = R_Calloc(1,probeset_type_list);
 
-  char *cur_type;
-  int n;
+  const char *cur_type;
+  int *counts;
+  int n_codes;
+  int i, n;
 
-  /* traverse the probesets. each time examining the probeset type */
+  *number = 0;
 
+  if (my_pgf->probesets == NULL){
+    return my_type_list;
+  }
 
-  if (my_pgf->probesets != NULL){
-    
-    if (my_pgf->probesets->first != NULL){
-      
-      my_pgf->probesets->current = my_pgf->probesets->first;
-      
-      if (my_pgf->probesets->current->type == NULL){
-	my_type_list[0].type = R_Calloc(5,char);
-	strcpy(my_type_list[0].type,"none");
-	
-      } else {
-	my_type_list[0].type = R_Calloc(strlen(my_pgf->probesets->current->type) + 1,char);
-	strcpy(my_type_list[0].type,my_pgf->probesets->current->type);
-      }
-      my_type_list[0].count = 1;
-      *number = 1; /* number of different types seen */
-      while (my_pgf->probesets->current->next != NULL){
-	my_pgf->probesets->current= (probeset_list_node *)my_pgf->probesets->current->next;
-	if (my_pgf->probesets->current->type == NULL){
-	  cur_type = "none";
-	} else {
-	  cur_type = my_pgf->probesets->current->type;
-	}
-	n = 0;
-	while (n < *number){
-	  if (strcmp(cur_type,my_type_list[n].type) == 0){
-	    break;
-	  }
-	  n++;
-	}
-	if (n == *number){
-	  my_type_list = R_Realloc(my_type_list,(n+1),probeset_type_list);
-	  my_type_list[n].type = R_Calloc(strlen(cur_type) + 1,char);
-	  strcpy(my_type_list[n].type,cur_type);
-	  my_type_list[n].count = 1;
-	  *number = *number + 1;
-  	} else {
-	  my_type_list[n].count++;
-	}
-      }
+  /* count by type code (the last slot counts probesets with no type). Then list the types found */
+
+  n_codes = my_pgf->types->n_types;
+  counts = R_Calloc(n_codes + 1, int);
+  
+  for (i=0; i < my_pgf->probesets->n_probesets; i++){
+    if (my_pgf->probesets->type == NULL || my_pgf->probesets->type[i] == PGF_NO_TYPE){
+      counts[n_codes]++;
+    } else {
+      counts[my_pgf->probesets->type[i]]++;
+    }
+  }
+
+  for (i=0; i <= n_codes; i++){
+    if (counts[i] == 0)
+      continue;
+    cur_type = (i == n_codes) ? "none" : pgf_type_string(my_pgf, (pgf_type_code)i);
+    n = *number;
+    if (n > 0){
+      my_type_list = R_Realloc(my_type_list,(n+1),probeset_type_list);
     }
+    my_type_list[n].type = R_Calloc(strlen(cur_type) + 1,char);
+    strcpy(my_type_list[n].type,cur_type);
+    my_type_list[n].count = counts[i];
+    *number = *number + 1;
   }
+  R_Free(counts);
+
   return  my_type_list;
 }
 
@@ -1311,27 +1615,664 @@ void dealloc_probeset_type_list(probeset_type_list *my_type_list, int length){
  ****************************************************************
  ****************************************************************/
 
-void read_pgf_file(char **filename){
+/****************************************************************
+ **
+ ** static int read_pgf(const char *filename, pgf_file *my_pgf, const char **columns, int n_columns)
+ **
+ ** parse the named file into my_pgf, reading only the optional 
+ ** columns named in columns (all of them if n_columns = -1). 
+ ** Returns PGF_OK, PGF_MISSING_HEADER if the header is missing 
+ ** required fields (in which case the body is not read) or the 
+ ** problem that stopped the body being read. The file is closed
+ ** either way and my_pgf should be freed with dealloc_pgf_file 
+ ** before any pgf_read_error().
+ **
+ ***************************************************************/
+
+static int read_pgf(const char *filename, pgf_file *my_pgf, const char **columns, int n_columns){
 
   FILE *cur_file;
+  char *buffer;
+  int status = PGF_MISSING_HEADER;
+
+  memset(my_pgf, 0, sizeof(pgf_file));
+  cur_file = open_pgf_file(filename);
+
+  buffer = R_Calloc(1024, char);
+  my_pgf->headers = R_Calloc(1, pgf_headers);
+
+  read_pgf_header(cur_file,buffer,my_pgf->headers);
+  if (validate_pgf_header(my_pgf->headers)){
+    pgf_select_columns(my_pgf, columns, n_columns);
+    status = read_pgf_probesets(cur_file, buffer, my_pgf);
+  }
+  R_Free(buffer);
+  fclose(cur_file);
+
+  return status;
+}
+
+
+/****************************************************************
+ **
+ ** static void pgf_read_error(const char *filename, int status)
+ **
+ ** raise the R error for a status other than PGF_OK from read_pgf
+ **
+ ***************************************************************/
+
+static void pgf_read_error(const char *filename, int status){
+
+  switch (status){
+  case PGF_MISSING_HEADER:
+    error("%s is missing required PGF header fields. Is it a PGF file?", filename);
+  case PGF_SHORT_LINE:
+    error("Line has fewer fields than the PGF header says it should. File %s corrupted?", filename);
+  case PGF_LEVEL2_BEFORE_LEVEL0:
+    error("Can not read a level 2 line before seeing a level 0 line. File %s corrupted?", filename);
+  case PGF_LEVEL2_BEFORE_LEVEL1:
+    error("Can not read a level 2 line before seeing a level 1 line. File %s corrupted?", filename);
+  case PGF_LEVEL1_BEFORE_LEVEL0:
+    error("Can not read a level 1 line before seeing a level 0 line. File %s corrupted?", filename);
+  case PGF_TOO_MANY_ROWS:
+    error("Too many rows in PGF file %s.", filename);
+  case PGF_TOO_MUCH_STRING_DATA:
+    error("Too much string data in PGF file %s.", filename);
+  case PGF_TOO_MANY_TYPES:
+    error("Too many distinct types in PGF file %s.", filename);
+  default:
+    error("Problem reading PGF file %s.", filename);
+  }
+}
+
+
+void read_pgf_file(char **filename){
+
   pgf_file my_pgf;
-  char *buffer = R_Calloc(1024, char);
   probeset_type_list *my_probeset_types;
-  int ntypes;
-  
-  cur_file = open_pgf_file(filename[0]);
+  int ntypes, status;
   
-  my_pgf.headers = R_Calloc(1, pgf_headers);
-  my_pgf.probesets = R_Calloc(1, probeset_list_header);
-
-  read_pgf_header(cur_file,buffer,my_pgf.headers);
-  if (validate_pgf_header(my_pgf.headers)){
-    read_pgf_probesets(cur_file, buffer, my_pgf.probesets, my_pgf.headers);
+  status = read_pgf(filename[0], &my_pgf, NULL, -1);
+  if (status == PGF_OK){
     my_probeset_types = pgf_count_probeset_types(&my_pgf, &ntypes);
     dealloc_probeset_type_list(my_probeset_types, ntypes);
   }
-  R_Free(buffer);
   dealloc_pgf_file(&my_pgf);
-  fclose(cur_file);
+  if (status != PGF_OK && status != PGF_MISSING_HEADER){
+    pgf_read_error(filename[0], status);
+  }
+}
+
+
+
+/****************************************************************
+ ****************************************************************
+ **
+ ** Functionality for returning the parsed file to R
+ **
+ ** The file is returned as a list with components
+ **
+ ** header    - a list of the #% header values
+ ** probesets - data.frame: probeset_id, type, probeset_name
+ ** atoms     - data.frame: atom_id, probeset_id, type, exon_position
+ ** probes    - data.frame: probe_id, atom_id, probeset_id, type, 
+ **             gc_count, probe_length, interrogation_position,
+ **             probe_sequence
+ **
+ ** types are factors. Columns which were not in the file are NA.
+ ** Optional columns which were not asked for are left out.
+ ** Every column is filled straight from the parsed tables.
+ **
+ ****************************************************************
+ ****************************************************************/
+
+static SEXP pgf_string_or_na(const char *str){
+  if (str == NULL){
+    return NA_STRING;
+  }
+  return mkChar(str);
+}
+
+static SEXP pgf_scalar_string(const char *str){
+  if (str == NULL){
+    return ScalarString(NA_STRING);
+  }
+  return mkString(str);
+}
+
+
+/****************************************************************
+ **
+ ** static SEXP pgf_make_data_frame(SEXP columns, const char **names, int n)
+ **
+ ** turn a list of n-long columns into a data.frame (with compact
+ ** row names) in place.
+ **
+ ***************************************************************/
+
+static SEXP pgf_make_data_frame(SEXP columns, const char **names, int n){
+
+  SEXP column_names, row_names;
+  int i;
+
+  PROTECT(column_names = allocVector(STRSXP, length(columns)));
+  for (i = 0; i < length(columns); i++){
+    SET_STRING_ELT(column_names, i, mkChar(names[i]));
+  }
+  setAttrib(columns, R_NamesSymbol, column_names);
+
+  PROTECT(row_names = allocVector(INTSXP, 2));
+  INTEGER(row_names)[0] = NA_INTEGER;
+  INTEGER(row_names)[1] = -n;
+  setAttrib(columns, R_RowNamesSymbol, row_names);
+  setAttrib(columns, R_ClassSymbol, mkString("data.frame"));
+  
+  UNPROTECT(2);
+  return columns;
+}
+
+
+/****************************************************************
+ **
+ ** static SEXP pgf_type_factor(pgf_file *my_pgf, pgf_type_code *codes, int n, int present)
+ **
+ ** make a factor from n type codes. Levels are the types used, in 
+ ** order of first appearance. present = 0 gives all NA.
+ **
+ ***************************************************************/
+
+static SEXP pgf_type_factor(pgf_file *my_pgf, pgf_type_code *codes, int n, int present){
+
+  SEXP factor, levels;
+  int *level_of_code = R_Calloc(my_pgf->types->n_types + 1, int);
+  int *code_of_level = R_Calloc(my_pgf->types->n_types + 1, int);
+  int n_levels = 0;
+  int i;
+
+  PROTECT(factor = allocVector(INTSXP, n));
+  
+  for (i = 0; i < n; i++){
+    if (!present || codes[i] == PGF_NO_TYPE){
+      INTEGER(factor)[i] = NA_INTEGER;
+      continue;
+    }
+    if (level_of_code[codes[i]] == 0){
+      code_of_level[n_levels] = codes[i];
+      n_levels++;
+      level_of_code[codes[i]] = n_levels;
+    }
+    INTEGER(factor)[i] = level_of_code[codes[i]];
+  }
+  
+  PROTECT(levels = allocVector(STRSXP, n_levels));
+  for (i = 0; i < n_levels; i++){
+    SET_STRING_ELT(levels, i, mkChar(pgf_type_string(my_pgf, (pgf_type_code)code_of_level[i])));
+  }
+  R_Free(level_of_code);
+  R_Free(code_of_level);
+  setAttrib(factor, R_LevelsSymbol, levels);
+  setAttrib(factor, R_ClassSymbol, mkString("factor"));
+
+  UNPROTECT(2);
+  return factor;
+}
+
+
+static SEXP pgf_string_vector(pgf_file *my_pgf, int *offsets, int n, int present){
+
+  SEXP strings;
+  int i;
+
+  PROTECT(strings = allocVector(STRSXP, n));
+  for (i = 0; i < n; i++){
+    SET_STRING_ELT(strings, i, present ? pgf_string_or_na(pgf_get_string(my_pgf, offsets[i])) : NA_STRING);
+  }
+  UNPROTECT(1);
+  return strings;
+}
+
+
+static SEXP pgf_int_vector(int *values, int n, int present){
+
+  SEXP ints;
+  int i;
+
+  PROTECT(ints = allocVector(INTSXP, n));
+  if (present){
+    memcpy(INTEGER(ints), values, n*sizeof(int));
+  } else {
+    for (i = 0; i < n; i++){
+      INTEGER(ints)[i] = NA_INTEGER;
+    }
+  }
+  UNPROTECT(1);
+  return ints;
+}
+
+
+static SEXP pgf_header_list(pgf_headers *header){
+
+  SEXP header_list, names, chip_type;
+  int i;
+  int n = 6 + header->n_other_headers;
+
+  PROTECT(header_list = allocVector(VECSXP, n));
+  PROTECT(names = allocVector(STRSXP, n));
+  
+  PROTECT(chip_type = allocVector(STRSXP, header->n_chip_type));
+  for (i = 0; i < header->n_chip_type; i++){
+    SET_STRING_ELT(chip_type, i, mkChar(header->chip_type[i]));
+  }
+  SET_VECTOR_ELT(header_list, 0, chip_type);
+  SET_VECTOR_ELT(header_list, 1, pgf_scalar_string(header->lib_set_name));
+  SET_VECTOR_ELT(header_list, 2, pgf_scalar_string(header->lib_set_version));
+  SET_VECTOR_ELT(header_list, 3, pgf_scalar_string(header->pgf_format_version));
+  SET_VECTOR_ELT(header_list, 4, pgf_scalar_string(header->create_date));
+  SET_VECTOR_ELT(header_list, 5, pgf_scalar_string(header->guid));
+  SET_STRING_ELT(names, 0, mkChar("chip_type"));
+  SET_STRING_ELT(names, 1, mkChar("lib_set_name"));
+  SET_STRING_ELT(names, 2, mkChar("lib_set_version"));
+  SET_STRING_ELT(names, 3, mkChar("pgf_format_version"));
+  SET_STRING_ELT(names, 4, mkChar("create_date"));
+  SET_STRING_ELT(names, 5, mkChar("guid"));
+
+  for (i = 0; i < header->n_other_headers; i++){
+    SET_VECTOR_ELT(header_list, 6 + i, mkString(header->other_headers_values[i]));
+    SET_STRING_ELT(names, 6 + i, mkChar(header->other_headers_keys[i]));
+  }
+  setAttrib(header_list, R_NamesSymbol, names);
+
+  UNPROTECT(3);
+  return header_list;
+}
+
+
+/****************************************************************
+ **
+ ** The data.frames only include the optional columns that were 
+ ** selected (see pgf_select_columns).
+ **
+ ***************************************************************/
+
+static SEXP pgf_probeset_frame(pgf_file *my_pgf){
+  
+  const char *names[3];
+  pgf_probeset_table *probesets = my_pgf->probesets;
+  header_0 *header0 = my_pgf->headers->header0;
+  int *selected = my_pgf->column_selected;
+  int n = probesets->n_probesets;
+  int k = 0;
+  SEXP frame;
+  
+  PROTECT(frame = allocVector(VECSXP, 1 + selected[0] + selected[1]));
+  names[k] = "probeset_id";
+  SET_VECTOR_ELT(frame, k++, pgf_int_vector(probesets->probeset_id, n, 1));
+  if (selected[0]){
+    names[k] = "type";
+    SET_VECTOR_ELT(frame, k++, pgf_type_factor(my_pgf, probesets->type, n, header0->type != -1));
+  }
+  if (selected[1]){
+    names[k] = "probeset_name";
+    SET_VECTOR_ELT(frame, k++, pgf_string_vector(my_pgf, probesets->probeset_name, n, header0->probeset_name != -1));
+  }
+  pgf_make_data_frame(frame, names, n);
+  UNPROTECT(1);
+  return frame;
+}
+
+
+static SEXP pgf_atom_frame(pgf_file *my_pgf){
+  
+  const char *names[4];
+  pgf_atom_table *atoms = my_pgf->atoms;
+  pgf_probeset_table *probesets = my_pgf->probesets;
+  header_1 *header1 = my_pgf->headers->header1;
+  int *selected = my_pgf->column_selected;
+  int n = atoms->n_atoms;
+  int i, j;
+  int k = 0;
+  SEXP frame, parent;
+  
+  PROTECT(frame = allocVector(VECSXP, 2 + selected[2] + selected[3]));
+  names[k] = "atom_id";
+  SET_VECTOR_ELT(frame, k++, pgf_int_vector(atoms->atom_id, n, 1));
+
+  parent = allocVector(INTSXP, n);
+  names[k] = "probeset_id";
+  SET_VECTOR_ELT(frame, k++, parent);
+  for (i = 0; i < probesets->n_probesets; i++){
+    for (j = probesets->first_atom[i]; j < probesets->first_atom[i+1]; j++){
+      INTEGER(parent)[j] = probesets->probeset_id[i];
+    }
+  }
+  
+  if (selected[2]){
+    names[k] = "type";
+    SET_VECTOR_ELT(frame, k++, pgf_type_factor(my_pgf, atoms->type, n, header1->type != -1));
+  }
+  if (selected[3]){
+    names[k] = "exon_position";
+    SET_VECTOR_ELT(frame, k++, pgf_string_vector(my_pgf, atoms->exon_position, n, header1->exon_position != -1));
+  }
+  pgf_make_data_frame(frame, names, n);
+  UNPROTECT(1);
+  return frame;
+}
+
+
+static SEXP pgf_probe_frame(pgf_file *my_pgf){
+  
+  const char *names[8];
+  pgf_probe_table *probes = my_pgf->probes;
+  pgf_atom_table *atoms = my_pgf->atoms;
+  pgf_probeset_table *probesets = my_pgf->probesets;
+  header_2 *header2 = my_pgf->headers->header2;
+  int *selected = my_pgf->column_selected;
+  int n = probes->n_probes;
+  int i, j, k;
+  int cur_col = 0;
+  SEXP frame, atom_parent, probeset_parent;
+  
+  PROTECT(frame = allocVector(VECSXP, 4 + selected[4] + selected[5] + selected[6] + selected[7]));
+  names[cur_col] = "probe_id";
+  SET_VECTOR_ELT(frame, cur_col++, pgf_int_vector(probes->probe_id, n, 1));
+
+  atom_parent = allocVector(INTSXP, n);
+  names[cur_col] = "atom_id";
+  SET_VECTOR_ELT(frame, cur_col++, atom_parent);
+  probeset_parent = allocVector(INTSXP, n);
+  names[cur_col] = "probeset_id";
+  SET_VECTOR_ELT(frame, cur_col++, probeset_parent);
+  for (i = 0; i < probesets->n_probesets; i++){
+    for (j = probesets->first_atom[i]; j < probesets->first_atom[i+1]; j++){
+      for (k = atoms->first_probe[j]; k < atoms->first_probe[j+1]; k++){
+	INTEGER(atom_parent)[k] = atoms->atom_id[j];
+	INTEGER(probeset_parent)[k] = probesets->probeset_id[i];
+      }
+    }
+  }
+
+  names[cur_col] = "type";
+  SET_VECTOR_ELT(frame, cur_col++, pgf_type_factor(my_pgf, probes->type, n, header2->type != -1));
+  if (selected[4]){
+    names[cur_col] = "gc_count";
+    SET_VECTOR_ELT(frame, cur_col++, pgf_int_vector(probes->gc_count, n, header2->gc_count != -1));
+  }
+  if (selected[5]){
+    names[cur_col] = "probe_length";
+    SET_VECTOR_ELT(frame, cur_col++, pgf_int_vector(probes->probe_length, n, header2->probe_length != -1));
+  }
+  if (selected[6]){
+    names[cur_col] = "interrogation_position";
+    SET_VECTOR_ELT(frame, cur_col++, pgf_int_vector(probes->interrogation_position, n, header2->interrogation_position != -1));
+  }
+  if (selected[7]){
+    names[cur_col] = "probe_sequence";
+    SET_VECTOR_ELT(frame, cur_col++, pgf_string_vector(my_pgf, probes->probe_sequence, n, header2->probe_sequence != -1));
+  }
+  pgf_make_data_frame(frame, names, n);
+  UNPROTECT(1);
+  return frame;
+}
+
+
+/****************************************************************
+ **
+ ** SEXP ReadPGFFile(SEXP filename, SEXP columns)
+ **
+ ** SEXP filename - name of PGF file
+ ** SEXP columns - character vector naming the optional columns 
+ **                to read (see pgf_optional_columns) or NULL for all
+ **
+ ** RETURNS list(header, probesets, atoms, probes) as described above
+ **
+ ***************************************************************/
+
+SEXP ReadPGFFile(SEXP filename, SEXP columns){
+
+  pgf_file my_pgf;
+  SEXP return_value, names;
+  const char *cur_file_name;
+  const char **column_names = NULL;
+  int n_columns = -1;
+  int i, status;
+
+  if (!isString(filename) || length(filename) != 1){
+    error("filename should be a single character string");
+  }
+  cur_file_name = CHAR(STRING_ELT(filename,0));
+
+  if (columns != R_NilValue){
+    if (!isString(columns)){
+      error("columns should be a character vector");
+    }
+    n_columns = length(columns);
+    column_names = (const char **)R_alloc(n_columns + 1, sizeof(char *));
+    for (i = 0; i < n_columns; i++){
+      column_names[i] = CHAR(STRING_ELT(columns, i));
+    }
+  }
+
+  if ((status = read_pgf(cur_file_name, &my_pgf, column_names, n_columns)) != PGF_OK){
+    dealloc_pgf_file(&my_pgf);
+    pgf_read_error(cur_file_name, status);
+  }
+
+  PROTECT(return_value = allocVector(VECSXP, 4));
+  SET_VECTOR_ELT(return_value, 0, pgf_header_list(my_pgf.headers));
+  SET_VECTOR_ELT(return_value, 1, pgf_probeset_frame(&my_pgf));
+  SET_VECTOR_ELT(return_value, 2, pgf_atom_frame(&my_pgf));
+  SET_VECTOR_ELT(return_value, 3, pgf_probe_frame(&my_pgf));
+  
+  dealloc_pgf_file(&my_pgf);
+
+  PROTECT(names = allocVector(STRSXP, 4));
+  SET_STRING_ELT(names, 0, mkChar("header"));
+  SET_STRING_ELT(names, 1, mkChar("probesets"));
+  SET_STRING_ELT(names, 2, mkChar("atoms"));
+  SET_STRING_ELT(names, 3, mkChar("probes"));
+  setAttrib(return_value, R_NamesSymbol, names);
+
+  UNPROTECT(2);
+  return return_value;
+}
+
+
+
+/****************************************************************
+ ****************************************************************
+ **
+ ** Combining a PGF and a CLF file into probe locations
+ **
+ ** Each probeset becomes an (n by 2) INTSXP matrix with columns pm
+ ** and mm giving (1 based) cell indices y*cols + x + 1, the same 
+ ** form as read.cdffile.locations(storage.mode="integer") so that 
+ ** it can be given as the cdfInfo to read_probeintensities. Within 
+ ** each atom the probes with a type starting "mm" fill the mm column
+ ** and all others the pm column, in file order. Where an atom has
+ ** no mm probes (eg Gene ST arrays) the mm column is NA, as are 
+ ** probes whose probe_id is not in the CLF file.
+ **
+ ****************************************************************
+ ****************************************************************/
+
+/* which type codes are wanted: all of them when probeset_types is NULL, 
+   otherwise those whose string is requested. PGF_NO_TYPE (including every
+   probeset of a file without a type column) is only wanted for NULL */
+
+static int *pgf_wanted_type_codes(pgf_file *my_pgf, SEXP probeset_types){
+
+  int *wanted_code = (int *)R_alloc(PGF_NO_TYPE + 1, sizeof(int));
+  int i, j;
+
+  memset(wanted_code, 0, (PGF_NO_TYPE + 1)*sizeof(int));
+  if (isNull(probeset_types)){
+    for (i = 0; i <= PGF_NO_TYPE; i++){
+      wanted_code[i] = 1;
+    }
+    return wanted_code;
+  }
+  for (i = 0; i < my_pgf->types->n_types; i++){
+    for (j = 0; j < length(probeset_types); j++){
+      if (STRING_ELT(probeset_types,j) != NA_STRING && 
+	  strcmp(pgf_type_string(my_pgf, (pgf_type_code)i), CHAR(STRING_ELT(probeset_types,j))) == 0){
+	wanted_code[i] = 1;
+	break;
+      }
+    }
+  }
+  return wanted_code;
+}
+
+
+static SEXP pgf_probeset_locations(pgf_file *my_pgf, int probeset, const int *cell_index, const int *is_mm){
+
+  pgf_atom_table *atoms = my_pgf->atoms;
+  pgf_probe_table *probes = my_pgf->probes;
+  SEXP locations, dimnames, colnames;
+  int *loc;
+  int atom, probe, n_rows = 0, row, n_pm, n_mm;
+  int column;
+
+  for (atom = my_pgf->probesets->first_atom[probeset]; atom < my_pgf->probesets->first_atom[probeset+1]; atom++){
+    n_pm = 0;
+    n_mm = 0;
+    for (probe = atoms->first_probe[atom]; probe < atoms->first_probe[atom+1]; probe++){
+      if (is_mm[probes->type[probe]]){
+	n_mm++;
+      } else {
+	n_pm++;
+      }
+    }
+    n_rows+= (n_pm > n_mm) ? n_pm : n_mm;
+  }
+
+  PROTECT(locations = allocMatrix(INTSXP, n_rows, 2));
+  loc = INTEGER(locations);
+  for (row = 0; row < 2*n_rows; row++){
+    loc[row] = NA_INTEGER;
+  }
+  
+  row = 0;
+  for (atom = my_pgf->probesets->first_atom[probeset]; atom < my_pgf->probesets->first_atom[probeset+1]; atom++){
+    n_pm = 0;
+    n_mm = 0;
+    for (probe = atoms->first_probe[atom]; probe < atoms->first_probe[atom+1]; probe++){
+      if (is_mm[probes->type[probe]]){
+	column = n_rows + row + n_mm++;
+      } else {
+	column = row + n_pm++;
+      }
+      if (cell_index[probe] != -1){
+	loc[column] = cell_index[probe] + 1;
+      }
+    }
+    row+= (n_pm > n_mm) ? n_pm : n_mm;
+  }
+
+  PROTECT(colnames = allocVector(STRSXP, 2));
+  SET_STRING_ELT(colnames, 0, mkChar("pm"));
+  SET_STRING_ELT(colnames, 1, mkChar("mm"));
+  PROTECT(dimnames = allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(dimnames, 1, colnames);
+  setAttrib(locations, R_DimNamesSymbol, dimnames);
+
+  UNPROTECT(3);
+  return locations;
+}
+
+
+/****************************************************************
+ **
+ ** SEXP ReadPGFCLFLocations(SEXP pgf_filename, SEXP clf_filename, SEXP probeset_types, SEXP sidecar)
+ **
+ ** SEXP pgf_filename - name of PGF file
+ ** SEXP clf_filename - name of CLF file
+ ** SEXP probeset_types - NULL for all probesets, otherwise a character
+ **                       vector of the probeset types wanted (eg "main")
+ ** SEXP sidecar - NULL or name of binary sidecar file for the CLF 
+ **                probe_ids (see read_clf.c)
+ **
+ ** RETURNS a list of location matrices as described above, named by
+ ** probeset_id, with an "n.probes" attribute giving the number of 
+ ** probesets and the total number of rows.
+ **
+ ***************************************************************/
+
+SEXP ReadPGFCLFLocations(SEXP pgf_filename, SEXP clf_filename, SEXP probeset_types, SEXP sidecar){
+
+  pgf_file my_pgf;
+  SEXP locations, names, counts;
+  const char *type_column[1] = {"probeset_type"};
+  const char *sidecar_name = NULL;
+  int *cell_index;
+  int *is_mm;
+  int *wanted, *wanted_code;
+  int i, k, n_kept = 0, n_rows = 0, n_cells, status;
+  char buf[32];
+
+  if (!isString(pgf_filename) || length(pgf_filename) != 1){
+    error("pgf_filename should be a single character string");
+  }
+  if (!isString(clf_filename) || length(clf_filename) != 1){
+    error("clf_filename should be a single character string");
+  }
+  if (!isNull(probeset_types) && !isString(probeset_types)){
+    error("probeset_types should be NULL or a character vector");
+  }
+  if (!isNull(sidecar)){
+    if (!isString(sidecar) || length(sidecar) != 1){
+      error("sidecar should be NULL or a single character string");
+    }
+    if (STRING_ELT(sidecar,0) != NA_STRING){
+      sidecar_name = CHAR(STRING_ELT(sidecar,0));
+    }
+  }
+
+  /* only the probeset types are needed from the optional columns */
+  if ((status = read_pgf(CHAR(STRING_ELT(pgf_filename,0)), &my_pgf, type_column, isNull(probeset_types) ? 0 : 1)) != PGF_OK){
+    dealloc_pgf_file(&my_pgf);
+    pgf_read_error(CHAR(STRING_ELT(pgf_filename,0)), status);
+  }
+
+  cell_index = (int *)R_alloc(my_pgf.probes->n_probes + 1, sizeof(int));
+  clf_probe_id_indices(CHAR(STRING_ELT(clf_filename,0)), sidecar_name, my_pgf.probes->probe_id, my_pgf.probes->n_probes, cell_index, &n_cells);
+
+  /* indexed by type code, with PGF_NO_TYPE counting as pm */
+  is_mm = (int *)R_alloc(PGF_NO_TYPE + 1, sizeof(int));
+  memset(is_mm, 0, (PGF_NO_TYPE + 1)*sizeof(int));
+  for (i = 0; i < my_pgf.types->n_types; i++){
+    is_mm[i] = (strncmp(pgf_type_string(&my_pgf, (pgf_type_code)i), "mm", 2) == 0);
+  }
+
+  wanted_code = pgf_wanted_type_codes(&my_pgf, probeset_types);
+  wanted = (int *)R_alloc(my_pgf.probesets->n_probesets + 1, sizeof(int));
+  for (i = 0; i < my_pgf.probesets->n_probesets; i++){
+    wanted[i] = wanted_code[my_pgf.probesets->type == NULL ? PGF_NO_TYPE : my_pgf.probesets->type[i]];
+    n_kept+= wanted[i];
+  }
+
+  PROTECT(locations = allocVector(VECSXP, n_kept));
+  PROTECT(names = allocVector(STRSXP, n_kept));
+  for (i = 0, k = 0; i < my_pgf.probesets->n_probesets; i++){
+    if (!wanted[i]){
+      continue;
+    }
+    SET_VECTOR_ELT(locations, k, pgf_probeset_locations(&my_pgf, i, cell_index, is_mm));
+    n_rows+= INTEGER(getAttrib(VECTOR_ELT(locations, k), R_DimSymbol))[0];
+    sprintf(buf, "%d", my_pgf.probesets->probeset_id[i]);
+    SET_STRING_ELT(names, k, mkChar(buf));
+    k++;
+  }
+  setAttrib(locations, R_NamesSymbol, names);
+
+  PROTECT(counts = allocVector(INTSXP, 2));
+  INTEGER(counts)[0] = n_kept;
+  INTEGER(counts)[1] = n_rows;
+  setAttrib(locations, install("n.probes"), counts);
+
+  dealloc_pgf_file(&my_pgf);
 
+  UNPROTECT(3);
+  return locations;
 }
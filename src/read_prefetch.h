@@ -0,0 +1,21 @@
+#ifndef READ_PREFETCH_H
+#define READ_PREFETCH_H
+
+
+/****************************************************************
+ **
+ ** Hinting to the operating system which CEL files of a batch will
+ ** be read next (see read_prefetch.c)
+ **
+ ***************************************************************/
+
+#define PREFETCH_ENV_VAR "R_AFFYIO_PREFETCH"
+#define PREFETCH_DEFAULT_DEPTH 2
+
+
+extern int read_prefetch_depth;
+
+void read_prefetch_begin(void);
+void read_prefetch_ahead(const char **filenames, int end, int i, int stride, int first);
+
+#endif
@@ -0,0 +1,389 @@
+/******************************************************************
+ **
+ ** file: read_timing.c
+ **
+ ** Aim: time the phases of reading a batch of CEL files and count
+ **      the files opened and bytes read in each
+ **
+ ** Created on Oct 16, 2026
+ **
+ ** History
+ ** Oct 16, 2026 - Initial version
+ ** Oct 16, 2026 - timers always set their phase and keep whether timing was on when started; the counters are cleared under the lock
+ **
+ **
+ ** Timing is off until turned on by R_read_timing(), which also
+ ** clears the counters. While it is off read_timing_start() and
+ ** friends return after testing read_timing_enabled, so the
+ ** readers pay a single branch per call. A timer keeps the value
+ ** of read_timing_enabled it was started with, so a timer started
+ ** before timing is turned on is not stopped as if it had run.
+ **
+ ** For each phase (see read_timing.h) we keep the number of calls,
+ ** the wall time from the first start to the last stop, the busy
+ ** time (summed over all threads), the number of files opened and
+ ** the number of bytes read. Bytes are counted as the size on disk
+ ** of each file read in the read phase, so for gzipped files they
+ ** are compressed bytes. Busy time is also kept for each thread,
+ ** threads being numbered in the order they call
+ ** read_timing_thread_begin(); row 0 is the main thread.
+ **
+ ******************************************************************/
+
+#include <R.h>
+#include <Rdefines.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "read_timing.h"
+
+#if USE_PTHREADS
+#include <pthread.h>
+#endif
+
+
+typedef struct{
+  int calls;
+  double first_start;
+  double last_stop;
+  double busy;
+  int opened;
+  double bytes;
+} phase_timing;
+
+
+typedef struct{
+  int index;               /* row of thread_busy */
+  int phase;               /* the phase being timed, -1 if none */
+} thread_state;
+
+
+int read_timing_enabled = 0;
+
+static phase_timing phases[TIMING_N_PHASES];
+static double *thread_busy = NULL;    /* n_threads by TIMING_N_PHASES, by row */
+static int n_threads = 0;
+static int max_threads = 0;
+static thread_state main_state = {0, -1};
+
+static const char *phase_names[TIMING_N_PHASES] = {"format", "check", "read", "mask", "store"};
+
+#if USE_PTHREADS
+static pthread_mutex_t timing_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t state_key;
+static pthread_once_t state_key_once = PTHREAD_ONCE_INIT;
+
+static void make_state_key(void){
+  pthread_key_create(&state_key, NULL);
+}
+#endif
+
+
+
+static double now(void){
+
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + 1e-6*(double)tv.tv_usec;
+}
+
+
+static thread_state *current_state(void){
+#if USE_PTHREADS
+  thread_state *state;
+
+  pthread_once(&state_key_once, make_state_key);
+  state = (thread_state *)pthread_getspecific(state_key);
+  if (state != NULL){
+    return state;
+  }
+#endif
+  return &main_state;
+}
+
+
+static void lock_timing(void){
+#if USE_PTHREADS
+  pthread_mutex_lock(&timing_mutex);
+#endif
+}
+
+
+static void unlock_timing(void){
+#if USE_PTHREADS
+  pthread_mutex_unlock(&timing_mutex);
+#endif
+}
+
+
+/* called with the lock held */
+static int add_thread(void){
+
+  if (n_threads == max_threads){
+    max_threads = (max_threads == 0) ? 16 : 2*max_threads;
+    thread_busy = R_Realloc(thread_busy, max_threads*TIMING_N_PHASES, double);
+  }
+  memset(&thread_busy[n_threads*TIMING_N_PHASES], 0, TIMING_N_PHASES*sizeof(double));
+  return n_threads++;
+}
+
+
+static void reset_timing(void){
+
+  lock_timing();
+  memset(phases, 0, sizeof(phases));
+  n_threads = 0;
+  add_thread();
+  main_state.index = 0;
+  main_state.phase = -1;
+  unlock_timing();
+}
+
+
+/****************************************************************
+ **
+ ** void read_timing_start(read_timer *timer, int phase)
+ ** void read_timing_stop(read_timer *timer, const char *filename)
+ **
+ ** time one call of a phase. If filename is not NULL its size is
+ ** added to the bytes read in the phase. Timers must not be nested
+ ** within a thread.
+ **
+ ****************************************************************/
+
+void read_timing_start(read_timer *timer, int phase){
+
+  timer->enabled = read_timing_enabled;
+  timer->phase = timer->enabled ? phase : -1;
+  timer->start = 0.0;
+  if (!timer->enabled){
+    return;
+  }
+  timer->start = now();
+  current_state()->phase = phase;
+}
+
+
+void read_timing_stop(read_timer *timer, const char *filename){
+
+  struct stat file_info;
+  thread_state *state;
+  double stop, bytes = 0.0;
+  phase_timing *cur;
+
+  if (!timer->enabled || timer->phase < 0){
+    return;
+  }
+  stop = now();
+  if (filename != NULL && stat(filename, &file_info) == 0){
+    bytes = (double)file_info.st_size;
+  }
+  state = current_state();
+
+  lock_timing();
+  cur = &phases[timer->phase];
+  if (cur->calls == 0 || timer->start < cur->first_start){
+    cur->first_start = timer->start;
+  }
+  if (stop > cur->last_stop){
+    cur->last_stop = stop;
+  }
+  cur->calls++;
+  cur->busy += stop - timer->start;
+  cur->bytes += bytes;
+  if (state->index < n_threads){
+    thread_busy[state->index*TIMING_N_PHASES + timer->phase] += stop - timer->start;
+  }
+  unlock_timing();
+
+  state->phase = -1;
+  timer->phase = -1;
+}
+
+
+/****************************************************************
+ **
+ ** void read_timing_opened(void)
+ **
+ ** count a file being opened in whichever phase the calling
+ ** thread is timing.
+ **
+ ****************************************************************/
+
+void read_timing_opened(void){
+
+  thread_state *state;
+
+  if (!read_timing_enabled){
+    return;
+  }
+  state = current_state();
+  if (state->phase < 0){
+    return;
+  }
+  lock_timing();
+  phases[state->phase].opened++;
+  unlock_timing();
+}
+
+
+/****************************************************************
+ **
+ ** void read_timing_thread_begin(void)
+ ** void read_timing_thread_end(void)
+ **
+ ** bracket the work of a worker thread so that its busy time is
+ ** kept separately from that of other threads.
+ **
+ ****************************************************************/
+
+void read_timing_thread_begin(void){
+#if USE_PTHREADS
+  thread_state *state;
+
+  if (!read_timing_enabled){
+    return;
+  }
+  pthread_once(&state_key_once, make_state_key);
+  state = R_Calloc(1, thread_state);
+  state->phase = -1;
+  lock_timing();
+  state->index = add_thread();
+  unlock_timing();
+  pthread_setspecific(state_key, state);
+#endif
+}
+
+
+void read_timing_thread_end(void){
+#if USE_PTHREADS
+  thread_state *state;
+
+  pthread_once(&state_key_once, make_state_key);
+  state = (thread_state *)pthread_getspecific(state_key);
+  if (state != NULL){
+    pthread_setspecific(state_key, NULL);
+    R_Free(state);
+  }
+#endif
+}
+
+
+/****************************************************************
+ **
+ ** SEXP R_read_timing(SEXP enable)
+ **
+ ** turn timing on or off, clearing the counters. Returns whether
+ ** timing was on before.
+ **
+ ****************************************************************/
+
+SEXP R_read_timing(SEXP enable){
+
+  int was_enabled = read_timing_enabled;
+
+  reset_timing();
+  read_timing_enabled = asLogical(enable) == TRUE;
+  return ScalarLogical(was_enabled);
+}
+
+
+/****************************************************************
+ **
+ ** SEXP R_read_timing_report(void)
+ **
+ ** returns a list with a data.frame of the counters for each
+ ** phase and a matrix of the busy time of each thread (rows) in
+ ** each phase (columns). Times are in seconds.
+ **
+ ****************************************************************/
+
+SEXP R_read_timing_report(void){
+
+  int i, j;
+  SEXP report, report_names, frame, names, row_names;
+  SEXP phase, calls, wall, busy, opened, bytes;
+  SEXP threads, dimnames, thread_names, col_names;
+  char buffer[32];
+
+  const char *column_names[6] = {"phase", "calls", "wall", "busy", "files.opened", "bytes"};
+
+  if (n_threads == 0){
+    reset_timing();
+  }
+
+  PROTECT(frame = allocVector(VECSXP, 6));
+  PROTECT(phase = allocVector(STRSXP, TIMING_N_PHASES));
+  PROTECT(calls = allocVector(INTSXP, TIMING_N_PHASES));
+  PROTECT(wall = allocVector(REALSXP, TIMING_N_PHASES));
+  PROTECT(busy = allocVector(REALSXP, TIMING_N_PHASES));
+  PROTECT(opened = allocVector(INTSXP, TIMING_N_PHASES));
+  PROTECT(bytes = allocVector(REALSXP, TIMING_N_PHASES));
+  for (i = 0; i < TIMING_N_PHASES; i++){
+    SET_STRING_ELT(phase, i, mkChar(phase_names[i]));
+    INTEGER(calls)[i] = phases[i].calls;
+    REAL(wall)[i] = (phases[i].calls > 0) ? phases[i].last_stop - phases[i].first_start : 0.0;
+    REAL(busy)[i] = phases[i].busy;
+    INTEGER(opened)[i] = phases[i].opened;
+    REAL(bytes)[i] = phases[i].bytes;
+  }
+  SET_VECTOR_ELT(frame, 0, phase);
+  SET_VECTOR_ELT(frame, 1, calls);
+  SET_VECTOR_ELT(frame, 2, wall);
+  SET_VECTOR_ELT(frame, 3, busy);
+  SET_VECTOR_ELT(frame, 4, opened);
+  SET_VECTOR_ELT(frame, 5, bytes);
+  UNPROTECT(6);
+
+  PROTECT(names = allocVector(STRSXP, 6));
+  for (i = 0; i < 6; i++){
+    SET_STRING_ELT(names, i, mkChar(column_names[i]));
+  }
+  setAttrib(frame, R_NamesSymbol, names);
+  UNPROTECT(1);
+
+  PROTECT(row_names = allocVector(INTSXP, 2));
+  INTEGER(row_names)[0] = NA_INTEGER;
+  INTEGER(row_names)[1] = -TIMING_N_PHASES;
+  setAttrib(frame, R_RowNamesSymbol, row_names);
+  setAttrib(frame, R_ClassSymbol, mkString("data.frame"));
+  UNPROTECT(1);
+
+  PROTECT(threads = allocMatrix(REALSXP, n_threads, TIMING_N_PHASES));
+  for (i = 0; i < n_threads; i++){
+    for (j = 0; j < TIMING_N_PHASES; j++){
+      REAL(threads)[j*n_threads + i] = thread_busy[i*TIMING_N_PHASES + j];
+    }
+  }
+  PROTECT(dimnames = allocVector(VECSXP, 2));
+  PROTECT(thread_names = allocVector(STRSXP, n_threads));
+  SET_STRING_ELT(thread_names, 0, mkChar("main"));
+  for (i = 1; i < n_threads; i++){
+    sprintf(buffer, "thread %d", i);
+    SET_STRING_ELT(thread_names, i, mkChar(buffer));
+  }
+  PROTECT(col_names = allocVector(STRSXP, TIMING_N_PHASES));
+  for (j = 0; j < TIMING_N_PHASES; j++){
+    SET_STRING_ELT(col_names, j, mkChar(phase_names[j]));
+  }
+  SET_VECTOR_ELT(dimnames, 0, thread_names);
+  SET_VECTOR_ELT(dimnames, 1, col_names);
+  setAttrib(threads, R_DimNamesSymbol, dimnames);
+  UNPROTECT(3);
+
+  PROTECT(report = allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(report, 0, frame);
+  SET_VECTOR_ELT(report, 1, threads);
+  PROTECT(report_names = allocVector(STRSXP, 2));
+  SET_STRING_ELT(report_names, 0, mkChar("phases"));
+  SET_STRING_ELT(report_names, 1, mkChar("threads"));
+  setAttrib(report, R_NamesSymbol, report_names);
+
+  UNPROTECT(4);
+  return report;
+}
@@ -0,0 +1,35 @@
+#ifndef READ_TIMING_H
+#define READ_TIMING_H
+
+
+/****************************************************************
+ **
+ ** The phases of reading a batch of CEL files that are timed
+ ** (see read_timing.c)
+ **
+ ***************************************************************/
+
+#define TIMING_FORMAT 0          /* sniffing the file format */
+#define TIMING_CHECK 1           /* checking headers against the reference CDF */
+#define TIMING_READ 2            /* decompressing and parsing the intensities */
+#define TIMING_MASK 3            /* applying masks and outliers */
+#define TIMING_STORE 4           /* storing intensities into PM/MM matrices */
+#define TIMING_N_PHASES 5
+
+
+typedef struct{
+  int enabled;             /* read_timing_enabled when started */
+  int phase;               /* -1 when not running */
+  double start;
+} read_timer;
+
+
+extern int read_timing_enabled;
+
+void read_timing_start(read_timer *timer, int phase);
+void read_timing_stop(read_timer *timer, const char *filename);
+void read_timing_opened(void);
+void read_timing_thread_begin(void);
+void read_timing_thread_end(void);
+
+#endif
@@ -0,0 +1,563 @@
+/******************************************************************
+ **
+ ** file: benchmark.c
+ **
+ ** Aim: time the affyio parsers on synthetic files so that changes
+ **      to their speed can be measured
+ **
+ ** Created on Oct 16, 2026
+ **
+ ** History
+ ** Oct 16, 2026 - Initial version
+ ** Oct 16, 2026 - Add -t, which checks that truncated CEL files are reported
+ **                as R errors by the threaded batch readers
+ ** Oct 16, 2026 - Protect the chip type handed to read_abatch and read_abatch_stddev
+ ** Oct 16, 2026 - Protect the thread counts and block size handed to the -t checks
+ ** Oct 16, 2026 - -t also checks R_read_cel_cells
+ **
+ **
+ ** Usage: affyio_benchmark [-c cols] [-r rows] [-n repeats]
+ **                         [-d directory] [-f filter] [-k] [-t]
+ **
+ ** Writes text, gzipped text, binary, Command Console and two
+ ** channel CEL files, XDA and text CDF files and PGF, CLF and BPMAP
+ ** files for an array of cols by rows cells (default 712 by 712)
+ ** into directory (default a new directory under /tmp), then times
+ ** each reader on them, reporting the best of repeats (default 3)
+ ** runs as MB/s (of the file on disk) and cells/s (cells, CDF
+ ** cells, PGF probes or BPMAP probe pairs). Only readers whose
+ ** format or name contains filter are run. The files are removed
+ ** afterwards unless -k is given.
+ **
+ ** The readers are the .Call entry points of the package, run in
+ ** an embedded R session, so the times include building the R
+ ** objects that would be returned to R. See the Makefile for
+ ** building.
+ **
+ ** With -t nothing is timed. Instead copies of each single channel
+ ** CEL file cut short in the header and in the intensities are
+ ** given, among whole files, to the batch readers that read on
+ ** several threads. Each must fail with an R error (rather than
+ ** crash, hang or succeed). The exit status is the number of
+ ** checks that did not.
+ **
+ ******************************************************************/
+
+#include <R.h>
+#include <Rinternals.h>
+#include <Rembedded.h>
+#include <R_ext/Memory.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "read_abatch.h"
+#include "generate.h"
+
+
+SEXP R_read_cel_file(SEXP filename, SEXP intensities_mean_only);
+SEXP ReadCDFFile(SEXP filename);
+SEXP ReadCDFFileIntoRList(SEXP filename, SEXP fullstructure);
+SEXP ReadtextCDFFileIntoRList(SEXP filename);
+SEXP ReadPGFFile(SEXP filename, SEXP columns);
+SEXP ReadCLFFile(SEXP filename, SEXP sidecar);
+SEXP ReadBPMAPFileIntoRList(SEXP filename);
+SEXP ReadHeaderBatch(SEXP filenames, SEXP threads);
+SEXP R_read_cel_files(SEXP filenames, SEXP intensities_mean_only, SEXP threads);
+SEXP R_read_cel_files_matrices(SEXP filenames, SEXP intensities_mean_only, SEXP threads);
+SEXP R_cel_block_iterator(SEXP filenames, SEXP block_size, SEXP rm_mask, SEXP rm_outliers, SEXP rm_extra, SEXP ref_cdfName, SEXP ref_dim, SEXP threads);
+SEXP R_cel_block_iterator_next(SEXP iterator);
+SEXP R_cel_block_iterator_free(SEXP iterator);
+SEXP R_read_cel_cells(SEXP filenames, SEXP cells, SEXP threads);
+
+
+#define FILE_TEXT_CEL 0
+#define FILE_GZTEXT_CEL 1
+#define FILE_BINARY_CEL 2
+#define FILE_GZBINARY_CEL 3
+#define FILE_GENERIC_CEL 4
+#define FILE_GZGENERIC_CEL 5
+#define FILE_MULTICHANNEL_CEL 6
+#define FILE_XDA_CDF 7
+#define FILE_TEXT_CDF 8
+#define FILE_PGF 9
+#define FILE_CLF 10
+#define FILE_BPMAP 11
+#define N_FILES 12
+
+
+typedef struct{
+  const char *format;
+  const char *name;           /* under the benchmark directory */
+  char *path;
+  double bytes;
+  double cells;
+} benchmark_file;
+
+
+static benchmark_file files[N_FILES] = {
+  {"text CEL", "text.CEL", NULL, 0, 0},
+  {"gzipped text CEL", "gztext.CEL.gz", NULL, 0, 0},
+  {"binary CEL", "binary.CEL", NULL, 0, 0},
+  {"gzipped binary CEL", "gzbinary.CEL.gz", NULL, 0, 0},
+  {"Command Console CEL", "generic.CEL", NULL, 0, 0},
+  {"gzipped Command Console CEL", "gzgeneric.CEL.gz", NULL, 0, 0},
+  {"multichannel CEL", "multichannel.CEL", NULL, 0, 0},
+  {"XDA CDF", "xda.cdf", NULL, 0, 0},
+  {"text CDF", "text.cdf", NULL, 0, 0},
+  {"PGF", "bench.pgf", NULL, 0, 0},
+  {"CLF", "bench.clf", NULL, 0, 0},
+  {"BPMAP", "bench.bpmap", NULL, 0, 0}
+};
+
+
+/* array dimensions, needed by the CEL readers */
+static int array_cols, array_rows;
+
+
+
+static SEXP cel_intensities(SEXP filename){
+
+  SEXP cdfName, dim, result;
+
+  PROTECT(cdfName = mkString(GENERATE_CHIP_TYPE));
+  PROTECT(dim = allocVector(INTSXP, 2));
+  INTEGER(dim)[0] = array_cols;
+  INTEGER(dim)[1] = array_rows;
+  result = read_abatch(filename, ScalarLogical(FALSE), ScalarLogical(FALSE), ScalarLogical(FALSE),
+                       cdfName, dim, ScalarLogical(FALSE));
+  UNPROTECT(2);
+  return result;
+}
+
+
+static SEXP cel_stddev(SEXP filename){
+
+  SEXP cdfName, dim, result;
+
+  PROTECT(cdfName = mkString(GENERATE_CHIP_TYPE));
+  PROTECT(dim = allocVector(INTSXP, 2));
+  INTEGER(dim)[0] = array_cols;
+  INTEGER(dim)[1] = array_rows;
+  result = read_abatch_stddev(filename, ScalarLogical(FALSE), ScalarLogical(FALSE), ScalarLogical(FALSE),
+                              cdfName, dim, ScalarLogical(FALSE));
+  UNPROTECT(2);
+  return result;
+}
+
+
+static SEXP cel_file(SEXP filename){
+  return R_read_cel_file(filename, ScalarLogical(FALSE));
+}
+
+
+static SEXP cdf_locations(SEXP filename){
+  return ReadCDFFile(filename);
+}
+
+
+static SEXP cdf_list(SEXP filename){
+  return ReadCDFFileIntoRList(filename, ScalarLogical(TRUE));
+}
+
+
+static SEXP text_cdf_list(SEXP filename){
+  return ReadtextCDFFileIntoRList(filename);
+}
+
+
+static SEXP pgf_file(SEXP filename){
+  return ReadPGFFile(filename, R_NilValue);
+}
+
+
+static SEXP clf_file(SEXP filename){
+  return ReadCLFFile(filename, R_NilValue);
+}
+
+
+static SEXP bpmap_file(SEXP filename){
+  return ReadBPMAPFileIntoRList(filename);
+}
+
+
+typedef struct{
+  const char *name;
+  int file;
+  SEXP (*reader)(SEXP filename);
+} benchmark;
+
+
+static const benchmark benchmarks[] = {
+  {"read_abatch", FILE_TEXT_CEL, cel_intensities},
+  {"read_abatch_stddev", FILE_TEXT_CEL, cel_stddev},
+  {"R_read_cel_file", FILE_TEXT_CEL, cel_file},
+  {"read_abatch", FILE_GZTEXT_CEL, cel_intensities},
+  {"R_read_cel_file", FILE_GZTEXT_CEL, cel_file},
+  {"read_abatch", FILE_BINARY_CEL, cel_intensities},
+  {"read_abatch_stddev", FILE_BINARY_CEL, cel_stddev},
+  {"R_read_cel_file", FILE_BINARY_CEL, cel_file},
+  {"read_abatch", FILE_GZBINARY_CEL, cel_intensities},
+  {"R_read_cel_file", FILE_GZBINARY_CEL, cel_file},
+  {"read_abatch", FILE_GENERIC_CEL, cel_intensities},
+  {"read_abatch_stddev", FILE_GENERIC_CEL, cel_stddev},
+  {"R_read_cel_file", FILE_GENERIC_CEL, cel_file},
+  {"read_abatch", FILE_GZGENERIC_CEL, cel_intensities},
+  {"R_read_cel_file", FILE_GZGENERIC_CEL, cel_file},
+  {"R_read_cel_file", FILE_MULTICHANNEL_CEL, cel_file},
+  {"ReadCDFFile", FILE_XDA_CDF, cdf_locations},
+  {"ReadCDFFileIntoRList", FILE_XDA_CDF, cdf_list},
+  {"ReadtextCDFFileIntoRList", FILE_TEXT_CDF, text_cdf_list},
+  {"ReadPGFFile", FILE_PGF, pgf_file},
+  {"ReadCLFFile", FILE_CLF, clf_file},
+  {"ReadBPMAPFileIntoRList", FILE_BPMAP, bpmap_file}
+};
+
+#define N_BENCHMARKS (sizeof(benchmarks)/sizeof(benchmark))
+
+
+
+static double now(void){
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+}
+
+
+static double file_size(const char *path){
+
+  struct stat file_info;
+
+  if (stat(path, &file_info) != 0){
+    return 0.0;
+  }
+  return (double)file_info.st_size;
+}
+
+
+static void make_files(const char *directory){
+
+  int i;
+  benchmark_file *cur;
+
+  for (i = 0; i < N_FILES; i++){
+    cur = &files[i];
+    cur->path = malloc(strlen(directory) + strlen(cur->name) + 2);
+    sprintf(cur->path, "%s/%s", directory, cur->name);
+    switch (i){
+    case FILE_TEXT_CEL: cur->cells = generate_text_cel(cur->path, array_cols, array_rows, 0); break;
+    case FILE_GZTEXT_CEL: cur->cells = generate_text_cel(cur->path, array_cols, array_rows, 1); break;
+    case FILE_BINARY_CEL: cur->cells = generate_binary_cel(cur->path, array_cols, array_rows, 0); break;
+    case FILE_GZBINARY_CEL: cur->cells = generate_binary_cel(cur->path, array_cols, array_rows, 1); break;
+    case FILE_GENERIC_CEL: cur->cells = generate_generic_cel(cur->path, array_cols, array_rows, 1, 0); break;
+    case FILE_GZGENERIC_CEL: cur->cells = generate_generic_cel(cur->path, array_cols, array_rows, 1, 1); break;
+    case FILE_MULTICHANNEL_CEL: cur->cells = generate_generic_cel(cur->path, array_cols, array_rows, 2, 0); break;
+    case FILE_XDA_CDF: cur->cells = generate_xda_cdf(cur->path, array_cols, array_rows); break;
+    case FILE_TEXT_CDF: cur->cells = generate_text_cdf(cur->path, array_cols, array_rows); break;
+    case FILE_PGF: cur->cells = generate_pgf(cur->path, array_cols, array_rows); break;
+    case FILE_CLF: cur->cells = generate_clf(cur->path, array_cols, array_rows); break;
+    case FILE_BPMAP: cur->cells = generate_bpmap(cur->path, array_cols, array_rows); break;
+    }
+    cur->bytes = file_size(cur->path);
+  }
+}
+
+
+/* run a reader inside R_ToplevelExec so that an R error is reported rather than ending the program */
+
+typedef struct{
+  const benchmark *cur;
+  SEXP filename;
+} reader_call;
+
+
+static void run_reader(void *data){
+
+  reader_call *call = (reader_call *)data;
+
+  call->cur->reader(call->filename);
+}
+
+
+static int wanted(const benchmark *cur, const char *filter){
+  return filter == NULL || strstr(cur->name, filter) != NULL || strstr(files[cur->file].format, filter) != NULL;
+}
+
+
+static void run_benchmarks(int repeats, const char *filter){
+
+  int i, r, failed;
+  double start, seconds, best;
+  reader_call call;
+  const benchmark_file *file;
+
+  printf("%-28s %-26s %9s %10s %10s %9s %10s\n", "format", "reader", "MB", "cells", "seconds", "MB/s", "Mcells/s");
+  for (i = 0; i < (int)N_BENCHMARKS; i++){
+    if (!wanted(&benchmarks[i], filter)){
+      continue;
+    }
+    file = &files[benchmarks[i].file];
+    call.cur = &benchmarks[i];
+    PROTECT(call.filename = mkString(file->path));
+
+    best = -1.0;
+    failed = 0;
+    for (r = 0; r < repeats && !failed; r++){
+      R_gc();
+      start = now();
+      failed = !R_ToplevelExec(run_reader, &call);
+      seconds = now() - start;
+      if (best < 0.0 || seconds < best){
+        best = seconds;
+      }
+    }
+    UNPROTECT(1);
+
+    if (failed){
+      printf("%-28s %-26s failed\n", file->format, benchmarks[i].name);
+    } else {
+      printf("%-28s %-26s %9.2f %10.0f %10.4f %9.1f %10.2f\n", file->format, benchmarks[i].name,
+             file->bytes/1e6, file->cells, best, file->bytes/1e6/best, file->cells/1e6/best);
+    }
+    fflush(stdout);
+  }
+}
+
+
+/****************************************************************
+ **
+ ** Checking that truncated CEL files are reported
+ **
+ ***************************************************************/
+
+#define CHECK_THREADS 2
+
+
+/* write the first length bytes of from to a new file to */
+
+static int truncated_copy(const char *from, const char *to, double length){
+
+  FILE *infile, *outfile;
+  char buffer[4096];
+  size_t n;
+  double left = length;
+
+  if ((infile = fopen(from, "rb")) == NULL){
+    return 0;
+  }
+  if ((outfile = fopen(to, "wb")) == NULL){
+    fclose(infile);
+    return 0;
+  }
+  while (left > 0 && (n = fread(buffer, 1, (left < sizeof(buffer)) ? (size_t)left : sizeof(buffer), infile)) > 0){
+    fwrite(buffer, 1, n, outfile);
+    left -= n;
+  }
+  fclose(infile);
+  fclose(outfile);
+  return 1;
+}
+
+
+static SEXP batch_dim(void){
+
+  SEXP dim = allocVector(INTSXP, 2);
+
+  INTEGER(dim)[0] = array_cols;
+  INTEGER(dim)[1] = array_rows;
+  return dim;
+}
+
+
+static void check_headers(void *data){
+  SEXP threads;
+
+  PROTECT(threads = ScalarInteger(CHECK_THREADS));
+  ReadHeaderBatch(*(SEXP *)data, threads);
+  UNPROTECT(1);
+}
+
+
+static void check_cel_files(void *data){
+  SEXP threads;
+
+  PROTECT(threads = ScalarInteger(CHECK_THREADS));
+  R_read_cel_files(*(SEXP *)data, ScalarLogical(FALSE), threads);
+  UNPROTECT(1);
+}
+
+
+static void check_cel_files_matrices(void *data){
+  SEXP threads;
+
+  PROTECT(threads = ScalarInteger(CHECK_THREADS));
+  R_read_cel_files_matrices(*(SEXP *)data, ScalarLogical(FALSE), threads);
+  UNPROTECT(1);
+}
+
+
+static void check_cel_blocks(void *data){
+  SEXP blockSize, cdfName, dim, threads, iterator;
+
+  PROTECT(blockSize = ScalarInteger(2));
+  PROTECT(cdfName = mkString(GENERATE_CHIP_TYPE));
+  PROTECT(dim = batch_dim());
+  PROTECT(threads = ScalarInteger(CHECK_THREADS));
+  PROTECT(iterator = R_cel_block_iterator(*(SEXP *)data, blockSize, ScalarLogical(FALSE), ScalarLogical(FALSE),
+                                          ScalarLogical(FALSE), cdfName, dim, threads));
+  while (R_cel_block_iterator_next(iterator) != R_NilValue){
+  }
+  R_cel_block_iterator_free(iterator);
+  UNPROTECT(5);
+}
+
+
+static void check_cel_cells(void *data){
+  SEXP cells, threads;
+  int k;
+
+  /* every seventh cell, so the reads reach the end of the file */
+  PROTECT(cells = allocVector(INTSXP, (array_cols*array_rows + 6)/7));
+  for (k = 0; k < LENGTH(cells); k++){
+    INTEGER(cells)[k] = 7*k + 1;
+  }
+  PROTECT(threads = ScalarInteger(CHECK_THREADS));
+  R_read_cel_cells(*(SEXP *)data, cells, threads);
+  UNPROTECT(2);
+}
+
+
+typedef struct{
+  const char *name;
+  void (*check)(void *data);
+  int header_only;          /* only reads the headers, so is only given files cut short there */
+} truncation_check;
+
+
+static const truncation_check truncation_checks[] = {
+  {"ReadHeaderBatch", check_headers, 1},
+  {"R_read_cel_files", check_cel_files, 0},
+  {"R_read_cel_files_matrices", check_cel_files_matrices, 0},
+  {"R_cel_block_iterator", check_cel_blocks, 0},
+  {"R_read_cel_cells", check_cel_cells, 0}
+};
+
+#define N_TRUNCATION_CHECKS (sizeof(truncation_checks)/sizeof(truncation_check))
+
+
+static int run_truncation_checks(const char *directory){
+
+  int i, j, k, cut, n_bad = 0;
+  char *path;
+  const benchmark_file *file;
+  SEXP filenames;
+
+  path = malloc(strlen(directory) + 32);
+  sprintf(path, "%s/truncated.CEL", directory);
+
+  for (i = FILE_TEXT_CEL; i <= FILE_GZGENERIC_CEL; i++){
+    file = &files[i];
+    for (cut = 0; cut < 2; cut++){
+      /* 64 bytes stops in the header, a quarter of the file in the intensities
+         (which come first in the command console formats, before the stddev) */
+      if (!truncated_copy(file->path, path, cut == 0 ? 64.0 : file->bytes/4)){
+        fprintf(stderr, "affyio_benchmark: could not write %s\n", path);
+        free(path);
+        return 1;
+      }
+      /* the truncated file is the third, so is read on a worker thread (in the
+         second block of the iterator, while the first is handed out) */
+      PROTECT(filenames = allocVector(STRSXP, 4));
+      for (k = 0; k < 4; k++){
+        SET_STRING_ELT(filenames, k, mkChar(k == 2 ? path : file->path));
+      }
+      for (j = 0; j < (int)N_TRUNCATION_CHECKS; j++){
+        if (cut == 1 && truncation_checks[j].header_only){
+          continue;
+        }
+        if (R_ToplevelExec(truncation_checks[j].check, &filenames)){
+          printf("%-28s %-26s %-12s NOT REPORTED\n", file->format, truncation_checks[j].name, cut == 0 ? "header" : "intensities");
+          n_bad++;
+        } else {
+          printf("%-28s %-26s %-12s reported\n", file->format, truncation_checks[j].name, cut == 0 ? "header" : "intensities");
+        }
+        fflush(stdout);
+      }
+      UNPROTECT(1);
+    }
+  }
+  unlink(path);
+  free(path);
+  return n_bad;
+}
+
+
+static void usage(void){
+  fprintf(stderr, "usage: affyio_benchmark [-c cols] [-r rows] [-n repeats] [-d directory] [-f filter] [-k] [-t]\n");
+  exit(1);
+}
+
+
+int main(int argc, char **argv){
+
+  int option, i;
+  int repeats = 3, keep = 0, made_directory = 0, check = 0, n_bad = 0;
+  char *directory = NULL, *filter = NULL;
+  char template[] = "/tmp/affyio_benchmark.XXXXXX";
+  char *r_argv[] = {"affyio_benchmark", "--vanilla", "--silent", "--no-save"};
+
+  array_cols = array_rows = 712;
+
+  while ((option = getopt(argc, argv, "c:r:n:d:f:kt")) != -1){
+    switch (option){
+    case 'c': array_cols = atoi(optarg); break;
+    case 'r': array_rows = atoi(optarg); break;
+    case 'n': repeats = atoi(optarg); break;
+    case 'd': directory = optarg; break;
+    case 'f': filter = optarg; break;
+    case 'k': keep = 1; break;
+    case 't': check = 1; break;
+    default: usage();
+    }
+  }
+  if (array_cols < 1 || array_cols > 32767 || array_rows < 1 || array_rows > 32767 || repeats < 1){
+    usage();
+  }
+
+  if (directory == NULL){
+    if ((directory = mkdtemp(template)) == NULL){
+      fprintf(stderr, "affyio_benchmark: could not make a directory under /tmp\n");
+      return 1;
+    }
+    made_directory = 1;
+  }
+
+  printf("Writing %d x %d array files to %s\n", array_cols, array_rows, directory);
+  fflush(stdout);
+  make_files(directory);
+
+  Rf_initEmbeddedR(sizeof(r_argv)/sizeof(char *), r_argv);
+  if (check){
+    n_bad = run_truncation_checks(directory);
+  } else {
+    run_benchmarks(repeats, filter);
+  }
+  Rf_endEmbeddedR(0);
+
+  for (i = 0; i < N_FILES; i++){
+    if (!keep){
+      unlink(files[i].path);
+    }
+    free(files[i].path);
+  }
+  if (made_directory && !keep){
+    rmdir(directory);
+  }
+  return n_bad;
+}
@@ -0,0 +1,773 @@
+/******************************************************************
+ **
+ ** file: generate.c
+ **
+ ** Aim: write synthetic Affymetrix files of a given array size for
+ **      benchmarking the parsers
+ **
+ ** Created on Oct 16, 2026
+ **
+ ** History
+ ** Oct 16, 2026 - Initial version
+ **
+ **
+ ** Each file is built up in memory and then written out (through
+ ** zlib when compressed), so that the file offsets the binary
+ ** formats store ahead of the data they point at can be patched in
+ ** once known. The contents are deterministic, so the same size
+ ** always gives the same files.
+ **
+ ** The layouts follow those read by the corresponding code in src/
+ ** (read_abatch.c, read_generic.c, read_cdf_xda.c, read_cdffile2.c,
+ ** read_pgf.c, read_clf.c and read_bpmap.c).
+ **
+ ******************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#include "generate.h"
+
+
+#define CELLS_PER_UNIT 22       /* a PM/MM pair for each of 11 atoms */
+#define PROBES_PER_PROBESET 4
+#define BPMAP_SEQUENCES 4
+
+
+typedef struct{
+  unsigned char *data;
+  size_t length;
+  size_t size;
+} buffer;
+
+
+static const char *dat_header_format = "[12..46952]  bench:CLS=%d RWS=%d XIN=3  YIN=3  VE=17        2.0 10/16/26 10:05:43       GridVerify=None    " GENERATE_CHIP_TYPE ".1sq                   6";
+static const char *algorithm_parameters = "Percentile:75;CellMargin:2;OutlierHigh:1.500;OutlierLow:1.004";
+
+
+
+static void out_of_memory(void){
+  fprintf(stderr, "generate: out of memory\n");
+  exit(1);
+}
+
+
+static void put_bytes(buffer *b, const void *x, size_t n){
+
+  if (b->length + n > b->size){
+    b->size = (b->size == 0) ? 65536 : b->size;
+    while (b->length + n > b->size){
+      b->size *= 2;
+    }
+    if ((b->data = realloc(b->data, b->size)) == NULL){
+      out_of_memory();
+    }
+  }
+  memcpy(b->data + b->length, x, n);
+  b->length += n;
+}
+
+
+static void put_printf(buffer *b, const char *format, ...){
+
+  char line[1024];
+  int n;
+  va_list args;
+
+  va_start(args, format);
+  n = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  put_bytes(b, line, (n < (int)sizeof(line)) ? (size_t)n : sizeof(line) - 1);
+}
+
+
+static void put_le(buffer *b, uint32_t value, int n_bytes){
+
+  unsigned char bytes[4];
+  int i;
+
+  for (i = 0; i < n_bytes; i++){
+    bytes[i] = (unsigned char)(value >> (8*i));
+  }
+  put_bytes(b, bytes, n_bytes);
+}
+
+
+static void put_be(buffer *b, uint32_t value, int n_bytes){
+
+  unsigned char bytes[4];
+  int i;
+
+  for (i = 0; i < n_bytes; i++){
+    bytes[i] = (unsigned char)(value >> (8*(n_bytes - 1 - i)));
+  }
+  put_bytes(b, bytes, n_bytes);
+}
+
+
+static uint32_t float_bits(float x){
+
+  uint32_t bits;
+
+  memcpy(&bits, &x, sizeof(bits));
+  return bits;
+}
+
+
+static void patch_le(buffer *b, size_t position, uint32_t value){
+
+  int i;
+
+  for (i = 0; i < 4; i++){
+    b->data[position + i] = (unsigned char)(value >> (8*i));
+  }
+}
+
+
+static void patch_be(buffer *b, size_t position, uint32_t value){
+
+  int i;
+
+  for (i = 0; i < 4; i++){
+    b->data[position + i] = (unsigned char)(value >> (8*(3 - i)));
+  }
+}
+
+
+static void put_padded(buffer *b, const char *x, size_t width){
+
+  char padded[256];
+
+  memset(padded, 0, sizeof(padded));
+  strncpy(padded, x, width);
+  put_bytes(b, padded, width);
+}
+
+
+static void save_buffer(buffer *b, const char *filename, int compress){
+
+  FILE *outfile;
+  gzFile gzoutfile;
+
+  if (compress){
+    if ((gzoutfile = gzopen(filename, "wb")) == NULL ||
+        gzwrite(gzoutfile, b->data, (unsigned)b->length) != (int)b->length){
+      fprintf(stderr, "generate: could not write %s\n", filename);
+      exit(1);
+    }
+    gzclose(gzoutfile);
+  } else {
+    if ((outfile = fopen(filename, "wb")) == NULL ||
+        fwrite(b->data, 1, b->length, outfile) != b->length){
+      fprintf(stderr, "generate: could not write %s\n", filename);
+      exit(1);
+    }
+    fclose(outfile);
+  }
+  free(b->data);
+  b->data = NULL;
+  b->length = b->size = 0;
+}
+
+
+/* a small linear congruential generator, so contents are the same everywhere */
+
+static uint32_t next_random(uint32_t *state){
+  *state = *state*1664525u + 1013904223u;
+  return *state >> 8;
+}
+
+
+static float cell_mean(uint32_t *state){
+  return (float)(20 + next_random(state) % 200000)/10.0f;
+}
+
+
+static float cell_stddev(uint32_t *state){
+  return (float)(next_random(state) % 20000)/10.0f;
+}
+
+
+static int cell_npixels(uint32_t *state){
+  return 9 + (int)(next_random(state) % 30);
+}
+
+
+/* masks and outliers: a scattering of distinct cells */
+
+static int n_flagged(int n_cells){
+  return n_cells/2000 + 1;
+}
+
+
+static int flagged_cell(int k, int n_cells, int outliers){
+  return (int)(((long long)(2*k + outliers)*7919) % n_cells);
+}
+
+
+static const char bases[4] = {'A', 'C', 'G', 'T'};
+
+static char complement(char base){
+  switch (base){
+  case 'A': return 'T';
+  case 'C': return 'G';
+  case 'G': return 'C';
+  default: return 'A';
+  }
+}
+
+
+
+/****************************************************************
+ **
+ ** double generate_text_cel(const char *filename, int cols, int rows, int compress)
+ **
+ ** a version 3 text CEL file (gzipped if compress)
+ **
+ ****************************************************************/
+
+double generate_text_cel(const char *filename, int cols, int rows, int compress){
+
+  buffer b = {NULL, 0, 0};
+  uint32_t state = 1;
+  int n_cells = cols*rows;
+  int i, k, x, y;
+  float mean, stddev;
+  char dat_header[256];
+
+  snprintf(dat_header, sizeof(dat_header), dat_header_format, cols, rows);
+
+  put_printf(&b, "[CEL]\r\nVersion=3\r\n\r\n[HEADER]\r\nCols=%d\r\nRows=%d\r\nTotalX=%d\r\nTotalY=%d\r\n", cols, rows, cols, rows);
+  put_printf(&b, "OffsetX=0\r\nOffsetY=0\r\nGridCornerUL=213 228\r\nGridCornerUR=4463 220\r\nGridCornerLR=4471 4470\r\nGridCornerLL=221 4478\r\n");
+  put_printf(&b, "Axis-invertX=0\r\nAxisInvertY=0\r\nswapXY=0\r\nDatHeader=%s\r\nAlgorithm=Percentile\r\nAlgorithmParameters=%s\r\n\r\n", dat_header, algorithm_parameters);
+
+  put_printf(&b, "[INTENSITY]\r\nNumberCells=%d\r\nCellHeader=X\tY\tMEAN\tSTDV\tNPIXELS\r\n", n_cells);
+  for (y = 0; y < rows; y++){
+    for (x = 0; x < cols; x++){
+      mean = cell_mean(&state);
+      stddev = cell_stddev(&state);
+      put_printf(&b, "%3d\t%3d\t%.1f\t%.1f\t%3d\r\n", x, y, mean, stddev, cell_npixels(&state));
+    }
+  }
+
+  for (k = 0; k < 2; k++){
+    put_printf(&b, "\r\n[%s]\r\nNumberCells=%d\r\nCellHeader=X\tY\r\n", (k == 0) ? "MASKS" : "OUTLIERS", n_flagged(n_cells));
+    for (i = 0; i < n_flagged(n_cells); i++){
+      y = flagged_cell(i, n_cells, k);
+      put_printf(&b, "%d\t%d\r\n", y % cols, y / cols);
+    }
+  }
+  put_printf(&b, "\r\n[MODIFIED]\r\nNumberCells=0\r\nCellHeader=X\tY\tORIGMEAN\r\n");
+
+  save_buffer(&b, filename, compress);
+  return (double)n_cells;
+}
+
+
+/****************************************************************
+ **
+ ** double generate_binary_cel(const char *filename, int cols, int rows, int compress)
+ **
+ ** a version 4 binary CEL file (little endian)
+ **
+ ****************************************************************/
+
+double generate_binary_cel(const char *filename, int cols, int rows, int compress){
+
+  buffer b = {NULL, 0, 0};
+  buffer header = {NULL, 0, 0};
+  uint32_t state = 1;
+  int n_cells = cols*rows;
+  int i, k, cell;
+  char dat_header[256];
+
+  snprintf(dat_header, sizeof(dat_header), dat_header_format, cols, rows);
+
+  put_printf(&header, "Cols=%d\nRows=%d\nTotalX=%d\nTotalY=%d\nOffsetX=0\nOffsetY=0\n", cols, rows, cols, rows);
+  put_printf(&header, "GridCornerUL=213 228\nGridCornerUR=4463 220\nGridCornerLR=4471 4470\nGridCornerLL=221 4478\n");
+  put_printf(&header, "Axis-invertX=0\nAxisInvertY=0\nswapXY=0\nDatHeader=%s\nAlgorithm=Percentile\nAlgorithmParameters=%s\n", dat_header, algorithm_parameters);
+
+  put_le(&b, 64, 4);
+  put_le(&b, 4, 4);
+  put_le(&b, rows, 4);
+  put_le(&b, cols, 4);
+  put_le(&b, n_cells, 4);
+  put_le(&b, (uint32_t)header.length, 4);
+  put_bytes(&b, header.data, header.length);
+  free(header.data);
+  put_le(&b, 10, 4);
+  put_bytes(&b, "Percentile", 10);
+  put_le(&b, (uint32_t)strlen(algorithm_parameters), 4);
+  put_bytes(&b, algorithm_parameters, strlen(algorithm_parameters));
+  put_le(&b, 2, 4);                       /* cell margin */
+  put_le(&b, n_flagged(n_cells), 4);      /* outliers */
+  put_le(&b, n_flagged(n_cells), 4);      /* masks */
+  put_le(&b, 0, 4);                       /* sub-grids */
+
+  for (i = 0; i < n_cells; i++){
+    put_le(&b, float_bits(cell_mean(&state)), 4);
+    put_le(&b, float_bits(cell_stddev(&state)), 4);
+    put_le(&b, (uint32_t)cell_npixels(&state), 2);
+  }
+  for (k = 0; k < 2; k++){
+    for (i = 0; i < n_flagged(n_cells); i++){
+      cell = flagged_cell(i, n_cells, k);
+      put_le(&b, cell % cols, 2);
+      put_le(&b, cell / cols, 2);
+    }
+  }
+
+  save_buffer(&b, filename, compress);
+  return (double)n_cells;
+}
+
+
+
+/* Command Console (Calvin) strings are big endian with a 32 bit length */
+
+static void put_astring(buffer *b, const char *x){
+  put_be(b, (uint32_t)strlen(x), 4);
+  put_bytes(b, x, strlen(x));
+}
+
+
+static void put_awstring(buffer *b, const char *x){
+
+  size_t i;
+
+  put_be(b, (uint32_t)strlen(x), 4);
+  for (i = 0; i < strlen(x); i++){
+    put_be(b, (unsigned char)x[i], 2);
+  }
+}
+
+
+static void put_nvt_text(buffer *b, const char *name, const char *value){
+
+  size_t i;
+
+  put_awstring(b, name);
+  put_be(b, (uint32_t)(2*strlen(value)), 4);
+  for (i = 0; i < strlen(value); i++){
+    put_be(b, (unsigned char)value[i], 2);
+  }
+  put_awstring(b, "text/plain");
+}
+
+
+static void put_nvt_int32(buffer *b, const char *name, int32_t value){
+  put_awstring(b, name);
+  put_be(b, 4, 4);
+  put_be(b, (uint32_t)value, 4);
+  put_awstring(b, "text/x-calvin-integer-32");
+}
+
+
+static void put_nvt_float(buffer *b, const char *name, float value){
+  put_awstring(b, name);
+  put_be(b, 4, 4);
+  put_be(b, float_bits(value), 4);
+  put_awstring(b, "text/x-calvin-float");
+}
+
+
+/* starts a data set of n_rows rows, returning where its last position is to be patched */
+
+static size_t start_data_set(buffer *b, const char *name, int n_cols, const char **col_names, const int *col_types, int n_rows){
+
+  size_t first;
+  int j;
+
+  first = b->length;
+  put_be(b, 0, 4);
+  put_be(b, 0, 4);
+  put_awstring(b, name);
+  put_be(b, 0, 4);
+  put_be(b, n_cols, 4);
+  for (j = 0; j < n_cols; j++){
+    put_awstring(b, col_names[j]);
+    put_be(b, (uint32_t)col_types[j], 1);
+    put_be(b, (col_types[j] == 2) ? 2 : 4, 4);
+  }
+  put_be(b, n_rows, 4);
+  patch_be(b, first, (uint32_t)b->length);
+  return first + 4;
+}
+
+
+/****************************************************************
+ **
+ ** double generate_generic_cel(const char *filename, int cols, int rows, int n_channels, int compress)
+ **
+ ** a Command Console CEL file. When n_channels is more than one a
+ ** multichannel file with one data group for each channel.
+ **
+ ****************************************************************/
+
+double generate_generic_cel(const char *filename, int cols, int rows, int n_channels, int compress){
+
+  buffer b = {NULL, 0, 0};
+  uint32_t state = 1;
+  int n_cells = cols*rows;
+  int i, k, c, cell;
+  size_t group_start, last;
+  char dat_header[256], group_name[32];
+  float *mean, *stddev;
+  int *npixels;
+
+  const char *float_col[1] = {"Intensity"};
+  const char *pixel_col[1] = {"Pixel"};
+  const char *xy_cols[2] = {"X", "Y"};
+  const int float_type[1] = {6};
+  const int short_type[2] = {2, 2};
+
+  snprintf(dat_header, sizeof(dat_header), dat_header_format, cols, rows);
+
+  mean = malloc(n_cells*sizeof(float));
+  stddev = malloc(n_cells*sizeof(float));
+  npixels = malloc(n_cells*sizeof(int));
+  if (mean == NULL || stddev == NULL || npixels == NULL){
+    out_of_memory();
+  }
+
+  put_be(&b, 59, 1);
+  put_be(&b, 1, 1);
+  put_be(&b, n_channels, 4);
+  put_be(&b, 0, 4);
+
+  put_astring(&b, (n_channels > 1) ? "affymetrix-calvin-multi-intensity" : "affymetrix-calvin-intensity");
+  put_astring(&b, "benchmark");
+  put_awstring(&b, "2026-10-16T10:05:43Z");
+  put_awstring(&b, "en-US");
+  put_be(&b, 16, 4);
+  put_nvt_text(&b, "affymetrix-array-type", GENERATE_CHIP_TYPE);
+  put_nvt_int32(&b, "affymetrix-cel-cols", cols);
+  put_nvt_int32(&b, "affymetrix-cel-rows", rows);
+  put_nvt_float(&b, "affymetrix-algorithm-param-GridULX", 213.0f);
+  put_nvt_float(&b, "affymetrix-algorithm-param-GridULY", 228.0f);
+  put_nvt_float(&b, "affymetrix-algorithm-param-GridURX", 4463.0f);
+  put_nvt_float(&b, "affymetrix-algorithm-param-GridURY", 220.0f);
+  put_nvt_float(&b, "affymetrix-algorithm-param-GridLRX", 4471.0f);
+  put_nvt_float(&b, "affymetrix-algorithm-param-GridLRY", 4470.0f);
+  put_nvt_float(&b, "affymetrix-algorithm-param-GridLLX", 221.0f);
+  put_nvt_float(&b, "affymetrix-algorithm-param-GridLLY", 4478.0f);
+  put_nvt_text(&b, "affymetrix-dat-header", dat_header);
+  put_nvt_text(&b, "affymetrix-scan-date", "2026-10-16T10:05:43Z");
+  put_nvt_text(&b, "affymetrix-algorithm-name", "Percentile");
+  put_nvt_int32(&b, "affymetrix-algorithm-param-Percentile", 75);
+  put_nvt_int32(&b, "affymetrix-algorithm-param-CellMargin", 2);
+  put_be(&b, 0, 4);
+  patch_be(&b, 6, (uint32_t)b.length);
+
+  for (c = 0; c < n_channels; c++){
+    group_start = b.length;
+    snprintf(group_name, sizeof(group_name), (n_channels > 1) ? "Channel %d" : "Default Group", c + 1);
+    put_be(&b, 0, 4);
+    put_be(&b, 0, 4);
+    put_be(&b, 5, 4);
+    put_awstring(&b, group_name);
+    patch_be(&b, group_start + 4, (uint32_t)b.length);
+
+    /* drawn in the same order as for the other formats so the first channel has the same values */
+    for (i = 0; i < n_cells; i++){
+      mean[i] = cell_mean(&state);
+      stddev[i] = cell_stddev(&state);
+      npixels[i] = cell_npixels(&state);
+    }
+
+    float_col[0] = "Intensity";
+    last = start_data_set(&b, "Intensity", 1, float_col, float_type, n_cells);
+    for (i = 0; i < n_cells; i++){
+      put_be(&b, float_bits(mean[i]), 4);
+    }
+    patch_be(&b, last, (uint32_t)b.length);
+
+    float_col[0] = "StdDev";
+    last = start_data_set(&b, "StdDev", 1, float_col, float_type, n_cells);
+    for (i = 0; i < n_cells; i++){
+      put_be(&b, float_bits(stddev[i]), 4);
+    }
+    patch_be(&b, last, (uint32_t)b.length);
+
+    last = start_data_set(&b, "Pixel", 1, pixel_col, short_type, n_cells);
+    for (i = 0; i < n_cells; i++){
+      put_be(&b, (uint32_t)npixels[i], 2);
+    }
+    patch_be(&b, last, (uint32_t)b.length);
+
+    for (k = 1; k >= 0; k--){
+      last = start_data_set(&b, (k == 1) ? "Outlier" : "Mask", 2, xy_cols, short_type, n_flagged(n_cells));
+      for (i = 0; i < n_flagged(n_cells); i++){
+        cell = flagged_cell(i, n_cells, k);
+        put_be(&b, cell % cols, 2);
+        put_be(&b, cell / cols, 2);
+      }
+      patch_be(&b, last, (uint32_t)b.length);
+    }
+
+    if (c < n_channels - 1){
+      patch_be(&b, group_start, (uint32_t)b.length);
+    }
+  }
+
+  free(mean);
+  free(stddev);
+  free(npixels);
+  save_buffer(&b, filename, compress);
+  return (double)n_cells*n_channels;
+}
+
+
+
+/* PM/MM cells of a CDF unit: atom a of unit u uses cells u*CELLS_PER_UNIT + 2a (PM) and + 1 (MM) */
+
+static int n_cdf_units(int cols, int rows){
+  return (cols*rows)/CELLS_PER_UNIT;
+}
+
+
+/****************************************************************
+ **
+ ** double generate_xda_cdf(const char *filename, int cols, int rows)
+ **
+ ** a binary (XDA) CDF file of expression units, each one block of
+ ** 11 PM/MM pairs
+ **
+ ****************************************************************/
+
+double generate_xda_cdf(const char *filename, int cols, int rows){
+
+  buffer b = {NULL, 0, 0};
+  int n_units = n_cdf_units(cols, rows);
+  int u, a, cell, mm;
+  size_t unit_positions;
+  char name[64];
+  uint32_t state = 1;
+  char target;
+
+  put_le(&b, 67, 4);
+  put_le(&b, 1, 4);
+  put_le(&b, cols, 2);
+  put_le(&b, rows, 2);
+  put_le(&b, n_units, 4);
+  put_le(&b, 0, 4);
+  put_le(&b, 0, 4);
+
+  for (u = 0; u < n_units; u++){
+    snprintf(name, sizeof(name), "ps%d_at", u);
+    put_padded(&b, name, 64);
+  }
+  unit_positions = b.length;
+  for (u = 0; u < n_units; u++){
+    put_le(&b, 0, 4);
+  }
+
+  for (u = 0; u < n_units; u++){
+    patch_le(&b, unit_positions + 4*u, (uint32_t)b.length);
+    put_le(&b, 1, 2);                     /* unit type: expression */
+    put_le(&b, 1, 1);                     /* direction */
+    put_le(&b, CELLS_PER_UNIT/2, 4);
+    put_le(&b, 1, 4);
+    put_le(&b, CELLS_PER_UNIT, 4);
+    put_le(&b, u, 4);
+    put_le(&b, 2, 1);
+
+    put_le(&b, CELLS_PER_UNIT/2, 4);
+    put_le(&b, CELLS_PER_UNIT, 4);
+    put_le(&b, 2, 1);
+    put_le(&b, 1, 1);
+    put_le(&b, 0, 4);
+    put_le(&b, 0, 4);
+    snprintf(name, sizeof(name), "ps%d_at", u);
+    put_padded(&b, name, 64);
+
+    for (a = 0; a < CELLS_PER_UNIT/2; a++){
+      target = bases[next_random(&state) % 4];
+      for (mm = 0; mm < 2; mm++){
+        cell = u*CELLS_PER_UNIT + 2*a + mm;
+        put_le(&b, a, 4);
+        put_le(&b, cell % cols, 2);
+        put_le(&b, cell / cols, 2);
+        put_le(&b, a, 4);
+        put_le(&b, (uint32_t)(mm ? target : complement(target)), 1);
+        put_le(&b, (uint32_t)target, 1);
+      }
+    }
+  }
+
+  save_buffer(&b, filename, 0);
+  return (double)n_units*CELLS_PER_UNIT;
+}
+
+
+/****************************************************************
+ **
+ ** double generate_text_cdf(const char *filename, int cols, int rows)
+ **
+ ** a GC3.0 text CDF file with the same units as generate_xda_cdf
+ **
+ ****************************************************************/
+
+double generate_text_cdf(const char *filename, int cols, int rows){
+
+  buffer b = {NULL, 0, 0};
+  int n_units = n_cdf_units(cols, rows);
+  int u, a, cell, mm;
+  uint32_t state = 1;
+  char target, probe;
+
+  put_printf(&b, "[CDF]\nVersion=GC3.0\n\n[Chip]\nName=%s\nRows=%d\nCols=%d\n", GENERATE_CHIP_TYPE, rows, cols);
+  put_printf(&b, "NumberOfUnits=%d\nMaxUnit=%d\nNumQCUnits=0\nChipReference=\n\n", n_units, n_units);
+
+  for (u = 0; u < n_units; u++){
+    put_printf(&b, "[Unit%d]\nName=NONE\nDirection=1\nNumAtoms=%d\nNumCells=%d\nUnitNumber=%d\nUnitType=3\nNumberBlocks=1\n\n",
+               u, CELLS_PER_UNIT/2, CELLS_PER_UNIT, u);
+    put_printf(&b, "[Unit%d_Block1]\nName=ps%d_at\nBlockNumber=1\nNumAtoms=%d\nNumCells=%d\nStartPosition=0\nStopPosition=%d\n",
+               u, u, CELLS_PER_UNIT/2, CELLS_PER_UNIT, CELLS_PER_UNIT/2 - 1);
+    put_printf(&b, "CellHeader=X\tY\tPROBE\tFEAT\tQUAL\tEXPOS\tPOS\tCBASE\tPBASE\tTBASE\tATOM\tINDEX\tCODONIND\tCODON\tREGIONTYPE\tREGION\n");
+    for (a = 0; a < CELLS_PER_UNIT/2; a++){
+      target = bases[next_random(&state) % 4];
+      for (mm = 0; mm < 2; mm++){
+        cell = u*CELLS_PER_UNIT + 2*a + mm;
+        probe = mm ? target : complement(target);
+        put_printf(&b, "Cell%d=%d\t%d\tN\tcontrol\tps%d_at\t%d\t13\t%c\t%c\t%c\t%d\t%d\t-1\t-1\t99\t\n",
+                   2*a + mm + 1, cell % cols, cell / cols, u, a, probe, probe, target, a, cell);
+      }
+    }
+    put_printf(&b, "\n");
+  }
+
+  save_buffer(&b, filename, 0);
+  return (double)n_units*CELLS_PER_UNIT;
+}
+
+
+/****************************************************************
+ **
+ ** double generate_pgf(const char *filename, int cols, int rows)
+ **
+ ** a PGF file with one probeset of PROBES_PER_PROBESET probes for
+ ** every PROBES_PER_PROBESET cells
+ **
+ ****************************************************************/
+
+double generate_pgf(const char *filename, int cols, int rows){
+
+  buffer b = {NULL, 0, 0};
+  int n_probesets = (cols*rows)/PROBES_PER_PROBESET;
+  int i, j, k, probe_id = 0;
+  char sequence[26];
+  uint32_t state = 1;
+  const char *types[3] = {"main", "normgene->intron", "control->bgp->antigenomic"};
+
+  put_printf(&b, "#%%chip_type=%s\n#%%lib_set_name=bench\n#%%lib_set_version=1\n#%%pgf_format_version=1.0\n", GENERATE_CHIP_TYPE);
+  put_printf(&b, "#%%header0=probeset_id\ttype\tprobeset_name\n#%%header1=\tatom_id\ttype\texon_position\n");
+  put_printf(&b, "#%%header2=\t\tprobe_id\ttype\tgc_count\tprobe_length\tinterrogation_position\tprobe_sequence\n");
+
+  for (i = 0; i < n_probesets; i++){
+    put_printf(&b, "%d\t%s\tps%d\n", i + 1, types[i % 3], i);
+    put_printf(&b, "\t%d\tpm:st\t%d\n", i + 1, i % 7);
+    for (j = 0; j < PROBES_PER_PROBESET; j++){
+      for (k = 0; k < 25; k++){
+        sequence[k] = bases[next_random(&state) % 4];
+      }
+      sequence[25] = '\0';
+      probe_id++;
+      put_printf(&b, "\t\t%d\tpm:st\t%d\t25\t13\t%s\n", probe_id, (int)(next_random(&state) % 26), sequence);
+    }
+  }
+
+  save_buffer(&b, filename, 0);
+  return (double)n_probesets*PROBES_PER_PROBESET;
+}
+
+
+/****************************************************************
+ **
+ ** double generate_clf(const char *filename, int cols, int rows)
+ **
+ ** a CLF file listing every cell in probe_id order
+ **
+ ****************************************************************/
+
+double generate_clf(const char *filename, int cols, int rows){
+
+  buffer b = {NULL, 0, 0};
+  int x, y;
+
+  put_printf(&b, "#%%chip_type=%s\n#%%lib_set_name=bench\n#%%lib_set_version=1\n#%%clf_format_version=1.0\n", GENERATE_CHIP_TYPE);
+  put_printf(&b, "#%%rows=%d\n#%%cols=%d\n#%%header0=probe_id\tx\ty\n", rows, cols);
+  for (y = 0; y < rows; y++){
+    for (x = 0; x < cols; x++){
+      put_printf(&b, "%d\t%d\t%d\n", y*cols + x + 1, x, y);
+    }
+  }
+
+  save_buffer(&b, filename, 0);
+  return (double)cols*rows;
+}
+
+
+/****************************************************************
+ **
+ ** double generate_bpmap(const char *filename, int cols, int rows)
+ **
+ ** a version 3 BPMAP file of PM/MM probe pairs spread over
+ ** BPMAP_SEQUENCES sequences, using every cell
+ **
+ ****************************************************************/
+
+double generate_bpmap(const char *filename, int cols, int rows){
+
+  buffer b = {NULL, 0, 0};
+  int n_pairs = (cols*rows)/2;
+  int per_sequence = n_pairs/BPMAP_SEQUENCES;
+  int s, i, k, cell = 0;
+  unsigned char packed[7];
+  uint32_t state = 1, position;
+  char name[32];
+
+  put_bytes(&b, "PHT7\r\n\032\n", 8);
+  put_be(&b, float_bits(3.0f), 4);
+  put_be(&b, BPMAP_SEQUENCES, 4);
+  for (s = 0; s < BPMAP_SEQUENCES; s++){
+    snprintf(name, sizeof(name), "chr%d", s + 1);
+    put_be(&b, (uint32_t)strlen(name), 4);
+    put_bytes(&b, name, strlen(name));
+    put_be(&b, 0, 4);                     /* PM/MM probe mapping */
+    put_be(&b, 0, 4);
+    put_be(&b, per_sequence, 4);
+    put_be(&b, 2, 4);
+    put_bytes(&b, "Hs", 2);
+    put_be(&b, 2, 4);
+    put_bytes(&b, "v1", 2);
+    put_be(&b, 0, 4);
+  }
+
+  for (s = 0; s < BPMAP_SEQUENCES; s++){
+    put_be(&b, s, 4);
+    position = 1000;
+    for (i = 0; i < per_sequence; i++, cell += 2){
+      put_be(&b, cell % cols, 4);
+      put_be(&b, cell / cols, 4);
+      put_be(&b, (cell + 1) % cols, 4);
+      put_be(&b, (cell + 1) / cols, 4);
+      put_be(&b, 25, 1);
+      for (k = 0; k < 7; k++){
+        packed[k] = (unsigned char)next_random(&state);
+      }
+      put_bytes(&b, packed, 7);
+      put_be(&b, 1, 4);                   /* match score */
+      position += 1 + next_random(&state) % 40;
+      put_be(&b, position, 4);
+      put_be(&b, next_random(&state) % 2, 1);
+    }
+  }
+
+  save_buffer(&b, filename, 0);
+  return (double)per_sequence*BPMAP_SEQUENCES;
+}
@@ -0,0 +1,25 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+
+/****************************************************************
+ **
+ ** Writers for synthetic Affymetrix files (see generate.c). Each
+ ** returns the number of cells (or probes) written. CEL files are
+ ** of chip type GENERATE_CHIP_TYPE.
+ **
+ ***************************************************************/
+
+#define GENERATE_CHIP_TYPE "BENCHCHIP"
+
+
+double generate_text_cel(const char *filename, int cols, int rows, int compress);
+double generate_binary_cel(const char *filename, int cols, int rows, int compress);
+double generate_generic_cel(const char *filename, int cols, int rows, int n_channels, int compress);
+double generate_xda_cdf(const char *filename, int cols, int rows);
+double generate_text_cdf(const char *filename, int cols, int rows);
+double generate_pgf(const char *filename, int cols, int rows);
+double generate_clf(const char *filename, int cols, int rows);
+double generate_bpmap(const char *filename, int cols, int rows);
+
+#endif